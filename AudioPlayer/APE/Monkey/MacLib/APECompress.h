@@ -0,0 +1,53 @@
+#pragma once
+
+#include "MACLib.h"
+
+namespace APE_MONKEY
+{
+
+class CAPECompressCreate;
+
+/*************************************************************************************************
+CAPECompress - the IAPECompress implementation
+
+Collects the caller's data into a frame-sized buffer and hands each full frame to
+CAPECompressCreate (which encodes it there and then, or queues it for a worker when there's
+more than one thread).
+*************************************************************************************************/
+class CAPECompress : public IAPECompress
+{
+public:
+    CAPECompress(int nThreads = 1);
+    ~CAPECompress();
+
+    // start encoding
+    int Start(const str_utf16 * pOutputFilename, const WAVEFORMATEX * pwfeInput, int nMaxAudioBytes, int nCompressionLevel = COMPRESSION_LEVEL_NORMAL, const void * pHeaderData = NULL, int nHeaderBytes = CREATE_WAV_HEADER_ON_DECOMPRESSION);
+    int StartEx(CIO * pioOutput, const WAVEFORMATEX * pwfeInput, int nMaxAudioBytes, int nCompressionLevel = COMPRESSION_LEVEL_NORMAL, const void * pHeaderData = NULL, int nHeaderBytes = CREATE_WAV_HEADER_ON_DECOMPRESSION);
+
+    // add data / compress data
+    int AddData(unsigned char * pData, int nBytes);
+    int GetBufferBytesAvailable();
+    unsigned char * LockBuffer(int * pBytesAvailable);
+    int UnlockBuffer(int nBytesAdded, BOOL bProcess = TRUE);
+
+    // finish / kill
+    int Finish(unsigned char * pTerminatingData, int nTerminatingBytes, int nWAVTerminatingBytes);
+    int Kill();
+
+private:
+    int ProcessBuffer(BOOL bFinalize = FALSE);
+
+    CSmartPtr<CAPECompressCreate> m_spAPECompressCreate;
+
+    int m_nBufferHead;
+    int m_nBufferTail;
+    int m_nBufferSize;
+    unsigned char * m_pBuffer;
+    BOOL m_bBufferLocked;
+
+    CIO * m_pioOutput;
+    BOOL m_bOwnsOutputIO;
+    WAVEFORMATEX m_wfeInput;
+};
+
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "BitArray.h"
+
+namespace APE_MONKEY
+{
+
+class CPrepare;
+class IPredictorCompress;
+
+/*************************************************************************************************
+CAPECompressCore - encodes frames into a bit array
+
+Every frame starts from scratch (the predictors, the bit array states and the range coder are
+flushed), so a frame encoded here is the same bytes wherever it ends up in the file.
+*************************************************************************************************/
+class CAPECompressCore
+{
+public:
+    CAPECompressCore(CIO * pIO, const WAVEFORMATEX * pwfeInput, int nMaxFrameBlocks, int nCompressionLevel);
+    ~CAPECompressCore();
+
+    int EncodeFrame(const void * pInputData, int nInputBytes);
+
+    CBitArray * GetBitArray() { return m_spBitArray.GetPtr(); }
+    int GetPeakLevel() { return m_nPeakLevel; }
+
+private:
+    int Prepare(const void * pInputData, int nInputBytes, int * pSpecialCodes);
+
+    CSmartPtr<CBitArray> m_spBitArray;
+    CSmartPtr<IPredictorCompress> m_spPredictorY;
+    CSmartPtr<IPredictorCompress> m_spPredictorX;
+
+    BIT_ARRAY_STATE m_BitArrayStateX;
+    BIT_ARRAY_STATE m_BitArrayStateY;
+
+    CSmartPtr<int> m_spDataX;
+    CSmartPtr<int> m_spDataY;
+    CSmartPtr<CPrepare> m_spPrepare;
+    WAVEFORMATEX m_wfeInput;
+    int m_nPeakLevel;
+};
+
+}
@@ -0,0 +1,433 @@
+#include "All.h"
+#include "APECompressCreate.h"
+#include "APECompressCore.h"
+#include "MemoryIO.h"
+
+namespace APE_MONKEY
+{
+
+#define MAX_PARALLEL_COMPRESS_THREADS       64
+
+CAPECompressCreate::CAPECompressCreate(int nThreads)
+{
+    // initialize (the synchronization objects first, so the destructor is always safe)
+    pthread_mutex_init(&m_Mutex, NULL);
+    pthread_cond_init(&m_condWork, NULL);
+    pthread_cond_init(&m_condReady, NULL);
+    m_nMaxFrames = 0;
+    m_pIO = NULL;
+    m_nStartPosition = 0;
+    m_nCompressionLevel = COMPRESSION_LEVEL_NORMAL;
+    m_nBlocksPerFrame = 0;
+    m_nFrameIndex = 0;
+    m_nLastFrameBlocks = 0;
+    m_nWorkers = 0;
+    m_nSlots = 0;
+    m_nFramesWritten = 0;
+    m_nFramesQueued = 0;
+    m_nNextEncodeFrame = 0;
+    m_bQuit = FALSE;
+
+    // figure the number of workers
+    if (nThreads <= 0)
+        nThreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    m_nThreads = max(1, min(nThreads, MAX_PARALLEL_COMPRESS_THREADS));
+}
+
+CAPECompressCreate::~CAPECompressCreate()
+{
+    StopWorkers();
+
+    pthread_cond_destroy(&m_condReady);
+    pthread_cond_destroy(&m_condWork);
+    pthread_mutex_destroy(&m_Mutex);
+}
+
+int CAPECompressCreate::Start(CIO * pioOutput, const WAVEFORMATEX * pwfeInput, int nMaxAudioBytes, int nCompressionLevel, const void * pHeaderData, int nHeaderBytes)
+{
+    // verify the parameters
+    if (pioOutput == NULL || pwfeInput == NULL)
+        return ERROR_BAD_PARAMETER;
+
+    // verify the wave format
+    if ((pwfeInput->nChannels != 1) && (pwfeInput->nChannels != 2))
+        return ERROR_INPUT_FILE_UNSUPPORTED_CHANNEL_COUNT;
+    if ((pwfeInput->wBitsPerSample != 8) && (pwfeInput->wBitsPerSample != 16) && (pwfeInput->wBitsPerSample != 24))
+        return ERROR_INPUT_FILE_UNSUPPORTED_BIT_DEPTH;
+
+    // initialize (frames are bigger at the higher levels)
+    memcpy(&m_wfeInput, pwfeInput, sizeof(WAVEFORMATEX));
+    m_nBlocksPerFrame = 73728;
+    if (nCompressionLevel == COMPRESSION_LEVEL_EXTRA_HIGH)
+        m_nBlocksPerFrame *= 4;
+    else if (nCompressionLevel == COMPRESSION_LEVEL_INSANE)
+        m_nBlocksPerFrame *= 16;
+
+    m_pIO = pioOutput;
+    m_nCompressionLevel = nCompressionLevel;
+    m_nFrameIndex = 0;
+    m_nLastFrameBlocks = m_nBlocksPerFrame;
+    m_nFramesWritten = 0;
+
+    // the core (the one on the file encodes every frame with one thread, or just holds the
+    // file's bit array with several)
+    m_spAPECompressCore.Assign(new CAPECompressCore(m_pIO, pwfeInput, m_nBlocksPerFrame, nCompressionLevel));
+
+    // calculate the maximum number of frames
+    if (nMaxAudioBytes < 0)
+        nMaxAudioBytes = 2147483647;
+
+    uint32 nMaxAudioBlocks = nMaxAudioBytes / pwfeInput->nBlockAlign;
+    int nMaxFrames = nMaxAudioBlocks / m_nBlocksPerFrame;
+    if ((nMaxAudioBlocks % m_nBlocksPerFrame) != 0) nMaxFrames++;
+
+    RETURN_ON_ERROR(InitializeFile(m_pIO, &m_wfeInput, nMaxFrames, m_nCompressionLevel, pHeaderData, nHeaderBytes))
+
+    if (m_nThreads > 1)
+    {
+        RETURN_ON_ERROR(StartWorkers())
+    }
+
+    return ERROR_SUCCESS;
+}
+
+int CAPECompressCreate::GetFullFrameBytes()
+{
+    return m_nBlocksPerFrame * m_wfeInput.nBlockAlign;
+}
+
+int CAPECompressCreate::EncodeFrame(const void * pInputData, int nInputBytes)
+{
+    int nInputBlocks = nInputBytes / m_wfeInput.nBlockAlign;
+
+    if ((nInputBlocks < m_nBlocksPerFrame) && (m_nLastFrameBlocks < m_nBlocksPerFrame))
+    {
+        return -1; // can only pass a smaller frame for the very last time
+    }
+
+    // update the seek table
+    if (m_nFrameIndex >= m_nMaxFrames)
+        return ERROR_APE_COMPRESS_TOO_MUCH_DATA;
+
+    if (m_nSlots == 0)
+    {
+        // encode the frame straight into the file's bit array
+        CBitArray * pBitArray = m_spAPECompressCore->GetBitArray();
+        pBitArray->AdvanceToByteBoundary();
+        RETURN_ON_ERROR(SetSeekByte(m_nFrameIndex, m_pIO->GetPosition() + (pBitArray->GetCurrentBitIndex() / 8) - m_nStartPosition))
+        RETURN_ON_ERROR(m_spAPECompressCore->EncodeFrame(pInputData, nInputBytes))
+    }
+    else
+    {
+        // the slot is free once the frame that used it last is in the file
+        RETURN_ON_ERROR(WriteFrames(m_nFrameIndex - m_nSlots + 1))
+
+        FRAME_SLOT * pSlot = &m_spSlots[m_nFrameIndex % m_nSlots];
+        memcpy(pSlot->pInput, pInputData, nInputBytes);
+        pSlot->nInputBytes = nInputBytes;
+        pSlot->bReady = FALSE;
+
+        pthread_mutex_lock(&m_Mutex);
+        m_nFramesQueued = m_nFrameIndex + 1;
+        pthread_cond_signal(&m_condWork);
+        pthread_mutex_unlock(&m_Mutex);
+    }
+
+    // update stats
+    m_nLastFrameBlocks = nInputBlocks;
+    m_nFrameIndex++;
+
+    // write out whatever the workers have finished
+    if (m_nSlots > 0)
+    {
+        RETURN_ON_ERROR(WriteFrames(0))
+    }
+
+    return ERROR_SUCCESS;
+}
+
+int CAPECompressCreate::Finish(const void * pTerminatingData, int nTerminatingBytes, int nWAVTerminatingBytes)
+{
+    // write the frames still being encoded
+    if (m_nSlots > 0)
+    {
+        RETURN_ON_ERROR(WriteFrames(m_nFrameIndex))
+        StopWorkers();
+    }
+
+    // clear the bit array
+    RETURN_ON_ERROR(m_spAPECompressCore->GetBitArray()->OutputBitArray(TRUE))
+
+    // finalize the file
+    RETURN_ON_ERROR(FinalizeFile(m_pIO, m_nFrameIndex, m_nLastFrameBlocks, pTerminatingData, nTerminatingBytes, nWAVTerminatingBytes))
+
+    return ERROR_SUCCESS;
+}
+
+int CAPECompressCreate::SetSeekByte(int nFrame, long long nByteOffset)
+{
+    if (nFrame >= m_nMaxFrames) return ERROR_APE_COMPRESS_TOO_MUCH_DATA;
+    m_spSeekTable[nFrame] = (uint32) nByteOffset;
+    return ERROR_SUCCESS;
+}
+
+int CAPECompressCreate::InitializeFile(CIO * pIO, const WAVEFORMATEX * pwfeInput, int nMaxFrames, int nCompressionLevel, const void * pHeaderData, int nHeaderBytes)
+{
+    // error check the parameters
+    if (pIO == NULL || pwfeInput == NULL || nMaxFrames <= 0)
+        return ERROR_BAD_PARAMETER;
+
+    APE_DESCRIPTOR * pDescriptor = &m_APEDescriptor;
+    APE_HEADER * pHeader = &m_APEHeader;
+    memset(pDescriptor, 0, sizeof(APE_DESCRIPTOR));
+    memset(pHeader, 0, sizeof(APE_HEADER));
+
+    // create the descriptor (only fill what we know)
+    memcpy(pDescriptor->cID, "MAC ", 4);
+    pDescriptor->nVersion = MAC_FILE_VERSION_NUMBER;
+
+    pDescriptor->nDescriptorBytes = sizeof(APE_DESCRIPTOR);
+    pDescriptor->nHeaderBytes = sizeof(APE_HEADER);
+    pDescriptor->nSeekTableBytes = nMaxFrames * sizeof(uint32);
+    pDescriptor->nHeaderDataBytes = (nHeaderBytes == CREATE_WAV_HEADER_ON_DECOMPRESSION) ? 0 : nHeaderBytes;
+
+    // create the header (only fill what we know now)
+    pHeader->nBitsPerSample = pwfeInput->wBitsPerSample;
+    pHeader->nChannels = pwfeInput->nChannels;
+    pHeader->nSampleRate = pwfeInput->nSamplesPerSec;
+
+    pHeader->nCompressionLevel = (uint16) nCompressionLevel;
+    pHeader->nFormatFlags = (nHeaderBytes == CREATE_WAV_HEADER_ON_DECOMPRESSION) ? MAC_FORMAT_FLAG_CREATE_WAV_HEADER : 0;
+
+    pHeader->nBlocksPerFrame = m_nBlocksPerFrame;
+
+    // write the data to the file (the seek table is all zeros for now)
+    m_nMaxFrames = nMaxFrames;
+    m_spSeekTable.Assign(new uint32 [nMaxFrames], TRUE);
+    memset(m_spSeekTable, 0, nMaxFrames * sizeof(uint32));
+
+    m_nStartPosition = pIO->GetPosition();
+
+    unsigned int nBytesWritten = 0;
+    RETURN_ON_ERROR(pIO->Write(pDescriptor, sizeof(APE_DESCRIPTOR), &nBytesWritten))
+    RETURN_ON_ERROR(pIO->Write(pHeader, sizeof(APE_HEADER), &nBytesWritten))
+    RETURN_ON_ERROR(pIO->Write(m_spSeekTable, nMaxFrames * sizeof(uint32), &nBytesWritten))
+
+    // store the header data (it's MD5'd along with the frames)
+    if ((pHeaderData != NULL) && (nHeaderBytes > 0))
+    {
+        m_spAPECompressCore->GetBitArray()->GetMD5Helper().AddData(pHeaderData, nHeaderBytes);
+        RETURN_ON_ERROR(pIO->Write(pHeaderData, nHeaderBytes, &nBytesWritten))
+    }
+
+    // return success
+    return ERROR_SUCCESS;
+}
+
+int CAPECompressCreate::FinalizeFile(CIO * pIO, int nNumberOfFrames, int nFinalFrameBlocks, const void * pTerminatingData, int nTerminatingBytes, int nWAVTerminatingBytes)
+{
+    // store the tail position
+    long long nTailPosition = pIO->GetPosition();
+
+    // append the terminating data (only the WAV part is MD5'd, the rest is the tag)
+    unsigned int nBytesWritten = 0;
+    if (nTerminatingBytes > 0)
+    {
+        m_spAPECompressCore->GetBitArray()->GetMD5Helper().AddData(pTerminatingData, min(nWAVTerminatingBytes, nTerminatingBytes));
+        if (pIO->Write(pTerminatingData, nTerminatingBytes, &nBytesWritten) != 0) { return ERROR_IO_WRITE; }
+    }
+
+    // fill in what we know now
+    APE_DESCRIPTOR * pDescriptor = &m_APEDescriptor;
+    APE_HEADER * pHeader = &m_APEHeader;
+
+    pHeader->nFinalFrameBlocks = nFinalFrameBlocks;
+    pHeader->nTotalFrames = nNumberOfFrames;
+
+    long long nFrameDataBytes = nTailPosition - m_nStartPosition - pDescriptor->nDescriptorBytes - pDescriptor->nHeaderBytes -
+        pDescriptor->nSeekTableBytes - pDescriptor->nHeaderDataBytes;
+    pDescriptor->nAPEFrameDataBytes = (uint32) (nFrameDataBytes & 0xFFFFFFFF);
+    pDescriptor->nAPEFrameDataBytesHigh = (uint32) (nFrameDataBytes >> 32);
+    pDescriptor->nTerminatingDataBytes = nWAVTerminatingBytes;
+
+    // MD5 the header and seek table (they go last, since they're only known now)
+    CMD5Helper & MD5 = m_spAPECompressCore->GetBitArray()->GetMD5Helper();
+    MD5.AddData(pHeader, sizeof(APE_HEADER));
+    MD5.AddData(m_spSeekTable, m_nMaxFrames * sizeof(uint32));
+    MD5.GetResult(pDescriptor->cFileMD5);
+
+    // write it all back over the placeholders
+    RETURN_ON_ERROR(pIO->Seek(m_nStartPosition, FILE_BEGIN))
+    RETURN_ON_ERROR(pIO->Write(pDescriptor, sizeof(APE_DESCRIPTOR), &nBytesWritten))
+    RETURN_ON_ERROR(pIO->Write(pHeader, sizeof(APE_HEADER), &nBytesWritten))
+    RETURN_ON_ERROR(pIO->Write(m_spSeekTable, m_nMaxFrames * sizeof(uint32), &nBytesWritten))
+
+    // leave the file at the end
+    RETURN_ON_ERROR(pIO->Seek(0, FILE_END))
+
+    return ERROR_SUCCESS;
+}
+
+/*****************************************************************************************
+Worker pool
+*****************************************************************************************/
+int CAPECompressCreate::StartWorkers()
+{
+    // two slots per worker keeps every worker busy while the oldest frame is being written
+    m_nSlots = m_nThreads * 2;
+    m_spSlots.Assign(new FRAME_SLOT [m_nSlots], TRUE);
+    for (int z = 0; z < m_nSlots; z++)
+    {
+        m_spSlots[z].pInput = new unsigned char [GetFullFrameBytes()];
+        m_spSlots[z].nInputBytes = 0;
+        m_spSlots[z].pOutput = NULL;
+        m_spSlots[z].nOutputCapacity = 0;
+        m_spSlots[z].nOutputBytes = 0;
+        m_spSlots[z].nResult = ERROR_SUCCESS;
+        m_spSlots[z].bReady = FALSE;
+    }
+
+    m_nFramesQueued = 0;
+    m_nNextEncodeFrame = 0;
+    m_bQuit = FALSE;
+
+    // create the workers (each with its own encoder, writing to memory)
+    m_spWorkers.Assign(new WORKER [m_nThreads], TRUE);
+    for (int z = 0; z < m_nThreads; z++)
+    {
+        WORKER * pWorker = &m_spWorkers[z];
+        pWorker->pOwner = this;
+        pWorker->pIO = new CMemoryIO;
+        pWorker->pCore = new CAPECompressCore(pWorker->pIO, &m_wfeInput, m_nBlocksPerFrame, m_nCompressionLevel);
+        pWorker->bThreadCreated = FALSE;
+        m_nWorkers++;
+
+        if (pthread_create(&pWorker->hThread, NULL, WorkerThread, pWorker) != 0)
+            return ERROR_UNDEFINED;
+        pWorker->bThreadCreated = TRUE;
+    }
+
+    return ERROR_SUCCESS;
+}
+
+void CAPECompressCreate::StopWorkers()
+{
+    pthread_mutex_lock(&m_Mutex);
+    m_bQuit = TRUE;
+    pthread_cond_broadcast(&m_condWork);
+    pthread_mutex_unlock(&m_Mutex);
+
+    for (int z = 0; z < m_nWorkers; z++)
+    {
+        WORKER * pWorker = &m_spWorkers[z];
+        if (pWorker->bThreadCreated)
+            pthread_join(pWorker->hThread, NULL);
+        SAFE_DELETE(pWorker->pCore)
+        SAFE_DELETE(pWorker->pIO)
+    }
+    m_nWorkers = 0;
+
+    for (int z = 0; z < m_nSlots; z++)
+    {
+        SAFE_ARRAY_DELETE(m_spSlots[z].pInput)
+        SAFE_ARRAY_DELETE(m_spSlots[z].pOutput)
+    }
+    m_nSlots = 0;
+}
+
+void * CAPECompressCreate::WorkerThread(void * pParam)
+{
+    WORKER * pWorker = (WORKER *) pParam;
+    pWorker->pOwner->WorkerLoop(pWorker);
+    return NULL;
+}
+
+void CAPECompressCreate::WorkerLoop(WORKER * pWorker)
+{
+    pthread_mutex_lock(&m_Mutex);
+    while (TRUE)
+    {
+        // wait for a frame
+        while ((m_bQuit == FALSE) && (m_nNextEncodeFrame >= m_nFramesQueued))
+            pthread_cond_wait(&m_condWork, &m_Mutex);
+        if (m_bQuit)
+            break;
+
+        FRAME_SLOT * pSlot = &m_spSlots[m_nNextEncodeFrame % m_nSlots];
+        m_nNextEncodeFrame++;
+        pthread_mutex_unlock(&m_Mutex);
+
+        int nResult = ERROR_UNDEFINED;
+        try
+        {
+            nResult = EncodeSlot(pWorker, pSlot);
+        }
+        catch(...)
+        {
+            nResult = ERROR_UNDEFINED;
+        }
+
+        pthread_mutex_lock(&m_Mutex);
+        pSlot->nResult = nResult;
+        pSlot->bReady = TRUE;
+        pthread_cond_signal(&m_condReady);
+    }
+    pthread_mutex_unlock(&m_Mutex);
+}
+
+int CAPECompressCreate::EncodeSlot(WORKER * pWorker, FRAME_SLOT * pSlot)
+{
+    // encode the frame from the start of the worker's bit array (so the bytes land in the words
+    // the way AppendFrame(...) wants them)
+    CBitArray * pBitArray = pWorker->pCore->GetBitArray();
+    RETURN_ON_ERROR(pWorker->pIO->Seek(0, FILE_BEGIN))
+    RETURN_ON_ERROR(pWorker->pCore->EncodeFrame(pSlot->pInput, pSlot->nInputBytes))
+
+    long long nFrameBytes = pWorker->pIO->GetPosition() + (pBitArray->GetCurrentBitIndex() / 8);
+    RETURN_ON_ERROR(pBitArray->OutputBitArray(TRUE))
+    if (nFrameBytes > 0x7FFFFFF0)
+        return ERROR_UNDEFINED;
+
+    // copy it out (the worker's memory gets reused for its next frame)
+    int nWords = int((nFrameBytes + 3) / 4);
+    if (nWords > pSlot->nOutputCapacity)
+    {
+        SAFE_ARRAY_DELETE(pSlot->pOutput)
+        pSlot->nOutputCapacity = max(nWords, pSlot->nOutputCapacity * 3 / 2);
+        pSlot->pOutput = new uint32 [pSlot->nOutputCapacity];
+    }
+    memcpy(pSlot->pOutput, pWorker->pIO->GetMappedBuffer(), nWords * sizeof(uint32));
+    pSlot->nOutputBytes = (int) nFrameBytes;
+
+    return ERROR_SUCCESS;
+}
+
+int CAPECompressCreate::WriteFrames(int nWaitFrames)
+{
+    // append the finished frames to the file's bit array in order, waiting for the ones before
+    // nWaitFrames
+    CBitArray * pBitArray = m_spAPECompressCore->GetBitArray();
+    while (m_nFramesWritten < m_nFrameIndex)
+    {
+        FRAME_SLOT * pSlot = &m_spSlots[m_nFramesWritten % m_nSlots];
+
+        pthread_mutex_lock(&m_Mutex);
+        while ((pSlot->bReady == FALSE) && (m_nFramesWritten < nWaitFrames))
+            pthread_cond_wait(&m_condReady, &m_Mutex);
+        BOOL bReady = pSlot->bReady;
+        pthread_mutex_unlock(&m_Mutex);
+        if (bReady == FALSE)
+            break;
+
+        RETURN_ON_ERROR(pSlot->nResult)
+
+        pBitArray->AdvanceToByteBoundary();
+        RETURN_ON_ERROR(SetSeekByte(m_nFramesWritten, m_pIO->GetPosition() + (pBitArray->GetCurrentBitIndex() / 8) - m_nStartPosition))
+        RETURN_ON_ERROR(pBitArray->AppendFrame(pSlot->pOutput, pSlot->nOutputBytes))
+        m_nFramesWritten++;
+    }
+
+    return ERROR_SUCCESS;
+}
+
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <pthread.h>
+#include "MACLib.h"
+
+namespace APE_MONKEY
+{
+
+class CAPECompressCore;
+class CMemoryIO;
+
+/*************************************************************************************************
+CAPECompressCreate - writes an APE file a frame at a time
+
+The descriptor, header and seek table are written by Start(...) as placeholders (the seek table
+has room for every frame nMaxAudioBytes could need) and filled in by Finish(...), along with the
+MD5 (see "MD5 Hash" in MACLib.h).
+
+With more than one thread, frames are encoded on a pool of workers: EncodeFrame(...) copies the
+frame into a slot (frame N always goes in slot N % m_nSlots, like CParallelAPEDecompress) and
+returns, and each worker encodes whole frames into its own bit array.  Frames don't depend on
+each other (see CAPECompressCore), so the finished frames are appended to the file's bit array
+in order and the file comes out the same, byte for byte, as with one thread.
+*************************************************************************************************/
+class CAPECompressCreate
+{
+public:
+    CAPECompressCreate(int nThreads = 1);
+    ~CAPECompressCreate();
+
+    int Start(CIO * pioOutput, const WAVEFORMATEX * pwfeInput, int nMaxAudioBytes, int nCompressionLevel = COMPRESSION_LEVEL_NORMAL, const void * pHeaderData = NULL, int nHeaderBytes = CREATE_WAV_HEADER_ON_DECOMPRESSION);
+
+    int GetFullFrameBytes();
+    int EncodeFrame(const void * pInputData, int nInputBytes);
+
+    int Finish(const void * pTerminatingData, int nTerminatingBytes, int nWAVTerminatingBytes);
+
+private:
+    struct FRAME_SLOT
+    {
+        unsigned char * pInput;
+        int nInputBytes;
+        uint32 * pOutput;
+        int nOutputCapacity;
+        int nOutputBytes;
+        int nResult;
+        BOOL bReady;
+    };
+
+    struct WORKER
+    {
+        CAPECompressCreate * pOwner;
+        CMemoryIO * pIO;
+        CAPECompressCore * pCore;
+        pthread_t hThread;
+        BOOL bThreadCreated;
+    };
+
+    int SetSeekByte(int nFrame, long long nByteOffset);
+    int InitializeFile(CIO * pIO, const WAVEFORMATEX * pwfeInput, int nMaxFrames, int nCompressionLevel, const void * pHeaderData, int nHeaderBytes);
+    int FinalizeFile(CIO * pIO, int nNumberOfFrames, int nFinalFrameBlocks, const void * pTerminatingData, int nTerminatingBytes, int nWAVTerminatingBytes);
+
+    // the worker pool (only when there's more than one thread)
+    int StartWorkers();
+    void StopWorkers();
+    static void * WorkerThread(void * pParam);
+    void WorkerLoop(WORKER * pWorker);
+    int EncodeSlot(WORKER * pWorker, FRAME_SLOT * pSlot);
+    int WriteFrames(int nWaitFrames);
+
+    // data
+    CSmartPtr<uint32> m_spSeekTable;
+    int m_nMaxFrames;
+    CIO * m_pIO;
+    long long m_nStartPosition;
+    APE_DESCRIPTOR m_APEDescriptor;
+    APE_HEADER m_APEHeader;
+
+    CSmartPtr<CAPECompressCore> m_spAPECompressCore;
+    WAVEFORMATEX m_wfeInput;
+    int m_nCompressionLevel;
+    int m_nBlocksPerFrame;
+    int m_nFrameIndex;
+    int m_nLastFrameBlocks;
+
+    // workers and the frame slots they encode from (frames are written in order, from the
+    // calling thread)
+    int m_nThreads;
+    CSmartPtr<WORKER> m_spWorkers;
+    int m_nWorkers;
+    CSmartPtr<FRAME_SLOT> m_spSlots;
+    int m_nSlots;
+    int m_nFramesWritten;
+
+    // scheduling (everything below is guarded by m_Mutex)
+    pthread_mutex_t m_Mutex;
+    pthread_cond_t m_condWork;
+    pthread_cond_t m_condReady;
+    int m_nFramesQueued;
+    int m_nNextEncodeFrame;
+    BOOL m_bQuit;
+};
+
+}
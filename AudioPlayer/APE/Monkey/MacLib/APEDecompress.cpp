@@ -2,6 +2,7 @@
 #include "APEDecompress.h"
 #include "APEInfo.h"
 #include "Prepare.h"
+#include "CRC.h"
 #include "UnBitArray.h"
 #include "NewPredictor.h"
 #include "MACLib.h"
@@ -11,6 +12,14 @@ namespace APE_MONKEY
 
 #define DECODE_BLOCK_SIZE       4096
 
+#ifdef ENABLE_STAGE_TIMING
+    #define STAGE_TIMING_START                  TICK_COUNT_TYPE nStageTick; TICK_COUNT_READ(nStageTick)
+    #define STAGE_TIMING_ADD(TOTAL)             { TICK_COUNT_TYPE nNow; TICK_COUNT_READ(nNow); TOTAL += nNow - nStageTick; nStageTick = nNow; }
+#else
+    #define STAGE_TIMING_START
+    #define STAGE_TIMING_ADD(TOTAL)
+#endif
+
 CAPEDecompress::CAPEDecompress(int * pErrorCode, CAPEInfo * pAPEInfo, int nStartBlock, int nFinishBlock)
 {
     *pErrorCode = ERROR_SUCCESS;
@@ -37,6 +46,19 @@ CAPEDecompress::CAPEDecompress(int * pErrorCode, CAPEInfo * pAPEInfo, int nStart
     m_nFrameBufferFinishedBlocks = 0;
     m_bErrorDecodingCurrentFrame = FALSE;
     m_nErrorDecodingCurrentFrameOutputSilenceBlocks = 0;
+    m_pStagedPredictorX = NULL;
+    m_pStagedPredictorY = NULL;
+    m_pDecodeBlocks = NULL;
+    m_pUnprepareBlocks = NULL;
+    m_bReleaseAsDecoded = FALSE;
+    m_nFrameReleasedBlocks = 0;
+    m_pDirectOutput = NULL;
+    m_nVerifyMode = APE_VERIFY_INLINE;
+    m_nFrameVerifyMode = APE_VERIFY_INLINE;
+    m_nOutputFormat = APE_OUTPUT_NATIVE;
+    m_nOutputBlockAlign = m_nBlockAlign;
+    m_pConvertBlocks = NULL;
+    memset(&m_StageTimes, 0, sizeof(m_StageTimes));
 
     // set the "real" start and finish blocks
     m_nStartBlock = (nStartBlock < 0) ? 0 : min(nStartBlock, (int)GetInfo(APE_INFO_TOTAL_BLOCKS));
@@ -65,20 +87,31 @@ int CAPEDecompress::InitializeDecompressor()
     if (m_spUnBitArray == NULL)
         return ERROR_UPSUPPORTED_FILE_VERSION;
 
+    m_pUnprepareBlocks = CPrepare::GetUnprepareBlocks(&m_wfeInput);
+    if (m_pUnprepareBlocks == NULL)
+        return ERROR_INVALID_INPUT_FILE;
+
+    // both ways of decoding work on arrays of up to DECODE_BLOCK_SIZE blocks per channel
+    m_spDataX.Assign(new int [DECODE_BLOCK_SIZE], TRUE);
+    m_spDataY.Assign(new int [DECODE_BLOCK_SIZE], TRUE);
+
     if (GetInfo(APE_INFO_FILE_VERSION) >= 3950)
     {
         m_spNewPredictorX.Assign(new CPredictorDecompress3950toCurrent((int)GetInfo(APE_INFO_COMPRESSION_LEVEL), (int)GetInfo(APE_INFO_FILE_VERSION)));
         m_spNewPredictorY.Assign(new CPredictorDecompress3950toCurrent((int)GetInfo(APE_INFO_COMPRESSION_LEVEL), (int)GetInfo(APE_INFO_FILE_VERSION)));
+
+        m_pStagedPredictorX = (CPredictorDecompress3950toCurrent *) m_spNewPredictorX.GetPtr();
+        m_pStagedPredictorY = (CPredictorDecompress3950toCurrent *) m_spNewPredictorY.GetPtr();
+        m_pDecodeBlocks = &CAPEDecompress::DecodeBlocksStaged;
     }
     else
     {
         m_spNewPredictorX.Assign(new CPredictorDecompressNormal3930to3950((int)GetInfo(APE_INFO_COMPRESSION_LEVEL), (int)GetInfo(APE_INFO_FILE_VERSION)));
         m_spNewPredictorY.Assign(new CPredictorDecompressNormal3930to3950((int)GetInfo(APE_INFO_COMPRESSION_LEVEL), (int)GetInfo(APE_INFO_FILE_VERSION)));
+        m_pDecodeBlocks = &CAPEDecompress::DecodeBlocksPerBlock;
     }
 
-    // seek to the beginning
-    return Seek(0);
-
+    return ERROR_SUCCESS;
 }
 
 int CAPEDecompress::GetData(char * pBuffer, int nBlocks, int * pBlocksRetrieved)
@@ -86,19 +119,43 @@ int CAPEDecompress::GetData(char * pBuffer, int nBlocks, int * pBlocksRetrieved)
     int nRetVal = ERROR_SUCCESS;
     if (pBlocksRetrieved) *pBlocksRetrieved = 0;
     
-    // make sure we're initialized
-    RETURN_ON_ERROR(InitializeDecompressor())
+    // make sure we're initialized (and start at the beginning the first time through)
+    if (m_bDecompressorInitialized == FALSE)
+        RETURN_ON_ERROR(Seek(0))
 
     // cap
     int nBlocksUntilFinish = (int)(m_nFinishBlock - m_nCurrentBlock);
     const int nBlocksToRetrieve = min(nBlocks, nBlocksUntilFinish);
 
-    // get the data
+    // get the data (planar output moves on a sample per block, with each channel nBlocks
+    // samples after the one before it)
     unsigned char * pOutputBuffer = (unsigned char *) pBuffer;
+    const int nOutputStep = (m_nOutputFormat & APE_OUTPUT_PLANAR) ? 4 : m_nOutputBlockAlign;
     int nBlocksLeft = nBlocksToRetrieve;
     int nBlocksThisPass = 1;
     while ((nBlocksLeft > 0) && (nBlocksThisPass > 0))
     {
+        // whole frames are decoded straight into the output (the frame buffer only takes the
+        // partial frames at either end of a request, and everything if the output is planar)
+        int nFrameBlocks = (m_nCurrentFrame < (int) GetInfo(APE_INFO_TOTAL_FRAMES)) ? (int) GetInfo(APE_INFO_FRAME_BLOCKS, m_nCurrentFrame) : 0;
+        if ((nFrameBlocks > 0) && (nFrameBlocks <= nBlocksLeft) && (m_cbFrameBuffer.MaxGet() == 0) &&
+            (m_nErrorDecodingCurrentFrameOutputSilenceBlocks == 0) && (nOutputStep == m_nOutputBlockAlign) &&
+            (m_nCurrentFrameBufferBlock == m_nCurrentFrame * (int) GetInfo(APE_INFO_BLOCKS_PER_FRAME)))
+        {
+            // a 32-bit output format has the PCM decoded to the end of the frame's output and
+            // widened in place (each block's output ends up no later than its PCM was)
+            unsigned char * pFrameOutput = &pOutputBuffer[nFrameBlocks * (m_nOutputBlockAlign - m_nBlockAlign)];
+            int nDecodeRetVal = DecodeFrameDirect(pFrameOutput);
+            if (nDecodeRetVal != ERROR_SUCCESS)
+                nRetVal = nDecodeRetVal;
+            if (m_pConvertBlocks != NULL)
+                m_pConvertBlocks(pFrameOutput, nFrameBlocks, pOutputBuffer, nBlocks);
+            pOutputBuffer += nFrameBlocks * nOutputStep;
+            nBlocksLeft -= nFrameBlocks;
+            nBlocksThisPass = nFrameBlocks;
+            continue;
+        }
+
         // fill up the frame buffer
         int nDecodeRetVal = FillFrameBuffer();
         if (nDecodeRetVal != ERROR_SUCCESS)
@@ -107,11 +164,23 @@ int CAPEDecompress::GetData(char * pBuffer, int nBlocks, int * pBlocksRetrieved)
         const int nFrameBufferBlocks = m_nFrameBufferFinishedBlocks;
         nBlocksThisPass = min(nBlocksLeft, nFrameBufferBlocks);
 
-        // remove as much as possible
+        // remove as much as possible (converted straight out of the buffer for a 32-bit format)
         if (nBlocksThisPass > 0)
         {
-            m_cbFrameBuffer.Get(pOutputBuffer, nBlocksThisPass * m_nBlockAlign);
-            pOutputBuffer += nBlocksThisPass * m_nBlockAlign;
+            if (m_pConvertBlocks == NULL)
+            {
+                m_cbFrameBuffer.Get(pOutputBuffer, nBlocksThisPass * m_nBlockAlign);
+            }
+            else
+            {
+                const unsigned char * pFirst = NULL; const unsigned char * pSecond = NULL;
+                int nFirstBytes = 0; int nSecondBytes = 0;
+                m_cbFrameBuffer.GetHead(nBlocksThisPass * m_nBlockAlign, &pFirst, &nFirstBytes, &pSecond, &nSecondBytes);
+                m_pConvertBlocks(pFirst, nFirstBytes / m_nBlockAlign, pOutputBuffer, nBlocks);
+                m_pConvertBlocks(pSecond, nSecondBytes / m_nBlockAlign, &pOutputBuffer[(nFirstBytes / m_nBlockAlign) * nOutputStep], nBlocks);
+                m_cbFrameBuffer.RemoveHead(nBlocksThisPass * m_nBlockAlign);
+            }
+            pOutputBuffer += nBlocksThisPass * nOutputStep;
             nBlocksLeft -= nBlocksThisPass;
             m_nFrameBufferFinishedBlocks -= nBlocksThisPass;
         }
@@ -144,23 +213,57 @@ int CAPEDecompress::Seek(int nBlockOffset)
     // seek to the perfect location
     int nBaseFrame = nBlockOffset / GetInfo(APE_INFO_BLOCKS_PER_FRAME);
     int nBlocksToSkip = nBlockOffset % GetInfo(APE_INFO_BLOCKS_PER_FRAME);
-    int nBytesToSkip = nBlocksToSkip * m_nBlockAlign;
         
     m_nCurrentBlock = nBaseFrame * GetInfo(APE_INFO_BLOCKS_PER_FRAME);
     m_nCurrentFrameBufferBlock = (int)(nBaseFrame * GetInfo(APE_INFO_BLOCKS_PER_FRAME));
     m_nCurrentFrame = nBaseFrame;
     m_nFrameBufferFinishedBlocks = 0;
+    m_nErrorDecodingCurrentFrameOutputSilenceBlocks = 0;
     m_cbFrameBuffer.Empty();
-    RETURN_ON_ERROR(SeekToFrame(m_nCurrentFrame));
+
+    // whatever the verifier has of the frame we were in can't be finished now
+    if (m_spVerifier != NULL)
+        m_spVerifier->Discard();
+
+    // pick up from the closest checkpoint in the frame if there's an index, otherwise from the frame start
+    int nCheckpointBlocks = 0;
+    const unsigned char * pState = (m_spSeekIndex != NULL) ? m_spSeekIndex->Find(nBaseFrame, nBlocksToSkip, &nCheckpointBlocks) : NULL;
+    CDecoderStateReader Reader(pState, (m_spSeekIndex != NULL) ? m_spSeekIndex->GetStateBytes() : 0);
+    if ((pState != NULL) && (LoadDecoderState(Reader) == ERROR_SUCCESS))
+    {
+        m_nCurrentBlock += nCheckpointBlocks;
+        m_nCurrentFrameBufferBlock += nCheckpointBlocks;
+        m_bReleaseAsDecoded = TRUE;
+        m_nFrameReleasedBlocks = nCheckpointBlocks;
+        nBlocksToSkip -= nCheckpointBlocks;
+    }
+    else
+    {
+        RETURN_ON_ERROR(SeekToFrame(m_nCurrentFrame));
+    }
 
     // skip necessary blocks
-    CSmartPtr<char> spTempBuffer(new char [nBytesToSkip], TRUE);
-    if (spTempBuffer == NULL) return ERROR_INSUFFICIENT_MEMORY;
-    
-    int nBlocksRetrieved = 0;
-    GetData(spTempBuffer, nBlocksToSkip, &nBlocksRetrieved);
-    if (nBlocksRetrieved != nBlocksToSkip)
-        return ERROR_UNDEFINED;
+    return SkipBlocks(nBlocksToSkip);
+}
+
+/*****************************************************************************************
+Decodes and drops blocks (straight out of the frame buffer, so there's nothing to allocate)
+*****************************************************************************************/
+int CAPEDecompress::SkipBlocks(int nBlocks)
+{
+    while (nBlocks > 0)
+    {
+        FillFrameBuffer();
+
+        int nBlocksThisPass = min(nBlocks, m_nFrameBufferFinishedBlocks);
+        if (nBlocksThisPass <= 0)
+            return ERROR_UNDEFINED;
+
+        m_cbFrameBuffer.RemoveHead(nBlocksThisPass * m_nBlockAlign);
+        m_nFrameBufferFinishedBlocks -= nBlocksThisPass;
+        m_nCurrentBlock += nBlocksThisPass;
+        nBlocks -= nBlocksThisPass;
+    }
 
     return ERROR_SUCCESS;
 }
@@ -170,8 +273,6 @@ Decodes blocks of data
 *****************************************************************************************/
 int CAPEDecompress::FillFrameBuffer()
 {
-    static int cnt = 0;
-    cnt ++;
     int nRetVal = ERROR_SUCCESS;
 
     // determine the maximum blocks we can decode
@@ -184,21 +285,12 @@ int CAPEDecompress::FillFrameBuffer()
     int nBlocksLeft = m_cbFrameBuffer.MaxAdd() / m_nBlockAlign;
     while (nBlocksLeft > 0)
     {
-        static int loopCnt = 0;
-        loopCnt ++;
-//        static clock_t mSec = clock();
-        
         // output silence from previous error
         if (m_nErrorDecodingCurrentFrameOutputSilenceBlocks > 0)
         {
             // output silence
             int nOutputSilenceBlocks = min(m_nErrorDecodingCurrentFrameOutputSilenceBlocks, nBlocksLeft);
-            unsigned char cSilence = (GetInfo(APE_INFO_BITS_PER_SAMPLE) == 8) ? 127 : 0;
-            for (int z = 0; z < nOutputSilenceBlocks * m_nBlockAlign; z++)
-            {
-                *m_cbFrameBuffer.GetDirectWritePointer() = cSilence;
-                m_cbFrameBuffer.UpdateAfterDirectWrite(1);
-            }
+            OutputSilence(nOutputSilenceBlocks, (GetInfo(APE_INFO_BITS_PER_SAMPLE) == 8) ? 127 : 0);
 
             // decrement
             m_nErrorDecodingCurrentFrameOutputSilenceBlocks -= nOutputSilenceBlocks;
@@ -209,25 +301,33 @@ int CAPEDecompress::FillFrameBuffer()
                 break;
         }
         
-//        printf("Step1 func time:%d loop Time %d eclipse:%f\r\n", cnt, loopCnt, ((double)clock() - mSec) / CLOCKS_PER_SEC); mSec = clock();
-        
         // get frame size
         int nFrameBlocks = (int)GetInfo(APE_INFO_FRAME_BLOCKS, m_nCurrentFrame);
         if (nFrameBlocks < 0)
             break;
-//        printf("Step2 func time:%d loop Time %d eclipse:%f\r\n", cnt, loopCnt, ((double)clock() - mSec) / CLOCKS_PER_SEC); mSec = clock();
         // analyze
         int nFrameOffsetBlocks = m_nCurrentFrameBufferBlock % GetInfo(APE_INFO_BLOCKS_PER_FRAME);
         int nFrameBlocksLeft = nFrameBlocks - nFrameOffsetBlocks;
         int nBlocksThisPass = min(nFrameBlocksLeft, nBlocksLeft);
-//        printf("Step3 func time:%d loop Time %d eclipse:%f\r\n", cnt, loopCnt, ((double)clock() - mSec) / CLOCKS_PER_SEC); mSec = clock();
         // start the frame if we need to
         if (nFrameOffsetBlocks == 0)
             StartFrame();
-//                printf("Step4 func time:%d loop Time %d eclipse:%f\r\n", cnt, loopCnt, ((double)clock() - mSec) / CLOCKS_PER_SEC); mSec = clock();
+        // stop at the next checkpoint so the index can take it, and go a little at a time
+        // through a frame that is handed out as it's decoded
+        if (m_spSeekIndex != NULL)
+            nBlocksThisPass = min(nBlocksThisPass, m_spSeekIndex->GetCheckpointBlocks() - (nFrameOffsetBlocks % m_spSeekIndex->GetCheckpointBlocks()));
+        if (m_bReleaseAsDecoded)
+            nBlocksThisPass = min(nBlocksThisPass, DECODE_BLOCK_SIZE);
         // decode data
         DecodeBlocksToFrameBuffer(nBlocksThisPass);
-//                    printf("Step5 func time:%d loop Time %d eclipse:%f\r\n", cnt, loopCnt, ((double)clock() - mSec) / CLOCKS_PER_SEC); mSec = clock();
+        // take a checkpoint and hand out the blocks if we're going as we decode
+        if ((m_bErrorDecodingCurrentFrame == FALSE) && ((nFrameOffsetBlocks + nBlocksThisPass) < nFrameBlocks))
+            RecordCheckpoint(nFrameOffsetBlocks + nBlocksThisPass);
+        if (m_bReleaseAsDecoded && (m_bErrorDecodingCurrentFrame == FALSE))
+        {
+            m_nFrameBufferFinishedBlocks += nBlocksThisPass;
+            m_nFrameReleasedBlocks += nBlocksThisPass;
+        }
         // end the frame if we decoded all the blocks from the current frame
         BOOL bEndedFrame = FALSE;
         if ((nFrameOffsetBlocks + nBlocksThisPass) >= nFrameBlocks)
@@ -235,18 +335,18 @@ int CAPEDecompress::FillFrameBuffer()
             EndFrame();
             bEndedFrame = TRUE;
         }
-//        printf("Step5.5 func time:%d loop Time %d eclipse:%f\r\n", cnt, loopCnt, ((double)clock() - mSec) / CLOCKS_PER_SEC); mSec = clock();
         // handle errors (either mid-frame or from a CRC at the end of the frame)
         if (m_bErrorDecodingCurrentFrame)
         {
+            // blocks that were already handed out (or skipped over from a checkpoint) can't be taken back
             unsigned long long nFrameBlocksDecoded = 0;
             if (bEndedFrame)
             {   
                 // remove the frame buffer blocks that have been marked as good
-                m_nFrameBufferFinishedBlocks -= GetInfo(APE_INFO_FRAME_BLOCKS, m_nCurrentFrame - 1);
+                m_nFrameBufferFinishedBlocks -= GetInfo(APE_INFO_FRAME_BLOCKS, m_nCurrentFrame - 1) - m_nFrameReleasedBlocks;
                 
                 // assume that the frame buffer contains the correct number of blocks for the entire frame
-                nFrameBlocksDecoded = GetInfo(APE_INFO_FRAME_BLOCKS, m_nCurrentFrame - 1);
+                nFrameBlocksDecoded = GetInfo(APE_INFO_FRAME_BLOCKS, m_nCurrentFrame - 1) - m_nFrameReleasedBlocks;
             }
             else
             {
@@ -254,7 +354,7 @@ int CAPEDecompress::FillFrameBuffer()
                 m_nCurrentFrame++;
 
                 // calculate how many blocks were output before we errored
-                nFrameBlocksDecoded = m_nCurrentFrameBufferBlock - (GetInfo(APE_INFO_BLOCKS_PER_FRAME) * (m_nCurrentFrame - 1));
+                nFrameBlocksDecoded = m_nCurrentFrameBufferBlock - (GetInfo(APE_INFO_BLOCKS_PER_FRAME) * (m_nCurrentFrame - 1)) - m_nFrameReleasedBlocks;
             }
 
             // remove any decoded data for this frame from the buffer
@@ -265,20 +365,26 @@ int CAPEDecompress::FillFrameBuffer()
             if (m_nCurrentFrame < GetInfo(APE_INFO_TOTAL_FRAMES))
                 SeekToFrame(m_nCurrentFrame);
 
-            // reset our frame buffer position to the beginning of the frame
-            m_nCurrentFrameBufferBlock = (int)((m_nCurrentFrame - 1) * GetInfo(APE_INFO_BLOCKS_PER_FRAME));
+            // reset our frame buffer position to the beginning of the frame (or the part of it we still owe)
+            m_nCurrentFrameBufferBlock = (int)((m_nCurrentFrame - 1) * GetInfo(APE_INFO_BLOCKS_PER_FRAME)) + m_nFrameReleasedBlocks;
 
             // output silence for the duration of the error frame (we can't just dump it to the
             // frame buffer here since the frame buffer may not be large enough to hold the
             // duration of the entire frame)
-            m_nErrorDecodingCurrentFrameOutputSilenceBlocks += nFrameBlocks;
+            m_nErrorDecodingCurrentFrameOutputSilenceBlocks += nFrameBlocks - m_nFrameReleasedBlocks;
+            m_bReleaseAsDecoded = FALSE;
+            m_nFrameReleasedBlocks = 0;
 
             // save the return value
             nRetVal = ERROR_INVALID_CHECKSUM;
         }
-//        printf("Step6 func time:%d loop Time %d eclipse:%f\r\n", cnt, loopCnt, ((double)clock() - mSec) / CLOCKS_PER_SEC); mSec = clock();
         // update the number of blocks that still fit in the buffer
         nBlocksLeft = m_cbFrameBuffer.MaxAdd() / m_nBlockAlign;
+
+        // give back what we have so far of a frame that's handed out as it's decoded, and stop
+        // at the end of a frame (so the next one can go straight to the caller if it all fits)
+        if ((m_bReleaseAsDecoded || bEndedFrame) && (m_nFrameBufferFinishedBlocks > 0))
+            break;
     }
 
     return nRetVal;
@@ -286,104 +392,270 @@ int CAPEDecompress::FillFrameBuffer()
 
 void CAPEDecompress::DecodeBlocksToFrameBuffer(int nBlocks)
 {
-    // decode the samples
-    int nBlocksProcessed = 0;
+    // decode the samples (the special codes only change from frame to frame, so they're sorted
+    // out here rather than for each block)
     int nFrameBufferBytes = m_cbFrameBuffer.MaxGet();
+    unsigned char * pDirectStart = m_pDirectOutput;
+
+    // a silent frame is all the one byte (what Unprepare makes of zeros), so it's filled and
+    // CRC'd without going through the predictors or the per sample conversion
+    BOOL bSilence = (m_wfeInput.nChannels == 2) ?
+        ((m_nSpecialCodes & SPECIAL_FRAME_LEFT_SILENCE) && (m_nSpecialCodes & SPECIAL_FRAME_RIGHT_SILENCE)) :
+        (m_nSpecialCodes & SPECIAL_FRAME_MONO_SILENCE);
+    unsigned char cSilence = (m_wfeInput.wBitsPerSample == 8) ? 128 : 0;
 
     try
     {
-        if (m_wfeInput.nChannels == 2)
+        if (bSilence)
+            OutputSilence(nBlocks, cSilence);
+        else if ((m_wfeInput.nChannels == 2) && ((m_nSpecialCodes & SPECIAL_FRAME_PSEUDO_STEREO) == 0))
+            (this->*m_pDecodeBlocks)(nBlocks, TRUE);
+        else
+            (this->*m_pDecodeBlocks)(nBlocks, FALSE);
+    }
+    catch(...)
+    {
+        m_bErrorDecodingCurrentFrame = TRUE;
+    }
+
+    // get actual blocks that have been decoded and added to the frame buffer (or the output)
+    int nAddedBytes = (pDirectStart != NULL) ? (int) (m_pDirectOutput - pDirectStart) : (m_cbFrameBuffer.MaxGet() - nFrameBufferBytes);
+    int nActualBlocks = nAddedBytes / m_nBlockAlign;
+    if (nBlocks != nActualBlocks)
+        m_bErrorDecodingCurrentFrame = TRUE;
+
+    // CRC what was decoded in one pass (rather than a byte at a time as each sample is stored),
+    // or hand it to the verifier
+    STAGE_TIMING_START;
+    if (bSilence)
+    {
+        if (m_nFrameVerifyMode == APE_VERIFY_INLINE)
+            m_nCRC = CRC32UpdateRepeat(m_nCRC, cSilence, nAddedBytes);
+        else if (m_nFrameVerifyMode == APE_VERIFY_ASYNC)
+            m_spVerifier->AddSilence(m_nCurrentFrame, cSilence, nAddedBytes);
+    }
+    else if (m_nFrameVerifyMode != APE_VERIFY_NONE)
+    {
+        const unsigned char * pFirst = pDirectStart;
+        const unsigned char * pSecond = NULL;
+        int nFirstBytes = nAddedBytes, nSecondBytes = 0;
+        if (pDirectStart == NULL)
+            m_cbFrameBuffer.GetTail(nAddedBytes, &pFirst, &nFirstBytes, &pSecond, &nSecondBytes);
+
+        if (m_nFrameVerifyMode == APE_VERIFY_INLINE)
         {
-            if ((m_nSpecialCodes & SPECIAL_FRAME_LEFT_SILENCE) && 
-                (m_nSpecialCodes & SPECIAL_FRAME_RIGHT_SILENCE)) 
-            {
-                for (nBlocksProcessed = 0; nBlocksProcessed < nBlocks; nBlocksProcessed++)
-                {
-                    m_Prepare.Unprepare(0, 0, &m_wfeInput, m_cbFrameBuffer.GetDirectWritePointer(), &m_nCRC);
-                    m_cbFrameBuffer.UpdateAfterDirectWrite(m_nBlockAlign);
-                }
-            }
-            else if (m_nSpecialCodes & SPECIAL_FRAME_PSEUDO_STEREO)
-            {
-                for (nBlocksProcessed = 0; nBlocksProcessed < nBlocks; nBlocksProcessed++)
-                {
-                    int X = m_spNewPredictorX->DecompressValue(m_spUnBitArray->DecodeValueRange(m_BitArrayStateX));
-                    m_Prepare.Unprepare(X, 0, &m_wfeInput, m_cbFrameBuffer.GetDirectWritePointer(), &m_nCRC);
-                    m_cbFrameBuffer.UpdateAfterDirectWrite(m_nBlockAlign);
-                }
-            }    
-            else
-            {
-//                clock_t mSec = clock();
-//                static int cnt = 0;
-                
-                if (m_spAPEInfo->GetInfo(APE_INFO_FILE_VERSION) >= 3950)
-                {
-//                    clock_t total = 0;
-                    for (nBlocksProcessed = 0; nBlocksProcessed < nBlocks; nBlocksProcessed++)
-                    {
-                        
-                        int nY = m_spUnBitArray->DecodeValueRange(m_BitArrayStateY);
-                        int nX = m_spUnBitArray->DecodeValueRange(m_BitArrayStateX);
-//                        clock_t start = clock();
-                        int Y = m_spNewPredictorY->DecompressValue(nY, m_nLastX);
-                        int X = m_spNewPredictorX->DecompressValue(nX, Y);
-//                        total += clock() - start;
-                        m_nLastX = X;
-                        m_Prepare.Unprepare(X, Y, &m_wfeInput, m_cbFrameBuffer.GetDirectWritePointer(), &m_nCRC);
-                        m_cbFrameBuffer.UpdateAfterDirectWrite(m_nBlockAlign);
-                        
-                    }
-                    
-//                    printf("target 3 %d - %f\r\n", cnt, (double)(total) / CLOCKS_PER_SEC);mSec = clock();
-                }
-                else
-                {
-                    for (nBlocksProcessed = 0; nBlocksProcessed < nBlocks; nBlocksProcessed++)
-                    {
-                        int X = m_spNewPredictorX->DecompressValue(m_spUnBitArray->DecodeValueRange(m_BitArrayStateX));
-                        int Y = m_spNewPredictorY->DecompressValue(m_spUnBitArray->DecodeValueRange(m_BitArrayStateY));
-                        
-                        m_Prepare.Unprepare(X, Y, &m_wfeInput, m_cbFrameBuffer.GetDirectWritePointer(), &m_nCRC);
-                        m_cbFrameBuffer.UpdateAfterDirectWrite(m_nBlockAlign);
-                    }
-                }
+            m_nCRC = CRC32Update(m_nCRC, pFirst, nFirstBytes);
+            m_nCRC = CRC32Update(m_nCRC, pSecond, nSecondBytes);
+        }
+        else
+        {
+            m_spVerifier->AddData(m_nCurrentFrame, pFirst, nFirstBytes);
+            m_spVerifier->AddData(m_nCurrentFrame, pSecond, nSecondBytes);
+        }
+    }
+    STAGE_TIMING_ADD(m_StageTimes.nUnprepare)
 
-            }
+    // bump frame decode position
+    m_nCurrentFrameBufferBlock += nActualBlocks;
+}
+
+/*****************************************************************************************
+Decodes one whole frame straight into a caller buffer -- the frame buffer is left empty and
+positioned at the next frame, so GetData(...) can carry on from there
+*****************************************************************************************/
+int CAPEDecompress::DecodeFrame(int nFrameIndex, unsigned char * pBuffer, int * pBlocksDecoded)
+{
+    if (pBlocksDecoded) *pBlocksDecoded = 0;
+    RETURN_ON_ERROR(InitializeDecompressor())
+
+    int nFrameBlocks = (int) GetInfo(APE_INFO_FRAME_BLOCKS, nFrameIndex);
+    if ((nFrameBlocks <= 0) || (pBuffer == NULL))
+        return ERROR_BAD_PARAMETER;
+
+    // position at the start of the frame
+    const int nBlocksPerFrame = (int) GetInfo(APE_INFO_BLOCKS_PER_FRAME);
+    m_nCurrentFrame = nFrameIndex;
+    m_nCurrentFrameBufferBlock = nFrameIndex * nBlocksPerFrame;
+    m_nFrameBufferFinishedBlocks = 0;
+    m_nErrorDecodingCurrentFrameOutputSilenceBlocks = 0;
+    m_cbFrameBuffer.Empty();
+    RETURN_ON_ERROR(SeekToFrame(nFrameIndex))
+
+    // decode
+    int nRetVal = DecodeFrameDirect(pBuffer);
+    m_nCurrentBlock = m_nCurrentFrameBufferBlock;
+
+    if (pBlocksDecoded) *pBlocksDecoded = nFrameBlocks;
+    return nRetVal;
+}
+
+/*****************************************************************************************
+Decodes the current frame straight into pBuffer, bypassing the frame buffer (which has to be
+empty, and positioned at the start of the frame) -- checkpoints are still taken on the way
+*****************************************************************************************/
+int CAPEDecompress::DecodeFrameDirect(unsigned char * pBuffer)
+{
+    const int nFrameBlocks = (int) GetInfo(APE_INFO_FRAME_BLOCKS, m_nCurrentFrame);
+    const int nFrameStartBlock = m_nCurrentFrameBufferBlock;
+
+    StartFrame();
+    m_pDirectOutput = pBuffer;
+    int nFrameOffsetBlocks = 0;
+    while ((nFrameOffsetBlocks < nFrameBlocks) && (m_bErrorDecodingCurrentFrame == FALSE))
+    {
+        int nBlocksThisPass = nFrameBlocks - nFrameOffsetBlocks;
+        if (m_spSeekIndex != NULL)
+            nBlocksThisPass = min(nBlocksThisPass, m_spSeekIndex->GetCheckpointBlocks() - (nFrameOffsetBlocks % m_spSeekIndex->GetCheckpointBlocks()));
+
+        DecodeBlocksToFrameBuffer(nBlocksThisPass);
+        nFrameOffsetBlocks += nBlocksThisPass;
+        if ((m_bErrorDecodingCurrentFrame == FALSE) && (nFrameOffsetBlocks < nFrameBlocks))
+            RecordCheckpoint(nFrameOffsetBlocks);
+    }
+    m_pDirectOutput = NULL;
+    EndFrame();
+
+    // silence for a bad frame (like FillFrameBuffer(...)), and resynchronize at the next one
+    int nRetVal = ERROR_SUCCESS;
+    if (m_bErrorDecodingCurrentFrame)
+    {
+        memset(pBuffer, (GetInfo(APE_INFO_BITS_PER_SAMPLE) == 8) ? 127 : 0, nFrameBlocks * m_nBlockAlign);
+        if (m_nCurrentFrame < (int) GetInfo(APE_INFO_TOTAL_FRAMES))
+            SeekToFrame(m_nCurrentFrame);
+        nRetVal = ERROR_INVALID_CHECKSUM;
+    }
+
+    // none of it went through the frame buffer
+    m_nFrameBufferFinishedBlocks = 0;
+    m_nCurrentFrameBufferBlock = nFrameStartBlock + nFrameBlocks;
+    return nRetVal;
+}
+
+/*****************************************************************************************
+Staged decoding (3.95 and later) -- rather than taking each block through every stage, a
+run of blocks goes through one stage at a time: range decode the residuals, run the NN
+filters over each channel, run the stage 1 predictors, then convert to PCM
+(the stages only share state within themselves, so the output is identical)
+*****************************************************************************************/
+void CAPEDecompress::DecodeBlocksStaged(int nBlocks, BOOL bDecodeY)
+{
+    int * pX = m_spDataX;
+    int * pY = m_spDataY;
+
+    while (nBlocks > 0)
+    {
+        int nChunkBlocks = min(nBlocks, DECODE_BLOCK_SIZE);
+        STAGE_TIMING_START;
+
+        // range decode the residuals (Y then X for each block, like the encoder wrote them)
+        if (bDecodeY)
+            m_spUnBitArray->DecodeValueRangeArray(m_BitArrayStateY, pY, m_BitArrayStateX, pX, nChunkBlocks);
+        else
+            m_spUnBitArray->DecodeValueRangeArray(m_BitArrayStateX, pX, nChunkBlocks);
+        STAGE_TIMING_ADD(m_StageTimes.nRangeDecode)
+
+        // stage 2: NN filters
+        m_pStagedPredictorX->DecompressNNFilters(pX, nChunkBlocks);
+        if (bDecodeY)
+            m_pStagedPredictorY->DecompressNNFilters(pY, nChunkBlocks);
+        STAGE_TIMING_ADD(m_StageTimes.nNNFilters)
+
+        // stage 1: prediction (the channels are coupled here)
+        if (bDecodeY)
+        {
+            CPredictorDecompress3950toCurrent::DecompressPredictionStereo(m_pStagedPredictorX, m_pStagedPredictorY, pX, pY, nChunkBlocks, m_nLastX);
         }
         else
         {
-            if (m_nSpecialCodes & SPECIAL_FRAME_MONO_SILENCE)
-            {
-                for (nBlocksProcessed = 0; nBlocksProcessed < nBlocks; nBlocksProcessed++)
-                {
-                    m_Prepare.Unprepare(0, 0, &m_wfeInput, m_cbFrameBuffer.GetDirectWritePointer(), &m_nCRC);
-                    m_cbFrameBuffer.UpdateAfterDirectWrite(m_nBlockAlign);
-                }
-            }
-            else
+            m_pStagedPredictorX->DecompressPrediction(pX, nChunkBlocks);
+            if (m_wfeInput.nChannels == 2)
+                memset(pY, 0, nChunkBlocks * sizeof(int));
+        }
+        STAGE_TIMING_ADD(m_StageTimes.nPrediction)
+
+        // output
+        OutputBlocks(pX, pY, nChunkBlocks);
+        STAGE_TIMING_ADD(m_StageTimes.nUnprepare)
+
+        nBlocks -= nChunkBlocks;
+    }
+}
+
+/*****************************************************************************************
+Block at a time decoding (before 3.95) -- the predictors only go a value at a time, but the
+blocks still collect in arrays so the output goes through the same unprepare
+*****************************************************************************************/
+void CAPEDecompress::DecodeBlocksPerBlock(int nBlocks, BOOL bDecodeY)
+{
+    int * pX = m_spDataX;
+    int * pY = m_spDataY;
+
+    while (nBlocks > 0)
+    {
+        int nChunkBlocks = min(nBlocks, DECODE_BLOCK_SIZE);
+
+        if (bDecodeY)
+        {
+            for (int z = 0; z < nChunkBlocks; z++)
             {
-                for (nBlocksProcessed = 0; nBlocksProcessed < nBlocks; nBlocksProcessed++)
-                {
-                    int X = m_spNewPredictorX->DecompressValue(m_spUnBitArray->DecodeValueRange(m_BitArrayStateX));
-                    m_Prepare.Unprepare(X, 0, &m_wfeInput, m_cbFrameBuffer.GetDirectWritePointer(), &m_nCRC);
-                    m_cbFrameBuffer.UpdateAfterDirectWrite(m_nBlockAlign);
-                }
+                pX[z] = m_spNewPredictorX->DecompressValue(m_spUnBitArray->DecodeValueRange(m_BitArrayStateX));
+                pY[z] = m_spNewPredictorY->DecompressValue(m_spUnBitArray->DecodeValueRange(m_BitArrayStateY));
             }
         }
+        else
+        {
+            for (int z = 0; z < nChunkBlocks; z++)
+                pX[z] = m_spNewPredictorX->DecompressValue(m_spUnBitArray->DecodeValueRange(m_BitArrayStateX));
+            if (m_wfeInput.nChannels == 2)
+                memset(pY, 0, nChunkBlocks * sizeof(int));
+        }
+
+        OutputBlocks(pX, pY, nChunkBlocks);
+        nBlocks -= nChunkBlocks;
     }
-    catch(...)
+}
+
+void CAPEDecompress::OutputSilence(int nBlocks, unsigned char cSilence)
+{
+    if (m_pDirectOutput != NULL)
     {
-        m_bErrorDecodingCurrentFrame = TRUE;
+        memset(m_pDirectOutput, cSilence, nBlocks * m_nBlockAlign);
+        m_pDirectOutput += nBlocks * m_nBlockAlign;
+        return;
     }
 
-    // get actual blocks that have been decoded and added to the frame buffer
-    int nActualBlocks = (m_cbFrameBuffer.MaxGet() - nFrameBufferBytes) / m_nBlockAlign;
-    if (nBlocks != nActualBlocks)
-        m_bErrorDecodingCurrentFrame = TRUE;
+    // fill the frame buffer (split wherever it loops around)
+    while (nBlocks > 0)
+    {
+        int nRunBlocks = min(nBlocks, m_cbFrameBuffer.MaxDirectWrite() / m_nBlockAlign);
+        if (nRunBlocks <= 0) throw(1);
 
-    // bump frame decode position
-    m_nCurrentFrameBufferBlock += nActualBlocks;
+        memset(m_cbFrameBuffer.GetDirectWritePointer(), cSilence, nRunBlocks * m_nBlockAlign);
+        m_cbFrameBuffer.UpdateAfterDirectWrite(nRunBlocks * m_nBlockAlign);
+        nBlocks -= nRunBlocks;
+    }
+}
+
+void CAPEDecompress::OutputBlocks(const int * pX, const int * pY, int nBlocks)
+{
+    if (m_pDirectOutput != NULL)
+    {
+        m_pUnprepareBlocks(pX, pY, nBlocks, m_pDirectOutput);
+        m_pDirectOutput += nBlocks * m_nBlockAlign;
+        return;
+    }
+
+    // convert to PCM in the frame buffer (split wherever it loops around)
+    int nBlocksOutput = 0;
+    while (nBlocksOutput < nBlocks)
+    {
+        int nRunBlocks = min(nBlocks - nBlocksOutput, m_cbFrameBuffer.MaxDirectWrite() / m_nBlockAlign);
+        if (nRunBlocks <= 0) throw(1);
+
+        m_pUnprepareBlocks(&pX[nBlocksOutput], &pY[nBlocksOutput], nRunBlocks, m_cbFrameBuffer.GetDirectWritePointer());
+        m_cbFrameBuffer.UpdateAfterDirectWrite(nRunBlocks * m_nBlockAlign);
+        nBlocksOutput += nRunBlocks;
+    }
 }
 
 void CAPEDecompress::StartFrame()
@@ -394,6 +666,13 @@ void CAPEDecompress::StartFrame()
     m_nStoredCRC = m_spUnBitArray->DecodeValue(DECODE_VALUE_METHOD_UNSIGNED_INT);
     m_bErrorDecodingCurrentFrame = FALSE;
     m_nErrorDecodingCurrentFrameOutputSilenceBlocks = 0;
+    m_nFrameReleasedBlocks = 0;
+
+    // without the CRC check there's no reason to hold the frame back
+    m_nFrameVerifyMode = m_nVerifyMode;
+    m_bReleaseAsDecoded = (m_nFrameVerifyMode != APE_VERIFY_INLINE);
+    if (m_nFrameVerifyMode == APE_VERIFY_ASYNC)
+        m_spVerifier->StartFrame(m_nCurrentFrame);
 
     // get any 'special' codes if the file uses them (for silence, FALSE stereo, etc.)
     m_nSpecialCodes = 0;
@@ -419,13 +698,19 @@ void CAPEDecompress::StartFrame()
 
 void CAPEDecompress::EndFrame()
 {
-    m_nFrameBufferFinishedBlocks += GetInfo(APE_INFO_FRAME_BLOCKS, m_nCurrentFrame);
+    m_nFrameBufferFinishedBlocks += GetInfo(APE_INFO_FRAME_BLOCKS, m_nCurrentFrame) - m_nFrameReleasedBlocks;
     m_nCurrentFrame++;
 
     // finalize
     m_spUnBitArray->Finalize();
 
-    // check the CRC
+    // check the CRC (or leave it to the verifier, unless decoding already failed -- that
+    // frame has been reported with the return value)
+    if ((m_nFrameVerifyMode == APE_VERIFY_ASYNC) && (m_bErrorDecodingCurrentFrame == FALSE))
+        m_spVerifier->EndFrame(m_nCurrentFrame - 1, m_nStoredCRC);
+    if (m_nFrameVerifyMode != APE_VERIFY_INLINE)
+        return;
+
     m_nCRC = m_nCRC ^ 0xFFFFFFFF;
     m_nCRC >>= 1;
     if (m_nCRC != m_nStoredCRC)
@@ -448,7 +733,355 @@ Seek to the proper frame (if necessary) and do any alignment of the bit array
 int CAPEDecompress::SeekToFrame(int nFrameIndex)
 {
     int nSeekRemainder = (GetInfo(APE_INFO_SEEK_BYTE, nFrameIndex) - GetInfo(APE_INFO_SEEK_BYTE, 0)) % 4;
-    return m_spUnBitArray->FillAndResetBitArray((int)GetInfo(APE_INFO_SEEK_BYTE, nFrameIndex) - nSeekRemainder, nSeekRemainder * 8);
+    return m_spUnBitArray->FillAndResetBitArray((long long) GetInfo(APE_INFO_SEEK_BYTE, nFrameIndex) - nSeekRemainder, nSeekRemainder * 8);
+}
+
+/*****************************************************************************************
+Decoder state -- everything a frame carries from one block to the next, so decoding can pick
+up mid-frame from a checkpoint
+*****************************************************************************************/
+void CAPEDecompress::SaveDecoderState(CDecoderStateWriter & Writer)
+{
+    Writer.WriteValue(m_nCRC);
+    Writer.WriteValue(m_nStoredCRC);
+    Writer.WriteValue(m_nFrameVerifyMode);
+    Writer.WriteValue(m_nSpecialCodes);
+    Writer.WriteValue(m_nLastX);
+    Writer.WriteValue(m_BitArrayStateX);
+    Writer.WriteValue(m_BitArrayStateY);
+
+    m_spUnBitArray->SaveState(Writer);
+    m_spNewPredictorX->SaveState(Writer);
+    m_spNewPredictorY->SaveState(Writer);
+}
+
+int CAPEDecompress::LoadDecoderState(CDecoderStateReader & Reader)
+{
+    m_nCRC = Reader.ReadValue<unsigned int>();
+    m_nStoredCRC = Reader.ReadValue<unsigned int>();
+    m_nFrameVerifyMode = Reader.ReadValue<int>();
+    m_nSpecialCodes = Reader.ReadValue<int>();
+    m_nLastX = Reader.ReadValue<int>();
+    m_BitArrayStateX = Reader.ReadValue<UNBIT_ARRAY_STATE>();
+    m_BitArrayStateY = Reader.ReadValue<UNBIT_ARRAY_STATE>();
+
+    RETURN_ON_ERROR(m_spUnBitArray->LoadState(Reader))
+    m_spNewPredictorX->LoadState(Reader);
+    m_spNewPredictorY->LoadState(Reader);
+    if (Reader.GetError())
+        return ERROR_UNDEFINED;
+
+    // the running CRC is only any good if the frame was being checked inline (and the verifier
+    // hasn't seen the start of the frame)
+    if (m_nFrameVerifyMode != APE_VERIFY_INLINE)
+        m_nFrameVerifyMode = APE_VERIFY_NONE;
+
+    m_bErrorDecodingCurrentFrame = FALSE;
+    return ERROR_SUCCESS;
+}
+
+void CAPEDecompress::RecordCheckpoint(int nFrameOffsetBlocks)
+{
+    if (m_spSeekIndex == NULL)
+        return;
+
+    unsigned char * pState = m_spSeekIndex->Add(m_nCurrentFrame, nFrameOffsetBlocks);
+    if (pState != NULL)
+    {
+        CDecoderStateWriter Writer(pState);
+        SaveDecoderState(Writer);
+    }
+}
+
+/*****************************************************************************************
+Snapshots -- the decoder state at the block GetData(...) hands out next, so a restore picks up
+there like a seek to a checkpoint, without decoding anything again
+
+The decoder usually runs ahead of the caller (up to a frame is decoded into the frame buffer),
+so the state at the caller's block is made by decoding the start of its frame again on the side
+(from the closest checkpoint if there's a seek index), and then everything is put back.
+*****************************************************************************************/
+#define APE_SNAPSHOT_VERSION        1
+
+struct APE_SNAPSHOT_HEADER
+{
+    char cID[4];                        // "APSS"
+    uint32 nVersion;                    // APE_SNAPSHOT_VERSION
+    unsigned long long nFileID;         // identifies the APE file (see GetSeekIndexFileID())
+    unsigned long long nBlock;          // the next block GetData(...) hands out
+    uint32 nStateBytes;                 // followed by the decoder state at nBlock
+    uint32 nReserved;
+};
+
+int CAPEDecompress::SaveSnapshot(unsigned char * pBuffer, int * pBytes)
+{
+    if (pBytes == NULL)
+        return ERROR_BAD_PARAMETER;
+
+    // make sure we're initialized (and start at the beginning the first time through)
+    if (m_bDecompressorInitialized == FALSE)
+        RETURN_ON_ERROR(Seek(0))
+
+    CDecoderStateWriter Counter;
+    SaveDecoderState(Counter);
+    const int nBytes = int(sizeof(APE_SNAPSHOT_HEADER)) + Counter.GetBytes();
+    if ((pBuffer == NULL) || (*pBytes < nBytes))
+    {
+        int nRetVal = (pBuffer == NULL) ? ERROR_SUCCESS : ERROR_BAD_PARAMETER;
+        *pBytes = nBytes;
+        return nRetVal;
+    }
+
+    APE_SNAPSHOT_HEADER Header;
+    memset(&Header, 0, sizeof(Header));
+    memcpy(Header.cID, "APSS", 4);
+    Header.nVersion = APE_SNAPSHOT_VERSION;
+    Header.nFileID = GetSeekIndexFileID();
+    Header.nBlock = m_nCurrentBlock;
+    Header.nStateBytes = Counter.GetBytes();
+
+    // the state as it is if decoding is where the caller is, otherwise back at the caller's block
+    CDecoderStateWriter Writer(&pBuffer[sizeof(Header)]);
+    if ((m_nCurrentFrameBufferBlock == (int) m_nCurrentBlock) && (m_nErrorDecodingCurrentFrameOutputSilenceBlocks == 0) && (m_bErrorDecodingCurrentFrame == FALSE))
+        SaveDecoderState(Writer);
+    else
+        RETURN_ON_ERROR(SaveDecoderStateAt(Writer, (int) m_nCurrentBlock))
+    memcpy(pBuffer, &Header, sizeof(Header));
+
+    *pBytes = nBytes;
+    return ERROR_SUCCESS;
+}
+
+int CAPEDecompress::SaveDecoderStateAt(CDecoderStateWriter & Writer, int nBlock)
+{
+    const int nBlocksPerFrame = (int) GetInfo(APE_INFO_BLOCKS_PER_FRAME);
+    const int nFrame = nBlock / nBlocksPerFrame;
+    const int nFrameOffsetBlocks = nBlock % nBlocksPerFrame;
+    if (nFrame >= (int) GetInfo(APE_INFO_TOTAL_FRAMES))
+        return ERROR_BAD_PARAMETER;
+
+    // keep where we are (LoadDecoderState(...) doesn't cover the frame's progress and verify mode)
+    CDecoderStateWriter Counter;
+    SaveDecoderState(Counter);
+    CSmartPtr<unsigned char> spLiveState(new unsigned char [Counter.GetBytes()], TRUE);
+    CDecoderStateWriter LiveWriter(spLiveState);
+    SaveDecoderState(LiveWriter);
+    const int nFrameVerifyMode = m_nFrameVerifyMode;
+    const BOOL bErrorDecodingCurrentFrame = m_bErrorDecodingCurrentFrame;
+    const int nSilenceBlocks = m_nErrorDecodingCurrentFrameOutputSilenceBlocks;
+    const int nFrameReleasedBlocks = m_nFrameReleasedBlocks;
+    const BOOL bReleaseAsDecoded = m_bReleaseAsDecoded;
+    const int nCurrentFrameBufferBlock = m_nCurrentFrameBufferBlock;
+    const APE_STAGE_TIMES StageTimes = m_StageTimes;
+
+    // get to the block (the start of a frame is just the bit array at the frame, since
+    // StartFrame() sets up everything else)
+    int nRetVal = ERROR_SUCCESS;
+    int nCheckpointBlocks = 0;
+    const unsigned char * pState = ((m_spSeekIndex != NULL) && (nFrameOffsetBlocks > 0)) ? m_spSeekIndex->Find(nFrame, nFrameOffsetBlocks, &nCheckpointBlocks) : NULL;
+    CDecoderStateReader Reader(pState, (m_spSeekIndex != NULL) ? m_spSeekIndex->GetStateBytes() : 0);
+    if ((pState == NULL) || (LoadDecoderState(Reader) != ERROR_SUCCESS))
+    {
+        nCheckpointBlocks = 0;
+        nRetVal = SeekToFrame(nFrame);
+        if ((nRetVal == ERROR_SUCCESS) && (nFrameOffsetBlocks > 0))
+        {
+            // from the frame start the CRC is taken inline, so the restored frame can still be checked
+            const int nVerifyMode = m_nVerifyMode;
+            m_nVerifyMode = APE_VERIFY_INLINE;
+            StartFrame();
+            m_nVerifyMode = nVerifyMode;
+        }
+    }
+
+    if ((nRetVal == ERROR_SUCCESS) && (nFrameOffsetBlocks > nCheckpointBlocks))
+    {
+        CSmartPtr<unsigned char> spScratch(new unsigned char [DECODE_BLOCK_SIZE * m_nBlockAlign], TRUE);
+        for (int nBlocksLeft = nFrameOffsetBlocks - nCheckpointBlocks; (nBlocksLeft > 0) && (m_bErrorDecodingCurrentFrame == FALSE); )
+        {
+            int nBlocksThisPass = min(nBlocksLeft, DECODE_BLOCK_SIZE);
+            m_pDirectOutput = spScratch;
+            DecodeBlocksToFrameBuffer(nBlocksThisPass);
+            nBlocksLeft -= nBlocksThisPass;
+        }
+        m_pDirectOutput = NULL;
+        if (m_bErrorDecodingCurrentFrame)
+            nRetVal = ERROR_INVALID_CHECKSUM;
+    }
+
+    if (nRetVal == ERROR_SUCCESS)
+        SaveDecoderState(Writer);
+
+    // put everything back
+    CDecoderStateReader LiveReader(spLiveState, Counter.GetBytes());
+    int nLiveRetVal = LoadDecoderState(LiveReader);
+    m_nFrameVerifyMode = nFrameVerifyMode;
+    m_bErrorDecodingCurrentFrame = bErrorDecodingCurrentFrame;
+    m_nErrorDecodingCurrentFrameOutputSilenceBlocks = nSilenceBlocks;
+    m_nFrameReleasedBlocks = nFrameReleasedBlocks;
+    m_bReleaseAsDecoded = bReleaseAsDecoded;
+    m_nCurrentFrameBufferBlock = nCurrentFrameBufferBlock;
+    m_StageTimes = StageTimes;
+
+    return (nRetVal != ERROR_SUCCESS) ? nRetVal : nLiveRetVal;
+}
+
+int CAPEDecompress::RestoreSnapshot(const unsigned char * pBuffer, int nBytes)
+{
+    if ((pBuffer == NULL) || (nBytes < int(sizeof(APE_SNAPSHOT_HEADER))))
+        return ERROR_BAD_PARAMETER;
+    RETURN_ON_ERROR(InitializeDecompressor())
+
+    // the snapshot has to be for this file (and inside our range)
+    APE_SNAPSHOT_HEADER Header;
+    memcpy(&Header, pBuffer, sizeof(Header));
+    CDecoderStateWriter Counter;
+    SaveDecoderState(Counter);
+    if ((memcmp(Header.cID, "APSS", 4) != 0) || (Header.nVersion != APE_SNAPSHOT_VERSION) || (Header.nFileID != GetSeekIndexFileID()) ||
+        (Header.nStateBytes != uint32(Counter.GetBytes())) || (nBytes != int(sizeof(Header) + Header.nStateBytes)) ||
+        (Header.nBlock < m_nStartBlock) || (Header.nBlock > m_nFinishBlock))
+    {
+        return ERROR_INVALID_INPUT_FILE;
+    }
+
+    // whatever the verifier has of the frame we were in can't be finished now
+    if (m_spVerifier != NULL)
+        m_spVerifier->Discard();
+
+    // (if the state can't be put back, it's an ordinary seek)
+    CDecoderStateReader Reader(&pBuffer[sizeof(Header)], Header.nStateBytes);
+    if (LoadDecoderState(Reader) != ERROR_SUCCESS)
+        return Seek((int) (Header.nBlock - m_nStartBlock));
+
+    const int nBlocksPerFrame = (int) GetInfo(APE_INFO_BLOCKS_PER_FRAME);
+    m_nCurrentBlock = Header.nBlock;
+    m_nCurrentFrameBufferBlock = (int) Header.nBlock;
+    m_nCurrentFrame = (int) (Header.nBlock / nBlocksPerFrame);
+    m_nFrameBufferFinishedBlocks = 0;
+    m_nErrorDecodingCurrentFrameOutputSilenceBlocks = 0;
+    m_cbFrameBuffer.Empty();
+
+    // the rest of a frame is handed out as it's decoded (like a checkpoint in Seek(...))
+    if (Header.nBlock % nBlocksPerFrame != 0)
+    {
+        m_bReleaseAsDecoded = TRUE;
+        m_nFrameReleasedBlocks = (int) (Header.nBlock % nBlocksPerFrame);
+    }
+
+    return ERROR_SUCCESS;
+}
+
+/*****************************************************************************************
+Verify mode
+*****************************************************************************************/
+int CAPEDecompress::SetVerifyMode(int nMode, IAPEFrameErrorCallback * pCallback)
+{
+    if ((nMode != APE_VERIFY_INLINE) && (nMode != APE_VERIFY_ASYNC) && (nMode != APE_VERIFY_NONE))
+        return ERROR_BAD_PARAMETER;
+
+    // the old verifier finishes what it has before it goes (a frame in progress is left unchecked)
+    if (m_nFrameVerifyMode == APE_VERIFY_ASYNC)
+        m_nFrameVerifyMode = APE_VERIFY_NONE;
+    m_spVerifier.Delete();
+
+    if (nMode == APE_VERIFY_ASYNC)
+    {
+        int nErrorCode = ERROR_SUCCESS;
+        m_spVerifier.Assign(new CAPEFrameVerifier(&nErrorCode, pCallback));
+        if (nErrorCode != ERROR_SUCCESS)
+        {
+            m_spVerifier.Delete();
+            m_nVerifyMode = APE_VERIFY_INLINE;
+            return nErrorCode;
+        }
+    }
+
+    m_nVerifyMode = nMode;
+    return ERROR_SUCCESS;
+}
+
+/*****************************************************************************************
+Output format
+*****************************************************************************************/
+int CAPEDecompress::SetOutputFormat(int nFormat)
+{
+    CONVERT_BLOCKS_PROC pConvertBlocks = NULL;
+    if (nFormat != APE_OUTPUT_NATIVE)
+    {
+        pConvertBlocks = CPrepare::GetConvertBlocks(&m_wfeInput, nFormat);
+        if (pConvertBlocks == NULL)
+            return ERROR_BAD_PARAMETER;
+    }
+
+    m_nOutputFormat = nFormat;
+    m_nOutputBlockAlign = (nFormat == APE_OUTPUT_NATIVE) ? m_nBlockAlign : 4 * m_wfeInput.nChannels;
+    m_pConvertBlocks = pConvertBlocks;
+    return ERROR_SUCCESS;
+}
+
+/*****************************************************************************************
+Seek index
+*****************************************************************************************/
+int CAPEDecompress::CreateSeekIndex(int nCheckpointBlocks, BOOL bBuild)
+{
+    if (nCheckpointBlocks <= 0)
+        return ERROR_BAD_PARAMETER;
+
+    // the decoding components have to be there to size a checkpoint (and GetData(...) only
+    // starts at the beginning by itself if it's the one that initializes)
+    if (m_bDecompressorInitialized == FALSE)
+        RETURN_ON_ERROR(Seek(0))
+
+    // a counting pass gives the size of a checkpoint
+    CDecoderStateWriter Counter;
+    SaveDecoderState(Counter);
+
+    m_spSeekIndex.Assign(new CAPESeekIndex((int)GetInfo(APE_INFO_TOTAL_FRAMES), (int)GetInfo(APE_INFO_BLOCKS_PER_FRAME), nCheckpointBlocks, Counter.GetBytes()));
+    if (m_spSeekIndex == NULL)
+        return ERROR_INSUFFICIENT_MEMORY;
+
+    if (bBuild)
+    {
+        // decode everything once (the checkpoints are taken on the way) and go back
+        int nCurrentBlock = (int)(m_nCurrentBlock - m_nStartBlock);
+        RETURN_ON_ERROR(Seek(0))
+        SkipBlocks((int)(m_nFinishBlock - m_nCurrentBlock));
+        RETURN_ON_ERROR(Seek(nCurrentBlock))
+    }
+
+    return ERROR_SUCCESS;
+}
+
+int CAPEDecompress::LoadSeekIndex(CIO * pIO)
+{
+    if (m_spSeekIndex == NULL)
+        return ERROR_UNDEFINED;
+
+    return m_spSeekIndex->Load(pIO, GetSeekIndexFileID());
+}
+
+int CAPEDecompress::SaveSeekIndex(CIO * pIO)
+{
+    if (m_spSeekIndex == NULL)
+        return ERROR_UNDEFINED;
+
+    return m_spSeekIndex->Save(pIO, GetSeekIndexFileID());
+}
+
+unsigned long long CAPEDecompress::GetSeekIndexFileID()
+{
+    // FNV-1a over what tells files apart cheaply (size, length, where the last frame starts, format)
+    unsigned long long aryValues[5] = { GetInfo(APE_INFO_APE_TOTAL_BYTES), GetInfo(APE_INFO_TOTAL_BLOCKS),
+        GetInfo(APE_INFO_SEEK_BYTE, GetInfo(APE_INFO_TOTAL_FRAMES) - 1), GetInfo(APE_INFO_FILE_VERSION), GetInfo(APE_INFO_COMPRESSION_LEVEL) };
+
+    unsigned long long nHash = 14695981039346656037ULL;
+    const unsigned char * pBytes = (const unsigned char *) aryValues;
+    for (int z = 0; z < int(sizeof(aryValues)); z++)
+    {
+        nHash ^= pBytes[z];
+        nHash *= 1099511628211ULL;
+    }
+    return nHash;
 }
 
 /*****************************************************************************************
@@ -471,6 +1104,26 @@ unsigned long long CAPEDecompress::GetInfo(APE_DECOMPRESS_FIELDS Field, unsigned
             nRetVal = (unsigned long long)((double(m_nCurrentBlock) * double(1000)) / double(nSampleRate));
         break;
     }
+    case APE_DECOMPRESS_STAGE_TIMES:
+    {
+#ifdef ENABLE_STAGE_TIMING
+        memcpy((APE_STAGE_TIMES *) nParam1, &m_StageTimes, sizeof(APE_STAGE_TIMES));
+        nRetVal = ERROR_SUCCESS;
+#else
+        memset((APE_STAGE_TIMES *) nParam1, 0, sizeof(APE_STAGE_TIMES));
+        nRetVal = ERROR_UNDEFINED;
+#endif
+        break;
+    }
+    case APE_DECOMPRESS_VERIFY_MODE:
+        nRetVal = m_nVerifyMode;
+        break;
+    case APE_DECOMPRESS_OUTPUT_FORMAT:
+        nRetVal = m_nOutputFormat;
+        break;
+    case APE_DECOMPRESS_OUTPUT_BLOCK_ALIGN:
+        nRetVal = m_nOutputBlockAlign;
+        break;
     case APE_DECOMPRESS_TOTAL_BLOCKS:
         nRetVal = m_nFinishBlock - m_nStartBlock;
         break;
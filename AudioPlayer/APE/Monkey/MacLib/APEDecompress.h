@@ -4,6 +4,8 @@
 #include "MACLib.h"
 #include "Prepare.h"
 #include "CircleBuffer.h"
+#include "APESeekIndex.h"
+#include "APEFrameVerifier.h"
 
 namespace APE_MONKEY
 {
@@ -12,6 +14,7 @@ class CUnBitArray;
 class CPrepare;
 class CAPEInfo;
 class IPredictorDecompress;
+class CPredictorDecompress3950toCurrent;
 
 class CAPEDecompress : public IAPEDecompress
 {
@@ -24,6 +27,24 @@ public:
 
     unsigned long long GetInfo(APE_DECOMPRESS_FIELDS Field, unsigned long long nParam1 = 0, unsigned long long nParam2 = 0);
 
+    // decode one whole frame into a caller buffer (used by CParallelAPEDecompress)
+    int DecodeFrame(int nFrameIndex, unsigned char * pBuffer, int * pBlocksDecoded);
+
+    // checkpoints inside frames (see CAPESeekIndex)
+    int CreateSeekIndex(int nCheckpointBlocks, BOOL bBuild = FALSE);
+    int LoadSeekIndex(CIO * pIO);
+    int SaveSeekIndex(CIO * pIO);
+
+    // the whole decoder state at the current block (see SaveDecoderState(...))
+    int SaveSnapshot(unsigned char * pBuffer, int * pBytes);
+    int RestoreSnapshot(const unsigned char * pBuffer, int nBytes);
+
+    // frame CRCs inline, on a thread, or not at all
+    int SetVerifyMode(int nMode, IAPEFrameErrorCallback * pCallback = NULL);
+
+    // 32-bit integer or float output (DecodeFrame(...) always gives the file's own PCM)
+    int SetOutputFormat(int nFormat);
+
 protected:
     // file info
     int m_nBlockAlign;
@@ -37,19 +58,31 @@ protected:
     BOOL m_bDecompressorInitialized;
 
     // decoding tools    
-    CPrepare m_Prepare;
     WAVEFORMATEX m_wfeInput;
     unsigned int m_nCRC;
     unsigned int m_nStoredCRC;
     int m_nSpecialCodes;
     
     int SeekToFrame(int nFrameIndex);
+    int SkipBlocks(int nBlocks);
     void DecodeBlocksToFrameBuffer(int nBlocks);
+    int DecodeFrameDirect(unsigned char * pBuffer);
+    void DecodeBlocksStaged(int nBlocks, BOOL bDecodeY);
+    void DecodeBlocksPerBlock(int nBlocks, BOOL bDecodeY);
+    void OutputSilence(int nBlocks, unsigned char cSilence);
+    void OutputBlocks(const int * pX, const int * pY, int nBlocks);
     int FillFrameBuffer();
     void StartFrame();
     void EndFrame();
     int InitializeDecompressor();
 
+    // decoder state (everything that carries over from one block to the next inside a frame)
+    void SaveDecoderState(CDecoderStateWriter & Writer);
+    int LoadDecoderState(CDecoderStateReader & Reader);
+    void RecordCheckpoint(int nFrameOffsetBlocks);
+    int SaveDecoderStateAt(CDecoderStateWriter & Writer, int nBlock);
+    unsigned long long GetSeekIndexFileID();
+
     // more decoding components
     CSmartPtr<CAPEInfo> m_spAPEInfo;
     CSmartPtr<CUnBitArrayBase> m_spUnBitArray;
@@ -60,6 +93,16 @@ protected:
     CSmartPtr<IPredictorDecompress> m_spNewPredictorY;
 
     int m_nLastX;
+
+    // staged decoding (3.95 and later)
+    CPredictorDecompress3950toCurrent * m_pStagedPredictorX;
+    CPredictorDecompress3950toCurrent * m_pStagedPredictorY;
+
+    // the decoding loop and the PCM output for this file (picked once by InitializeDecompressor())
+    void (CAPEDecompress::* m_pDecodeBlocks)(int nBlocks, BOOL bDecodeY);
+    UNPREPARE_BLOCKS_PROC m_pUnprepareBlocks;
+    CSmartPtr<int> m_spDataX;
+    CSmartPtr<int> m_spDataY;
     
     // decoding buffer
     BOOL m_bErrorDecodingCurrentFrame;
@@ -67,6 +110,26 @@ protected:
     int m_nCurrentFrameBufferBlock;
     int m_nFrameBufferFinishedBlocks;
     CCircleBuffer m_cbFrameBuffer;
+    unsigned char * m_pDirectOutput; // set while a whole frame is decoded straight to the caller (DecodeFrameDirect(...))
+
+    // time spent in each stage of DecodeBlocksStaged(...) (only kept with ENABLE_STAGE_TIMING)
+    APE_STAGE_TIMES m_StageTimes;
+
+    // seek index, and how much of the current frame has been handed out before its end (a frame
+    // resumed from a checkpoint is released as it's decoded instead of when it's finished)
+    CSmartPtr<CAPESeekIndex> m_spSeekIndex;
+    BOOL m_bReleaseAsDecoded;
+    int m_nFrameReleasedBlocks;
+
+    // frame CRC checking (the mode a frame is started with sticks with it, m_nFrameVerifyMode)
+    int m_nVerifyMode;
+    int m_nFrameVerifyMode;
+    CSmartPtr<CAPEFrameVerifier> m_spVerifier;
+
+    // the format GetData(...) hands out (m_pConvertBlocks is NULL for APE_OUTPUT_NATIVE)
+    int m_nOutputFormat;
+    int m_nOutputBlockAlign;
+    CONVERT_BLOCKS_PROC m_pConvertBlocks;
 };
 
 }
@@ -0,0 +1,245 @@
+#include "All.h"
+#include "APEFileVerifier.h"
+#include "APEDecompress.h"
+#include "APEInfo.h"
+#include "md5.h"
+
+namespace APE_MONKEY
+{
+
+#define MAX_VERIFY_THREADS      64
+#define VERIFY_MD5_CHUNK_BYTES  (1024 * 1024)
+
+CAPEFileVerifier::CAPEFileVerifier(int * pErrorCode, const str_utf16 * pFilename, int nThreads)
+{
+    *pErrorCode = ERROR_SUCCESS;
+
+    // initialize
+    pthread_mutex_init(&m_Mutex, NULL);
+    m_nThreads = 0;
+    m_nTotalFrames = 0;
+    m_nFileBytes = 0;
+    m_nBadFrames = 0;
+    m_nMD5Status = APE_MD5_NOT_STORED;
+    m_nNextFrame = 0;
+
+    // keep the name (every worker opens the file for itself)
+    m_spFilename.Assign(new str_utf16 [wcslen(pFilename) + 1], TRUE);
+    wcscpy(m_spFilename, pFilename);
+
+    // open the file for ourselves (the MD5 is run over this one)
+    m_spAPEInfo.Assign(new CAPEInfo(pErrorCode, pFilename));
+    if (*pErrorCode != ERROR_SUCCESS)
+        return;
+
+    if (m_spAPEInfo->GetInfo(APE_INFO_FILE_VERSION) < 3930)
+    {
+        *pErrorCode = ERROR_UPSUPPORTED_FILE_VERSION;
+        return;
+    }
+
+    m_nTotalFrames = (int) m_spAPEInfo->GetInfo(APE_INFO_TOTAL_FRAMES);
+    m_nFileBytes = GET_IO(m_spAPEInfo)->GetSize();
+    if (m_nTotalFrames <= 0)
+    {
+        *pErrorCode = ERROR_INVALID_INPUT_FILE;
+        return;
+    }
+
+    m_spFrameResults.Assign(new int [m_nTotalFrames], TRUE);
+    for (int z = 0; z < m_nTotalFrames; z++)
+        m_spFrameResults[z] = ERROR_SUCCESS;
+
+    // figure the number of workers (no point in more workers than frames)
+    if (nThreads <= 0)
+        nThreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    m_nThreads = max(1, min(min(nThreads, MAX_VERIFY_THREADS), m_nTotalFrames));
+}
+
+CAPEFileVerifier::~CAPEFileVerifier()
+{
+    pthread_mutex_destroy(&m_Mutex);
+}
+
+int CAPEFileVerifier::Verify()
+{
+    if (m_spFrameResults == NULL)
+        return ERROR_UNDEFINED;
+
+    m_nNextFrame = 0;
+    m_nBadFrames = 0;
+    for (int z = 0; z < m_nTotalFrames; z++)
+        m_spFrameResults[z] = ERROR_SUCCESS;
+
+    // start the workers (each with its own file handle and decoding state)
+    int nRetVal = ERROR_SUCCESS;
+    CSmartPtr<WORKER> spWorkers(new WORKER [m_nThreads], TRUE);
+    const int nFrameBytes = (int) (m_spAPEInfo->GetInfo(APE_INFO_BLOCKS_PER_FRAME) * m_spAPEInfo->GetInfo(APE_INFO_BLOCK_ALIGN));
+    for (int z = 0; z < m_nThreads; z++)
+    {
+        WORKER * pWorker = &spWorkers[z];
+        pWorker->pOwner = this;
+        pWorker->pDecompress = NULL;
+        pWorker->pBuffer = NULL;
+        pWorker->bThreadCreated = FALSE;
+        if (nRetVal != ERROR_SUCCESS)
+            continue;
+
+        int nErrorCode = ERROR_SUCCESS;
+        CAPEInfo * pAPEInfo = new CAPEInfo(&nErrorCode, m_spFilename);
+        if (nErrorCode != ERROR_SUCCESS)
+        {
+            delete pAPEInfo;
+            nRetVal = nErrorCode;
+            continue;
+        }
+
+        // the decompressor eats the CAPEInfo object
+        pWorker->pDecompress = new CAPEDecompress(&nErrorCode, pAPEInfo);
+        pWorker->pBuffer = new unsigned char [nFrameBytes];
+        if (nErrorCode != ERROR_SUCCESS)
+        {
+            nRetVal = nErrorCode;
+            continue;
+        }
+
+        if (pthread_create(&pWorker->hThread, NULL, WorkerThread, pWorker) != 0)
+        {
+            nRetVal = ERROR_UNDEFINED;
+            continue;
+        }
+        pWorker->bThreadCreated = TRUE;
+    }
+
+    // run the MD5 while they decode (the workers still get through every frame if this fails)
+    int nMD5RetVal = (nRetVal == ERROR_SUCCESS) ? CheckMD5() : ERROR_SUCCESS;
+
+    // stop any workers that are still going if there was a problem starting them
+    if (nRetVal != ERROR_SUCCESS)
+    {
+        pthread_mutex_lock(&m_Mutex);
+        m_nNextFrame = m_nTotalFrames;
+        pthread_mutex_unlock(&m_Mutex);
+    }
+
+    for (int z = 0; z < m_nThreads; z++)
+    {
+        if (spWorkers[z].bThreadCreated)
+            pthread_join(spWorkers[z].hThread, NULL);
+        SAFE_DELETE(spWorkers[z].pDecompress)
+        SAFE_ARRAY_DELETE(spWorkers[z].pBuffer)
+    }
+    if (nRetVal != ERROR_SUCCESS)
+        return nRetVal;
+    if (nMD5RetVal != ERROR_SUCCESS)
+        return nMD5RetVal;
+
+    // tally
+    for (int z = 0; z < m_nTotalFrames; z++)
+    {
+        if (m_spFrameResults[z] != ERROR_SUCCESS)
+            m_nBadFrames++;
+    }
+
+    return ((m_nBadFrames > 0) || (m_nMD5Status == APE_MD5_MISMATCH)) ? ERROR_INVALID_CHECKSUM : ERROR_SUCCESS;
+}
+
+/*****************************************************************************************
+Worker threads -- take the next frame, decode it (which checks its CRC) and note the result
+*****************************************************************************************/
+void * CAPEFileVerifier::WorkerThread(void * pParam)
+{
+    WORKER * pWorker = (WORKER *) pParam;
+    pWorker->pOwner->WorkerLoop(pWorker);
+    return NULL;
+}
+
+void CAPEFileVerifier::WorkerLoop(WORKER * pWorker)
+{
+    while (TRUE)
+    {
+        pthread_mutex_lock(&m_Mutex);
+        int nFrame = m_nNextFrame++;
+        pthread_mutex_unlock(&m_Mutex);
+        if (nFrame >= m_nTotalFrames)
+            break;
+
+        int nResult = ERROR_SUCCESS;
+        try
+        {
+            nResult = pWorker->pDecompress->DecodeFrame(nFrame, pWorker->pBuffer, NULL);
+        }
+        catch(...)
+        {
+            nResult = ERROR_DECOMPRESSING_FRAME;
+        }
+        m_spFrameResults[nFrame] = nResult;
+    }
+}
+
+/*****************************************************************************************
+MD5 -- only files with a descriptor (3.98 and later) store one, and it's taken out of order:
+from the end of the seek table through the terminating data, then the header and seek table
+*****************************************************************************************/
+int CAPEFileVerifier::CheckMD5()
+{
+    APE_FILE_INFO * pInfo = (APE_FILE_INFO *) m_spAPEInfo->GetInfo(APE_INTERNAL_INFO);
+    APE_DESCRIPTOR * pDescriptor = pInfo->spAPEDescriptor;
+    if ((pInfo->nVersion < 3980) || (pDescriptor == NULL))
+    {
+        m_nMD5Status = APE_MD5_NOT_STORED;
+        return ERROR_SUCCESS;
+    }
+    if (pInfo->nMD5Invalid)
+    {
+        m_nMD5Status = APE_MD5_INVALID;
+        return ERROR_SUCCESS;
+    }
+
+    const long long nHead = (long long) pInfo->nJunkHeaderBytes + pDescriptor->nDescriptorBytes;
+    const long long nHeadBytes = (long long) pDescriptor->nHeaderBytes + pDescriptor->nSeekTableBytes;
+    const long long nDataBytes = (long long) pDescriptor->nHeaderDataBytes + pDescriptor->nAPEFrameDataBytes +
+        ((long long) pDescriptor->nAPEFrameDataBytesHigh << 32) + pDescriptor->nTerminatingDataBytes;
+    if (nHead + nHeadBytes + nDataBytes > m_nFileBytes)
+    {
+        m_nMD5Status = APE_MD5_MISMATCH;
+        return ERROR_SUCCESS;
+    }
+
+    CMD5Helper MD5;
+    CIO * pIO = GET_IO(m_spAPEInfo);
+    const unsigned char * pMapped = pIO->GetMappedBuffer();
+    if (pMapped != NULL)
+    {
+        // straight out of the mapping
+        for (long long nOffset = 0; nOffset < nDataBytes; nOffset += VERIFY_MD5_CHUNK_BYTES)
+            MD5.AddData(&pMapped[nHead + nHeadBytes + nOffset], (int) min(nDataBytes - nOffset, (long long) VERIFY_MD5_CHUNK_BYTES));
+        MD5.AddData(&pMapped[nHead], (int) nHeadBytes);
+    }
+    else
+    {
+        CSmartPtr<unsigned char> spBuffer(new unsigned char [(size_t) max(nHeadBytes, (long long) VERIFY_MD5_CHUNK_BYTES)], TRUE);
+        unsigned int nBytesRead = 0;
+
+        RETURN_ON_ERROR(pIO->Seek(nHead + nHeadBytes, FILE_BEGIN))
+        for (long long nOffset = 0; nOffset < nDataBytes; nOffset += VERIFY_MD5_CHUNK_BYTES)
+        {
+            unsigned int nBytes = (unsigned int) min(nDataBytes - nOffset, (long long) VERIFY_MD5_CHUNK_BYTES);
+            if ((pIO->Read(spBuffer, nBytes, &nBytesRead) != ERROR_SUCCESS) || (nBytesRead != nBytes))
+                return ERROR_IO_READ;
+            MD5.AddData(spBuffer, nBytes);
+        }
+
+        RETURN_ON_ERROR(pIO->Seek(nHead, FILE_BEGIN))
+        if ((pIO->Read(spBuffer, (unsigned int) nHeadBytes, &nBytesRead) != ERROR_SUCCESS) || (nBytesRead != (unsigned int) nHeadBytes))
+            return ERROR_IO_READ;
+        MD5.AddData(spBuffer, (int) nHeadBytes);
+    }
+
+    unsigned char cResult[16];
+    MD5.GetResult(cResult);
+    m_nMD5Status = (memcmp(cResult, pDescriptor->cFileMD5, 16) == 0) ? APE_MD5_MATCH : APE_MD5_MISMATCH;
+    return ERROR_SUCCESS;
+}
+
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <pthread.h>
+#include "MACLib.h"
+
+namespace APE_MONKEY
+{
+
+class CAPEInfo;
+class CAPEDecompress;
+
+#define APE_MD5_MATCH           0   // the MD5 in the descriptor matches the file
+#define APE_MD5_MISMATCH        1   // it doesn't
+#define APE_MD5_NOT_STORED      2   // the file doesn't have one (older than 3.98, or no descriptor)
+#define APE_MD5_INVALID         3   // the file has one, but it's known to be wrong (see CAPEInfo::CheckHeaderInformation())
+
+/*************************************************************************************************
+CAPEFileVerifier - checks a whole file: every frame's CRC, and the MD5 stored in the descriptor
+
+The frames are decoded on a pool of worker threads (each with its own CAPEDecompress and file
+mapping, like CParallelAPEDecompress, but the PCM is thrown away so the frames needn't be put back
+in order).  Meanwhile the calling thread runs the MD5 the way Monkey's Audio writes it: the header
+data, frames and terminating data, then the header and seek table (see "MD5 Hash" in MACLib.h).
+The tag isn't covered by either check.
+*************************************************************************************************/
+class CAPEFileVerifier
+{
+public:
+    CAPEFileVerifier(int * pErrorCode, const str_utf16 * pFilename, int nThreads = 0);
+    ~CAPEFileVerifier();
+
+    // checks the file (ERROR_SUCCESS if everything checks out, ERROR_INVALID_CHECKSUM if a frame
+    // or the MD5 is bad, anything else if the file couldn't be checked)
+    int Verify();
+
+    // the results of Verify()
+    int GetTotalFrames() { return m_nTotalFrames; }
+    int GetBadFrames() { return m_nBadFrames; }
+    BOOL IsFrameBad(int nFrame) { return ((m_spFrameResults != NULL) && (nFrame >= 0) && (nFrame < m_nTotalFrames) && (m_spFrameResults[nFrame] != ERROR_SUCCESS)) ? TRUE : FALSE; }
+    int GetMD5Status() { return m_nMD5Status; }
+    long long GetFileBytes() { return m_nFileBytes; }
+    CAPEInfo * GetAPEInfo() { return m_spAPEInfo; }
+
+protected:
+    struct WORKER
+    {
+        CAPEFileVerifier * pOwner;
+        CAPEDecompress * pDecompress;
+        unsigned char * pBuffer;
+        pthread_t hThread;
+        BOOL bThreadCreated;
+    };
+
+    static void * WorkerThread(void * pParam);
+    void WorkerLoop(WORKER * pWorker);
+    int CheckMD5();
+
+    // file info
+    CSmartPtr<CAPEInfo> m_spAPEInfo;
+    CSmartPtr<str_utf16> m_spFilename;
+    int m_nThreads;
+    int m_nTotalFrames;
+    long long m_nFileBytes;
+
+    // results (each frame's result is only written by the worker that decoded it)
+    CSmartPtr<int> m_spFrameResults;
+    int m_nBadFrames;
+    int m_nMD5Status;
+
+    // the next frame to hand out (guarded by m_Mutex)
+    pthread_mutex_t m_Mutex;
+    int m_nNextFrame;
+};
+
+}
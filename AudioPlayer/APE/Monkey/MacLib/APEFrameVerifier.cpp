@@ -0,0 +1,201 @@
+#include "All.h"
+#include "APEFrameVerifier.h"
+#include "CRC.h"
+
+namespace APE_MONKEY
+{
+
+#define APE_VERIFY_SLOTS            16
+#define APE_VERIFY_SLOT_BYTES       65536
+
+CAPEFrameVerifier::CAPEFrameVerifier(int * pErrorCode, IAPEFrameErrorCallback * pCallback)
+{
+    *pErrorCode = ERROR_SUCCESS;
+
+    // initialize (the synchronization objects first, so the destructor is always safe)
+    pthread_mutex_init(&m_Mutex, NULL);
+    pthread_cond_init(&m_condWork, NULL);
+    pthread_cond_init(&m_condSpace, NULL);
+    m_bThreadCreated = FALSE;
+    m_nHead = 0;
+    m_nCount = 0;
+    m_bQuit = FALSE;
+    m_pCallback = pCallback;
+    m_nFrame = -1;
+    m_nCRC = 0xFFFFFFFF;
+
+    m_spSlots.Assign(new VERIFY_SLOT [APE_VERIFY_SLOTS], TRUE);
+    m_spData.Assign(new unsigned char [APE_VERIFY_SLOTS * APE_VERIFY_SLOT_BYTES], TRUE);
+    if ((m_spSlots == NULL) || (m_spData == NULL))
+    {
+        *pErrorCode = ERROR_INSUFFICIENT_MEMORY;
+        return;
+    }
+    for (int z = 0; z < APE_VERIFY_SLOTS; z++)
+        m_spSlots[z].pData = &m_spData[z * APE_VERIFY_SLOT_BYTES];
+
+    if (pthread_create(&m_hThread, NULL, VerifyThread, this) != 0)
+    {
+        *pErrorCode = ERROR_UNDEFINED;
+        return;
+    }
+    m_bThreadCreated = TRUE;
+}
+
+CAPEFrameVerifier::~CAPEFrameVerifier()
+{
+    // the thread works through what's left before it quits
+    pthread_mutex_lock(&m_Mutex);
+    m_bQuit = TRUE;
+    pthread_cond_broadcast(&m_condWork);
+    pthread_mutex_unlock(&m_Mutex);
+
+    if (m_bThreadCreated)
+        pthread_join(m_hThread, NULL);
+
+    pthread_cond_destroy(&m_condSpace);
+    pthread_cond_destroy(&m_condWork);
+    pthread_mutex_destroy(&m_Mutex);
+}
+
+/*****************************************************************************************
+Handing over (on the decoding thread)
+*****************************************************************************************/
+void CAPEFrameVerifier::StartFrame(int nFrame)
+{
+    VERIFY_SLOT * pSlot = BeginSlot();
+    pSlot->Command = VERIFY_START_FRAME;
+    pSlot->nFrame = nFrame;
+    CommitSlot();
+}
+
+void CAPEFrameVerifier::AddData(int nFrame, const unsigned char * pData, int nBytes)
+{
+    while (nBytes > 0)
+    {
+        int nSlotBytes = min(nBytes, APE_VERIFY_SLOT_BYTES);
+
+        VERIFY_SLOT * pSlot = BeginSlot();
+        pSlot->Command = VERIFY_DATA;
+        pSlot->nFrame = nFrame;
+        pSlot->nBytes = nSlotBytes;
+        memcpy(pSlot->pData, pData, nSlotBytes);
+        CommitSlot();
+
+        pData += nSlotBytes;
+        nBytes -= nSlotBytes;
+    }
+}
+
+void CAPEFrameVerifier::AddSilence(int nFrame, unsigned char cSilence, int nBytes)
+{
+    VERIFY_SLOT * pSlot = BeginSlot();
+    pSlot->Command = VERIFY_SILENCE;
+    pSlot->nFrame = nFrame;
+    pSlot->nBytes = nBytes;
+    pSlot->cSilence = cSilence;
+    CommitSlot();
+}
+
+void CAPEFrameVerifier::EndFrame(int nFrame, unsigned int nStoredCRC)
+{
+    VERIFY_SLOT * pSlot = BeginSlot();
+    pSlot->Command = VERIFY_END_FRAME;
+    pSlot->nFrame = nFrame;
+    pSlot->nStoredCRC = nStoredCRC;
+    CommitSlot();
+}
+
+void CAPEFrameVerifier::Discard()
+{
+    VERIFY_SLOT * pSlot = BeginSlot();
+    pSlot->Command = VERIFY_DISCARD;
+    pSlot->nFrame = -1;
+    CommitSlot();
+}
+
+CAPEFrameVerifier::VERIFY_SLOT * CAPEFrameVerifier::BeginSlot()
+{
+    // wait for a free slot (the thread only looks at slots that have been committed, so this
+    // one can be filled in outside the lock)
+    pthread_mutex_lock(&m_Mutex);
+    while (m_nCount >= APE_VERIFY_SLOTS)
+        pthread_cond_wait(&m_condSpace, &m_Mutex);
+    VERIFY_SLOT * pSlot = &m_spSlots[(m_nHead + m_nCount) % APE_VERIFY_SLOTS];
+    pthread_mutex_unlock(&m_Mutex);
+    return pSlot;
+}
+
+void CAPEFrameVerifier::CommitSlot()
+{
+    pthread_mutex_lock(&m_Mutex);
+    m_nCount++;
+    pthread_cond_signal(&m_condWork);
+    pthread_mutex_unlock(&m_Mutex);
+}
+
+/*****************************************************************************************
+Checking (on the verifier's thread)
+*****************************************************************************************/
+void * CAPEFrameVerifier::VerifyThread(void * pParam)
+{
+    ((CAPEFrameVerifier *) pParam)->VerifyLoop();
+    return NULL;
+}
+
+void CAPEFrameVerifier::VerifyLoop()
+{
+    pthread_mutex_lock(&m_Mutex);
+    while (TRUE)
+    {
+        while ((m_nCount == 0) && (m_bQuit == FALSE))
+            pthread_cond_wait(&m_condWork, &m_Mutex);
+        if (m_nCount == 0)
+            break;
+
+        VERIFY_SLOT * pSlot = &m_spSlots[m_nHead];
+        pthread_mutex_unlock(&m_Mutex);
+
+        Process(*pSlot);
+
+        pthread_mutex_lock(&m_Mutex);
+        m_nHead = (m_nHead + 1) % APE_VERIFY_SLOTS;
+        m_nCount--;
+        pthread_cond_signal(&m_condSpace);
+    }
+    pthread_mutex_unlock(&m_Mutex);
+}
+
+void CAPEFrameVerifier::Process(const VERIFY_SLOT & Slot)
+{
+    switch (Slot.Command)
+    {
+    case VERIFY_START_FRAME:
+        m_nFrame = Slot.nFrame;
+        m_nCRC = 0xFFFFFFFF;
+        break;
+    case VERIFY_DATA:
+        if (Slot.nFrame == m_nFrame)
+            m_nCRC = CRC32Update(m_nCRC, Slot.pData, Slot.nBytes);
+        break;
+    case VERIFY_SILENCE:
+        if (Slot.nFrame == m_nFrame)
+            m_nCRC = CRC32UpdateRepeat(m_nCRC, Slot.cSilence, Slot.nBytes);
+        break;
+    case VERIFY_END_FRAME:
+        if (Slot.nFrame == m_nFrame)
+        {
+            // the same finish as CAPEDecompress::EndFrame()
+            unsigned int nCRC = (m_nCRC ^ 0xFFFFFFFF) >> 1;
+            if ((nCRC != Slot.nStoredCRC) && (m_pCallback != NULL))
+                m_pCallback->FrameError(Slot.nFrame);
+        }
+        m_nFrame = -1;
+        break;
+    case VERIFY_DISCARD:
+        m_nFrame = -1;
+        break;
+    }
+}
+
+}
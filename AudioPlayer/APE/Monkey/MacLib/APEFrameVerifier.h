@@ -0,0 +1,77 @@
+#pragma once
+
+#include <pthread.h>
+#include "MACLib.h"
+
+namespace APE_MONKEY
+{
+
+/*************************************************************************************************
+CAPEFrameVerifier - checks frame CRCs on a thread of its own (APE_VERIFY_ASYNC)
+
+The decoder hands over each frame's PCM as it comes out (copied into a small ring of slots, so
+the decoder only waits if the thread falls a ring behind), then the frame's stored CRC.  A frame
+is only checked if the verifier saw it from its first block; Discard() drops the one in progress
+(a seek lands in the middle of a frame).  Mismatches go to the callback, on the verifier's thread.
+
+Everything handed over has been checked by the time the verifier is deleted.
+*************************************************************************************************/
+class CAPEFrameVerifier
+{
+public:
+    CAPEFrameVerifier(int * pErrorCode, IAPEFrameErrorCallback * pCallback);
+    ~CAPEFrameVerifier();
+
+    void StartFrame(int nFrame);
+    void AddData(int nFrame, const unsigned char * pData, int nBytes);
+    void AddSilence(int nFrame, unsigned char cSilence, int nBytes);
+    void EndFrame(int nFrame, unsigned int nStoredCRC);
+    void Discard();
+
+protected:
+    enum VERIFY_COMMAND
+    {
+        VERIFY_START_FRAME,
+        VERIFY_DATA,
+        VERIFY_SILENCE,
+        VERIFY_END_FRAME,
+        VERIFY_DISCARD
+    };
+
+    struct VERIFY_SLOT
+    {
+        VERIFY_COMMAND Command;
+        int nFrame;
+        int nBytes;
+        unsigned char cSilence;
+        unsigned int nStoredCRC;
+        unsigned char * pData;
+    };
+
+    VERIFY_SLOT * BeginSlot();
+    void CommitSlot();
+
+    static void * VerifyThread(void * pParam);
+    void VerifyLoop();
+    void Process(const VERIFY_SLOT & Slot);
+
+    IAPEFrameErrorCallback * m_pCallback;
+    CSmartPtr<VERIFY_SLOT> m_spSlots;
+    CSmartPtr<unsigned char> m_spData;
+
+    // the frame being checked (on the verifier's thread)
+    int m_nFrame;
+    unsigned int m_nCRC;
+
+    // the ring (everything below is guarded by m_Mutex)
+    pthread_mutex_t m_Mutex;
+    pthread_cond_t m_condWork;
+    pthread_cond_t m_condSpace;
+    pthread_t m_hThread;
+    BOOL m_bThreadCreated;
+    int m_nHead;
+    int m_nCount;
+    BOOL m_bQuit;
+};
+
+}
@@ -6,20 +6,81 @@
 namespace APE_MONKEY
 {
 
-CAPEHeader::CAPEHeader(CStdLibFileIO * pIO)
+#define APE_HEADER_READ_BYTES           (64 * 1024)     // read from the start of the file in one go (covers the header of nearly every file)
+#define APE_DESCRIPTOR_SCAN_BYTES       (1024 * 1024)   // how far past the junk the descriptor is looked for
+
+CAPEHeader::CAPEHeader(CIO * pIO)
 {
     m_pIO = pIO;
+    m_pHead = NULL;
+    m_nHeadBytes = 0;
+    m_bHeadIsFile = FALSE;
 }
 
 CAPEHeader::~CAPEHeader()
 {
 }
 
+/*****************************************************************************************
+The start of the file from an offset -- the mapping if the source is mapped, otherwise one read
+of the start of the file (NULL past that; pBytesAvailable can be less than nBytes if the range
+runs past the end of what's there)
+*****************************************************************************************/
+const unsigned char * CAPEHeader::GetHeadAt(long long nOffset, unsigned int nBytes, unsigned int * pBytesAvailable)
+{
+    *pBytesAvailable = 0;
+
+    // the first time through, get the start of the file
+    if (m_pHead == NULL)
+    {
+        m_pHead = m_pIO->GetMappedBuffer();
+        if (m_pHead != NULL)
+        {
+            m_nHeadBytes = m_pIO->GetSize();
+            m_bHeadIsFile = TRUE;
+        }
+        else
+        {
+            unsigned int nHeadBytes = 0;
+            m_spHead.Assign(new unsigned char [APE_HEADER_READ_BYTES], TRUE);
+            if ((m_pIO->Seek(0, FILE_BEGIN) != ERROR_SUCCESS) || (m_pIO->Read(m_spHead, APE_HEADER_READ_BYTES, &nHeadBytes) != ERROR_SUCCESS))
+                nHeadBytes = 0;
+            m_pHead = m_spHead;
+            m_nHeadBytes = nHeadBytes;
+            m_bHeadIsFile = (nHeadBytes < APE_HEADER_READ_BYTES) ? TRUE : FALSE;
+        }
+    }
+
+    if ((nOffset < 0) || ((nOffset >= m_nHeadBytes) && (m_bHeadIsFile == FALSE)))
+        return NULL;
+
+    nOffset = min(nOffset, m_nHeadBytes);
+    *pBytesAvailable = (unsigned int) min((long long) nBytes, m_nHeadBytes - nOffset);
+    return &m_pHead[nOffset];
+}
+
+/*****************************************************************************************
+Reads at an offset -- out of the start of the file if that has all of it, and only otherwise
+out of the source itself (a big ID3v2 tag, or a huge seek table)
+*****************************************************************************************/
+int CAPEHeader::ReadAt(long long nOffset, void * pBuffer, unsigned int nBytes, unsigned int * pBytesRead)
+{
+    const unsigned char * pHead = GetHeadAt(nOffset, nBytes, pBytesRead);
+    if ((pHead != NULL) && ((*pBytesRead == nBytes) || m_bHeadIsFile))
+    {
+        memcpy(pBuffer, pHead, *pBytesRead);
+        return ERROR_SUCCESS;
+    }
+
+    *pBytesRead = 0;
+    RETURN_ON_ERROR(m_pIO->Seek(nOffset, FILE_BEGIN))
+    return m_pIO->Read(pBuffer, nBytes, pBytesRead);
+}
+
 int CAPEHeader::FindDescriptor(BOOL bSeek)
 {
-    // store the original location and seek to the beginning
-    int nOriginalFileLocation = (int)m_pIO->GetPosition();
-    m_pIO->Seek(0, FILE_BEGIN);
+    // store the original location
+    long long nOriginalFileLocation = m_pIO->GetPosition();
 
     // set the default junk bytes to 0
     int nJunkBytes = 0;
@@ -27,8 +88,8 @@ int CAPEHeader::FindDescriptor(BOOL bSeek)
     // skip an ID3v2 tag (which we really don't support anyway...)
     unsigned int nBytesRead = 0; 
     unsigned char cID3v2Header[10];
-    m_pIO->Read((unsigned char *) cID3v2Header, 10, &nBytesRead);
-    if (cID3v2Header[0] == 'I' && cID3v2Header[1] == 'D' && cID3v2Header[2] == '3') 
+    ReadAt(0, cID3v2Header, 10, &nBytesRead);
+    if ((nBytesRead == 10) && cID3v2Header[0] == 'I' && cID3v2Header[1] == 'D' && cID3v2Header[2] == '3') 
     {
         // why is it so hard to figure the lenght of an ID3v2 tag ?!?
 //        unsigned int nLength = *((unsigned int *) &cID3v2Header[6]);
@@ -59,41 +120,68 @@ int CAPEHeader::FindDescriptor(BOOL bSeek)
             // really do the trick
         }
 
-        m_pIO->Seek(nJunkBytes, FILE_BEGIN);
-
-        // scan for padding (slow and stupid, but who cares here...)
+        // skip the padding (a buffer at a time, until something that isn't a zero or the end of the file)
         if (!bHasTagFooter)
         {
-            char cTemp = 0;
-            m_pIO->Read((unsigned char *) &cTemp, 1, &nBytesRead);
-            while (cTemp == 0 && nBytesRead == 1)
+            unsigned char cPadding[4096];
+            do
             {
-                nJunkBytes++;
-                m_pIO->Read((unsigned char *) &cTemp, 1, &nBytesRead);
-            }
+                ReadAt(nJunkBytes, cPadding, sizeof(cPadding), &nBytesRead);
+                unsigned int nZeroes = 0;
+                while ((nZeroes < nBytesRead) && (cPadding[nZeroes] == 0))
+                    nZeroes++;
+                nJunkBytes += nZeroes;
+                if (nZeroes < nBytesRead)
+                    break;
+            } while (nBytesRead == sizeof(cPadding));
         }
     }
-    m_pIO->Seek(nJunkBytes, FILE_BEGIN);
-
-    // scan until we hit the APE_DESCRIPTOR, the end of the file, or 1 MB later
-    unsigned int nGoalID = (' ' << 24) | ('C' << 16) | ('A' << 8) | ('M');
-    unsigned int nReadID = 0;
-    int nRetVal = m_pIO->Read(&nReadID, 4, &nBytesRead);
-    if (nRetVal != 0 || nBytesRead != 4) return ERROR_UNDEFINED;
 
-    nBytesRead = 1;
-    int nScanBytes = 0;
-    while ((nGoalID != nReadID) && (nBytesRead == 1) && (nScanBytes < (1024 * 1024)))
+    // scan until we hit the APE_DESCRIPTOR, the end of the file, or 1 MB later (a window at a time,
+    // overlapping by the three bytes an ID could straddle); the start of the file is scanned where
+    // it is, and only what's past it is read into a buffer of our own
+    const long long nScanStart = nJunkBytes;
+    const long long nScanFinish = nScanStart + APE_DESCRIPTOR_SCAN_BYTES;
+    CSmartPtr<unsigned char> spScan;
+    nJunkBytes = -1;
+    long long nOffset = nScanStart;
+    while ((nJunkBytes == -1) && (nOffset <= nScanFinish))
     {
-        unsigned char cTemp;
-        m_pIO->Read(&cTemp, 1, &nBytesRead);
-        nReadID = (((unsigned int) cTemp) << 24) | (nReadID >> 8);
-        nJunkBytes++;
-        nScanBytes++;
-    }
+        unsigned int nWindowBytes = 0;
+        BOOL bLastWindow = FALSE;
+        const unsigned char * pWindow = GetHeadAt(nOffset, APE_HEADER_READ_BYTES, &nWindowBytes);
+        if ((pWindow != NULL) && ((nWindowBytes >= 4) || m_bHeadIsFile))
+        {
+            bLastWindow = m_bHeadIsFile && (nOffset + nWindowBytes >= m_nHeadBytes);
+        }
+        else
+        {
+            if (spScan == NULL)
+                spScan.Assign(new unsigned char [APE_HEADER_READ_BYTES], TRUE);
+            if (ReadAt(nOffset, spScan, APE_HEADER_READ_BYTES, &nWindowBytes) != ERROR_SUCCESS)
+                break;
+            pWindow = spScan;
+            bLastWindow = (nWindowBytes < APE_HEADER_READ_BYTES);
+        }
+        if (nWindowBytes < 4)
+            break;
+
+        const unsigned char * pScan = pWindow;
+        const unsigned char * pLast = &pWindow[min((long long) nWindowBytes - 4, nScanFinish - nOffset)];
+        while ((pScan <= pLast) && ((pScan = (const unsigned char *) memchr(pScan, 'M', pLast - pScan + 1)) != NULL))
+        {
+            if ((pScan[1] == 'A') && (pScan[2] == 'C') && (pScan[3] == ' '))
+            {
+                nJunkBytes = int(nOffset + (pScan - pWindow));
+                break;
+            }
+            pScan++;
+        }
 
-    if (nGoalID != nReadID)
-        nJunkBytes = -1;
+        if (bLastWindow)
+            break;
+        nOffset += nWindowBytes - 3;
+    }
 
     // seek to the proper place (depending on result and settings)
     if (bSeek && (nJunkBytes != -1))
@@ -126,7 +214,7 @@ int CAPEHeader::Analyze(APE_FILE_INFO * pInfo)
 
     // read the first 8 bytes of the descriptor (ID and version)
     APE_COMMON_HEADER CommonHeader; memset(&CommonHeader, 0, sizeof(APE_COMMON_HEADER));
-    m_pIO->Read(&CommonHeader, sizeof(APE_COMMON_HEADER), &nBytesRead);
+    ReadAt(pInfo->nJunkHeaderBytes, &CommonHeader, sizeof(APE_COMMON_HEADER), &nBytesRead);
 
     // make sure we're at the ID
     if (CommonHeader.cID[0] != 'M' || CommonHeader.cID[1] != 'A' || CommonHeader.cID[2] != 'C' || CommonHeader.cID[3] != ' ')
@@ -156,17 +244,13 @@ int CAPEHeader::AnalyzeCurrent(APE_FILE_INFO * pInfo)
     APE_HEADER APEHeader; memset(&APEHeader, 0, sizeof(APEHeader));
 
     // read the descriptor
-    m_pIO->Seek(pInfo->nJunkHeaderBytes, FILE_BEGIN);
-    m_pIO->Read(pInfo->spAPEDescriptor, sizeof(APE_DESCRIPTOR), &nBytesRead);
-
-    if ((pInfo->spAPEDescriptor->nDescriptorBytes - nBytesRead) > 0)
-        m_pIO->Seek(pInfo->spAPEDescriptor->nDescriptorBytes - nBytesRead, FILE_CURRENT);
+    long long nOffset = pInfo->nJunkHeaderBytes;
+    ReadAt(nOffset, pInfo->spAPEDescriptor, sizeof(APE_DESCRIPTOR), &nBytesRead);
+    nOffset += pInfo->spAPEDescriptor->nDescriptorBytes;
 
     // read the header
-    m_pIO->Read(&APEHeader, sizeof(APEHeader), &nBytesRead);
-
-    if ((pInfo->spAPEDescriptor->nHeaderBytes - nBytesRead) > 0)
-        m_pIO->Seek(pInfo->spAPEDescriptor->nHeaderBytes - nBytesRead, FILE_CURRENT);
+    ReadAt(nOffset, &APEHeader, sizeof(APEHeader), &nBytesRead);
+    nOffset += pInfo->spAPEDescriptor->nHeaderBytes;
 
     // fill the APE info structure
     pInfo->nVersion               = int(pInfo->spAPEDescriptor->nVersion);
@@ -195,14 +279,15 @@ int CAPEHeader::AnalyzeCurrent(APE_FILE_INFO * pInfo)
     pInfo->spSeekByteTable.Assign(new uint32 [pInfo->nSeekTableElements], TRUE);
     if (pInfo->spSeekByteTable == NULL) { return ERROR_UNDEFINED; }
 
-    m_pIO->Read((unsigned char *) pInfo->spSeekByteTable.GetPtr(), 4 * pInfo->nSeekTableElements, &nBytesRead);
+    ReadAt(nOffset, pInfo->spSeekByteTable.GetPtr(), 4 * pInfo->nSeekTableElements, &nBytesRead);
+    nOffset += pInfo->spAPEDescriptor->nSeekTableBytes;
 
     // get the wave header
     if (!(APEHeader.nFormatFlags & MAC_FORMAT_FLAG_CREATE_WAV_HEADER))
     {
         pInfo->spWaveHeaderData.Assign(new unsigned char [pInfo->nWAVHeaderBytes], TRUE);
         if (pInfo->spWaveHeaderData == NULL) { return ERROR_UNDEFINED; }
-        m_pIO->Read((unsigned char *) pInfo->spWaveHeaderData, pInfo->nWAVHeaderBytes, &nBytesRead);
+        ReadAt(nOffset, pInfo->spWaveHeaderData, pInfo->nWAVHeaderBytes, &nBytesRead);
     }
 
     return ERROR_SUCCESS;
@@ -215,8 +300,9 @@ int CAPEHeader::AnalyzeOld(APE_FILE_INFO * pInfo)
 
     // read the MAC header from the file
     APE_HEADER_OLD APEHeader;
-    m_pIO->Seek(pInfo->nJunkHeaderBytes, FILE_BEGIN);
-    m_pIO->Read((unsigned char *) &APEHeader, sizeof(APEHeader), &nBytesRead);
+    long long nOffset = pInfo->nJunkHeaderBytes;
+    ReadAt(nOffset, &APEHeader, sizeof(APEHeader), &nBytesRead);
+    nOffset += nBytesRead;
 
     // fail on 0 length APE files (catches non-finalized APE files)
     if (APEHeader.nTotalFrames == 0)
@@ -224,10 +310,16 @@ int CAPEHeader::AnalyzeOld(APE_FILE_INFO * pInfo)
 
     int nPeakLevel = -1;
     if (APEHeader.nFormatFlags & MAC_FORMAT_FLAG_HAS_PEAK_LEVEL)
-        m_pIO->Read((unsigned char *) &nPeakLevel, 4, &nBytesRead);
+    {
+        ReadAt(nOffset, &nPeakLevel, 4, &nBytesRead);
+        nOffset += nBytesRead;
+    }
 
     if (APEHeader.nFormatFlags & MAC_FORMAT_FLAG_HAS_SEEK_ELEMENTS)
-        m_pIO->Read((unsigned char *) &pInfo->nSeekTableElements, 4, &nBytesRead);
+    {
+        ReadAt(nOffset, &pInfo->nSeekTableElements, 4, &nBytesRead);
+        nOffset += nBytesRead;
+    }
     else
         pInfo->nSeekTableElements = APEHeader.nTotalFrames;
     
@@ -259,14 +351,16 @@ int CAPEHeader::AnalyzeOld(APE_FILE_INFO * pInfo)
     {
         pInfo->spWaveHeaderData.Assign(new unsigned char [APEHeader.nHeaderBytes], TRUE);
         if (pInfo->spWaveHeaderData == NULL) { return ERROR_UNDEFINED; }
-        m_pIO->Read((unsigned char *) pInfo->spWaveHeaderData, APEHeader.nHeaderBytes, &nBytesRead);
+        ReadAt(nOffset, pInfo->spWaveHeaderData, APEHeader.nHeaderBytes, &nBytesRead);
+        nOffset += nBytesRead;
     }
 
     // get the seek tables (really no reason to get the whole thing if there's extra)
     pInfo->spSeekByteTable.Assign(new uint32 [pInfo->nSeekTableElements], TRUE);
     if (pInfo->spSeekByteTable == NULL) { return ERROR_UNDEFINED; }
 
-    m_pIO->Read((unsigned char *) pInfo->spSeekByteTable.GetPtr(), 4 * pInfo->nSeekTableElements, &nBytesRead);
+    ReadAt(nOffset, pInfo->spSeekByteTable.GetPtr(), 4 * pInfo->nSeekTableElements, &nBytesRead);
+    nOffset += nBytesRead;
 
     // seek bit table (for older files)
     if (APEHeader.nVersion <= 3800) 
@@ -274,7 +368,7 @@ int CAPEHeader::AnalyzeOld(APE_FILE_INFO * pInfo)
         pInfo->spSeekBitTable.Assign(new unsigned char [pInfo->nSeekTableElements], TRUE);
         if (pInfo->spSeekBitTable == NULL) { return ERROR_UNDEFINED; }
 
-        m_pIO->Read((unsigned char *) pInfo->spSeekBitTable, pInfo->nSeekTableElements, &nBytesRead);
+        ReadAt(nOffset, pInfo->spSeekBitTable, pInfo->nSeekTableElements, &nBytesRead);
     }
 
     return ERROR_SUCCESS;
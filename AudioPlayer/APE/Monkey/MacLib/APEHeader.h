@@ -31,7 +31,6 @@ struct APE_HEADER_OLD
 
 struct APE_FILE_INFO;
 class CIO;
-class CStdLibFileIO;
     
 /*****************************************************************************************
 CAPEHeader - makes managing APE headers a little smoother (and the format change as of 3.98)
@@ -39,7 +38,7 @@ CAPEHeader - makes managing APE headers a little smoother (and the format change
 class CAPEHeader
 {
 public:    
-    CAPEHeader(CStdLibFileIO * pIO);
+    CAPEHeader(CIO * pIO);
     ~CAPEHeader();
 
     int Analyze(APE_FILE_INFO * pInfo);
@@ -49,8 +48,16 @@ protected:
     int AnalyzeOld(APE_FILE_INFO * pInfo);
 
     int FindDescriptor(BOOL bSeek);
+    const unsigned char * GetHeadAt(long long nOffset, unsigned int nBytes, unsigned int * pBytesAvailable);
+    int ReadAt(long long nOffset, void * pBuffer, unsigned int nBytes, unsigned int * pBytesRead);
 
-    CStdLibFileIO * m_pIO;
+    CIO * m_pIO;
+
+    // the start of the file, read once (or the whole file, if it's mapped)
+    const unsigned char * m_pHead;
+    long long m_nHeadBytes;
+    BOOL m_bHeadIsFile;
+    CSmartPtr<unsigned char> m_spHead;
 };
 
 }
@@ -5,6 +5,7 @@ CAPEInfo:
 #include "All.h"
 #include "APEInfo.h"
 #include "StdLibFileIO.h"
+#include "MappedFileIO.h"
 //#include "APECompress.h"
 #include "APEHeader.h"
 #include "CharacterHelper.h"
@@ -22,8 +23,8 @@ CAPEInfo::CAPEInfo(int * pErrorCode, const wchar_t * pFilename, CAPETag * pTag)
     *pErrorCode = ERROR_SUCCESS;
     CloseFile();
     
-    // open the file
-    m_spIO.Assign(new IO_CLASS_NAME);
+    // open the file (memory mapped when possible, since decoding can then read frames in place)
+    m_spIO.Assign(new CMappedFileIO);
 
     char *pAnsiFileName = CAPECharacterHelper::GetANSIFromUTF16(pFilename);
     if (m_spIO->Open(pAnsiFileName) != 0)
@@ -43,26 +44,19 @@ CAPEInfo::CAPEInfo(int * pErrorCode, const wchar_t * pFilename, CAPETag * pTag)
     }
 
     // get the tag (do this second so that we don't do it on failure)
+    // it's only read when something asks for it (a field, or its size to find the end of the last
+    // frame), so opening a file is just the header -- since a single I/O object is shared, the tag
+    // can't be read on another thread while this one decodes
     if (pTag == NULL)
-    {
-        // we don't want to analyze right away for non-local files
-        // since a single I/O object is shared, we can't tag and read at the same time (i.e. in multiple threads)
-        BOOL bAnalyzeNow = TRUE;
-        if ((_wcsnicmp(pFilename, L"http://", 7) == 0) || (_wcsnicmp(pFilename, L"m01p://", 7) == 0))
-            bAnalyzeNow = FALSE;
-
-        m_spAPETag.Assign(new CAPETag(m_spIO, bAnalyzeNow));
-    }
+        m_spAPETag.Assign(new CAPETag(m_spIO, FALSE));
     else
-    {
         m_spAPETag.Assign(pTag);
-    }
 
     // update
     CheckHeaderInformation();
 }
 
-CAPEInfo::CAPEInfo(int * pErrorCode, CStdLibFileIO * pIO, CAPETag * pTag)
+CAPEInfo::CAPEInfo(int * pErrorCode, CIO * pIO, CAPETag * pTag)
 {
     *pErrorCode = ERROR_SUCCESS;
     CloseFile();
@@ -79,7 +73,7 @@ CAPEInfo::CAPEInfo(int * pErrorCode, CStdLibFileIO * pIO, CAPETag * pTag)
 
     // get the tag (do this second so that we don't do it on failure)
     if (pTag == NULL)
-        m_spAPETag.Assign(new CAPETag(m_spIO, TRUE));
+        m_spAPETag.Assign(new CAPETag(m_spIO, FALSE));
     else
         m_spAPETag.Assign(pTag);
 
@@ -125,7 +119,7 @@ int CAPEInfo::CheckHeaderInformation()
     if ((m_APEFileInfo.spAPEDescriptor != NULL) &&
         (m_APEFileInfo.spAPEDescriptor->nTerminatingDataBytes > 0))
     {
-        int nFileBytes = int(m_spIO->GetSize());
+        long long nFileBytes = m_spIO->GetSize();
         if (nFileBytes > 0)
         {
             nFileBytes -= m_spAPETag->GetTagBytes();
@@ -65,7 +65,7 @@ Helper macros (sort of hacky)
 #define GET_USES_CRC(APE_INFO) (((APE_INFO)->GetInfo(APE_INFO_FORMAT_FLAGS) & MAC_FORMAT_FLAG_CRC) ? TRUE : FALSE)
 #define GET_FRAMES_START_ON_BYTES_BOUNDARIES(APE_INFO) (((APE_INFO)->GetInfo(APE_INFO_FILE_VERSION) > 3800) ? TRUE : FALSE)
 #define GET_USES_SPECIAL_FRAMES(APE_INFO) (((APE_INFO)->GetInfo(APE_INFO_FILE_VERSION) > 3820) ? TRUE : FALSE)
-#define GET_IO(APE_INFO) ((CStdLibFileIO *) (APE_INFO)->GetInfo(APE_INFO_IO_SOURCE))
+#define GET_IO(APE_INFO) ((CIO *) (APE_INFO)->GetInfo(APE_INFO_IO_SOURCE))
 #define GET_TAG(APE_INFO) ((CAPETag *) (APE_INFO)->GetInfo(APE_INFO_TAG))
 
 /*****************************************************************************************
@@ -77,7 +77,7 @@ public:
     
     // construction and destruction
     CAPEInfo(int * pErrorCode, const wchar_t * pFilename, CAPETag * pTag = NULL);
-    CAPEInfo(int * pErrorCode, APE_MONKEY::CStdLibFileIO * pIO, CAPETag * pTag = NULL);
+    CAPEInfo(int * pErrorCode, APE_MONKEY::CIO * pIO, CAPETag * pTag = NULL);
     virtual ~CAPEInfo();
 
     // query for information
@@ -91,7 +91,7 @@ private:
     
     // internal variables
     BOOL m_bHasFileInformationLoaded;
-    CSmartPtr<APE_MONKEY::CStdLibFileIO> m_spIO;
+    CSmartPtr<APE_MONKEY::CIO> m_spIO;
     CSmartPtr<CAPETag> m_spAPETag;
     APE_FILE_INFO m_APEFileInfo;
 };
@@ -0,0 +1,504 @@
+#include "All.h"
+#include <dirent.h>
+#include "APELibraryIndex.h"
+#include "APEInfo.h"
+#include "APELink.h"
+#include "APETag.h"
+#include "MappedFileIO.h"
+#include "MemoryIO.h"
+#include "CharacterHelper.h"
+
+namespace APE_MONKEY
+{
+
+#define MAX_LIBRARY_THREADS     64
+
+// a file found while walking the directory (they're sorted by path before anything is read)
+struct LIBRARY_FOUND_FILE
+{
+    long long nPathOffset;
+    const char * pPath;
+    long long nModifiedTime;
+    long long nFileBytes;
+};
+
+static int CompareFoundFiles(const void * pA, const void * pB)
+{
+    return strcmp(((const LIBRARY_FOUND_FILE *) pA)->pPath, ((const LIBRARY_FOUND_FILE *) pB)->pPath);
+}
+
+static BOOL HasExtension(const char * pPath, const char * pExtension)
+{
+    size_t nLength = strlen(pPath);
+    return ((nLength > 4) && (strcasecmp(&pPath[nLength - 4], pExtension) == 0)) ? TRUE : FALSE;
+}
+
+CAPELibraryIndex::CAPELibraryIndex()
+{
+    pthread_mutex_init(&m_Mutex, NULL);
+    m_pImage = NULL;
+    m_nImageBytes = 0;
+    m_pEntries = NULL;
+    m_nEntries = 0;
+    m_pStrings = NULL;
+    m_nStringBytes = 0;
+    m_pScanFiles = NULL;
+    m_nScanFiles = 0;
+    m_nNextScanFile = 0;
+    m_nFilesRead = 0;
+    m_nFilesReused = 0;
+    m_nFilesFailed = 0;
+
+    // start out empty (so there's always an index to save)
+    BuildImage(NULL, 0);
+}
+
+CAPELibraryIndex::~CAPELibraryIndex()
+{
+    pthread_mutex_destroy(&m_Mutex);
+}
+
+/*****************************************************************************************
+Loading and saving
+*****************************************************************************************/
+int CAPELibraryIndex::Load(const char * pFilename)
+{
+    CSmartPtr<CIO> spIO(new CMappedFileIO);
+    if (spIO->Open(pFilename) != ERROR_SUCCESS)
+        return ERROR_INVALID_INPUT_FILE;
+
+    // (anything that can't be mapped is read into memory)
+    const unsigned char * pImage = spIO->GetMappedBuffer();
+    const long long nImageBytes = spIO->GetSize();
+    CSmartPtr<unsigned char> spImage;
+    if (pImage == NULL)
+    {
+        if ((nImageBytes < (long long) sizeof(APE_LIBRARY_HEADER)) || (nImageBytes > 0x7FFFFFFF))
+            return ERROR_INVALID_INPUT_FILE;
+
+        unsigned int nBytesRead = 0;
+        spImage.Assign(new unsigned char [(size_t) nImageBytes], TRUE);
+        if ((spIO->Read(spImage, (unsigned int) nImageBytes, &nBytesRead) != ERROR_SUCCESS) || (nBytesRead != (unsigned int) nImageBytes))
+            return ERROR_IO_READ;
+        pImage = spImage;
+    }
+
+    RETURN_ON_ERROR(SetImage(pImage, nImageBytes))
+
+    // the index now lives in whichever of these holds it
+    spIO.SetDelete(FALSE);
+    m_spIO.Assign(spIO.GetPtr());
+    spImage.SetDelete(FALSE);
+    m_spImage.Assign(spImage.GetPtr(), TRUE);
+    return ERROR_SUCCESS;
+}
+
+int CAPELibraryIndex::Save(const char * pFilename)
+{
+    CSmartPtr<char> spTemporary(new char [strlen(pFilename) + 5], TRUE);
+    sprintf(spTemporary, "%s.tmp", pFilename);
+
+    FILE * pFile = fopen(spTemporary, "wb");
+    if (pFile == NULL)
+        return ERROR_IO_WRITE;
+    BOOL bWritten = (fwrite(m_pImage, 1, (size_t) m_nImageBytes, pFile) == (size_t) m_nImageBytes) ? TRUE : FALSE;
+    if (fclose(pFile) != 0)
+        bWritten = FALSE;
+
+    if ((bWritten == FALSE) || (rename(spTemporary, pFilename) != 0))
+    {
+        remove(spTemporary);
+        return ERROR_IO_WRITE;
+    }
+    return ERROR_SUCCESS;
+}
+
+int CAPELibraryIndex::SetImage(const unsigned char * pImage, long long nImageBytes)
+{
+    APE_LIBRARY_HEADER Header;
+    if ((pImage == NULL) || (nImageBytes < (long long) sizeof(Header)))
+        return ERROR_INVALID_INPUT_FILE;
+    memcpy(&Header, pImage, sizeof(Header));
+
+    // the entries are only checked as they're used (so nothing is read that isn't looked at), but
+    // the strings have to end with a terminator so no string can run off the end
+    const long long nStringStart = (long long) sizeof(Header) + (long long) Header.nEntries * sizeof(APE_LIBRARY_ENTRY);
+    if ((memcmp(Header.cID, "APLX", 4) != 0) || (Header.nVersion != APE_LIBRARY_INDEX_VERSION) || (Header.nEntryBytes != sizeof(APE_LIBRARY_ENTRY)) ||
+        (Header.nEntries > 0x7FFFFFFF) || (nStringStart + Header.nStringBytes != nImageBytes) ||
+        ((Header.nStringBytes > 0) && (pImage[nImageBytes - 1] != 0)))
+    {
+        return ERROR_INVALID_INPUT_FILE;
+    }
+
+    m_pImage = pImage;
+    m_nImageBytes = nImageBytes;
+    m_pEntries = (const APE_LIBRARY_ENTRY *) &pImage[sizeof(Header)];
+    m_nEntries = (int) Header.nEntries;
+    m_pStrings = (const char *) &pImage[nStringStart];
+    m_nStringBytes = Header.nStringBytes;
+    return ERROR_SUCCESS;
+}
+
+/*****************************************************************************************
+Lookups
+*****************************************************************************************/
+const APE_LIBRARY_ENTRY * CAPELibraryIndex::GetEntry(int nIndex)
+{
+    return ((nIndex >= 0) && (nIndex < m_nEntries)) ? &m_pEntries[nIndex] : NULL;
+}
+
+const APE_LIBRARY_ENTRY * CAPELibraryIndex::Find(const char * pPath)
+{
+    int nLow = 0, nHigh = m_nEntries - 1;
+    while (nLow <= nHigh)
+    {
+        int nMiddle = nLow + (nHigh - nLow) / 2;
+        int nCompare = strcmp(GetPath(&m_pEntries[nMiddle]), pPath);
+        if (nCompare == 0)
+            return &m_pEntries[nMiddle];
+        else if (nCompare < 0)
+            nLow = nMiddle + 1;
+        else
+            nHigh = nMiddle - 1;
+    }
+    return NULL;
+}
+
+const char * CAPELibraryIndex::GetPath(const APE_LIBRARY_ENTRY * pEntry)
+{
+    return ((pEntry != NULL) && (pEntry->nPathOffset < m_nStringBytes)) ? &m_pStrings[pEntry->nPathOffset] : "";
+}
+
+const char * CAPELibraryIndex::GetTagField(const APE_LIBRARY_ENTRY * pEntry, int nIndex, const char ** ppName)
+{
+    return FindTagField(pEntry, nIndex, NULL, ppName);
+}
+
+const char * CAPELibraryIndex::GetTagField(const APE_LIBRARY_ENTRY * pEntry, const char * pName)
+{
+    return FindTagField(pEntry, -1, pName, NULL);
+}
+
+const char * CAPELibraryIndex::FindTagField(const APE_LIBRARY_ENTRY * pEntry, int nIndex, const char * pName, const char ** ppName)
+{
+    if ((pEntry == NULL) || ((long long) pEntry->nTagOffset + pEntry->nTagBytes > m_nStringBytes))
+        return NULL;
+
+    const char * pFieldName = &m_pStrings[pEntry->nTagOffset];
+    const char * pEnd = pFieldName + pEntry->nTagBytes;
+    for (int z = 0; pFieldName < pEnd; z++)
+    {
+        const char * pValue = pFieldName + strlen(pFieldName) + 1;
+        if (pValue >= pEnd)
+            break;
+        if ((z == nIndex) || ((pName != NULL) && (strcasecmp(pFieldName, pName) == 0)))
+        {
+            if (ppName != NULL)
+                *ppName = pFieldName;
+            return pValue;
+        }
+        pFieldName = pValue + strlen(pValue) + 1;
+    }
+    return NULL;
+}
+
+/*****************************************************************************************
+Scanning -- find the files, take the ones that haven't changed from the index, read the rest on
+the workers (and the calling thread), then lay the new index out
+*****************************************************************************************/
+int CAPELibraryIndex::Scan(const char * pPath, int nThreads)
+{
+    // the path as given, without a trailing slash (so a directory always gives the same paths)
+    size_t nPathLength = strlen(pPath);
+    while ((nPathLength > 1) && (pPath[nPathLength - 1] == '/'))
+        nPathLength--;
+    CSmartPtr<char> spPath(new char [nPathLength + 1], TRUE);
+    memcpy(spPath, pPath, nPathLength);
+    spPath[nPathLength] = 0;
+
+    struct stat Stat;
+    if (stat(spPath, &Stat) != 0)
+        return ERROR_INVALID_INPUT_FILE;
+
+    // find the files
+    CMemoryIO Paths, Found;
+    AddPath(spPath, TRUE, &Paths, &Found);
+    const int nFiles = (int) (Found.GetSize() / sizeof(LIBRARY_FOUND_FILE));
+    CSmartPtr<LIBRARY_FOUND_FILE> spFound(new LIBRARY_FOUND_FILE [max(nFiles, 1)], TRUE);
+    if (nFiles > 0)
+        memcpy(spFound, Found.GetMappedBuffer(), nFiles * sizeof(LIBRARY_FOUND_FILE));
+    for (int z = 0; z < nFiles; z++)
+        spFound[z].pPath = (const char *) &Paths.GetMappedBuffer()[spFound[z].nPathOffset];
+    qsort(spFound, nFiles, sizeof(LIBRARY_FOUND_FILE), CompareFoundFiles);
+
+    // see which ones need reading
+    CSmartPtr<SCAN_FILE> spFiles(new SCAN_FILE [max(nFiles, 1)], TRUE);
+    int nFilesToRead = 0;
+    for (int z = 0; z < nFiles; z++)
+    {
+        SCAN_FILE * pFile = &spFiles[z];
+        pFile->pPath = spFound[z].pPath;
+        pFile->nModifiedTime = spFound[z].nModifiedTime;
+        pFile->nFileBytes = spFound[z].nFileBytes;
+        memset(&pFile->Entry, 0, sizeof(pFile->Entry));
+
+        // (an entry whose tag isn't inside the index is read again too)
+        const APE_LIBRARY_ENTRY * pPrevious = Find(pFile->pPath);
+        if ((pPrevious != NULL) && (pPrevious->nModifiedTime == pFile->nModifiedTime) && (pPrevious->nFileBytes == pFile->nFileBytes) &&
+            ((long long) pPrevious->nTagOffset + pPrevious->nTagBytes <= m_nStringBytes))
+        {
+            pFile->pPrevious = pPrevious;
+        }
+        else
+        {
+            pFile->pPrevious = NULL;
+        }
+        if (pFile->pPrevious == NULL)
+            nFilesToRead++;
+    }
+
+    // read them (no point in more threads than files)
+    m_pScanFiles = spFiles;
+    m_nScanFiles = nFiles;
+    m_nNextScanFile = 0;
+    if (nThreads <= 0)
+        nThreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    nThreads = max(1, min(min(nThreads, MAX_LIBRARY_THREADS), nFilesToRead));
+
+    pthread_t hThreads[MAX_LIBRARY_THREADS];
+    int nThreadsCreated = 0;
+    for (int z = 1; z < nThreads; z++)
+    {
+        if (pthread_create(&hThreads[nThreadsCreated], NULL, WorkerThread, this) == 0)
+            nThreadsCreated++;
+    }
+    WorkerLoop();
+    for (int z = 0; z < nThreadsCreated; z++)
+        pthread_join(hThreads[z], NULL);
+    m_pScanFiles = NULL;
+    m_nScanFiles = 0;
+
+    // lay out the new index (which replaces the one the unchanged files came from)
+    RETURN_ON_ERROR(BuildImage(spFiles, nFiles))
+    m_spIO.Delete();
+
+    m_nFilesRead = nFilesToRead;
+    m_nFilesReused = nFiles - nFilesToRead;
+    m_nFilesFailed = 0;
+    for (int z = 0; z < m_nEntries; z++)
+    {
+        if (m_pEntries[z].nResult != ERROR_SUCCESS)
+            m_nFilesFailed++;
+    }
+    return ERROR_SUCCESS;
+}
+
+void CAPELibraryIndex::AddPath(const char * pPath, BOOL bNamed, CIO * pPaths, CIO * pFiles)
+{
+    struct stat Stat;
+    if (stat(pPath, &Stat) != 0)
+        return;
+
+    if (S_ISDIR(Stat.st_mode))
+    {
+        // don't follow links to directories (they can go round in circles)
+        struct stat LinkStat;
+        if ((bNamed == FALSE) && (lstat(pPath, &LinkStat) == 0) && S_ISLNK(LinkStat.st_mode))
+            return;
+
+        DIR * pDirectory = opendir(pPath);
+        if (pDirectory == NULL)
+            return;
+        const size_t nPathLength = strlen(pPath);
+        struct dirent * pEntry;
+        while ((pEntry = readdir(pDirectory)) != NULL)
+        {
+            if ((strcmp(pEntry->d_name, ".") == 0) || (strcmp(pEntry->d_name, "..") == 0))
+                continue;
+            CSmartPtr<char> spChild(new char [nPathLength + strlen(pEntry->d_name) + 2], TRUE);
+            sprintf(spChild, ((nPathLength > 0) && (pPath[nPathLength - 1] == '/')) ? "%s%s" : "%s/%s", pPath, pEntry->d_name);
+            AddPath(spChild, FALSE, pPaths, pFiles);
+        }
+        closedir(pDirectory);
+    }
+    else if (S_ISREG(Stat.st_mode) && (bNamed || HasExtension(pPath, ".ape") || HasExtension(pPath, ".apl")))
+    {
+        LIBRARY_FOUND_FILE File;
+        memset(&File, 0, sizeof(File));
+        File.nPathOffset = pPaths->GetSize();
+        File.nModifiedTime = (long long) Stat.st_mtime;
+        File.nFileBytes = (long long) Stat.st_size;
+
+        unsigned int nBytesWritten = 0;
+        pPaths->Write(pPath, (unsigned int) strlen(pPath) + 1, &nBytesWritten);
+        pFiles->Write(&File, sizeof(File), &nBytesWritten);
+    }
+}
+
+void * CAPELibraryIndex::WorkerThread(void * pParam)
+{
+    ((CAPELibraryIndex *) pParam)->WorkerLoop();
+    return NULL;
+}
+
+void CAPELibraryIndex::WorkerLoop()
+{
+    while (TRUE)
+    {
+        pthread_mutex_lock(&m_Mutex);
+        int nFile = m_nNextScanFile++;
+        pthread_mutex_unlock(&m_Mutex);
+        if (nFile >= m_nScanFiles)
+            break;
+
+        if (m_pScanFiles[nFile].pPrevious == NULL)
+            ReadFile(&m_pScanFiles[nFile]);
+    }
+}
+
+void CAPELibraryIndex::ReadFile(SCAN_FILE * pFile)
+{
+    APE_LIBRARY_ENTRY * pEntry = &pFile->Entry;
+    CSmartPtr<str_utf16> spFilename(CAPECharacterHelper::GetUTF16FromUTF8((const str_utf8 *) pFile->pPath), TRUE);
+
+    try
+    {
+        // open it (a link file is the image's header, with the link's tag and range)
+        int nErrorCode = ERROR_SUCCESS;
+        CSmartPtr<CAPEInfo> spInfo;
+        int nStartBlock = -1, nFinishBlock = -1;
+        if (HasExtension(pFile->pPath, ".apl"))
+        {
+            CAPELink Link(spFilename);
+            if (Link.GetIsLinkFile() == FALSE)
+            {
+                pEntry->nResult = ERROR_INVALID_INPUT_FILE;
+                return;
+            }
+            spInfo.Assign(new CAPEInfo(&nErrorCode, Link.GetImageFilename(), new CAPETag(spFilename, FALSE)));
+            nStartBlock = Link.GetStartBlock();
+            nFinishBlock = Link.GetFinishBlock();
+        }
+        else
+        {
+            spInfo.Assign(new CAPEInfo(&nErrorCode, spFilename));
+        }
+        if (nErrorCode != ERROR_SUCCESS)
+        {
+            pEntry->nResult = nErrorCode;
+            return;
+        }
+
+        // the format (the range of a link is clipped to the image, as CAPEDecompress does)
+        long long nTotalBlocks = (long long) spInfo->GetInfo(APE_INFO_TOTAL_BLOCKS);
+        if (nStartBlock >= 0)
+            nTotalBlocks = max(min((long long) nFinishBlock, nTotalBlocks) - nStartBlock, 0LL);
+        const int nSampleRate = (int) spInfo->GetInfo(APE_INFO_SAMPLE_RATE);
+        pEntry->nTotalBlocks = nTotalBlocks;
+        pEntry->nLengthMS = (nSampleRate > 0) ? int(nTotalBlocks * 1000 / nSampleRate) : 0;
+        pEntry->nSampleRate = nSampleRate;
+        pEntry->nAverageBitrate = (int) spInfo->GetInfo(APE_INFO_AVERAGE_BITRATE);
+        pEntry->nChannels = (uint16) spInfo->GetInfo(APE_INFO_CHANNELS);
+        pEntry->nBitsPerSample = (uint16) spInfo->GetInfo(APE_INFO_BITS_PER_SAMPLE);
+        pEntry->nCompressionLevel = (uint16) spInfo->GetInfo(APE_INFO_COMPRESSION_LEVEL);
+        pEntry->nVersion = (uint16) spInfo->GetInfo(APE_INFO_FILE_VERSION);
+
+        // the tag's text fields (a value that's a list is cut at the first item)
+        CAPETag * pTag = GET_TAG(spInfo);
+        CMemoryIO Fields;
+        CAPETagField * pField = NULL;
+        for (int z = 0; (pField = pTag->GetTagField(z)) != NULL; z++)
+        {
+            if (pField->GetIsUTF8Text() == FALSE)
+                continue;
+
+            unsigned int nBytesWritten = 0;
+            const char * pName = pField->GetFieldNameANSI();
+            Fields.Write(pName, (unsigned int) strlen(pName) + 1, &nBytesWritten);
+            const char * pValue = pField->GetFieldValue();
+            unsigned int nValueBytes = 0;
+            while ((nValueBytes < (unsigned int) pField->GetFieldValueSize()) && (pValue[nValueBytes] != 0))
+                nValueBytes++;
+            Fields.Write(pValue, nValueBytes, &nBytesWritten);
+            Fields.Write("", 1, &nBytesWritten);
+            pEntry->nTagFields++;
+        }
+        pEntry->nTagBytes = (uint32) Fields.GetSize();
+        if (pEntry->nTagBytes > 0)
+        {
+            pFile->spTag.Assign(new unsigned char [pEntry->nTagBytes], TRUE);
+            memcpy(pFile->spTag, Fields.GetMappedBuffer(), pEntry->nTagBytes);
+        }
+
+        pEntry->nResult = ERROR_SUCCESS;
+    }
+    catch(...)
+    {
+        memset(pEntry, 0, sizeof(APE_LIBRARY_ENTRY));
+        pFile->spTag.Delete();
+        pEntry->nResult = ERROR_UNDEFINED;
+    }
+}
+
+int CAPELibraryIndex::BuildImage(SCAN_FILE * pFiles, int nFiles)
+{
+    // size it up (a file that was taken from the index brings its tag along)
+    long long nStringBytes = 0;
+    for (int z = 0; z < nFiles; z++)
+    {
+        nStringBytes += strlen(pFiles[z].pPath) + 1;
+        nStringBytes += (pFiles[z].pPrevious != NULL) ? pFiles[z].pPrevious->nTagBytes : pFiles[z].Entry.nTagBytes;
+    }
+    if (nStringBytes > 0xFFFFFFFFLL)
+        return ERROR_INSUFFICIENT_MEMORY;
+
+    const long long nImageBytes = (long long) sizeof(APE_LIBRARY_HEADER) + (long long) nFiles * sizeof(APE_LIBRARY_ENTRY) + nStringBytes;
+    CSmartPtr<unsigned char> spImage(new unsigned char [(size_t) nImageBytes], TRUE);
+    APE_LIBRARY_HEADER Header;
+    memset(&Header, 0, sizeof(Header));
+    memcpy(Header.cID, "APLX", 4);
+    Header.nVersion = APE_LIBRARY_INDEX_VERSION;
+    Header.nEntryBytes = sizeof(APE_LIBRARY_ENTRY);
+    Header.nEntries = (uint32) nFiles;
+    Header.nStringBytes = (uint32) nStringBytes;
+    memcpy(spImage, &Header, sizeof(Header));
+
+    APE_LIBRARY_ENTRY * pEntries = (APE_LIBRARY_ENTRY *) &spImage[sizeof(Header)];
+    char * pStrings = (char *) &pEntries[nFiles];
+    uint32 nStringOffset = 0;
+    for (int z = 0; z < nFiles; z++)
+    {
+        const SCAN_FILE * pFile = &pFiles[z];
+        APE_LIBRARY_ENTRY * pEntry = &pEntries[z];
+        const unsigned char * pTag = pFile->spTag;
+        if (pFile->pPrevious != NULL)
+        {
+            *pEntry = *pFile->pPrevious;
+            pTag = (const unsigned char *) &m_pStrings[pFile->pPrevious->nTagOffset];
+        }
+        else
+        {
+            *pEntry = pFile->Entry;
+        }
+        pEntry->nModifiedTime = pFile->nModifiedTime;
+        pEntry->nFileBytes = pFile->nFileBytes;
+
+        const uint32 nPathBytes = (uint32) strlen(pFile->pPath) + 1;
+        pEntry->nPathOffset = nStringOffset;
+        memcpy(&pStrings[nStringOffset], pFile->pPath, nPathBytes);
+        nStringOffset += nPathBytes;
+
+        pEntry->nTagOffset = nStringOffset;
+        if (pEntry->nTagBytes > 0)
+            memcpy(&pStrings[nStringOffset], pTag, pEntry->nTagBytes);
+        nStringOffset += pEntry->nTagBytes;
+    }
+
+    // switch over
+    RETURN_ON_ERROR(SetImage(spImage, nImageBytes))
+    spImage.SetDelete(FALSE);
+    m_spImage.Assign(spImage.GetPtr(), TRUE);
+    return ERROR_SUCCESS;
+}
+
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <pthread.h>
+#include "MACLib.h"
+
+namespace APE_MONKEY
+{
+
+class CIO;
+
+#define APE_LIBRARY_INDEX_VERSION       1
+
+/*************************************************************************************************
+Library index file -- an APE_LIBRARY_HEADER, the entries (sorted by path), then the strings: each
+path, and each file's tag as name / value pairs, all NUL-terminated UTF-8
+*************************************************************************************************/
+struct APE_LIBRARY_HEADER
+{
+    char cID[4];                            // should equal 'APLX'
+    uint32 nVersion;                        // APE_LIBRARY_INDEX_VERSION
+    uint32 nEntryBytes;                     // sizeof(APE_LIBRARY_ENTRY)
+    uint32 nEntries;                        // the number of files
+    uint32 nStringBytes;                    // the bytes of strings after the entries
+    uint32 nReserved;
+};
+
+struct APE_LIBRARY_ENTRY
+{
+    long long nModifiedTime;                // when the file was last modified (seconds since 1970)...
+    long long nFileBytes;                   // ...and its size (a rescan reads it again if either changes)
+    long long nTotalBlocks;                 // the blocks of audio (just the linked range for an .apl)
+    uint32 nPathOffset;                     // the path (an offset into the strings)
+    uint32 nTagOffset;                      // the tag's text fields (an offset into the strings)
+    uint32 nTagBytes;                       // the bytes of them
+    uint32 nTagFields;                      // the number of them
+    int32 nResult;                          // ERROR_SUCCESS, or why the file couldn't be read (and nothing below is set)
+    int32 nLengthMS;                        // the length in ms
+    int32 nSampleRate;                      // audio samples per second
+    int32 nAverageBitrate;                  // kbps
+    uint16 nChannels;                       // audio channels
+    uint16 nBitsPerSample;                  // audio bits per sample
+    uint16 nCompressionLevel;               // the compression level
+    uint16 nVersion;                        // file version number * 1000 (3.99 = 3990)
+};
+
+/*************************************************************************************************
+CAPELibraryIndex - the format, length and tag of every .ape / .apl file under a directory, so a
+player can list a library without opening the files
+
+Scan(...) finds the files and reads each one's header and tag (a CAPEInfo per file) on a pool of
+threads.  Files whose size and modification time match the index as it was are taken from it, so
+rescanning a library that hasn't changed only stats the files.  The index is saved as one flat
+file that Load(...) maps, so a lookup only touches the pages it needs.
+*************************************************************************************************/
+class CAPELibraryIndex
+{
+public:
+    CAPELibraryIndex();
+    ~CAPELibraryIndex();
+
+    // reads an index written by Save(...) (the index is left alone if the file isn't one)
+    int Load(const char * pFilename);
+
+    // scans a directory (recursively) or a single file, and leaves the index with just the files
+    // found (paths are stored as found, starting with pPath)
+    int Scan(const char * pPath, int nThreads = 0);
+
+    // writes the index (to a temporary file renamed over pFilename, so a reader never sees half of one)
+    int Save(const char * pFilename);
+
+    // the entries, by index (sorted by path) or by path
+    int GetEntries() { return m_nEntries; }
+    const APE_LIBRARY_ENTRY * GetEntry(int nIndex);
+    const APE_LIBRARY_ENTRY * Find(const char * pPath);
+    const char * GetPath(const APE_LIBRARY_ENTRY * pEntry);
+
+    // an entry's tag fields, by index or by name (names are the tag's, e.g. "Title", compared
+    // without case); NULL if there's no such field
+    const char * GetTagField(const APE_LIBRARY_ENTRY * pEntry, int nIndex, const char ** ppName = NULL);
+    const char * GetTagField(const APE_LIBRARY_ENTRY * pEntry, const char * pName);
+
+    // the size of the index (as Save(...) writes it), and what the last Scan(...) did
+    long long GetIndexBytes() { return m_nImageBytes; }
+    int GetFilesRead() { return m_nFilesRead; }
+    int GetFilesReused() { return m_nFilesReused; }
+    int GetFilesFailed() { return m_nFilesFailed; }
+
+protected:
+    // a file found by Scan(...)
+    struct SCAN_FILE
+    {
+        const char * pPath;
+        long long nModifiedTime;
+        long long nFileBytes;
+        const APE_LIBRARY_ENTRY * pPrevious;    // the same file, unchanged, in the index as it was
+        APE_LIBRARY_ENTRY Entry;                // otherwise what the file was read into...
+        CSmartPtr<unsigned char> spTag;         // ...with its tag fields
+    };
+
+    const char * FindTagField(const APE_LIBRARY_ENTRY * pEntry, int nIndex, const char * pName, const char ** ppName);
+    static void AddPath(const char * pPath, BOOL bNamed, CIO * pPaths, CIO * pFiles);
+    static void * WorkerThread(void * pParam);
+    void WorkerLoop();
+    static void ReadFile(SCAN_FILE * pFile);
+    int BuildImage(SCAN_FILE * pFiles, int nFiles);
+    int SetImage(const unsigned char * pImage, long long nImageBytes);
+
+    // the index (mapped by Load(...), or built by Scan(...))
+    CSmartPtr<CIO> m_spIO;
+    CSmartPtr<unsigned char> m_spImage;
+    const unsigned char * m_pImage;
+    long long m_nImageBytes;
+    const APE_LIBRARY_ENTRY * m_pEntries;
+    int m_nEntries;
+    const char * m_pStrings;
+    uint32 m_nStringBytes;
+
+    // the files being scanned (the next one to read is guarded by m_Mutex)
+    SCAN_FILE * m_pScanFiles;
+    int m_nScanFiles;
+    int m_nNextScanFile;
+    pthread_mutex_t m_Mutex;
+
+    // scan results
+    int m_nFilesRead;
+    int m_nFilesReused;
+    int m_nFilesFailed;
+};
+
+}
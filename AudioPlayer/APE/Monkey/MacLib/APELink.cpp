@@ -11,6 +11,14 @@ namespace APE_MONKEY
 #define APE_LINK_START_BLOCK_TAG        "Start Block="
 #define APE_LINK_FINISH_BLOCK_TAG       "Finish Block="
 
+// the last '\\' or '/' in a path, or NULL if there isn't one
+static str_utf16 * GetLastSeparator(const str_utf16 * pPath)
+{
+    const str_utf16 * pBackslash = wcsrchr(pPath, '\\');
+    const str_utf16 * pSlash = wcsrchr(pPath, '/');
+    return (str_utf16 *) ((pBackslash > pSlash) ? pBackslash : pSlash);
+}
+
 CAPELink::CAPELink(const str_utf16 * pFilename)
 {
     // empty
@@ -83,12 +91,12 @@ void CAPELink::ParseData(const char * pData, const str_utf16 * pFilename)
 
                 CSmartPtr<str_utf16> spImageFileUTF16(CAPECharacterHelper::GetUTF16FromUTF8((unsigned char *) cImageFile), TRUE);
 
-                // process the path
-                if ((wcsrchr(spImageFileUTF16, '\\') == NULL) && (wcsrchr(pFilename, '\\') != NULL))
+                // process the path (an image named without a directory is next to the link)
+                if ((GetLastSeparator(spImageFileUTF16) == NULL) && (GetLastSeparator(pFilename) != NULL))
                 {
                     str_utf16 cImagePath[MAX_PATH + 1];
                     wcscpy(cImagePath, pFilename);
-                    wcscpy(wcsrchr(cImagePath, '\\') + 1, spImageFileUTF16);
+                    wcscpy(GetLastSeparator(cImagePath) + 1, spImageFileUTF16);
                     wcscpy(m_cImageFilename, cImagePath);
                 }
                 else
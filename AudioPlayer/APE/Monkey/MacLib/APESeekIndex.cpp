@@ -0,0 +1,179 @@
+#include "All.h"
+#include "APESeekIndex.h"
+#include "IO.h"
+
+namespace APE_MONKEY
+{
+
+#define APE_SEEK_INDEX_VERSION      2
+
+struct APE_SEEK_INDEX_HEADER
+{
+    char cID[4];                        // "APSI"
+    uint32 nVersion;                    // APE_SEEK_INDEX_VERSION
+    unsigned long long nFileID;         // identifies the APE file the index belongs to
+    uint32 nTotalFrames;
+    uint32 nBlocksPerFrame;
+    uint32 nCheckpointBlocks;
+    uint32 nStateBytes;
+    uint32 nCheckpoints;                // followed by this many (frame, slot, state) records
+    uint32 nReserved;
+};
+
+CAPESeekIndex::CAPESeekIndex(int nTotalFrames, int nBlocksPerFrame, int nCheckpointBlocks, int nStateBytes)
+{
+    m_nTotalFrames = max(nTotalFrames, 0);
+    m_nBlocksPerFrame = max(nBlocksPerFrame, 1);
+    m_nCheckpointBlocks = max(nCheckpointBlocks, 1);
+    m_nStateBytes = nStateBytes;
+    m_nCheckpoints = 0;
+
+    // checkpoints sit at nCheckpointBlocks, 2 * nCheckpointBlocks, ... (the start of a frame needs none)
+    m_nCheckpointsPerFrame = (m_nBlocksPerFrame - 1) / m_nCheckpointBlocks;
+
+    m_spFrameStates.Assign(new unsigned char * [m_nTotalFrames + 1], TRUE);
+    memset(m_spFrameStates.GetPtr(), 0, (m_nTotalFrames + 1) * sizeof(unsigned char *));
+    m_spValid.Assign(new unsigned char [m_nTotalFrames * m_nCheckpointsPerFrame + 1], TRUE);
+    memset(m_spValid.GetPtr(), 0, m_nTotalFrames * m_nCheckpointsPerFrame + 1);
+}
+
+CAPESeekIndex::~CAPESeekIndex()
+{
+    for (int z = 0; z < m_nTotalFrames; z++)
+        SAFE_ARRAY_DELETE(m_spFrameStates[z])
+}
+
+int CAPESeekIndex::GetSlot(int nFrame, int nFrameOffsetBlocks) const
+{
+    if ((nFrame < 0) || (nFrame >= m_nTotalFrames) || (nFrameOffsetBlocks <= 0) || ((nFrameOffsetBlocks % m_nCheckpointBlocks) != 0))
+        return -1;
+
+    int nSlot = (nFrameOffsetBlocks / m_nCheckpointBlocks) - 1;
+    return (nSlot < m_nCheckpointsPerFrame) ? nSlot : -1;
+}
+
+const unsigned char * CAPESeekIndex::Find(int nFrame, int nFrameOffsetBlocks, int * pCheckpointBlocks) const
+{
+    if ((nFrame < 0) || (nFrame >= m_nTotalFrames) || (m_spFrameStates[nFrame] == NULL))
+        return NULL;
+
+    // walk back from the closest checkpoint position to one that's been recorded
+    int nSlot = min(nFrameOffsetBlocks / m_nCheckpointBlocks, m_nCheckpointsPerFrame) - 1;
+    for (; nSlot >= 0; nSlot--)
+    {
+        if (m_spValid[nFrame * m_nCheckpointsPerFrame + nSlot])
+        {
+            if (pCheckpointBlocks) *pCheckpointBlocks = (nSlot + 1) * m_nCheckpointBlocks;
+            return &m_spFrameStates[nFrame][nSlot * m_nStateBytes];
+        }
+    }
+
+    return NULL;
+}
+
+unsigned char * CAPESeekIndex::Add(int nFrame, int nFrameOffsetBlocks)
+{
+    int nSlot = GetSlot(nFrame, nFrameOffsetBlocks);
+    if ((nSlot < 0) || m_spValid[nFrame * m_nCheckpointsPerFrame + nSlot])
+        return NULL;
+
+    if (m_spFrameStates[nFrame] == NULL)
+    {
+        m_spFrameStates[nFrame] = new unsigned char [m_nCheckpointsPerFrame * m_nStateBytes];
+        if (m_spFrameStates[nFrame] == NULL)
+            return NULL;
+    }
+
+    m_spValid[nFrame * m_nCheckpointsPerFrame + nSlot] = 1;
+    m_nCheckpoints++;
+    return &m_spFrameStates[nFrame][nSlot * m_nStateBytes];
+}
+
+void CAPESeekIndex::Remove(int nFrame, int nFrameOffsetBlocks)
+{
+    int nSlot = GetSlot(nFrame, nFrameOffsetBlocks);
+    if ((nSlot >= 0) && m_spValid[nFrame * m_nCheckpointsPerFrame + nSlot])
+    {
+        m_spValid[nFrame * m_nCheckpointsPerFrame + nSlot] = 0;
+        m_nCheckpoints--;
+    }
+}
+
+int CAPESeekIndex::Save(CIO * pIO, unsigned long long nFileID)
+{
+    APE_SEEK_INDEX_HEADER Header;
+    memset(&Header, 0, sizeof(Header));
+    memcpy(Header.cID, "APSI", 4);
+    Header.nVersion = APE_SEEK_INDEX_VERSION;
+    Header.nFileID = nFileID;
+    Header.nTotalFrames = m_nTotalFrames;
+    Header.nBlocksPerFrame = m_nBlocksPerFrame;
+    Header.nCheckpointBlocks = m_nCheckpointBlocks;
+    Header.nStateBytes = m_nStateBytes;
+    Header.nCheckpoints = m_nCheckpoints;
+
+    unsigned int nBytesWritten = 0;
+    if ((pIO->Write(&Header, sizeof(Header), &nBytesWritten) != 0) || (nBytesWritten != sizeof(Header)))
+        return ERROR_IO_WRITE;
+
+    for (int nFrame = 0; nFrame < m_nTotalFrames; nFrame++)
+    {
+        for (int nSlot = 0; nSlot < m_nCheckpointsPerFrame; nSlot++)
+        {
+            if (m_spValid[nFrame * m_nCheckpointsPerFrame + nSlot] == 0)
+                continue;
+
+            uint32 aryPosition[2] = { uint32(nFrame), uint32(nSlot) };
+            if ((pIO->Write(aryPosition, sizeof(aryPosition), &nBytesWritten) != 0) || (nBytesWritten != sizeof(aryPosition)))
+                return ERROR_IO_WRITE;
+            if ((pIO->Write(&m_spFrameStates[nFrame][nSlot * m_nStateBytes], m_nStateBytes, &nBytesWritten) != 0) || (nBytesWritten != (unsigned int) m_nStateBytes))
+                return ERROR_IO_WRITE;
+        }
+    }
+
+    return ERROR_SUCCESS;
+}
+
+int CAPESeekIndex::Load(CIO * pIO, unsigned long long nFileID)
+{
+    APE_SEEK_INDEX_HEADER Header;
+    unsigned int nBytesRead = 0;
+    if ((pIO->Read(&Header, sizeof(Header), &nBytesRead) != 0) || (nBytesRead != sizeof(Header)))
+        return ERROR_IO_READ;
+
+    // the index has to be for this file and this decoder
+    if ((memcmp(Header.cID, "APSI", 4) != 0) || (Header.nVersion != APE_SEEK_INDEX_VERSION) || (Header.nFileID != nFileID) ||
+        (Header.nTotalFrames != uint32(m_nTotalFrames)) || (Header.nBlocksPerFrame != uint32(m_nBlocksPerFrame)) ||
+        (Header.nCheckpointBlocks != uint32(m_nCheckpointBlocks)) || (Header.nStateBytes != uint32(m_nStateBytes)))
+    {
+        return ERROR_INVALID_INPUT_FILE;
+    }
+
+    for (uint32 z = 0; z < Header.nCheckpoints; z++)
+    {
+        uint32 aryPosition[2];
+        if ((pIO->Read(aryPosition, sizeof(aryPosition), &nBytesRead) != 0) || (nBytesRead != sizeof(aryPosition)))
+            return ERROR_IO_READ;
+
+        // a checkpoint we already have is read over
+        unsigned char * pState = Add(int(aryPosition[0]), int(aryPosition[1] + 1) * m_nCheckpointBlocks);
+        if (pState == NULL)
+        {
+            if ((aryPosition[0] >= uint32(m_nTotalFrames)) || (aryPosition[1] >= uint32(m_nCheckpointsPerFrame)))
+                return ERROR_INVALID_INPUT_FILE;
+            if (pIO->Seek(m_nStateBytes, FILE_CURRENT) != 0)
+                return ERROR_IO_READ;
+            continue;
+        }
+
+        if ((pIO->Read(pState, m_nStateBytes, &nBytesRead) != 0) || (nBytesRead != (unsigned int) m_nStateBytes))
+        {
+            Remove(int(aryPosition[0]), int(aryPosition[1] + 1) * m_nCheckpointBlocks);
+            return ERROR_IO_READ;
+        }
+    }
+
+    return ERROR_SUCCESS;
+}
+
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+namespace APE_MONKEY
+{
+
+class CIO;
+
+/*************************************************************************************************
+CAPESeekIndex - decoder state checkpoints inside frames
+
+Without an index a seek decodes from the start of the frame and throws away everything in front
+of the wanted block (up to a whole frame, 73728 blocks at Extra High).  The index keeps a snapshot
+of the decoder every nCheckpointBlocks blocks into each frame, so a seek restores the closest one
+and decodes less than nCheckpointBlocks.  CAPEDecompress records checkpoints as it decodes (or
+for the whole file in CreateSeekIndex(..., TRUE)), and the index can be saved next to the file.
+*************************************************************************************************/
+class CAPESeekIndex
+{
+public:
+    CAPESeekIndex(int nTotalFrames, int nBlocksPerFrame, int nCheckpointBlocks, int nStateBytes);
+    ~CAPESeekIndex();
+
+    // the closest checkpoint at or before nFrameOffsetBlocks (NULL if there isn't one)
+    const unsigned char * Find(int nFrame, int nFrameOffsetBlocks, int * pCheckpointBlocks) const;
+
+    // room for the checkpoint nFrameOffsetBlocks into a frame (NULL if that isn't a checkpoint
+    // position, the checkpoint is already there, or we're out of memory)
+    unsigned char * Add(int nFrame, int nFrameOffsetBlocks);
+    void Remove(int nFrame, int nFrameOffsetBlocks);
+
+    // sidecar file (nFileID ties the index to the file it was made for)
+    int Save(CIO * pIO, unsigned long long nFileID);
+    int Load(CIO * pIO, unsigned long long nFileID);
+
+    int GetCheckpointBlocks() const { return m_nCheckpointBlocks; }
+    int GetStateBytes() const { return m_nStateBytes; }
+    int GetCheckpoints() const { return m_nCheckpoints; }
+
+protected:
+    int GetSlot(int nFrame, int nFrameOffsetBlocks) const;
+
+    int m_nTotalFrames;
+    int m_nBlocksPerFrame;
+    int m_nCheckpointBlocks;
+    int m_nStateBytes;
+    int m_nCheckpointsPerFrame;
+    int m_nCheckpoints;
+
+    // one array of checkpoints per frame (allocated when the frame gets its first one)
+    CSmartPtr<unsigned char *> m_spFrameStates;
+    CSmartPtr<unsigned char> m_spValid;
+};
+
+}
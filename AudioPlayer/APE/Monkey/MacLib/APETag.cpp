@@ -16,6 +16,7 @@ CAPETagField::CAPETagField(const str_utf16 * pFieldName, const void * pFieldValu
     // field name
     m_spFieldNameUTF16.Assign(new str_utf16 [wcslen(pFieldName) + 1], TRUE);
     memcpy(m_spFieldNameUTF16, pFieldName, (wcslen(pFieldName) + 1) * sizeof(str_utf16));
+    m_spFieldNameANSI.Assign(CAPECharacterHelper::GetANSIFromUTF16(pFieldName), TRUE);
     
     // data (we'll always allocate two extra bytes and memset to 0 so we're safely NULL terminated)
     m_nFieldValueBytes = max(nFieldBytes, 0);
@@ -26,6 +27,25 @@ CAPETagField::CAPETagField(const str_utf16 * pFieldName, const void * pFieldValu
 
     // flags
     m_nFieldFlags = nFlags;
+
+    // not from a file
+    m_nFieldValueOffset = -1;
+    m_pIO = NULL;
+}
+
+CAPETagField::CAPETagField(const str_utf16 * pFieldName, const char * pFieldNameANSI, const char * pFieldValue, int nFieldBytes, int nFlags,
+    CIO * pIO, long long nFieldValueOffset)
+{
+    // the name and value are the tag's (and already NULL terminated)
+    m_spFieldNameUTF16.Assign((str_utf16 *) pFieldName, TRUE, FALSE);
+    m_spFieldNameANSI.Assign((char *) pFieldNameANSI, TRUE, FALSE);
+    m_spFieldValue.Assign((char *) pFieldValue, TRUE, FALSE);
+    m_nFieldValueBytes = max(nFieldBytes, 0);
+    m_nFieldFlags = nFlags;
+
+    // where the value is (and where to read it from, if it hasn't been)
+    m_nFieldValueOffset = nFieldValueOffset;
+    m_pIO = (pFieldValue == NULL) ? pIO : NULL;
 }
 
 CAPETagField::~CAPETagField()
@@ -34,8 +54,7 @@ CAPETagField::~CAPETagField()
     
 int CAPETagField::GetFieldSize()
 {
-    CSmartPtr<char> spFieldNameANSI(CAPECharacterHelper::GetANSIFromUTF16(m_spFieldNameUTF16), TRUE); 
-    return int(strlen(spFieldNameANSI)) + 1 + m_nFieldValueBytes + 4 + 4;
+    return int(strlen(m_spFieldNameANSI)) + 1 + m_nFieldValueBytes + 4 + 4;
 }
 
 const str_utf16 * CAPETagField::GetFieldName()
@@ -43,11 +62,37 @@ const str_utf16 * CAPETagField::GetFieldName()
     return m_spFieldNameUTF16;
 }
 
+const char * CAPETagField::GetFieldNameANSI()
+{
+    return m_spFieldNameANSI;
+}
+
 const char * CAPETagField::GetFieldValue()
 {
+    if (m_pIO != NULL)
+        LoadFieldValue();
+
     return m_spFieldValue;
 }
 
+void CAPETagField::LoadFieldValue()
+{
+    // read the value (terminated like any other; one that can't be read is left empty)
+    m_spFieldValue.Assign(new char [m_nFieldValueBytes + 2], TRUE);
+    memset(m_spFieldValue, 0, m_nFieldValueBytes + 2);
+
+    long long nOriginalPosition = m_pIO->GetPosition();
+    unsigned int nBytesRead = 0;
+    m_pIO->Seek(m_nFieldValueOffset, FILE_BEGIN);
+    if ((m_pIO->Read(m_spFieldValue, m_nFieldValueBytes, &nBytesRead) != ERROR_SUCCESS) || (nBytesRead != (unsigned int) m_nFieldValueBytes))
+    {
+        memset(m_spFieldValue, 0, m_nFieldValueBytes + 2);
+        m_nFieldValueBytes = 0;
+    }
+    m_pIO->Seek(nOriginalPosition, FILE_BEGIN);
+    m_pIO = NULL;
+}
+
 int CAPETagField::GetFieldValueSize()
 {
     return m_nFieldValueBytes;
@@ -60,21 +105,153 @@ int CAPETagField::GetFieldFlags()
 
 int CAPETagField::SaveField(char * pBuffer)
 {
+    const char * pFieldValue = GetFieldValue();
+
     *((int *) pBuffer) = m_nFieldValueBytes;
     pBuffer += 4;
     *((int *) pBuffer) = m_nFieldFlags;
     pBuffer += 4;
     
-    CSmartPtr<char> spFieldNameANSI((char *) CAPECharacterHelper::GetANSIFromUTF16(m_spFieldNameUTF16), TRUE); 
-    strcpy(pBuffer, spFieldNameANSI);
-    pBuffer += strlen(spFieldNameANSI) + 1;
+    strcpy(pBuffer, m_spFieldNameANSI);
+    pBuffer += strlen(m_spFieldNameANSI) + 1;
 
-    memcpy(pBuffer, m_spFieldValue, m_nFieldValueBytes);
+    memcpy(pBuffer, pFieldValue, m_nFieldValueBytes);
 
     return GetFieldSize();
 }
 
 
+/*****************************************************************************************
+Field names -- hashed and compared without case (just ASCII's, since the names in a tag are
+ASCII), as UTF-16 or as they're stored
+*****************************************************************************************/
+static inline unsigned int FoldFieldNameCharacter(unsigned int nCharacter)
+{
+    return ((nCharacter >= 'A') && (nCharacter <= 'Z')) ? (nCharacter + ('a' - 'A')) : nCharacter;
+}
+
+template <class CHARACTER> static unsigned int HashFieldName(const CHARACTER * pName)
+{
+    // FNV-1a
+    unsigned int nHash = 2166136261u;
+    for (int z = 0; pName[z] != 0; z++)
+        nHash = (nHash ^ FoldFieldNameCharacter((unsigned int) pName[z])) * 16777619u;
+    return nHash;
+}
+
+template <class CHARACTER> static BOOL GetFieldNamesMatch(const str_utf16 * pName, const CHARACTER * pOther)
+{
+    int z = 0;
+    for (; pName[z] != 0; z++)
+    {
+        if (FoldFieldNameCharacter((unsigned int) pName[z]) != FoldFieldNameCharacter((unsigned int) pOther[z]))
+            return FALSE;
+    }
+    return (pOther[z] == 0) ? TRUE : FALSE;
+}
+
+template <class CHARACTER> static int FindFieldHash(const short * paryHash, CAPETagField * const * paryFields, const CHARACTER * pName)
+{
+    for (int nSlot = HashFieldName(pName) & (APE_TAG_FIELD_HASH_SLOTS - 1); paryHash[nSlot] != -1; nSlot = (nSlot + 1) & (APE_TAG_FIELD_HASH_SLOTS - 1))
+    {
+        if (GetFieldNamesMatch(paryFields[paryHash[nSlot]]->GetFieldName(), pName))
+            return paryHash[nSlot];
+    }
+    return -1;
+}
+
+/*****************************************************************************************
+CAPETagWindow - reads the fields of a tag through a window (the whole tag, for most tags),
+so that a big binary value can be skipped without being read
+*****************************************************************************************/
+#define APE_TAG_WINDOW_BYTES            (64 * 1024)
+#define APE_TAG_FIELD_HEADER_BYTES      (8 + 255 + 1)   // size, flags and a name as long as the spec allows
+
+class CAPETagWindow
+{
+public:
+    CAPETagWindow(CIO * pIO, long long nFieldsOffset, int nFieldBytes)
+    {
+        m_pIO = pIO;
+        m_nFieldsOffset = nFieldsOffset;
+        m_nFieldBytes = nFieldBytes;
+        m_nWindowCapacity = min(nFieldBytes, APE_TAG_WINDOW_BYTES);
+        m_spWindow.Assign(new char [max(m_nWindowCapacity, 1)], TRUE);
+        m_nWindowLocation = 0;
+        m_nWindowBytes = 0;
+    }
+
+    // points to bytes of the fields (reading them if they aren't in the window), or NULL if they can't be read
+    const char * GetBytes(int nLocation, int nBytes)
+    {
+        if ((nLocation < 0) || (nBytes < 0) || (nBytes > m_nFieldBytes - nLocation))
+            return NULL;
+        if ((nLocation >= m_nWindowLocation) && (nLocation + nBytes <= m_nWindowLocation + m_nWindowBytes))
+            return &m_spWindow[nLocation - m_nWindowLocation];
+        if (nBytes > m_nWindowCapacity)
+            return NULL;
+
+        // move the window
+        unsigned int nBytesRead = 0;
+        int nWindowBytes = min(m_nWindowCapacity, m_nFieldBytes - nLocation);
+        m_nWindowBytes = 0;
+        m_pIO->Seek(m_nFieldsOffset + nLocation, FILE_BEGIN);
+        if ((m_pIO->Read(m_spWindow, nWindowBytes, &nBytesRead) != ERROR_SUCCESS) || (nBytesRead != (unsigned int) nWindowBytes))
+            return NULL;
+        m_nWindowLocation = nLocation;
+        m_nWindowBytes = nWindowBytes;
+        return m_spWindow;
+    }
+
+    // the most bytes GetBytes(...) can return from nLocation
+    int GetMaximumBytes(int nLocation)
+    {
+        return min(m_nWindowCapacity, m_nFieldBytes - nLocation);
+    }
+
+    // copies bytes of the fields (through the window if they fit in it, straight from the file if they don't)
+    BOOL CopyBytes(int nLocation, int nBytes, char * pBuffer)
+    {
+        if (nBytes <= m_nWindowCapacity)
+        {
+            const char * pBytes = GetBytes(nLocation, nBytes);
+            if (pBytes == NULL)
+                return FALSE;
+            memcpy(pBuffer, pBytes, nBytes);
+            return TRUE;
+        }
+
+        unsigned int nBytesRead = 0;
+        if ((nLocation < 0) || (nBytes > m_nFieldBytes - nLocation))
+            return FALSE;
+        m_pIO->Seek(m_nFieldsOffset + nLocation, FILE_BEGIN);
+        return ((m_pIO->Read(pBuffer, nBytes, &nBytesRead) == ERROR_SUCCESS) && (nBytesRead == (unsigned int) nBytes)) ? TRUE : FALSE;
+    }
+
+private:
+    CIO * m_pIO;
+    long long m_nFieldsOffset;
+    int m_nFieldBytes;
+    CSmartPtr<char> m_spWindow;
+    int m_nWindowCapacity;
+    int m_nWindowLocation;
+    int m_nWindowBytes;
+};
+
+// the length of a field's name (ASCII, terminated within nMaximumBytes), -1 if it isn't one, or
+// -2 if it's ASCII as far as nMaximumBytes
+static int GetFieldNameBytes(const char * pName, int nMaximumBytes)
+{
+    for (int z = 0; z < nMaximumBytes; z++)
+    {
+        if (pName[z] == 0)
+            return z;
+        if ((pName[z] < 0x20) || (pName[z] > 0x7E))
+            return -1;
+    }
+    return -2;
+}
+
 /*****************************************************************************************
 CAPETag
 *****************************************************************************************/
@@ -88,17 +265,20 @@ CAPETag::CAPETag(const str_utf16 * pFilename, BOOL bAnalyze)
     m_nFields = 0;
     m_nTagBytes = 0;
     m_bIgnoreReadOnly = FALSE;
+    m_bFieldHashValid = FALSE;
     
     if (bAnalyze)
         Analyze();
 }
 
-CAPETag::CAPETag(CStdLibFileIO * pIO, BOOL bAnalyze)
+CAPETag::CAPETag(CIO * pIO, BOOL bAnalyze)
 {
     m_spIO.Assign(pIO, FALSE, FALSE); // we don't own the IO source
     m_bAnalyzed = FALSE;
     m_nFields = 0;
     m_nTagBytes = 0;
+    m_bIgnoreReadOnly = FALSE;
+    m_bFieldHashValid = FALSE;
     
     if (bAnalyze)
     {
@@ -132,6 +312,10 @@ CAPETagField * CAPETag::GetTagField(int nIndex)
 
 int CAPETag::Save(BOOL bUseOldID3)
 {
+    // read any values that are still in the file before the tag is taken off it
+    for (int z = 0; z < m_nFields; z++)
+        m_aryFields[z]->GetFieldValue();
+
     if (Remove(FALSE) != ERROR_SUCCESS)
         return -1;
     
@@ -183,7 +367,7 @@ int CAPETag::Save(BOOL bUseOldID3)
 
 int CAPETag::WriteBufferToEndOfIO(void * pBuffer, int nBytes)
 {
-    int nOriginalPosition = (int)m_spIO->GetPosition();
+    long long nOriginalPosition = m_spIO->GetPosition();
     
     unsigned int nBytesWritten = 0;
     m_spIO->Seek(0, FILE_END);
@@ -205,7 +389,7 @@ int CAPETag::Analyze()
     m_bAnalyzed = TRUE;
 
     // store the original location
-    int nOriginalPosition = (int)m_spIO->GetPosition();
+    long long nOriginalPosition = m_spIO->GetPosition();
     
     // check for a tag
     unsigned int nBytesRead;
@@ -256,31 +440,11 @@ int CAPETag::Analyze()
                 m_bHasAPETag = TRUE;
                 m_nAPETagVersion = APETagFooter.GetVersion();
 
-                int nRawFieldBytes = APETagFooter.GetFieldBytes();
                 m_nTagBytes += APETagFooter.GetTotalTagBytes();
-                
-                CSmartPtr<char> spRawTag(new char [nRawFieldBytes], TRUE);
-                m_spIO->Seek(-(APETagFooter.GetTotalTagBytes() - APETagFooter.GetFieldsOffset()), FILE_END);
-                nRetVal = m_spIO->Read((unsigned char *) spRawTag.GetPtr(), nRawFieldBytes, &nBytesRead);
 
-                if ((nRetVal == 0) && (nRawFieldBytes == int(nBytesRead)))
-                {
-                    // parse out the raw fields
-                    int nLocation = 0;
-                    for (int z = 0; z < APETagFooter.GetNumberFields(); z++)
-                    {
-                        int nMaximumFieldBytes = nRawFieldBytes - nLocation;
-                        
-                        int nBytes = 0;
-                        if (LoadField(&spRawTag[nLocation], nMaximumFieldBytes, &nBytes) != ERROR_SUCCESS)
-                        {
-                            // if LoadField(...) fails, it means that the tag is corrupt (accidently or intentionally)
-                            // we'll just bail out -- leaving the fields we've already set
-                            break;
-                        }
-                        nLocation += nBytes;
-                    }
-                }
+                // if a field is corrupt (accidently or intentionally), we'll just stop there -- leaving the fields we've already set
+                LoadFields(m_spIO->GetSize() - (APETagFooter.GetTotalTagBytes() - APETagFooter.GetFieldsOffset()), APETagFooter.GetFieldBytes(),
+                    APETagFooter.GetNumberFields());
             }
         }
     }
@@ -291,6 +455,102 @@ int CAPETag::Analyze()
     return ERROR_SUCCESS;
 }
 
+int CAPETag::LoadFields(long long nFieldsOffset, int nFieldBytes, int nFields)
+{
+    if (nFieldsOffset < 0)
+        return ERROR_UNDEFINED;
+
+    // find each field's name and value (a field past what we can hold would be dropped anyway)
+    struct FIELD_LOCATION
+    {
+        int nLocation;
+        int nNameBytes;
+        int nValueBytes;
+        int nFlags;
+        BOOL bValueInline;
+    };
+    FIELD_LOCATION aryLocations[APE_TAG_MAX_FIELDS];
+    CAPETagWindow Window(m_spIO, nFieldsOffset, nFieldBytes);
+    int nLocations = 0;
+    int nNameCharacters = 0;
+    int nMemoryBytes = 0;
+    for (int nLocation = 0; (nLocations < nFields) && (nLocations < APE_TAG_MAX_FIELDS); nLocations++)
+    {
+        // size and flags
+        int nMaximumBytes = Window.GetMaximumBytes(nLocation);
+        int nHeaderBytes = min(nMaximumBytes, APE_TAG_FIELD_HEADER_BYTES);
+        const char * pBuffer = Window.GetBytes(nLocation, nHeaderBytes);
+        if ((pBuffer == NULL) || (nHeaderBytes < 8))
+            break;
+        FIELD_LOCATION * pField = &aryLocations[nLocations];
+        pField->nLocation = nLocation;
+        pField->nValueBytes = *((int *) &pBuffer[0]);
+        pField->nFlags = *((int *) &pBuffer[4]);
+
+        // the name must be ASCII, and terminated where the value still fits (so we can't get buffer overflow attacked)
+        if (pField->nValueBytes < 0)
+            break;
+        int nMaximumRead = nFieldBytes - nLocation - 8 - pField->nValueBytes;
+        if (nMaximumRead <= 0)
+            break;
+        int nNameBytes = GetFieldNameBytes(&pBuffer[8], min(nMaximumRead, nHeaderBytes - 8));
+        if ((nNameBytes == -2) && (nHeaderBytes < nMaximumBytes))
+        {
+            // a name longer than the spec allows -- look as far as the window goes
+            pBuffer = Window.GetBytes(nLocation, nMaximumBytes);
+            nNameBytes = (pBuffer != NULL) ? GetFieldNameBytes(&pBuffer[8], min(nMaximumRead, nMaximumBytes - 8)) : -1;
+        }
+        if (nNameBytes < 0)
+            break;
+        pField->nNameBytes = nNameBytes;
+
+        // big binary values stay in the file
+        pField->bValueInline = ((pField->nFlags & TAG_FIELD_FLAG_DATA_TYPE_MASK) != TAG_FIELD_FLAG_DATA_TYPE_BINARY) ||
+            (pField->nValueBytes <= APE_TAG_INLINE_BINARY_BYTES);
+
+        nNameCharacters += nNameBytes + 1;
+        nMemoryBytes += nNameBytes + 1 + (pField->bValueInline ? pField->nValueBytes + 2 : 0);
+        nLocation += 8 + nNameBytes + 1 + pField->nValueBytes;
+    }
+
+    // copy the names (UTF-16 first, so they're aligned, then as they're stored) and values into one block
+    m_spFieldMemory.Assign(new char [nNameCharacters * sizeof(str_utf16) + nMemoryBytes], TRUE);
+    str_utf16 * pNameUTF16 = (str_utf16 *) m_spFieldMemory.GetPtr();
+    char * pMemory = &m_spFieldMemory[nNameCharacters * sizeof(str_utf16)];
+    for (int z = 0; z < nLocations; z++)
+    {
+        FIELD_LOCATION * pField = &aryLocations[z];
+        int nValueLocation = pField->nLocation + 8 + pField->nNameBytes + 1;
+
+        const char * pNameANSI = pMemory;
+        if (Window.CopyBytes(pField->nLocation + 8, pField->nNameBytes + 1, pMemory) == FALSE)
+            return ERROR_IO_READ;
+        for (int nCharacter = 0; nCharacter <= pField->nNameBytes; nCharacter++)
+            pNameUTF16[nCharacter] = (str_utf16) pNameANSI[nCharacter];
+        pMemory += pField->nNameBytes + 1;
+
+        const char * pValue = NULL;
+        if (pField->bValueInline)
+        {
+            if (Window.CopyBytes(nValueLocation, pField->nValueBytes, pMemory) == FALSE)
+                return ERROR_IO_READ;
+            pMemory[pField->nValueBytes] = 0;
+            pMemory[pField->nValueBytes + 1] = 0;
+            pValue = pMemory;
+            pMemory += pField->nValueBytes + 2;
+        }
+
+        // set (an empty value removes the field, as it would with SetFieldBinary(...))
+        int nRetVal = (pField->nValueBytes == 0) ? SetFieldBinary(pNameUTF16, NULL, 0, pField->nFlags) :
+            SetField(new CAPETagField(pNameUTF16, pNameANSI, pValue, pField->nValueBytes, pField->nFlags, m_spIO, nFieldsOffset + nValueLocation));
+        if (nRetVal != ERROR_SUCCESS)
+            return nRetVal;
+        pNameUTF16 += pField->nNameBytes + 1;
+    }
+
+    return ERROR_SUCCESS;
+}
+
 int CAPETag::ClearFields()
 {
     for (int z = 0; z < m_nFields; z++)
@@ -299,6 +559,8 @@ int CAPETag::ClearFields()
     }
     
     m_nFields = 0;
+    m_spFieldMemory.Delete();
+    m_bFieldHashValid = FALSE;
 
     return ERROR_SUCCESS;
 }
@@ -307,15 +569,47 @@ int CAPETag::GetTagFieldIndex(const str_utf16 * pFieldName)
 {
     if (m_bAnalyzed == FALSE) { Analyze(); }
     if (pFieldName == NULL) return -1;
+    if (m_bFieldHashValid == FALSE) { BuildFieldHash(); }
 
-    for (int z = 0; z < m_nFields; z++)
+    return FindFieldHash(m_aryFieldHash, m_aryFields, pFieldName);
+}
+
+int CAPETag::GetTagFieldIndex(const char * pFieldName)
+{
+    if (pFieldName == NULL) return -1;
+
+    // a name that isn't ASCII can't match one as it's stored, so it's looked up as UTF-16
+    for (int z = 0; pFieldName[z] != 0; z++)
     {
-        if (_wcsicmp(m_aryFields[z]->GetFieldName(), pFieldName) == 0)
-            return z;
+        if ((unsigned char) pFieldName[z] >= 0x80)
+        {
+            CSmartPtr<str_utf16> spFieldName(CAPECharacterHelper::GetUTF16FromUTF8((const str_utf8 *) pFieldName), TRUE);
+            return GetTagFieldIndex(spFieldName);
+        }
     }
 
-    return -1;
+    if (m_bAnalyzed == FALSE) { Analyze(); }
+    if (m_bFieldHashValid == FALSE) { BuildFieldHash(); }
+
+    return FindFieldHash(m_aryFieldHash, m_aryFields, pFieldName);
+}
+
+void CAPETag::BuildFieldHash()
+{
+    memset(m_aryFieldHash, 0xFF, sizeof(m_aryFieldHash));
+    m_bFieldHashValid = TRUE;
 
+    for (int z = 0; z < m_nFields; z++)
+        AddFieldHash(z);
+}
+
+void CAPETag::AddFieldHash(int nIndex)
+{
+    // open addressing (there are always empty slots, since there are twice as many slots as fields)
+    int nSlot = HashFieldName(m_aryFields[nIndex]->GetFieldName()) & (APE_TAG_FIELD_HASH_SLOTS - 1);
+    while (m_aryFieldHash[nSlot] != -1)
+        nSlot = (nSlot + 1) & (APE_TAG_FIELD_HASH_SLOTS - 1);
+    m_aryFieldHash[nSlot] = (short) nIndex;
 }
 
 CAPETagField * CAPETag::GetTagField(const str_utf16 * pFieldName)
@@ -324,8 +618,46 @@ CAPETagField * CAPETag::GetTagField(const str_utf16 * pFieldName)
     return (nIndex != -1) ? m_aryFields[nIndex] : NULL;
 }
 
+CAPETagField * CAPETag::GetTagField(const char * pFieldName)
+{
+    int nIndex = GetTagFieldIndex(pFieldName);
+    return (nIndex != -1) ? m_aryFields[nIndex] : NULL;
+}
+
+const char * CAPETag::GetFieldUTF8(const char * pFieldName, int * pBytes)
+{
+    // (an APE 1.0 tag has no field types -- everything's text)
+    CAPETagField * pAPETagField = GetTagField(pFieldName);
+    if ((pAPETagField == NULL) || ((pAPETagField->GetIsUTF8Text() == FALSE) && (m_nAPETagVersion >= 2000)))
+    {
+        if (pBytes) *pBytes = 0;
+        return NULL;
+    }
+
+    if (pBytes) *pBytes = pAPETagField->GetFieldValueSize();
+    return pAPETagField->GetFieldValue();
+}
+
 int CAPETag::GetFieldString(const str_utf16 * pFieldName, str_ansi * pBuffer, int * pBufferCharacters, BOOL bUTF8Encode)
 {
+    if (m_bAnalyzed == FALSE) { Analyze(); }
+
+    // UTF-8 text is what's asked for already, so it's just copied
+    CAPETagField * pAPETagField = (bUTF8Encode && (*pBufferCharacters > 0) && (m_nAPETagVersion >= 2000)) ? GetTagField(pFieldName) : NULL;
+    if ((pAPETagField != NULL) && pAPETagField->GetIsUTF8Text())
+    {
+        int nCharacters = int(strlen(pAPETagField->GetFieldValue()));
+        if (nCharacters >= *pBufferCharacters)
+        {
+            *pBufferCharacters = nCharacters + 1;
+            return ERROR_UNDEFINED;
+        }
+
+        memcpy(pBuffer, pAPETagField->GetFieldValue(), nCharacters + 1);
+        *pBufferCharacters = nCharacters;
+        return ERROR_SUCCESS;
+    }
+
     int nOriginalCharacters = *pBufferCharacters;
     str_utf16 * pUTF16 = new str_utf16 [*pBufferCharacters + 1];
     pUTF16[0] = 0;
@@ -370,15 +702,22 @@ int CAPETag::GetFieldString(const str_utf16 * pFieldName, str_utf16 * pBuffer, i
         }
         else if (pAPETagField->GetIsUTF8Text() || (m_nAPETagVersion < 2000))
         {
-            // get the value in UTF-16 format
+            // get the value in UTF-16 format (UTF-8 is decoded straight into the buffer, once we know it fits)
             CSmartPtr<str_utf16> spUTF16;
+            const str_utf8 * pUTF8 = NULL;
+            int nCharacters = 0;
             if (m_nAPETagVersion >= 2000)
-                spUTF16.Assign(CAPECharacterHelper::GetUTF16FromUTF8((str_utf8 *) pAPETagField->GetFieldValue()), TRUE);
+            {
+                pUTF8 = (const str_utf8 *) pAPETagField->GetFieldValue();
+                nCharacters = CAPECharacterHelper::GetUTF16FromUTF8(pUTF8, NULL, 0);
+            }
             else
+            {
                 spUTF16.Assign(CAPECharacterHelper::GetUTF16FromANSI(pAPETagField->GetFieldValue()), TRUE);
+                nCharacters = (int(wcslen(spUTF16)) + 1);
+            }
 
-            // get the number of characters
-            int nCharacters = (int(wcslen(spUTF16)) + 1);
+            // check the number of characters
             if (nCharacters > *pBufferCharacters)
             {
                 // we'll fail here, because it's not clear what would get returned (null termination, size, etc.)
@@ -389,7 +728,10 @@ int CAPETag::GetFieldString(const str_utf16 * pFieldName, str_utf16 * pBuffer, i
             {
                 // just copy in
                 *pBufferCharacters = nCharacters;
-                memcpy(pBuffer, spUTF16.GetPtr(), *pBufferCharacters * sizeof(str_utf16));
+                if (pUTF8 != NULL)
+                    CAPECharacterHelper::GetUTF16FromUTF8(pUTF8, pBuffer, nCharacters);
+                else
+                    memcpy(pBuffer, spUTF16.GetPtr(), *pBufferCharacters * sizeof(str_utf16));
                 nRetVal = ERROR_SUCCESS;
             }
         }
@@ -491,57 +833,6 @@ int CAPETag::CreateID3Tag(ID3_TAG * pID3Tag)
     return ERROR_SUCCESS;
 }
 
-int CAPETag::LoadField(const char * pBuffer, int nMaximumBytes, int * pBytes)
-{
-    // set bytes to 0
-    if (pBytes) *pBytes = 0;
-
-    // size and flags
-    if (nMaximumBytes < 8)
-        return -1;
-    int nLocation = 0;
-    int nFieldValueSize = *((int *) &pBuffer[nLocation]);
-    nLocation += 4;
-    int nFieldFlags = *((int *) &pBuffer[nLocation]);
-    nLocation += 4;
-    
-    // safety check (so we can't get buffer overflow attacked)
-    BOOL bSafe = FALSE;
-    int nMaximumRead = nMaximumBytes - 8 - nFieldValueSize;
-    if (nMaximumRead > 0)
-    {
-        bSafe = TRUE;
-        for (int z = 0; (z < nMaximumRead) && (bSafe == TRUE); z++)
-        {
-            int nCharacter = pBuffer[nLocation + z];
-            if (nCharacter == 0)
-                break;
-            if ((nCharacter < 0x20) || (nCharacter > 0x7E))
-                bSafe = FALSE;
-        }
-    }
-    if (bSafe == FALSE)
-        return -1;
-
-    // name
-    int nNameCharacters = int(strlen(&pBuffer[nLocation]));
-    CSmartPtr<str_utf8> spNameUTF8(new str_utf8 [nNameCharacters + 1], TRUE);
-    memcpy(spNameUTF8, &pBuffer[nLocation], (nNameCharacters + 1) * sizeof(str_utf8));
-    nLocation += nNameCharacters + 1;
-    CSmartPtr<str_utf16> spNameUTF16(CAPECharacterHelper::GetUTF16FromUTF8(spNameUTF8.GetPtr()), TRUE);
-
-    // value
-    CSmartPtr<char> spFieldBuffer(new char [nFieldValueSize], TRUE);
-    memcpy(spFieldBuffer, &pBuffer[nLocation], nFieldValueSize);
-    nLocation += nFieldValueSize;
-
-    // update the bytes
-    if (pBytes) *pBytes = nLocation;
-
-    // set
-    return SetFieldBinary(spNameUTF16.GetPtr(), spFieldBuffer, nFieldValueSize, nFieldFlags);
-}
-
 int CAPETag::SetFieldString(const str_utf16 * pFieldName, const str_utf16 * pFieldValue)
 {
     // remove if empty
@@ -579,11 +870,32 @@ int CAPETag::SetFieldBinary(const str_utf16 * pFieldName, const void * pFieldVal
     if (pFieldName == NULL) return -1;
 
     // check to see if we're trying to remove the field (by setting it to NULL or an empty string)
-    BOOL bRemoving = (pFieldValue == NULL) || (nFieldBytes <= 0);
+    if ((pFieldValue == NULL) || (nFieldBytes <= 0))
+    {
+        int nFieldIndex = GetTagFieldIndex(pFieldName);
+        if (nFieldIndex == -1)
+            return ERROR_SUCCESS;
+
+        // fail if we're read-only (and not ignoring the read-only flag)
+        if ((m_bIgnoreReadOnly == FALSE) && (m_aryFields[nFieldIndex]->GetIsReadOnly()))
+            return -1;
+
+        return RemoveField(nFieldIndex);
+    }
+
+    // create the field and add it to the field array
+    return SetField(new CAPETagField(pFieldName, pFieldValue, nFieldBytes, nFieldFlags));
+}
+
+int CAPETag::SetField(CAPETagField * pField)
+{
+    // takes the field either way
+    CSmartPtr<CAPETagField> spField(pField);
 
     // get the index
-    int nFieldIndex = GetTagFieldIndex(pFieldName);
-    if (nFieldIndex != -1)
+    int nFieldIndex = GetTagFieldIndex(pField->GetFieldName());
+    BOOL bNewField = (nFieldIndex == -1) ? TRUE : FALSE;
+    if (bNewField == FALSE)
     {
         // existing field
 
@@ -591,25 +903,22 @@ int CAPETag::SetFieldBinary(const str_utf16 * pFieldName, const void * pFieldVal
         if ((m_bIgnoreReadOnly == FALSE) && (m_aryFields[nFieldIndex]->GetIsReadOnly()))
             return -1;
         
-        // erase the existing field
+        // erase the existing field (the name only changes case, so the hash still has it)
         SAFE_DELETE(m_aryFields[nFieldIndex])
-
-        if (bRemoving)
-        {
-            return RemoveField(nFieldIndex);
-        }
     }
     else
     {
-        if (bRemoving)
-            return ERROR_SUCCESS;
+        if (m_nFields >= APE_TAG_MAX_FIELDS)
+            return -1;
 
         nFieldIndex = m_nFields;
         m_nFields++;
     }
     
-    // create the field and add it to the field array
-    m_aryFields[nFieldIndex] = new CAPETagField(pFieldName, pFieldValue, nFieldBytes, nFieldFlags);
+    spField.SetDelete(FALSE);
+    m_aryFields[nFieldIndex] = pField;
+    if (bNewField && m_bFieldHashValid)
+        AddFieldHash(nFieldIndex);
 
     return ERROR_SUCCESS;
 }
@@ -619,8 +928,9 @@ int CAPETag::RemoveField(int nIndex)
     if ((nIndex >= 0) && (nIndex < m_nFields))
     {
         SAFE_DELETE(m_aryFields[nIndex])
-        memmove(&m_aryFields[nIndex], &m_aryFields[nIndex + 1], (256 - nIndex - 1) * sizeof(CAPETagField *));
+        memmove(&m_aryFields[nIndex], &m_aryFields[nIndex + 1], (APE_TAG_MAX_FIELDS - nIndex - 1) * sizeof(CAPETagField *));
         m_nFields--;
+        m_bFieldHashValid = FALSE;
         return ERROR_SUCCESS;
     }
 
@@ -637,7 +947,7 @@ int CAPETag::Remove(BOOL bUpdate)
     // variables
     unsigned int nBytesRead = 0;
     int nRetVal = 0;
-    int nOriginalPosition = (int)m_spIO->GetPosition();
+    long long nOriginalPosition = m_spIO->GetPosition();
 
     BOOL bID3Removed = TRUE;
     BOOL bAPETagRemoved = TRUE;
@@ -737,6 +1047,7 @@ int CAPETag::SortFields()
 {
     // sort the tag fields by size (so that the smallest fields are at the front of the tag)
     qsort(m_aryFields, m_nFields, sizeof(CAPETagField *), CompareFields);
+    m_bFieldHashValid = FALSE;
 
     return ERROR_SUCCESS;
 }
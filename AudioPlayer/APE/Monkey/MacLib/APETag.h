@@ -4,7 +4,6 @@ namespace APE_MONKEY
 {
 
 class CIO;
-class CStdLibFileIO;
 /*****************************************************************************************
 APETag version history / supported formats
 
@@ -33,6 +32,11 @@ Notes
 
 -When saving images, store the filename (no directory -- i.e. Cover.jpg) in UTF-8 followed 
 by a null terminator, followed by the image data.
+
+-Analyze() reads the fields into one block the tag owns (names and values together, with
+field names hashed for lookups), except binary values over APE_TAG_INLINE_BINARY_BYTES
+(cover art), which are only located -- CAPETagField::GetFieldValue() reads one when it's
+asked for, and GetFieldValueOffset() says where it is for reading it straight from the file.
 *****************************************************************************************/
 
 /*****************************************************************************************
@@ -40,6 +44,13 @@ The version of the APE tag
 *****************************************************************************************/
 #define CURRENT_APE_TAG_VERSION                 2000
 
+/*****************************************************************************************
+Limits
+*****************************************************************************************/
+#define APE_TAG_MAX_FIELDS                      256
+#define APE_TAG_FIELD_HASH_SLOTS                512             // a power of two, at least twice APE_TAG_MAX_FIELDS
+#define APE_TAG_INLINE_BINARY_BYTES             (16 * 1024)     // bigger binary values are left in the file until asked for
+
 /*****************************************************************************************
 "Standard" APE tag fields
 *****************************************************************************************/
@@ -166,6 +177,11 @@ class CAPETagField
 public:
     // create a tag field (use nFieldBytes = -1 for null-terminated strings)
     CAPETagField(const str_utf16 * pFieldName, const void * pFieldValue, int nFieldBytes = -1, int nFlags = 0);
+
+    // create a tag field read by CAPETag::Analyze() -- the name and value point into the tag's memory (which must
+    // outlive the field); a NULL value is read from pIO at nFieldValueOffset the first time it's asked for
+    CAPETagField(const str_utf16 * pFieldName, const char * pFieldNameANSI, const char * pFieldValue, int nFieldBytes, int nFlags,
+        CIO * pIO, long long nFieldValueOffset);
     
     // destructor
     ~CAPETagField();
@@ -173,11 +189,15 @@ public:
     // gets the size of the entire field in bytes (name, value, and metadata)
     int GetFieldSize();
     
-    // get the name of the field
+    // get the name of the field (and as it's stored in the tag, which is ASCII for a field read from a file)
     const str_utf16 * GetFieldName();
+    const char * GetFieldNameANSI();
 
-    // get the value of the field
+    // get the value of the field (NULL terminated, so text can be used in place)
     const char * GetFieldValue();
+
+    // where the value is in the file (-1 if the field wasn't read from one)
+    long long GetFieldValueOffset() { return m_nFieldValueOffset; }
     
     // get the size of the value (in bytes)
     int GetFieldValueSize();
@@ -196,11 +216,15 @@ public:
     void SetFieldFlags(int nFlags) { m_nFieldFlags = nFlags; }
 
 private:
-        
+    void LoadFieldValue();
+
     CSmartPtr<str_utf16> m_spFieldNameUTF16;
+    CSmartPtr<char> m_spFieldNameANSI;
     CSmartPtr<char> m_spFieldValue;
     int m_nFieldFlags;
     int m_nFieldValueBytes;
+    long long m_nFieldValueOffset;
+    CIO * m_pIO;                            // set while the value is still in the file
 };
 
 /*****************************************************************************************
@@ -212,7 +236,7 @@ public:
     // create an APE tag 
     // bAnalyze determines whether it will analyze immediately or on the first request
     // be careful with multiple threads / file pointer movement if you don't analyze immediately
-    CAPETag(CStdLibFileIO * pIO, BOOL bAnalyze = TRUE);
+    CAPETag(CIO * pIO, BOOL bAnalyze = TRUE);
     CAPETag(const str_utf16 * pFilename, BOOL bAnalyze = TRUE);
     
     // destructor
@@ -257,20 +281,30 @@ public:
     BOOL GetHasAPETag() { if (m_bAnalyzed == FALSE) { Analyze(); } return m_bHasAPETag;    }
     int GetAPETagVersion() { return GetHasAPETag() ? m_nAPETagVersion : -1;    }
 
-    // gets a desired tag field (returns NULL if not found)
+    // gets a desired tag field (returns NULL if not found); names are matched without case (through a hash,
+    // so a lookup doesn't depend on the number of fields), and a UTF-8 name needs no conversion
     // again, be careful, because this a pointer to the actual field in this class
     CAPETagField * GetTagField(const str_utf16 * pFieldName);
+    CAPETagField * GetTagField(const char * pFieldName);
     CAPETagField * GetTagField(int nIndex);
 
+    // gets the value of a text field as it's stored (UTF-8, or ANSI for an APE 1.0 tag) without copying it --
+    // a pointer into the tag, good until the tag changes (returns NULL if there's no such text field)
+    const char * GetFieldUTF8(const char * pFieldName, int * pBytes = NULL);
+
     // options
     void SetIgnoreReadOnly(BOOL bIgnoreReadOnly) { m_bIgnoreReadOnly = bIgnoreReadOnly; }
 
 private:
     // private functions
     int Analyze();
+    int LoadFields(long long nFieldsOffset, int nFieldBytes, int nFields);
     int GetTagFieldIndex(const str_utf16 * pFieldName);
+    int GetTagFieldIndex(const char * pFieldName);
+    int SetField(CAPETagField * pField);
+    void BuildFieldHash();
+    void AddFieldHash(int nIndex);
     int WriteBufferToEndOfIO(void * pBuffer, int nBytes);
-    int LoadField(const char * pBuffer, int nMaximumBytes, int * pBytes);
     int SortFields();
     static int CompareFields(const void * pA, const void * pB);
 
@@ -279,11 +313,14 @@ private:
     int GetFieldID3String(const str_utf16 * pFieldName, char * pBuffer, int nBytes);
 
     // private data
-    CSmartPtr<CStdLibFileIO> m_spIO;
+    CSmartPtr<CIO> m_spIO;
     BOOL m_bAnalyzed;
     int m_nTagBytes;
     int m_nFields;
-    CAPETagField * m_aryFields[256];
+    CAPETagField * m_aryFields[APE_TAG_MAX_FIELDS];
+    CSmartPtr<char> m_spFieldMemory;        // the names and values of the fields Analyze() read
+    short m_aryFieldHash[APE_TAG_FIELD_HASH_SLOTS]; // field indexes by name (-1 for an empty slot)
+    BOOL m_bFieldHashValid;
     BOOL m_bHasAPETag;
     int m_nAPETagVersion;
     BOOL m_bHasID3Tag;
@@ -3,7 +3,7 @@ Includes
 ************************************************************************************/
 #include "All.h"
 #include "BitArray.h"
-#include "MD5.h"
+#include "md5.h"
 
 namespace APE_MONKEY
 {
@@ -44,7 +44,7 @@ const uint32 RANGE_WIDTH[64] = {19578,16582,12257,7906,4576,2366,1170,536,261,11
 /************************************************************************************
 Constructor
 ************************************************************************************/
-CBitArray::CBitArray(CStdLibFileIO *pIO)
+CBitArray::CBitArray(CIO *pIO)
 {
     // allocate memory for the bit array
     m_pBitArray = new uint32 [BIT_ARRAY_ELEMENTS];
@@ -85,8 +85,9 @@ int CBitArray::OutputBitArray(BOOL bFinalize)
 
         RETURN_ON_ERROR(m_pIO->Write(m_pBitArray, nBytesToWrite, &nBytesWritten))
 
-        // reset the bit pointer
+        // reset the bit pointer (and clear what was written, so the array can be filled again)
         m_nCurrentBitIndex = 0;    
+        memset(m_pBitArray, 0, nBytesToWrite);
     }
     else
     {
@@ -196,6 +197,26 @@ int CBitArray::EncodeUnsignedLong(unsigned int n)
     return 0;
 }
 
+/************************************************************************************
+Appends a frame that was encoded by another bit array (starting at bit 0, so the
+bytes are in the same order in the words) -- the current position must be on a byte
+boundary, and nBytes is the frame's size in bytes (any padding in the last word is 0)
+************************************************************************************/
+int CBitArray::AppendFrame(const uint32 * pFrame, int nBytes)
+{
+    // the words go in like unsigned longs
+    int nWords = (nBytes + 3) / 4;
+    for (int z = 0; z < nWords; z++)
+    {
+        RETURN_ON_ERROR(EncodeUnsignedLong(pFrame[z]))
+    }
+
+    // back up over the padding
+    m_nCurrentBitIndex -= ((nWords * 4) - nBytes) * 8;
+
+    return 0;
+}
+
 /************************************************************************************
 Advance to a byte boundary (for frame alignment)
 ************************************************************************************/
@@ -1,7 +1,7 @@
 #pragma once
 
 #include "StdLibFileIO.h"
-#include "MD5.h"
+#include "md5.h"
 
 namespace APE_MONKEY
 {
@@ -25,13 +25,14 @@ class CBitArray
 {
 public:    
     // construction / destruction
-    CBitArray(APE_MONKEY::CStdLibFileIO *pIO);
+    CBitArray(APE_MONKEY::CIO *pIO);
     ~CBitArray();
 
     // encoding
     int EncodeUnsignedLong(unsigned int n);
     int EncodeValue(int nEncode, BIT_ARRAY_STATE & BitArrayState);
     int EncodeBits(unsigned int nValue, int nBits);
+    int AppendFrame(const uint32 * pFrame, int nBytes);
 
     // output (saving)
     int OutputBitArray(BOOL bFinalize = FALSE);
@@ -47,7 +48,7 @@ public:
 private:    
     // data members
     uint32 * m_pBitArray;
-    CStdLibFileIO * m_pIO;
+    CIO * m_pIO;
     uint32 m_nCurrentBitIndex;
     RANGE_CODER_STRUCT_COMPRESS m_RangeCoderInfo;
     CMD5Helper m_MD5;
@@ -0,0 +1,268 @@
+#include "All.h"
+#include "GlobalFunctions.h"
+#include "CRC.h"
+
+// PCLMULQDQ folding wants the target attribute, so it goes with the GCC / clang x86 builds
+#ifdef ENABLE_AVX_ASSEMBLY
+    #define ENABLE_PCLMUL_CRC
+    #include <immintrin.h>
+    #define PCLMUL_TARGET __attribute__((target("pclmul,sse4.1")))
+#endif
+#if defined(__ARM_FEATURE_CRC32)
+    #include <arm_acle.h>
+#endif
+
+namespace APE_MONKEY
+{
+
+#define CRC32_POLYNOMIAL        0xEDB88320
+
+/*****************************************************************************************
+Slicing-by-8 -- table N is the CRC of a byte followed by N zero bytes, so eight bytes are
+looked up independently instead of through a chain of eight dependent lookups
+*****************************************************************************************/
+struct CRC32_SLICING_TABLES
+{
+    uint32 aryTable[8][256];
+
+    CRC32_SLICING_TABLES()
+    {
+        for (uint32 nByte = 0; nByte < 256; nByte++)
+        {
+            uint32 nCRC = nByte;
+            for (int nBit = 0; nBit < 8; nBit++)
+                nCRC = (nCRC >> 1) ^ ((nCRC & 1) ? CRC32_POLYNOMIAL : 0);
+            aryTable[0][nByte] = nCRC;
+        }
+
+        for (int nSlice = 1; nSlice < 8; nSlice++)
+        {
+            for (int nByte = 0; nByte < 256; nByte++)
+                aryTable[nSlice][nByte] = (aryTable[nSlice - 1][nByte] >> 8) ^ aryTable[0][aryTable[nSlice - 1][nByte] & 0xFF];
+        }
+    }
+};
+
+static const CRC32_SLICING_TABLES & GetSlicingTables()
+{
+    static const CRC32_SLICING_TABLES Tables;
+    return Tables;
+}
+
+static uint32 CRC32UpdateSlicing(uint32 nCRC, const unsigned char * pData, int nBytes)
+{
+    const CRC32_SLICING_TABLES & Tables = GetSlicingTables();
+    const uint32 (* T)[256] = Tables.aryTable;
+
+#if !defined(__BYTE_ORDER__) || (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+    while (nBytes >= 8)
+    {
+        uint32 nLow, nHigh;
+        memcpy(&nLow, &pData[0], 4);
+        memcpy(&nHigh, &pData[4], 4);
+        nLow ^= nCRC;
+
+        nCRC = T[7][nLow & 0xFF] ^ T[6][(nLow >> 8) & 0xFF] ^ T[5][(nLow >> 16) & 0xFF] ^ T[4][nLow >> 24] ^
+               T[3][nHigh & 0xFF] ^ T[2][(nHigh >> 8) & 0xFF] ^ T[1][(nHigh >> 16) & 0xFF] ^ T[0][nHigh >> 24];
+
+        pData += 8;
+        nBytes -= 8;
+    }
+#endif
+
+    while (nBytes-- > 0)
+        nCRC = (nCRC >> 8) ^ T[0][(nCRC & 0xFF) ^ *pData++];
+
+    return nCRC;
+}
+
+/*****************************************************************************************
+ARMv8 -- the CRC32 instructions are this polynomial (not CRC32C) and don't invert either
+*****************************************************************************************/
+#if defined(__ARM_FEATURE_CRC32)
+static uint32 CRC32UpdateARM(uint32 nCRC, const unsigned char * pData, int nBytes)
+{
+    while (nBytes >= 8)
+    {
+        unsigned long long nValue;
+        memcpy(&nValue, pData, 8);
+        nCRC = __crc32d(nCRC, nValue);
+        pData += 8;
+        nBytes -= 8;
+    }
+
+    while (nBytes-- > 0)
+        nCRC = __crc32b(nCRC, *pData++);
+
+    return nCRC;
+}
+#endif
+
+/*****************************************************************************************
+PCLMULQDQ -- folds 64 bytes at a time with carry-less multiplies, then Barrett reduces to
+32 bits (Gopal et al., "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ
+Instruction", with the bit-reflected constants for this polynomial); needs at least 64 bytes
+and a multiple of 16
+*****************************************************************************************/
+#ifdef ENABLE_PCLMUL_CRC
+PCLMUL_TARGET static uint32 CRC32UpdatePCLMUL(uint32 nCRC, const unsigned char * pData, int nBytes)
+{
+    static const unsigned long long aryK1K2[2] __attribute__((aligned(16))) = { 0x0154442bd4ULL, 0x01c6e41596ULL };
+    static const unsigned long long aryK3K4[2] __attribute__((aligned(16))) = { 0x01751997d0ULL, 0x00ccaa009eULL };
+    static const unsigned long long aryK5K0[2] __attribute__((aligned(16))) = { 0x0163cd6124ULL, 0x0000000000ULL };
+    static const unsigned long long aryPoly[2] __attribute__((aligned(16))) = { 0x01db710641ULL, 0x01f7011641ULL };
+
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+    x1 = _mm_loadu_si128((const __m128i *) (pData + 0x00));
+    x2 = _mm_loadu_si128((const __m128i *) (pData + 0x10));
+    x3 = _mm_loadu_si128((const __m128i *) (pData + 0x20));
+    x4 = _mm_loadu_si128((const __m128i *) (pData + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int) nCRC));
+    x0 = _mm_load_si128((const __m128i *) aryK1K2);
+    pData += 64;
+    nBytes -= 64;
+
+    // fold four lanes of 16 bytes in parallel
+    while (nBytes >= 64)
+    {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+        y5 = _mm_loadu_si128((const __m128i *) (pData + 0x00));
+        y6 = _mm_loadu_si128((const __m128i *) (pData + 0x10));
+        y7 = _mm_loadu_si128((const __m128i *) (pData + 0x20));
+        y8 = _mm_loadu_si128((const __m128i *) (pData + 0x30));
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+        pData += 64;
+        nBytes -= 64;
+    }
+
+    // fold the four lanes into one
+    x0 = _mm_load_si128((const __m128i *) aryK3K4);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    // the rest 16 bytes at a time
+    while (nBytes >= 16)
+    {
+        x2 = _mm_loadu_si128((const __m128i *) pData);
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+        pData += 16;
+        nBytes -= 16;
+    }
+
+    // 128 bits to 64
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+    x0 = _mm_loadl_epi64((const __m128i *) aryK5K0);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduction to 32 bits
+    x0 = _mm_load_si128((const __m128i *) aryPoly);
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return (uint32) _mm_extract_epi32(x1, 1);
+}
+#endif
+
+/*****************************************************************************************
+Arithmetic modulo the polynomial (bit-reflected, so x^0 is the top bit) -- running the CRC
+over a zero byte is a multiply by x^8, which is what lets a run be done without the bytes
+*****************************************************************************************/
+static uint32 MultiplyModP(uint32 nA, uint32 nB)
+{
+    uint32 nProduct = 0;
+    for (uint32 nMask = 0x80000000; nMask != 0; nMask >>= 1)
+    {
+        if (nA & nMask)
+        {
+            nProduct ^= nB;
+            if ((nA & (nMask - 1)) == 0)
+                break;
+        }
+        nB = (nB & 1) ? ((nB >> 1) ^ CRC32_POLYNOMIAL) : (nB >> 1);
+    }
+    return nProduct;
+}
+
+uint32 CRC32UpdateRepeat(uint32 nCRC, unsigned char cByte, int nBytes)
+{
+    if (nBytes <= 0)
+        return nCRC;
+
+    // one byte takes the CRC c to c * x^8 + T[cByte], so a run of n bytes takes it to
+    // c * x^8n + R(n), where R(n) is the run's CRC from zero; both are built up from the top
+    // bit of n down (doubling: R(2m) = R(m) * x^8m + R(m), one more: R(m + 1) = R(m) * x^8 + T)
+    const uint32 nX8 = 0x00800000;
+    const uint32 nByteCRC = GetSlicingTables().aryTable[0][cByte];
+
+    uint32 nPower = 0x80000000; // x^0
+    uint32 nRun = 0;
+    for (int nBit = 30; nBit >= 0; nBit--)
+    {
+        if (nPower != 0x80000000)
+        {
+            nRun = MultiplyModP(nPower, nRun) ^ nRun;
+            nPower = MultiplyModP(nPower, nPower);
+        }
+        if (nBytes & (1 << nBit))
+        {
+            nRun = MultiplyModP(nX8, nRun) ^ nByteCRC;
+            nPower = MultiplyModP(nX8, nPower);
+        }
+    }
+
+    return MultiplyModP(nPower, nCRC) ^ nRun;
+}
+
+uint32 CRC32Update(uint32 nCRC, const unsigned char * pData, int nBytes)
+{
+#if defined(__ARM_FEATURE_CRC32)
+    return CRC32UpdateARM(nCRC, pData, nBytes);
+#else
+    #ifdef ENABLE_PCLMUL_CRC
+        static const bool bPCLMULAvailable = GetPCLMULAvailable();
+        if (bPCLMULAvailable && (nBytes >= 64))
+        {
+            int nFoldBytes = nBytes & ~15;
+            nCRC = CRC32UpdatePCLMUL(nCRC, pData, nFoldBytes);
+            pData += nFoldBytes;
+            nBytes -= nFoldBytes;
+        }
+    #endif
+
+    return CRC32UpdateSlicing(nCRC, pData, nBytes);
+#endif
+}
+
+}
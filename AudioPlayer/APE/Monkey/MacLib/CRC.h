@@ -0,0 +1,26 @@
+#pragma once
+
+namespace APE_MONKEY
+{
+
+/*************************************************************************************************
+CRC32Update - the frame CRC (CRC-32, reflected 0xEDB88320) over a run of bytes
+
+Carries a running CRC without the initial and final inversion, so it's interchangeable with the
+byte at a time loop
+    nCRC = (nCRC >> 8) ^ CRC32_TABLE[(nCRC & 0xFF) ^ *pData++];
+and a span can be done in as many pieces as is convenient.  It uses the ARMv8 CRC32 instructions
+when the compiler targets them, PCLMULQDQ folding on x86 CPUs that have it (checked at runtime),
+and slicing-by-8 otherwise.
+*************************************************************************************************/
+uint32 CRC32Update(uint32 nCRC, const unsigned char * pData, int nBytes);
+
+/*************************************************************************************************
+CRC32UpdateRepeat - the same running CRC carried over nBytes copies of one byte (a silent frame)
+
+Works it out in closed form, a handful of multiplies modulo the polynomial for each bit of nBytes,
+so it costs the same for a frame of silence as for a single block.
+*************************************************************************************************/
+uint32 CRC32UpdateRepeat(uint32 nCRC, unsigned char cByte, int nBytes);
+
+}
@@ -1,10 +1,8 @@
 #include "All.h"
 #include "MACLib.h"
-//#include "APECompress.h"
-//#include "APECompressCreate.h"
-//#include "APECompressCore.h"
-//#include "APECompress.h"
+#include "APECompress.h"
 #include "APEDecompress.h"
+#include "ParallelAPEDecompress.h"
 #include "APEInfo.h"
 #include "APELink.h"
 #include "CharacterHelper.h"
@@ -107,7 +105,7 @@ IAPEDecompress * __stdcall CreateIAPEDecompress(const str_utf16 * pFilename, int
     return pAPEDecompress;
 }
 
-IAPEDecompress * __stdcall CreateIAPEDecompressEx(CStdLibFileIO * pIO, int * pErrorCode)
+IAPEDecompress * __stdcall CreateIAPEDecompressEx(CIO * pIO, int * pErrorCode)
 {
     // create info 
     int nErrorCode = ERROR_UNDEFINED;
@@ -129,13 +127,52 @@ IAPEDecompress * __stdcall CreateIAPEDecompressEx2(CAPEInfo * pAPEInfo, int nSta
     return pAPEDecompress;
 }
 
-//IAPECompress * __stdcall CreateIAPECompress(int * pErrorCode)
-//{
-//    if (pErrorCode)
-//        *pErrorCode = ERROR_SUCCESS;
-//
-//    return new CAPECompress();
-//}
+IAPEDecompress * __stdcall CreateIAPEDecompressParallel(const str_utf16 * pFilename, int nThreads, int * pErrorCode)
+{
+    // error check the parameters
+    if ((pFilename == NULL) || (wcslen(pFilename) == 0))
+    {
+        if (pErrorCode) *pErrorCode = ERROR_BAD_PARAMETER;
+        return NULL;
+    }
+
+    // create (nThreads <= 0 means one worker per processor)
+    int nErrorCode = ERROR_UNDEFINED;
+    IAPEDecompress * pAPEDecompress = NULL;
+    try
+    {
+        pAPEDecompress = new CParallelAPEDecompress(&nErrorCode, pFilename, nThreads);
+        if (nErrorCode != ERROR_SUCCESS)
+        {
+            SAFE_DELETE(pAPEDecompress)
+        }
+    }
+    catch(...)
+    {
+        SAFE_DELETE(pAPEDecompress)
+        nErrorCode = ERROR_UNDEFINED;
+    }
+
+    if (pErrorCode) *pErrorCode = nErrorCode;
+    return pAPEDecompress;
+}
+
+IAPECompress * __stdcall CreateIAPECompress(int * pErrorCode)
+{
+    if (pErrorCode)
+        *pErrorCode = ERROR_SUCCESS;
+
+    return new CAPECompress();
+}
+
+IAPECompress * __stdcall CreateIAPECompressParallel(int nThreads, int * pErrorCode)
+{
+    if (pErrorCode)
+        *pErrorCode = ERROR_SUCCESS;
+
+    // nThreads <= 0 means one worker per processor
+    return new CAPECompress(nThreads);
+}
 
 int __stdcall FillWaveFormatEx(WAVEFORMATEX * pWaveFormatEx, int nSampleRate, int nBitsPerSample, int nChannels)
 {
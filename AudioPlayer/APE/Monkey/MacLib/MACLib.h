@@ -89,6 +89,15 @@ Defines
 #define CREATE_WAV_HEADER_ON_DECOMPRESSION    -1
 #define MAX_AUDIO_BYTES_UNKNOWN -1
 
+#define APE_VERIFY_INLINE               0   // hold each frame back until its CRC checks out (a bad frame comes out as silence)
+#define APE_VERIFY_ASYNC                1   // hand blocks out as they're decoded, check the CRCs on a thread of their own
+#define APE_VERIFY_NONE                 2   // hand blocks out as they're decoded, no CRCs
+
+#define APE_OUTPUT_NATIVE               0       // the file's own PCM: 8-bit unsigned, 16 or 24-bit signed (the default)
+#define APE_OUTPUT_INT32                1       // 32-bit signed, the sample in the top bits (so full scale is the same for any bit depth)
+#define APE_OUTPUT_FLOAT32              2       // 32-bit float, full scale is -1.0 to 1.0
+#define APE_OUTPUT_PLANAR               0x100   // (with APE_OUTPUT_INT32 or APE_OUTPUT_FLOAT32) one channel after the other instead of interleaved
+
 /*****************************************************************************************
 Progress callbacks
 *****************************************************************************************/
@@ -102,6 +111,16 @@ public:
     virtual int GetKillFlag() = 0; // KILL_FLAG_CONTINUE to continue
 };
 
+/*****************************************************************************************
+Frame error callback (see IAPEDecompress::SetVerifyMode(...))
+*****************************************************************************************/
+class IAPEFrameErrorCallback
+{
+public:
+
+    virtual void FrameError(int nFrame) = 0; // the frame's CRC didn't match (called on the verifying thread)
+};
+
 /*****************************************************************************************
 All structures are designed for 4-byte alignment
 *****************************************************************************************/
@@ -182,7 +201,7 @@ Classes (fully defined elsewhere)
 *************************************************************************************************/
 class CInputSource;
 class CAPEInfo;
-class CStdLibFileIO;
+class CIO;
     
 /*************************************************************************************************
 IAPEDecompress fields - used when querying for information
@@ -234,10 +253,29 @@ enum APE_DECOMPRESS_FIELDS
     APE_DECOMPRESS_LENGTH_MS = 2003,            // length of the decompressors range in milliseconds [ignored, ignored]
     APE_DECOMPRESS_CURRENT_BITRATE = 2004,      // current bitrate [ignored, ignored]
     APE_DECOMPRESS_AVERAGE_BITRATE = 2005,      // average bitrate (works with ranges) [ignored, ignored]
+    APE_DECOMPRESS_STAGE_TIMES = 2006,          // error code, time spent in each decoding stage so far (needs ENABLE_STAGE_TIMING) [APE_STAGE_TIMES *, ignored]
+    APE_DECOMPRESS_VERIFY_MODE = 2007,          // how frames are checked (APE_VERIFY_XXX, see SetVerifyMode(...)) [ignored, ignored]
+    APE_DECOMPRESS_OUTPUT_FORMAT = 2008,        // the sample format GetData(...) hands out (APE_OUTPUT_XXX, see SetOutputFormat(...)) [ignored, ignored]
+    APE_DECOMPRESS_OUTPUT_BLOCK_ALIGN = 2009,   // the bytes GetData(...) hands out for each block [ignored, ignored]
 
     APE_INTERNAL_INFO = 3000,                   // for internal use -- don't use (returns APE_FILE_INFO *) [ignored, ignored]
 };
 
+/*************************************************************************************************
+APE_STAGE_TIMES - where the decoding time goes (in TICK_COUNT_FREQ units)
+
+Only the staged decoder (3.95 and later files) is broken down; anything else (older files,
+silent frames, frame setup, I/O) is the difference between the wall clock and the sum.  With
+several decoding threads the times are added up over the threads.
+*************************************************************************************************/
+struct APE_STAGE_TIMES
+{
+    TICK_COUNT_TYPE nRangeDecode;               // range decoding the residuals
+    TICK_COUNT_TYPE nNNFilters;                 // NN filters (stage 2)
+    TICK_COUNT_TYPE nPrediction;                // predictor (stage 1, including the channel coupling)
+    TICK_COUNT_TYPE nUnprepare;                 // unprepare, output and CRC
+};
+
 /*************************************************************************************************
 IAPEDecompress - interface for working with existing APE files (decoding, seeking, analyzing, etc.)
 *************************************************************************************************/
@@ -273,6 +311,101 @@ public:
     //////////////////////////////////////////////////////////////////////////////////////////////
     virtual int Seek(int nBlockOffset) = 0;
 
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    // SeekToTime(...) - seeks to the block closest to a time
+    // 
+    // Parameters:
+    //    double dSeconds
+    //        the time to seek to, from the start of the (possibly ranged) decompressor
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    virtual int SeekToTime(double dSeconds)
+    {
+        double dBlock = floor(dSeconds * double(GetInfo(APE_INFO_SAMPLE_RATE)) + 0.5);
+        double dTotalBlocks = double(GetInfo(APE_DECOMPRESS_TOTAL_BLOCKS));
+        if (dBlock < 0) dBlock = 0;
+        if (dBlock > dTotalBlocks) dBlock = dTotalBlocks;
+        return Seek(int(dBlock));
+    }
+
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    // CreateSeekIndex(...) - keeps decoder checkpoints inside frames so a seek doesn't have to
+    // decode from the start of the frame (up to a whole frame of throw-away work)
+    // 
+    // Parameters:
+    //    int nCheckpointBlocks
+    //        blocks between checkpoints (a seek decodes less than this before the wanted block)
+    //    BOOL bBuild
+    //        TRUE to decode the whole file now, otherwise checkpoints are taken as the file plays
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    virtual int CreateSeekIndex(int, BOOL = FALSE) { return ERROR_UNDEFINED; }
+
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    // LoadSeekIndex(...) / SaveSeekIndex(...) - reads or writes the seek index (an index that
+    // was made for another file or with another checkpoint interval doesn't load)
+    // 
+    // Parameters:
+    //    CIO * pIO
+    //        the sidecar file, positioned where the index starts
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    virtual int LoadSeekIndex(CIO *) { return ERROR_UNDEFINED; }
+    virtual int SaveSeekIndex(CIO *) { return ERROR_UNDEFINED; }
+
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    // SaveSnapshot(...) / RestoreSnapshot(...) - saves everything the decoder needs to carry on
+    // from the current block, and puts a decompressor for the same file back there (GetData(...)
+    // goes on with the next block, and nothing is decoded again)
+    //
+    // A snapshot is just the decoder state at the current block (the predictors, NN filters, range
+    // coder and frame CRC so far), a few hundred bytes to a few tens of KB, so it's cheap to keep
+    // one per track.  The decoder usually runs ahead of GetData(...), so saving can mean decoding
+    // the start of the current frame again (only from the closest checkpoint with a seek index).
+    // It's tied to the file, not the decompressor, so it can be kept and restored after a relaunch
+    // (one for another file doesn't restore).
+    //
+    // Parameters:
+    //    unsigned char * pBuffer
+    //        where the snapshot goes (NULL to just get its size)
+    //    int * pBytes
+    //        the size of pBuffer going in, the size of the snapshot coming out
+    //    const unsigned char * pBuffer / int nBytes
+    //        a snapshot from SaveSnapshot(...)
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    virtual int SaveSnapshot(unsigned char *, int *) { return ERROR_UNDEFINED; }
+    virtual int RestoreSnapshot(const unsigned char *, int) { return ERROR_UNDEFINED; }
+
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    // SetVerifyMode(...) - how the frame CRCs are checked (APE_VERIFY_INLINE unless this is called)
+    //
+    // With APE_VERIFY_ASYNC or APE_VERIFY_NONE a frame's blocks are handed out as they're decoded
+    // instead of once the whole frame is in, so a bad frame can't be turned into silence (errors
+    // the decoder runs into still silence what hasn't been handed out yet).  A frame keeps the
+    // mode it was started with.
+    // 
+    // Parameters:
+    //    int nMode
+    //        APE_VERIFY_INLINE, APE_VERIFY_ASYNC or APE_VERIFY_NONE
+    //    IAPEFrameErrorCallback * pCallback
+    //        told about frames that fail the check with APE_VERIFY_ASYNC (on the verifying thread,
+    //        and for every frame decoded so far by the time the mode changes or the decompressor
+    //        is deleted)
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    virtual int SetVerifyMode(int, IAPEFrameErrorCallback * = NULL) { return ERROR_UNDEFINED; }
+
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    // SetOutputFormat(...) - the sample format GetData(...) hands out (APE_OUTPUT_NATIVE unless
+    // this is called)
+    //
+    // The 32-bit formats are converted from the decoded PCM as it's handed out (the frame CRCs are
+    // still over the file's own PCM).  With APE_OUTPUT_PLANAR, channel n of a GetData(...) call
+    // starts n * nBlocks samples into the buffer (nBlocks as asked for, even if fewer come back).
+    // 
+    // Parameters:
+    //    int nFormat
+    //        APE_OUTPUT_NATIVE, or APE_OUTPUT_INT32 or APE_OUTPUT_FLOAT32 (optionally with
+    //        APE_OUTPUT_PLANAR)
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    virtual int SetOutputFormat(int nFormat) { return (nFormat == APE_OUTPUT_NATIVE) ? ERROR_SUCCESS : ERROR_UNDEFINED; }
+
     /*********************************************************************************************
     * Get Information
     *********************************************************************************************/
@@ -291,6 +424,133 @@ public:
     virtual unsigned long long GetInfo(APE_DECOMPRESS_FIELDS Field, unsigned long long nParam1 = 0, unsigned long long nParam2 = 0) = 0;
 };
 
+/*************************************************************************************************
+IAPECompress - interface for creating APE files
+
+Usage:
+
+    To create an APE file, you Start(...), then add data (in a variety of ways), then Finish(...)
+*************************************************************************************************/
+class IAPECompress
+{
+public:
+
+    // destructor (needed so implementation's destructor will be called)
+    virtual ~IAPECompress() {}
+    
+    /*********************************************************************************************
+    * Start
+    *********************************************************************************************/
+    
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    // Start(...) / StartEx(...) - starts encoding
+    //
+    // Parameters:
+    //    CIO * pioOutput / const str_utf16 * pFilename
+    //        the output... either a filename or an I/O source (which has to be able to seek back
+    //        to where it was when StartEx(...) was called, since the header is written last)
+    //    WAVEFORMATEX * pwfeInput
+    //        format of the audio to encode (use FillWaveFormatEx() if necessary)
+    //    int nMaxAudioBytes
+    //        the absolute maximum audio bytes that will be encoded... encoding fails with a
+    //        ERROR_APE_COMPRESS_TOO_MUCH_DATA if you attempt to encode more than specified here
+    //        (if unknown, use MAX_AUDIO_BYTES_UNKNOWN to allocate as much storage in the seek table as
+    //        possible... limit is then 2 GB of data (~4 hours of CD music)... this wastes around
+    //        30kb, so only do it if completely necessary)
+    //    int nCompressionLevel
+    //        the compression level for the APE file (fast - insane)
+    //        (note: extra high and insane are much slower to compress and decompress)
+    //    const void * pHeaderData
+    //        a pointer to a buffer containing the WAV header (data before the data block in the WAV)
+    //        (note: use NULL for on-the-fly encoding... see next parameter)
+    //    int nHeaderBytes
+    //        number of bytes in the header data buffer (use CREATE_WAV_HEADER_ON_DECOMPRESSION and
+    //        NULL for the pHeaderData and MAC will automatically create the appropriate WAV header
+    //        on decompression)
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    
+    virtual int Start(const str_utf16 * pOutputFilename, const WAVEFORMATEX * pwfeInput, 
+        int nMaxAudioBytes = MAX_AUDIO_BYTES_UNKNOWN, int nCompressionLevel = COMPRESSION_LEVEL_NORMAL, 
+        const void * pHeaderData = NULL, int nHeaderBytes = CREATE_WAV_HEADER_ON_DECOMPRESSION) = 0;
+
+    virtual int StartEx(CIO * pioOutput, const WAVEFORMATEX * pwfeInput, 
+        int nMaxAudioBytes = MAX_AUDIO_BYTES_UNKNOWN, int nCompressionLevel = COMPRESSION_LEVEL_NORMAL,
+        const void * pHeaderData = NULL, int nHeaderBytes = CREATE_WAV_HEADER_ON_DECOMPRESSION) = 0;
+    
+    /*********************************************************************************************
+    * Add / Compress Data
+    *    - there are 2 ways to add data:
+    *        1) simple call AddData(...)
+    *        2) lock MAC's buffer, copy into it, and unlock (LockBuffer(...) / UnlockBuffer(...))
+    *********************************************************************************************/
+    
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    // AddData(...) - adds data to the encoder
+    //
+    // Parameters:
+    //    unsigned char * pData
+    //        a pointer to a buffer containing the raw audio data
+    //    int nBytes
+    //        the number of bytes in the buffer
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    virtual int AddData(unsigned char * pData, int nBytes) = 0;
+    
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    // GetBufferBytesAvailable(...) - returns the number of bytes available in the buffer
+    //    (helpful when locking)
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    virtual int GetBufferBytesAvailable() = 0;
+    
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    // LockBuffer(...) - locks MAC's buffer so we can copy into it
+    //
+    // Parameters:
+    //    int * pBytesAvailable
+    //        returns the number of bytes available in the buffer (DO NOT COPY MORE THAN THIS IN)
+    //
+    // Return:
+    //    pointer to the buffer (add at that location)
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    virtual unsigned char * LockBuffer(int * pBytesAvailable) = 0;
+    
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    // UnlockBuffer(...) - releases the buffer
+    //
+    // Parameters:
+    //    int nBytesAdded
+    //        the number of bytes copied into the buffer
+    //    BOOL bProcess
+    //        whether MAC should process as much as possible of the buffer
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    virtual int UnlockBuffer(int nBytesAdded, BOOL bProcess = TRUE) = 0;
+    
+    /*********************************************************************************************
+    * Finish / Kill
+    *********************************************************************************************/
+
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    // Finish(...) - ends encoding and finalizes the file
+    //
+    // Parameters:
+    //    unsigned char * pTerminatingData
+    //        a pointer to a buffer containing the information to place at the end of the APE file
+    //        (comprised of the WAV terminating data (data after the data block in the WAV) followed
+    //        by any tag information)
+    //    int nTerminatingBytes
+    //        number of bytes in the terminating data buffer
+    //    int nWAVTerminatingBytes
+    //        the number of bytes of the terminating data buffer that should be appended to a decoded
+    //        WAV file (it's basically nTerminatingBytes - the bytes that make up the tag)
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    virtual int Finish(unsigned char * pTerminatingData, int nTerminatingBytes, int nWAVTerminatingBytes) = 0;
+    
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    // Kill(...) - stops encoding and deletes the output file
+    // --- NOT CURRENTLY IMPLEMENTED ---
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    virtual int Kill() = 0;
+};
+
 /*************************************************************************************************
 Functions to create the interfaces
 
@@ -309,8 +569,11 @@ Usage example:
 //extern "C"
 //{
     APE_MONKEY::IAPEDecompress * __stdcall CreateIAPEDecompress(const str_utf16 * pFilename, int * pErrorCode = NULL);
-    APE_MONKEY::IAPEDecompress * __stdcall CreateIAPEDecompressEx(APE_MONKEY::CStdLibFileIO * pIO, int * pErrorCode = NULL);
+    APE_MONKEY::IAPEDecompress * __stdcall CreateIAPEDecompressEx(APE_MONKEY::CIO * pIO, int * pErrorCode = NULL);
     APE_MONKEY::IAPEDecompress * __stdcall CreateIAPEDecompressEx2(APE_MONKEY::CAPEInfo * pAPEInfo, int nStartBlock = -1, int nFinishBlock = -1, int * pErrorCode = NULL);
+    APE_MONKEY::IAPEDecompress * __stdcall CreateIAPEDecompressParallel(const str_utf16 * pFilename, int nThreads = 0, int * pErrorCode = NULL);
+    APE_MONKEY::IAPECompress * __stdcall CreateIAPECompress(int * pErrorCode = NULL);
+    APE_MONKEY::IAPECompress * __stdcall CreateIAPECompressParallel(int nThreads = 0, int * pErrorCode = NULL);
 //}
 
 /*************************************************************************************************
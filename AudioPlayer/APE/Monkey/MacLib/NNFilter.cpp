@@ -1,24 +1,243 @@
 #include "All.h"
 #include "GlobalFunctions.h"
 #include "NNFilter.h"
-//#include <emmintrin.h>
-//#include <smmintrin.h>
+
+#ifdef ENABLE_SSE_ASSEMBLY
+    #include <emmintrin.h>
+#endif
+#ifdef ENABLE_AVX_ASSEMBLY
+    #include <immintrin.h>
+    #define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#ifdef ENABLE_NEON_ASSEMBLY
+    #include <arm_neon.h>
+#endif
 
 namespace APE_MONKEY
 {
 
-CNNFilter::CNNFilter(int nOrder, int nShift, int nVersion)
+/*****************************************************************************************
+The dot product / adapt kernels, for CNNFilter and CNNFilterFast alike -- ORDER is the order
+when it's a constant (so the loops unroll), or 0 to go by nOrder (any multiple of 16); the SIMD
+ones need pB / pM aligned to their vector size
+*****************************************************************************************/
+template <int ORDER> __forceinline static int DotProductPortable(const short * pA, const short * pB, int nOrder)
+{
+    const int nCount = (ORDER > 0) ? ORDER : nOrder;
+    int nDotProduct = 0;
+    for (int z = 0; z < nCount; z += 16)
+    {
+        EXPAND_16_TIMES(nDotProduct += *pA++ * *pB++;)
+    }
+    return nDotProduct;
+}
+
+template <int ORDER> __forceinline static void AdaptPortable(short * pM, const short * pAdapt, int nDirection, int nOrder)
+{
+    const int nCount = (ORDER > 0) ? ORDER : nOrder;
+    if (nDirection < 0)
+    {
+        for (int z = 0; z < nCount; z += 16)
+        {
+            EXPAND_16_TIMES(*pM++ += *pAdapt++;)
+        }
+    }
+    else if (nDirection > 0)
+    {
+        for (int z = 0; z < nCount; z += 16)
+        {
+            EXPAND_16_TIMES(*pM++ -= *pAdapt++;)
+        }
+    }
+}
+
+#ifdef ENABLE_SSE_ASSEMBLY
+template <int ORDER> __forceinline static int DotProductSSE(const short * pA, const short * pB, int nOrder)
+{
+    ASSERT((size_t(pB) % 16) == 0);
+    const int nCount = (ORDER > 0) ? ORDER : nOrder;
+
+    // (the 32-bit lanes wrap the same way the int sum in DotProductPortable(...) does)
+    __m128i sseSum = _mm_setzero_si128();
+    for (int z = 0; z < nCount; z += 8)
+        sseSum = _mm_add_epi32(sseSum, _mm_madd_epi16(_mm_loadu_si128((const __m128i *) &pA[z]), _mm_load_si128((const __m128i *) &pB[z])));
+
+    sseSum = _mm_add_epi32(sseSum, _mm_shuffle_epi32(sseSum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sseSum = _mm_add_epi32(sseSum, _mm_shuffle_epi32(sseSum, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(sseSum);
+}
+
+template <int ORDER> __forceinline static void AdaptSSE(short * pM, const short * pAdapt, int nDirection, int nOrder)
+{
+    ASSERT((size_t(pM) % 16) == 0);
+    const int nCount = (ORDER > 0) ? ORDER : nOrder;
+
+    if (nDirection < 0)
+    {
+        for (int z = 0; z < nCount; z += 8)
+            _mm_store_si128((__m128i *) &pM[z], _mm_add_epi16(_mm_load_si128((__m128i *) &pM[z]), _mm_loadu_si128((const __m128i *) &pAdapt[z])));
+    }
+    else if (nDirection > 0)
+    {
+        for (int z = 0; z < nCount; z += 8)
+            _mm_store_si128((__m128i *) &pM[z], _mm_sub_epi16(_mm_load_si128((__m128i *) &pM[z]), _mm_loadu_si128((const __m128i *) &pAdapt[z])));
+    }
+}
+#endif
+
+#ifdef ENABLE_AVX_ASSEMBLY
+template <int ORDER> AVX2_TARGET __forceinline static int DotProductAVX2(const short * pA, const short * pB, int nOrder)
+{
+    ASSERT((size_t(pB) % 32) == 0);
+    const int nCount = (ORDER > 0) ? ORDER : nOrder;
+
+    __m256i avxSum = _mm256_setzero_si256();
+    for (int z = 0; z < nCount; z += 16)
+        avxSum = _mm256_add_epi32(avxSum, _mm256_madd_epi16(_mm256_loadu_si256((const __m256i *) &pA[z]), _mm256_load_si256((const __m256i *) &pB[z])));
+
+    __m128i sseSum = _mm_add_epi32(_mm256_castsi256_si128(avxSum), _mm256_extracti128_si256(avxSum, 1));
+    sseSum = _mm_add_epi32(sseSum, _mm_shuffle_epi32(sseSum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sseSum = _mm_add_epi32(sseSum, _mm_shuffle_epi32(sseSum, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(sseSum);
+}
+
+template <int ORDER> AVX2_TARGET __forceinline static void AdaptAVX2(short * pM, const short * pAdapt, int nDirection, int nOrder)
+{
+    ASSERT((size_t(pM) % 32) == 0);
+    const int nCount = (ORDER > 0) ? ORDER : nOrder;
+
+    if (nDirection < 0)
+    {
+        for (int z = 0; z < nCount; z += 16)
+            _mm256_store_si256((__m256i *) &pM[z], _mm256_add_epi16(_mm256_load_si256((__m256i *) &pM[z]), _mm256_loadu_si256((const __m256i *) &pAdapt[z])));
+    }
+    else if (nDirection > 0)
+    {
+        for (int z = 0; z < nCount; z += 16)
+            _mm256_store_si256((__m256i *) &pM[z], _mm256_sub_epi16(_mm256_load_si256((__m256i *) &pM[z]), _mm256_loadu_si256((const __m256i *) &pAdapt[z])));
+    }
+}
+#endif
+
+#ifdef ENABLE_NEON_ASSEMBLY
+template <int ORDER> __forceinline static int DotProductNEON(const short * pA, const short * pB, int nOrder)
+{
+    const int nCount = (ORDER > 0) ? ORDER : nOrder;
+
+    int32x4_t neonSum1 = vdupq_n_s32(0);
+    int32x4_t neonSum2 = vdupq_n_s32(0);
+    for (int z = 0; z < nCount; z += 8)
+    {
+        int16x8_t neonA = vld1q_s16(&pA[z]);
+        int16x8_t neonB = vld1q_s16(&pB[z]);
+        neonSum1 = vmlal_s16(neonSum1, vget_low_s16(neonA), vget_low_s16(neonB));
+        neonSum2 = vmlal_s16(neonSum2, vget_high_s16(neonA), vget_high_s16(neonB));
+    }
+
+    int32x4_t neonSum = vaddq_s32(neonSum1, neonSum2);
+    int32x2_t neonHalf = vadd_s32(vget_low_s32(neonSum), vget_high_s32(neonSum));
+    return vget_lane_s32(vpadd_s32(neonHalf, neonHalf), 0);
+}
+
+template <int ORDER> __forceinline static void AdaptNEON(short * pM, const short * pAdapt, int nDirection, int nOrder)
+{
+    const int nCount = (ORDER > 0) ? ORDER : nOrder;
+
+    if (nDirection < 0)
+    {
+        for (int z = 0; z < nCount; z += 8)
+            vst1q_s16(&pM[z], vaddq_s16(vld1q_s16(&pM[z]), vld1q_s16(&pAdapt[z])));
+    }
+    else if (nDirection > 0)
+    {
+        for (int z = 0; z < nCount; z += 8)
+            vst1q_s16(&pM[z], vsubq_s16(vld1q_s16(&pM[z]), vld1q_s16(&pAdapt[z])));
+    }
+}
+#endif
+
+// KERNEL's kernels, or the portable ones where it isn't built in (the AVX2 ones only inline
+// into a function that's built for AVX2 itself)
+template <int KERNEL, int ORDER> __forceinline static int CalculateDotProduct(const short * pA, const short * pB, int nOrder)
+{
+#ifdef ENABLE_AVX_ASSEMBLY
+    if (KERNEL == NN_KERNEL_AVX2)
+        return DotProductAVX2<ORDER>(pA, pB, nOrder);
+#endif
+#ifdef ENABLE_SSE_ASSEMBLY
+    if (KERNEL == NN_KERNEL_SSE)
+        return DotProductSSE<ORDER>(pA, pB, nOrder);
+#endif
+#ifdef ENABLE_NEON_ASSEMBLY
+    if (KERNEL == NN_KERNEL_NEON)
+        return DotProductNEON<ORDER>(pA, pB, nOrder);
+#endif
+    return DotProductPortable<ORDER>(pA, pB, nOrder);
+}
+
+template <int KERNEL, int ORDER> __forceinline static void Adapt(short * pM, const short * pAdapt, int nDirection, int nOrder)
+{
+#ifdef ENABLE_AVX_ASSEMBLY
+    if (KERNEL == NN_KERNEL_AVX2)
+        AdaptAVX2<ORDER>(pM, pAdapt, nDirection, nOrder);
+    else
+#endif
+#ifdef ENABLE_SSE_ASSEMBLY
+    if (KERNEL == NN_KERNEL_SSE)
+        AdaptSSE<ORDER>(pM, pAdapt, nDirection, nOrder);
+    else
+#endif
+#ifdef ENABLE_NEON_ASSEMBLY
+    if (KERNEL == NN_KERNEL_NEON)
+        AdaptNEON<ORDER>(pM, pAdapt, nDirection, nOrder);
+    else
+#endif
+        AdaptPortable<ORDER>(pM, pAdapt, nDirection, nOrder);
+}
+
+/*****************************************************************************************
+CNNFilter
+*****************************************************************************************/
+CNNFilter::CNNFilter(int nOrder, int nShift, int nVersion, int nKernel)
 {
     if ((nOrder <= 0) || ((nOrder % 16) != 0)) throw(1);
     m_nOrder = nOrder;
     m_nShift = nShift;
     m_nVersion = nVersion;
-    
-    m_bSSEAvailable = GetSSEAvailable();
+
+    // pick the kernel once
+    if (nKernel == NN_KERNEL_BEST)
+        nKernel = GetAVX2Available() ? NN_KERNEL_AVX2 : GetSSEAvailable() ? NN_KERNEL_SSE : GetNEONAvailable() ? NN_KERNEL_NEON : NN_KERNEL_PORTABLE;
+
+    // the decompression loop, and the kernels for Compress(...)
+    BOOL bAdapt3980 = (m_nVersion >= 3980);
+    switch (nKernel)
+    {
+        case NN_KERNEL_AVX2:
+            m_pDecompressArray = bAdapt3980 ? &CNNFilter::DecompressArrayAVX2<TRUE> : &CNNFilter::DecompressArrayAVX2<FALSE>;
+            m_pCalculateDotProduct = &CalculateDotProduct<NN_KERNEL_AVX2, 0>;
+            m_pAdapt = &Adapt<NN_KERNEL_AVX2, 0>;
+            break;
+        case NN_KERNEL_SSE:
+            m_pDecompressArray = bAdapt3980 ? &CNNFilter::DecompressArrayTemplate<NN_KERNEL_SSE, TRUE> : &CNNFilter::DecompressArrayTemplate<NN_KERNEL_SSE, FALSE>;
+            m_pCalculateDotProduct = &CalculateDotProduct<NN_KERNEL_SSE, 0>;
+            m_pAdapt = &Adapt<NN_KERNEL_SSE, 0>;
+            break;
+        case NN_KERNEL_NEON:
+            m_pDecompressArray = bAdapt3980 ? &CNNFilter::DecompressArrayTemplate<NN_KERNEL_NEON, TRUE> : &CNNFilter::DecompressArrayTemplate<NN_KERNEL_NEON, FALSE>;
+            m_pCalculateDotProduct = &CalculateDotProduct<NN_KERNEL_NEON, 0>;
+            m_pAdapt = &Adapt<NN_KERNEL_NEON, 0>;
+            break;
+        default:
+            m_pDecompressArray = bAdapt3980 ? &CNNFilter::DecompressArrayTemplate<NN_KERNEL_PORTABLE, TRUE> : &CNNFilter::DecompressArrayTemplate<NN_KERNEL_PORTABLE, FALSE>;
+            m_pCalculateDotProduct = &CalculateDotProduct<NN_KERNEL_PORTABLE, 0>;
+            m_pAdapt = &Adapt<NN_KERNEL_PORTABLE, 0>;
+            break;
+    }
     
     m_rbInput.Create(NN_WINDOW_ELEMENTS, m_nOrder);
     m_rbDeltaM.Create(NN_WINDOW_ELEMENTS, m_nOrder);
-    m_paryM = (short *) AllocateAligned(sizeof(short) * m_nOrder, 16); // align for possible SSE usage
+    m_paryM = (short *) AllocateAligned(sizeof(short) * m_nOrder, 32); // align for possible SSE / AVX2 usage
 }
 
 CNNFilter::~CNNFilter()
@@ -38,26 +257,35 @@ void CNNFilter::Flush()
     m_nRunningAverage = 0;
 }
 
+void CNNFilter::SaveState(CDecoderStateWriter & Writer)
+{
+    Writer.Write(&m_paryM[0], m_nOrder * sizeof(short));
+    m_rbInput.SaveState(Writer);
+    m_rbDeltaM.SaveState(Writer);
+    Writer.WriteValue(m_nRunningAverage);
+}
+
+void CNNFilter::LoadState(CDecoderStateReader & Reader)
+{
+    Reader.Read(&m_paryM[0], m_nOrder * sizeof(short));
+    m_rbInput.LoadState(Reader);
+    m_rbDeltaM.LoadState(Reader);
+    m_nRunningAverage = Reader.ReadValue<int>();
+}
+
 int CNNFilter::Compress(int nInput)
 {
     // convert the input to a short and store it
     m_rbInput[0] = GetSaturatedShortFromInt(nInput);
 
     // figure a dot product
-    int nDotProduct;
-    if (m_bSSEAvailable)
-       nDotProduct = CalculateDotProductSSE(&m_rbInput[-m_nOrder], &m_paryM[0], m_nOrder);
-    else
-        nDotProduct = CalculateDotProduct(&m_rbInput[-m_nOrder], &m_paryM[0], m_nOrder);
+    int nDotProduct = m_pCalculateDotProduct(&m_rbInput[-m_nOrder], &m_paryM[0], m_nOrder);
 
     // calculate the output
     int nOutput = nInput - ((nDotProduct + (1 << (m_nShift - 1))) >> m_nShift);
 
     // adapt
-    if (m_bSSEAvailable)
-        AdaptSSE(&m_paryM[0], &m_rbDeltaM[-m_nOrder], nOutput, m_nOrder);
-    else
-        Adapt(&m_paryM[0], &m_rbDeltaM[-m_nOrder], nOutput, m_nOrder);
+    m_pAdapt(&m_paryM[0], &m_rbDeltaM[-m_nOrder], nOutput, m_nOrder);
 
     int nTempABS = abs(nInput);
 
@@ -85,160 +313,209 @@ int CNNFilter::Compress(int nInput)
 
 int CNNFilter::Decompress(int nInput)
 {
-    // figure a dot product
-    int nDotProduct;
-    if (m_bSSEAvailable)
-        nDotProduct = CalculateDotProductSSE(&m_rbInput[-m_nOrder], &m_paryM[0], m_nOrder);
-    else
-        nDotProduct = CalculateDotProduct(&m_rbInput[-m_nOrder], &m_paryM[0], m_nOrder);
+    (this->*m_pDecompressArray)(&nInput, 1);
+    return nInput;
+}
 
-    // adapt
-    if (m_bSSEAvailable)
-        AdaptSSE(&m_paryM[0], &m_rbDeltaM[-m_nOrder], nInput, m_nOrder);
-    else
-        Adapt(&m_paryM[0], &m_rbDeltaM[-m_nOrder], nInput, m_nOrder);
+void CNNFilter::DecompressArray(int * pData, int nElements)
+{
+    (this->*m_pDecompressArray)(pData, nElements);
+}
 
-    // store the output value
-    int nOutput = nInput + ((nDotProduct + (1 << (m_nShift - 1))) >> m_nShift);
+template <int KERNEL, BOOL ADAPT_3980> __forceinline void CNNFilter::DecompressArrayTemplate(int * pData, int nElements)
+{
+    // run the filter over a whole array (in place) so its state stays hot in the cache -- the
+    // kernel and the version are template arguments, so the loop doesn't check them
+    for (int z = 0; z < nElements; z++)
+    {
+        int nInput = pData[z];
 
-    // update the input buffer
-    m_rbInput[0] = GetSaturatedShortFromInt(nOutput);
+        // figure a dot product and adapt
+        int nDotProduct = CalculateDotProduct<KERNEL, 0>(&m_rbInput[-m_nOrder], &m_paryM[0], m_nOrder);
+        Adapt<KERNEL, 0>(&m_paryM[0], &m_rbDeltaM[-m_nOrder], nInput, m_nOrder);
 
-    if (m_nVersion >= 3980)
-    {
-        int nTempABS = abs(nOutput);
-
-        if (nTempABS > (m_nRunningAverage * 3))
-            m_rbDeltaM[0] = ((nOutput >> 25) & 64) - 32;
-        else if (nTempABS > (m_nRunningAverage * 4) / 3)
-            m_rbDeltaM[0] = ((nOutput >> 26) & 32) - 16;
-        else if (nTempABS > 0)
-            m_rbDeltaM[0] = ((nOutput >> 27) & 16) - 8;
+        // store the output value
+        int nOutput = nInput + ((nDotProduct + (1 << (m_nShift - 1))) >> m_nShift);
+
+        // update the input buffer
+        m_rbInput[0] = GetSaturatedShortFromInt(nOutput);
+
+        if (ADAPT_3980)
+        {
+            int nTempABS = abs(nOutput);
+
+            if (nTempABS > (m_nRunningAverage * 3))
+                m_rbDeltaM[0] = ((nOutput >> 25) & 64) - 32;
+            else if (nTempABS > (m_nRunningAverage * 4) / 3)
+                m_rbDeltaM[0] = ((nOutput >> 26) & 32) - 16;
+            else if (nTempABS > 0)
+                m_rbDeltaM[0] = ((nOutput >> 27) & 16) - 8;
+            else
+                m_rbDeltaM[0] = 0;
+
+            m_nRunningAverage += (nTempABS - m_nRunningAverage) / 16;
+
+            m_rbDeltaM[-1] >>= 1;
+            m_rbDeltaM[-2] >>= 1;
+            m_rbDeltaM[-8] >>= 1;
+        }
         else
-            m_rbDeltaM[0] = 0;
+        {
+            m_rbDeltaM[0] = (nOutput == 0) ? 0 : ((nOutput >> 28) & 8) - 4;
+            m_rbDeltaM[-4] >>= 1;
+            m_rbDeltaM[-8] >>= 1;
+        }
 
-        m_nRunningAverage += (nTempABS - m_nRunningAverage) / 16;
+        // increment and roll if necessary
+        m_rbInput.IncrementSafe();
+        m_rbDeltaM.IncrementSafe();
 
-        m_rbDeltaM[-1] >>= 1;
-        m_rbDeltaM[-2] >>= 1;
-        m_rbDeltaM[-8] >>= 1;
+        pData[z] = nOutput;
     }
+}
+
+#ifdef ENABLE_AVX_ASSEMBLY
+template <BOOL ADAPT_3980> AVX2_TARGET void CNNFilter::DecompressArrayAVX2(int * pData, int nElements)
+{
+    // the whole loop is built for AVX2 so the kernels inline into it
+    DecompressArrayTemplate<NN_KERNEL_AVX2, ADAPT_3980>(pData, nElements);
+}
+#else
+template <BOOL ADAPT_3980> void CNNFilter::DecompressArrayAVX2(int * pData, int nElements)
+{
+    DecompressArrayTemplate<NN_KERNEL_PORTABLE, ADAPT_3980>(pData, nElements);
+}
+#endif
+
+/*****************************************************************************************
+CNNFilterFast
+*****************************************************************************************/
+template <int ORDER, int SHIFT> CNNFilterFast<ORDER, SHIFT>::CNNFilterFast(int nVersion, int nKernel)
+{
+    m_paryM = &m_aryMStorage[(16 - ((size_t(&m_aryMStorage[0]) % 32) / sizeof(short))) % 16];
+
+    if (nKernel == NN_KERNEL_BEST)
+        nKernel = GetAVX2Available() ? NN_KERNEL_AVX2 : GetSSEAvailable() ? NN_KERNEL_SSE : GetNEONAvailable() ? NN_KERNEL_NEON : NN_KERNEL_PORTABLE;
+
+    BOOL bAdapt3980 = (nVersion >= 3980);
+    if (nKernel == NN_KERNEL_AVX2)
+        m_pDecompressArray = bAdapt3980 ? &CNNFilterFast::DecompressArrayAVX2<TRUE> : &CNNFilterFast::DecompressArrayAVX2<FALSE>;
+    else if (nKernel == NN_KERNEL_SSE)
+        m_pDecompressArray = bAdapt3980 ? &CNNFilterFast::DecompressArrayTemplate<NN_KERNEL_SSE, TRUE> : &CNNFilterFast::DecompressArrayTemplate<NN_KERNEL_SSE, FALSE>;
+    else if (nKernel == NN_KERNEL_NEON)
+        m_pDecompressArray = bAdapt3980 ? &CNNFilterFast::DecompressArrayTemplate<NN_KERNEL_NEON, TRUE> : &CNNFilterFast::DecompressArrayTemplate<NN_KERNEL_NEON, FALSE>;
     else
-    {
-        m_rbDeltaM[0] = (nOutput == 0) ? 0 : ((nOutput >> 28) & 8) - 4;
-        m_rbDeltaM[-4] >>= 1;
-        m_rbDeltaM[-8] >>= 1;
-    }
+        m_pDecompressArray = bAdapt3980 ? &CNNFilterFast::DecompressArrayTemplate<NN_KERNEL_PORTABLE, TRUE> : &CNNFilterFast::DecompressArrayTemplate<NN_KERNEL_PORTABLE, FALSE>;
 
-    // increment and roll if necessary
-    m_rbInput.IncrementSafe();
-    m_rbDeltaM.IncrementSafe();
-    
-    return nOutput;
+    Flush();
 }
 
-void CNNFilter::Adapt(short * pM, short * pAdapt, int nDirection, int nOrder)
+template <int ORDER, int SHIFT> void CNNFilterFast<ORDER, SHIFT>::Flush()
 {
-    nOrder >>= 4;
+    memset(&m_paryM[0], 0, ORDER * sizeof(short));
+    m_rbInput.Flush();
+    m_rbDeltaM.Flush();
+    m_nRunningAverage = 0;
+}
 
-    if (nDirection < 0) 
-    {    
-        while (nOrder--)
-        {
-            EXPAND_16_TIMES(*pM++ += *pAdapt++;)
-        }
-    }
-    else if (nDirection > 0)
-    {
-        while (nOrder--)
-        {
-            EXPAND_16_TIMES(*pM++ -= *pAdapt++;)
-        }
-    }
+template <int ORDER, int SHIFT> void CNNFilterFast<ORDER, SHIFT>::SaveState(CDecoderStateWriter & Writer)
+{
+    Writer.Write(&m_paryM[0], ORDER * sizeof(short));
+    m_rbInput.SaveState(Writer);
+    m_rbDeltaM.SaveState(Writer);
+    Writer.WriteValue(m_nRunningAverage);
 }
 
-int CNNFilter::CalculateDotProduct(short * pA, short * pB, int nOrder)
+template <int ORDER, int SHIFT> void CNNFilterFast<ORDER, SHIFT>::LoadState(CDecoderStateReader & Reader)
 {
-    int nDotProduct = 0;
-    nOrder >>= 4;
+    Reader.Read(&m_paryM[0], ORDER * sizeof(short));
+    m_rbInput.LoadState(Reader);
+    m_rbDeltaM.LoadState(Reader);
+    m_nRunningAverage = Reader.ReadValue<int>();
+}
 
-    while (nOrder--)
+template <int ORDER, int SHIFT> template <int KERNEL, BOOL ADAPT_3980> __forceinline void CNNFilterFast<ORDER, SHIFT>::DecompressArrayTemplate(int * pData, int nElements)
+{
+    while (nElements > 0)
     {
-        EXPAND_16_TIMES(nDotProduct += *pA++ * *pB++;)
-    }
-    
-    return nDotProduct;
-}
+        // both buffers move together, so they run out of window together
+        int nRunElements = min(nElements, m_rbInput.GetWindowElementsLeft());
 
-void CNNFilter::AdaptSSE(short * pM, short * pAdapt, int nDirection, int nOrder)
-{
-    // we require that pM is aligned, allowing faster loads and stores
-//    ASSERT((size_t(pM) % 16) == 0);
-//
-//    if (nDirection < 0) 
-//    {    
-//        for (int z = 0; z < nOrder; z += 8)
-//        {
-//            __m128i sseM = _mm_load_si128((__m128i *) &pM[z]);
-//            __m128i sseAdapt = _mm_loadu_si128((__m128i *) &pAdapt[z]);
-//            __m128i sseNew = _mm_add_epi16(sseM, sseAdapt);
-//            _mm_store_si128((__m128i *) &pM[z], sseNew);
-//        }
-//    }
-//    else if (nDirection > 0)
-//    {
-//        for (int z = 0; z < nOrder; z += 8)
-//        {
-//            __m128i sseM = _mm_load_si128((__m128i *) &pM[z]);
-//            __m128i sseAdapt = _mm_loadu_si128((__m128i *) &pAdapt[z]);
-//            __m128i sseNew = _mm_sub_epi16(sseM, sseAdapt);
-//            _mm_store_si128((__m128i *) &pM[z], sseNew);
-//        }
-//    }
-    
-    if (nDirection < 0) {
-        for (int z=0; z<nOrder; z++) {
-            pM[z] += pAdapt[z];
+        for (int z = 0; z < nRunElements; z++)
+        {
+            int nInput = pData[z];
+
+            // figure a dot product and adapt
+            int nDotProduct = CalculateDotProduct<KERNEL, ORDER>(&m_rbInput[-ORDER], &m_paryM[0], ORDER);
+            Adapt<KERNEL, ORDER>(&m_paryM[0], &m_rbDeltaM[-ORDER], nInput, ORDER);
+
+            // store the output value
+            int nOutput = nInput + ((nDotProduct + (1 << (SHIFT - 1))) >> SHIFT);
+
+            // update the input buffer
+            m_rbInput[0] = short((nOutput == short(nOutput)) ? nOutput : (nOutput >> 31) ^ 0x7FFF);
+
+            if (ADAPT_3980)
+            {
+                int nTempABS = abs(nOutput);
+
+                if (nTempABS > (m_nRunningAverage * 3))
+                    m_rbDeltaM[0] = ((nOutput >> 25) & 64) - 32;
+                else if (nTempABS > (m_nRunningAverage * 4) / 3)
+                    m_rbDeltaM[0] = ((nOutput >> 26) & 32) - 16;
+                else if (nTempABS > 0)
+                    m_rbDeltaM[0] = ((nOutput >> 27) & 16) - 8;
+                else
+                    m_rbDeltaM[0] = 0;
+
+                m_nRunningAverage += (nTempABS - m_nRunningAverage) / 16;
+
+                m_rbDeltaM[-1] >>= 1;
+                m_rbDeltaM[-2] >>= 1;
+                m_rbDeltaM[-8] >>= 1;
+            }
+            else
+            {
+                m_rbDeltaM[0] = (nOutput == 0) ? 0 : ((nOutput >> 28) & 8) - 4;
+                m_rbDeltaM[-4] >>= 1;
+                m_rbDeltaM[-8] >>= 1;
+            }
+
+            m_rbInput.IncrementFast();
+            m_rbDeltaM.IncrementFast();
+
+            pData[z] = nOutput;
         }
-    } else if (nDirection > 0) {
-        for (int z=0; z<nOrder; z++) {
-            pM[z] -= pAdapt[z];
+
+        if (m_rbInput.GetWindowElementsLeft() == 0)
+        {
+            m_rbInput.Roll();
+            m_rbDeltaM.Roll();
         }
+
+        pData += nRunElements;
+        nElements -= nRunElements;
     }
 }
 
-#define vUInt8 __m123i 
-    
-int CNNFilter::CalculateDotProductSSE(short * pA, short * pB, int nOrder)
+#ifdef ENABLE_AVX_ASSEMBLY
+template <int ORDER, int SHIFT> template <BOOL ADAPT_3980> AVX2_TARGET void CNNFilterFast<ORDER, SHIFT>::DecompressArrayAVX2(int * pData, int nElements)
 {
-    // we require that pB is aligned, allowing faster loads
-    ASSERT((size_t(pB) % 16) == 0);
-
-//    // loop
-//    __m128i sseSum = _mm_setzero_si128();
-//    for (int z = 0; z < nOrder; z += 8)
-//    {
-//        __m128i sseA = _mm_loadu_si128((__m128i *) &pA[z]);
-//        __m128i sseB = _mm_load_si128((__m128i *) &pB[z]);
-//        __m128i sseDotProduct = _mm_madd_epi16(sseA, sseB);
-//        sseSum = _mm_add_epi32(sseSum, sseDotProduct);
-//    }
-//
-//    // build output
-//    int nDotProduct = sseSum.m128i_i32[0] + sseSum.m128i_i32[1] + sseSum.m128i_i32[2] + sseSum.m128i_i32[3];
-//  return nDotProduct;
-    
-    // TODO: SSE4 instructions might help performance of the horizontal add, for example:
-    //int nDotProduct = _mm_extract_epi32(sseSum, 0) + _mm_extract_epi32(sseSum, 1) + _mm_extract_epi32(sseSum, 2) + _mm_extract_epi32(sseSum, 3);
-    int32 intSum = 0;
-    short sum[2];
-    for (int z=0; z<nOrder; z+=2) {
-        sum[0] = pA[z] + pB[z];
-        sum[1] = pA[z+1] + pB[z+1];
-        intSum += *((int32 *)sum);
-    }
-    return intSum;
-    
+    // the whole loop is built for AVX2 so the kernels inline into it
+    DecompressArrayTemplate<NN_KERNEL_AVX2, ADAPT_3980>(pData, nElements);
 }
+#else
+template <int ORDER, int SHIFT> template <BOOL ADAPT_3980> void CNNFilterFast<ORDER, SHIFT>::DecompressArrayAVX2(int * pData, int nElements)
+{
+    DecompressArrayTemplate<NN_KERNEL_PORTABLE, ADAPT_3980>(pData, nElements);
+}
+#endif
+
+// the order / shift pairs the format uses
+template class CNNFilterFast<16, 11>;
+template class CNNFilterFast<64, 11>;
+template class CNNFilterFast<256, 13>;
+template class CNNFilterFast<32, 10>;
+template class CNNFilterFast<1280, 15>;
 
 }
\ No newline at end of file
@@ -1,27 +1,40 @@
 #pragma once
 
+#include "RollBuffer.h"
+
 namespace APE_MONKEY
 {
 
-#include "RollBuffer.h"
 #include "NoWindows.h"
 #define NN_WINDOW_ELEMENTS    512
 
+// the dot product / adapt kernels (see CNNFilter::DecompressArrayTemplate(...))
+#define NN_KERNEL_PORTABLE    0
+#define NN_KERNEL_SSE         1
+#define NN_KERNEL_AVX2        2
+#define NN_KERNEL_NEON        3
+#define NN_KERNEL_BEST        -1    // the fastest one this CPU has
+
 class CNNFilter
 {
 public:
-    CNNFilter(int nOrder, int nShift, int nVersion);
+    // nKernel is NN_KERNEL_BEST or a kernel the CPU has (forcing one is for testing)
+    CNNFilter(int nOrder, int nShift, int nVersion, int nKernel = NN_KERNEL_BEST);
     ~CNNFilter();
 
     int Compress(int nInput);
     int Decompress(int nInput);
+    void DecompressArray(int * pData, int nElements);
     void Flush();
 
+    // coefficients, history and running average (everything Decompress(...) carries along)
+    void SaveState(CDecoderStateWriter & Writer);
+    void LoadState(CDecoderStateReader & Reader);
+
 private:
     int m_nOrder;
     int m_nShift;
     int m_nVersion;
-    BOOL m_bSSEAvailable;
     int m_nRunningAverage;
 
     APE_MONKEY::CRollBuffer<short> m_rbInput;
@@ -29,16 +42,53 @@ private:
 
     short * m_paryM;
 
+    // the loop for this CPU and version, and the kernels Compress(...) uses (picked by the
+    // constructor from the ones NNFilter.cpp shares with CNNFilterFast)
+    void (CNNFilter::* m_pDecompressArray)(int * pData, int nElements);
+    template <int KERNEL, BOOL ADAPT_3980> void DecompressArrayTemplate(int * pData, int nElements);
+    template <BOOL ADAPT_3980> void DecompressArrayAVX2(int * pData, int nElements);
+    int (* m_pCalculateDotProduct)(const short * pA, const short * pB, int nOrder);
+    void (* m_pAdapt)(short * pM, const short * pAdapt, int nDirection, int nOrder);
+
     __forceinline short GetSaturatedShortFromInt(int nValue) const
     {
         return short((nValue == short(nValue)) ? nValue : (nValue >> 31) ^ 0x7FFF);
     }
+};
+
+/*************************************************************************************************
+CNNFilterFast - CNNFilter's decompression for one of the order / shift pairs the format uses
+(16/11, 64/11, 256/13, 32/10 and 1280/15; NNFilter.cpp builds those)
+
+The order is a constant, so the dot product and adapt kernels unroll, the coefficients live in
+the object and the history is in fixed size roll buffers that are only checked for a roll once
+per run of samples.  The results and the saved state are the same as CNNFilter's.
+*************************************************************************************************/
+template <int ORDER, int SHIFT> class CNNFilterFast
+{
+public:
+    CNNFilterFast(int nVersion, int nKernel = NN_KERNEL_BEST);
+
+    void DecompressArray(int * pData, int nElements) { (this->*m_pDecompressArray)(pData, nElements); }
+    void Flush();
+
+    void SaveState(CDecoderStateWriter & Writer);
+    void LoadState(CDecoderStateReader & Reader);
+
+private:
+    int m_nRunningAverage;
+
+    APE_MONKEY::CRollBufferFast<short, NN_WINDOW_ELEMENTS, ORDER> m_rbInput;
+    APE_MONKEY::CRollBufferFast<short, NN_WINDOW_ELEMENTS, ORDER> m_rbDeltaM;
+
+    // the coefficients (m_paryM is into m_aryMStorage, aligned for SSE / AVX2)
+    short m_aryMStorage[ORDER + 16];
+    short * m_paryM;
 
-    __forceinline void Adapt(short * pM, short * pAdapt, int nDirection, int nOrder);
-    __forceinline int CalculateDotProduct(short * pA, short * pB, int nOrder);
-    
-    __forceinline void AdaptSSE(short * pM, short * pAdapt, int nDirection, int nOrder);
-    __forceinline int CalculateDotProductSSE(short * pA, short * pB, int nOrder);
+    // the loop for this CPU and version (picked by the constructor)
+    void (CNNFilterFast::* m_pDecompressArray)(int * pData, int nElements);
+    template <int KERNEL, BOOL ADAPT_3980> void DecompressArrayTemplate(int * pData, int nElements);
+    template <BOOL ADAPT_3980> void DecompressArrayAVX2(int * pData, int nElements);
 };
 
 }
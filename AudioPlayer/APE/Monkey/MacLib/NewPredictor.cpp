@@ -205,6 +205,30 @@ int CPredictorDecompressNormal3930to3950::Flush()
     return ERROR_SUCCESS;
 }
 
+void CPredictorDecompressNormal3930to3950::SaveState(CDecoderStateWriter & Writer)
+{
+    if (m_pNNFilter) m_pNNFilter->SaveState(Writer);
+    if (m_pNNFilter1) m_pNNFilter1->SaveState(Writer);
+
+    Writer.Write(&m_pInputBuffer[-HISTORY_ELEMENTS], HISTORY_ELEMENTS * sizeof(int));
+    Writer.Write(&m_aryM[0], M_COUNT * sizeof(int));
+    Writer.WriteValue(m_nLastValue);
+}
+
+void CPredictorDecompressNormal3930to3950::LoadState(CDecoderStateReader & Reader)
+{
+    if (m_pNNFilter) m_pNNFilter->LoadState(Reader);
+    if (m_pNNFilter1) m_pNNFilter1->LoadState(Reader);
+
+    // the history goes back to the start of the window
+    Reader.Read(&m_pBuffer[0][0], HISTORY_ELEMENTS * sizeof(int));
+    m_pInputBuffer = &m_pBuffer[0][HISTORY_ELEMENTS];
+    m_nCurrentIndex = 0;
+
+    Reader.Read(&m_aryM[0], M_COUNT * sizeof(int));
+    m_nLastValue = Reader.ReadValue<int>();
+}
+
 int CPredictorDecompressNormal3930to3950::DecompressValue(int nInput, int)
 {
     if (m_nCurrentIndex == WINDOW_BLOCKS)
@@ -258,43 +282,23 @@ int CPredictorDecompressNormal3930to3950::DecompressValue(int nInput, int)
 /*****************************************************************************************
 CPredictorDecompress3950toCurrent
 *****************************************************************************************/
+// insane was always decoded with the current NN filter adapt, whatever the file version
+#define NN_FILTER_VERSION(LEVEL, VERSION) (((LEVEL) == COMPRESSION_LEVEL_INSANE) ? MAC_FILE_VERSION_NUMBER : (VERSION))
+
 CPredictorDecompress3950toCurrent::CPredictorDecompress3950toCurrent(int nCompressionLevel, int nVersion) 
-    : IPredictorDecompress(nCompressionLevel, nVersion)
+    : IPredictorDecompress(nCompressionLevel, nVersion),
+    m_NNFilter16(NN_FILTER_VERSION(nCompressionLevel, nVersion)),
+    m_NNFilter64(NN_FILTER_VERSION(nCompressionLevel, nVersion)),
+    m_NNFilter32(NN_FILTER_VERSION(nCompressionLevel, nVersion)),
+    m_NNFilter256(NN_FILTER_VERSION(nCompressionLevel, nVersion)),
+    m_NNFilter1280(NN_FILTER_VERSION(nCompressionLevel, nVersion))
 {
     m_nVersion = nVersion;
+    m_nCompressionLevel = nCompressionLevel;
 
-    if (nCompressionLevel == COMPRESSION_LEVEL_FAST)
-    {
-        m_pNNFilter = NULL;
-        m_pNNFilter1 = NULL;
-        m_pNNFilter2 = NULL;
-    }
-    else if (nCompressionLevel == COMPRESSION_LEVEL_NORMAL)
-    {
-        m_pNNFilter = new CNNFilter(16, 11, nVersion);
-        m_pNNFilter1 = NULL;
-        m_pNNFilter2 = NULL;
-    }
-    else if (nCompressionLevel == COMPRESSION_LEVEL_HIGH)
-    {
-        m_pNNFilter = new CNNFilter(64, 11, nVersion);
-        m_pNNFilter1 = NULL;
-        m_pNNFilter2 = NULL;
-    }
-    else if (nCompressionLevel == COMPRESSION_LEVEL_EXTRA_HIGH)
-    {
-        m_pNNFilter = new CNNFilter(256, 13, nVersion);
-        m_pNNFilter1 = new CNNFilter(32, 10, nVersion);
-        m_pNNFilter2 = NULL;
-    }
-    else if (nCompressionLevel == COMPRESSION_LEVEL_INSANE)
-    {
-        m_pNNFilter = new CNNFilter(1024 + 256, 15, MAC_FILE_VERSION_NUMBER);
-        m_pNNFilter1 = new CNNFilter(256, 13, MAC_FILE_VERSION_NUMBER);
-        m_pNNFilter2 = new CNNFilter(16, 11, MAC_FILE_VERSION_NUMBER);
-
-    }
-    else
+    if ((nCompressionLevel != COMPRESSION_LEVEL_FAST) && (nCompressionLevel != COMPRESSION_LEVEL_NORMAL) &&
+        (nCompressionLevel != COMPRESSION_LEVEL_HIGH) && (nCompressionLevel != COMPRESSION_LEVEL_EXTRA_HIGH) &&
+        (nCompressionLevel != COMPRESSION_LEVEL_INSANE))
     {
         throw(1);
     }
@@ -302,16 +306,17 @@ CPredictorDecompress3950toCurrent::CPredictorDecompress3950toCurrent(int nCompre
 
 CPredictorDecompress3950toCurrent::~CPredictorDecompress3950toCurrent()
 {
-    SAFE_DELETE(m_pNNFilter)
-    SAFE_DELETE(m_pNNFilter1)
-    SAFE_DELETE(m_pNNFilter2)
 }
     
 int CPredictorDecompress3950toCurrent::Flush()
 {
-    if (m_pNNFilter) m_pNNFilter->Flush();
-    if (m_pNNFilter1) m_pNNFilter1->Flush();
-    if (m_pNNFilter2) m_pNNFilter2->Flush();
+    switch (m_nCompressionLevel)
+    {
+        case COMPRESSION_LEVEL_NORMAL: m_NNFilter16.Flush(); break;
+        case COMPRESSION_LEVEL_HIGH: m_NNFilter64.Flush(); break;
+        case COMPRESSION_LEVEL_EXTRA_HIGH: m_NNFilter256.Flush(); m_NNFilter32.Flush(); break;
+        case COMPRESSION_LEVEL_INSANE: m_NNFilter1280.Flush(); m_NNFilter256.Flush(); m_NNFilter16.Flush(); break;
+    }
 
     ZeroMemory(m_aryMA, sizeof(m_aryMA));
     ZeroMemory(m_aryMB, sizeof(m_aryMB));
@@ -336,7 +341,103 @@ int CPredictorDecompress3950toCurrent::Flush()
     return ERROR_SUCCESS;
 }
 
+void CPredictorDecompress3950toCurrent::SaveState(CDecoderStateWriter & Writer)
+{
+    // largest filter first (the order the pointers used to be saved in)
+    switch (m_nCompressionLevel)
+    {
+        case COMPRESSION_LEVEL_NORMAL: m_NNFilter16.SaveState(Writer); break;
+        case COMPRESSION_LEVEL_HIGH: m_NNFilter64.SaveState(Writer); break;
+        case COMPRESSION_LEVEL_EXTRA_HIGH: m_NNFilter256.SaveState(Writer); m_NNFilter32.SaveState(Writer); break;
+        case COMPRESSION_LEVEL_INSANE: m_NNFilter1280.SaveState(Writer); m_NNFilter256.SaveState(Writer); m_NNFilter16.SaveState(Writer); break;
+    }
+
+    Writer.Write(&m_aryMA[0], M_COUNT * sizeof(int));
+    Writer.Write(&m_aryMB[0], M_COUNT * sizeof(int));
+    m_rbPredictionA.SaveState(Writer);
+    m_rbPredictionB.SaveState(Writer);
+    m_rbAdaptA.SaveState(Writer);
+    m_rbAdaptB.SaveState(Writer);
+    m_Stage1FilterA.SaveState(Writer);
+    m_Stage1FilterB.SaveState(Writer);
+    Writer.WriteValue(m_nLastValueA);
+}
+
+void CPredictorDecompress3950toCurrent::LoadState(CDecoderStateReader & Reader)
+{
+    switch (m_nCompressionLevel)
+    {
+        case COMPRESSION_LEVEL_NORMAL: m_NNFilter16.LoadState(Reader); break;
+        case COMPRESSION_LEVEL_HIGH: m_NNFilter64.LoadState(Reader); break;
+        case COMPRESSION_LEVEL_EXTRA_HIGH: m_NNFilter256.LoadState(Reader); m_NNFilter32.LoadState(Reader); break;
+        case COMPRESSION_LEVEL_INSANE: m_NNFilter1280.LoadState(Reader); m_NNFilter256.LoadState(Reader); m_NNFilter16.LoadState(Reader); break;
+    }
+
+    Reader.Read(&m_aryMA[0], M_COUNT * sizeof(int));
+    Reader.Read(&m_aryMB[0], M_COUNT * sizeof(int));
+    m_rbPredictionA.LoadState(Reader);
+    m_rbPredictionB.LoadState(Reader);
+    m_rbAdaptA.LoadState(Reader);
+    m_rbAdaptB.LoadState(Reader);
+    m_Stage1FilterA.LoadState(Reader);
+    m_Stage1FilterB.LoadState(Reader);
+    m_nLastValueA = Reader.ReadValue<int>();
+
+    // the roll buffers were put back at the start of their windows
+    m_nCurrentIndex = 0;
+}
+
 int CPredictorDecompress3950toCurrent::DecompressValue(int nA, int nB)
+{
+    // stage 2: NNFilter
+    DecompressNNFilters(&nA, 1);
+
+    // stage 1
+    return DecompressStage1(nA, nB);
+}
+
+void CPredictorDecompress3950toCurrent::DecompressNNFilters(int * pData, int nElements)
+{
+    // stage 2: NNFilter (each filter only depends on its own output, so it can run over the whole
+    // array; smallest filter first)
+    switch (m_nCompressionLevel)
+    {
+        case COMPRESSION_LEVEL_NORMAL:
+            m_NNFilter16.DecompressArray(pData, nElements);
+            break;
+        case COMPRESSION_LEVEL_HIGH:
+            m_NNFilter64.DecompressArray(pData, nElements);
+            break;
+        case COMPRESSION_LEVEL_EXTRA_HIGH:
+            m_NNFilter32.DecompressArray(pData, nElements);
+            m_NNFilter256.DecompressArray(pData, nElements);
+            break;
+        case COMPRESSION_LEVEL_INSANE:
+            m_NNFilter16.DecompressArray(pData, nElements);
+            m_NNFilter256.DecompressArray(pData, nElements);
+            m_NNFilter1280.DecompressArray(pData, nElements);
+            break;
+    }
+}
+
+void CPredictorDecompress3950toCurrent::DecompressPrediction(int * pData, int nElements)
+{
+    for (int z = 0; z < nElements; z++)
+        pData[z] = DecompressStage1(pData[z], 0);
+}
+
+void CPredictorDecompress3950toCurrent::DecompressPredictionStereo(CPredictorDecompress3950toCurrent * pPredictorX, CPredictorDecompress3950toCurrent * pPredictorY, int * pDataX, int * pDataY, int nElements, int & nLastX)
+{
+    // Y is predicted from the last X and X from the current Y, so the two channels have to be interleaved here
+    for (int z = 0; z < nElements; z++)
+    {
+        pDataY[z] = pPredictorY->DecompressStage1(pDataY[z], nLastX);
+        pDataX[z] = pPredictorX->DecompressStage1(pDataX[z], pDataY[z]);
+        nLastX = pDataX[z];
+    }
+}
+
+int CPredictorDecompress3950toCurrent::DecompressStage1(int nA, int nB)
 {
     if (m_nCurrentIndex == WINDOW_BLOCKS)
     {
@@ -347,14 +448,6 @@ int CPredictorDecompress3950toCurrent::DecompressValue(int nA, int nB)
         m_nCurrentIndex = 0;
     }
 
-    // stage 2: NNFilter
-    if (m_pNNFilter2)
-        nA = m_pNNFilter2->Decompress(nA);
-    if (m_pNNFilter1)
-        nA = m_pNNFilter1->Decompress(nA);
-    if (m_pNNFilter)
-        nA = m_pNNFilter->Decompress(nA);
-
     // stage 1: multiple predictors (order 2 and offset 1)
     m_rbPredictionA[0] = m_nLastValueA;
     m_rbPredictionA[-1] = m_rbPredictionA[0] - m_rbPredictionA[-1];
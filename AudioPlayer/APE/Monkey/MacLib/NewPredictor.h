@@ -56,6 +56,9 @@ public:
     int DecompressValue(int nInput, int);
     int Flush();
 
+    void SaveState(CDecoderStateWriter & Writer);
+    void LoadState(CDecoderStateReader & Reader);
+
 protected:
     // buffer information
     int * m_pBuffer[BUFFER_COUNT];
@@ -82,7 +85,17 @@ public:
     int DecompressValue(int nA, int nB = 0);
     int Flush();
 
+    void SaveState(CDecoderStateWriter & Writer);
+    void LoadState(CDecoderStateReader & Reader);
+
+    // staged decoding (stage 2 over a whole array of residuals, then stage 1 over the result)
+    void DecompressNNFilters(int * pData, int nElements);
+    void DecompressPrediction(int * pData, int nElements);
+    static void DecompressPredictionStereo(CPredictorDecompress3950toCurrent * pPredictorX, CPredictorDecompress3950toCurrent * pPredictorY, int * pDataX, int * pDataY, int nElements, int & nLastX);
+
 protected:
+    __forceinline int DecompressStage1(int nA, int nB);
+
     // adaption
     int m_aryMA[M_COUNT];
     int m_aryMB[M_COUNT];
@@ -101,9 +114,14 @@ protected:
     int m_nCurrentIndex;
     int m_nLastValueA;
     int m_nVersion;
-    CNNFilter * m_pNNFilter;
-    CNNFilter * m_pNNFilter1;
-    CNNFilter * m_pNNFilter2;
+
+    // stage 2 (which filters run depends on the compression level, see DecompressNNFilters(...))
+    int m_nCompressionLevel;
+    CNNFilterFast<16, 11> m_NNFilter16;
+    CNNFilterFast<64, 11> m_NNFilter64;
+    CNNFilterFast<32, 10> m_NNFilter32;
+    CNNFilterFast<256, 13> m_NNFilter256;
+    CNNFilterFast<1280, 15> m_NNFilter1280;
 };
 
 }
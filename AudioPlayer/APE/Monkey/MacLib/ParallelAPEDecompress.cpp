@@ -0,0 +1,393 @@
+#include "All.h"
+#include "ParallelAPEDecompress.h"
+#include "APEDecompress.h"
+#include "APEInfo.h"
+
+namespace APE_MONKEY
+{
+
+#define MAX_PARALLEL_DECOMPRESS_THREADS     64
+
+CParallelAPEDecompress::CParallelAPEDecompress(int * pErrorCode, const str_utf16 * pFilename, int nThreads)
+{
+    *pErrorCode = ERROR_SUCCESS;
+
+    // initialize (the synchronization objects first, so the destructor is always safe)
+    pthread_mutex_init(&m_Mutex, NULL);
+    pthread_cond_init(&m_condWork, NULL);
+    pthread_cond_init(&m_condReady, NULL);
+    m_nWorkers = 0;
+    m_nSlots = 0;
+    m_nOutputFrame = 0;
+    m_nOutputFrameOffsetBlocks = 0;
+    m_nNextDecodeFrame = 0;
+    m_nActiveWorkers = 0;
+    m_bPaused = FALSE;
+    m_bQuit = FALSE;
+    m_nCurrentBlock = 0;
+    m_nBlockAlign = 0;
+    m_nOutputFormat = APE_OUTPUT_NATIVE;
+    m_nOutputBlockAlign = 0;
+    m_pConvertBlocks = NULL;
+
+    // open the file for ourselves (for GetInfo(...) on the calling thread)
+    m_spAPEInfo.Assign(new CAPEInfo(pErrorCode, pFilename));
+    if (*pErrorCode != ERROR_SUCCESS)
+        return;
+
+    if (m_spAPEInfo->GetInfo(APE_INFO_FILE_VERSION) < 3930)
+    {
+        *pErrorCode = ERROR_UPSUPPORTED_FILE_VERSION;
+        return;
+    }
+
+    m_nBlockAlign = (int) m_spAPEInfo->GetInfo(APE_INFO_BLOCK_ALIGN);
+    m_nOutputBlockAlign = m_nBlockAlign;
+    m_nBlocksPerFrame = (int) m_spAPEInfo->GetInfo(APE_INFO_BLOCKS_PER_FRAME);
+    m_nTotalFrames = (int) m_spAPEInfo->GetInfo(APE_INFO_TOTAL_FRAMES);
+    m_nTotalBlocks = m_spAPEInfo->GetInfo(APE_INFO_TOTAL_BLOCKS);
+    if ((m_nBlockAlign <= 0) || (m_nBlocksPerFrame <= 0) || (m_nTotalFrames <= 0))
+    {
+        *pErrorCode = ERROR_INVALID_INPUT_FILE;
+        return;
+    }
+
+    // figure the number of workers (no point in more workers than frames)
+    if (nThreads <= 0)
+        nThreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    nThreads = max(1, min(nThreads, MAX_PARALLEL_DECOMPRESS_THREADS));
+    nThreads = min(nThreads, m_nTotalFrames);
+
+    // two slots per worker keeps every worker busy while the caller drains the oldest frame
+    m_nSlots = min(nThreads * 2, m_nTotalFrames);
+    m_spSlots.Assign(new FRAME_SLOT [m_nSlots], TRUE);
+    for (int z = 0; z < m_nSlots; z++)
+    {
+        m_spSlots[z].pBuffer = NULL;
+        m_spSlots[z].nFrame = -1;
+        m_spSlots[z].nBlocks = 0;
+        m_spSlots[z].nResult = ERROR_SUCCESS;
+        m_spSlots[z].bReady = FALSE;
+    }
+    for (int z = 0; z < m_nSlots; z++)
+    {
+        m_spSlots[z].pBuffer = new unsigned char [m_nBlocksPerFrame * m_nBlockAlign];
+        if (m_spSlots[z].pBuffer == NULL)
+        {
+            *pErrorCode = ERROR_INSUFFICIENT_MEMORY;
+            return;
+        }
+    }
+
+    // create the workers (each with its own file handle and decoding state)
+    m_spWorkers.Assign(new WORKER [nThreads], TRUE);
+    for (int z = 0; z < nThreads; z++)
+    {
+        WORKER * pWorker = &m_spWorkers[z];
+        pWorker->pOwner = this;
+        pWorker->pDecompress = NULL;
+        pWorker->bThreadCreated = FALSE;
+        m_nWorkers++;
+
+        int nErrorCode = ERROR_SUCCESS;
+        CAPEInfo * pAPEInfo = new CAPEInfo(&nErrorCode, pFilename);
+        if (nErrorCode != ERROR_SUCCESS)
+        {
+            delete pAPEInfo;
+            *pErrorCode = nErrorCode;
+            return;
+        }
+
+        // the decompressor eats the CAPEInfo object
+        pWorker->pDecompress = new CAPEDecompress(&nErrorCode, pAPEInfo);
+        if (nErrorCode != ERROR_SUCCESS)
+        {
+            *pErrorCode = nErrorCode;
+            return;
+        }
+
+        if (pthread_create(&pWorker->hThread, NULL, WorkerThread, pWorker) != 0)
+        {
+            *pErrorCode = ERROR_UNDEFINED;
+            return;
+        }
+        pWorker->bThreadCreated = TRUE;
+    }
+}
+
+CParallelAPEDecompress::~CParallelAPEDecompress()
+{
+    StopWorkers();
+
+    for (int z = 0; z < m_nWorkers; z++)
+        SAFE_DELETE(m_spWorkers[z].pDecompress)
+
+    for (int z = 0; z < m_nSlots; z++)
+        SAFE_ARRAY_DELETE(m_spSlots[z].pBuffer)
+
+    pthread_cond_destroy(&m_condReady);
+    pthread_cond_destroy(&m_condWork);
+    pthread_mutex_destroy(&m_Mutex);
+}
+
+void CParallelAPEDecompress::StopWorkers()
+{
+    pthread_mutex_lock(&m_Mutex);
+    m_bQuit = TRUE;
+    pthread_cond_broadcast(&m_condWork);
+    pthread_mutex_unlock(&m_Mutex);
+
+    for (int z = 0; z < m_nWorkers; z++)
+    {
+        if (m_spWorkers[z].bThreadCreated)
+        {
+            pthread_join(m_spWorkers[z].hThread, NULL);
+            m_spWorkers[z].bThreadCreated = FALSE;
+        }
+    }
+}
+
+/*****************************************************************************************
+Worker threads -- take the next frame in order (as long as its slot has been drained),
+decode it outside the lock, then mark the slot ready
+*****************************************************************************************/
+void * CParallelAPEDecompress::WorkerThread(void * pParam)
+{
+    WORKER * pWorker = (WORKER *) pParam;
+    pWorker->pOwner->WorkerLoop(pWorker);
+    return NULL;
+}
+
+void CParallelAPEDecompress::WorkerLoop(WORKER * pWorker)
+{
+    pthread_mutex_lock(&m_Mutex);
+    while (TRUE)
+    {
+        while ((m_bQuit == FALSE) && (m_bPaused || (m_nNextDecodeFrame >= m_nTotalFrames) || (m_nNextDecodeFrame >= m_nOutputFrame + m_nSlots)))
+            pthread_cond_wait(&m_condWork, &m_Mutex);
+        if (m_bQuit)
+            break;
+
+        int nFrame = m_nNextDecodeFrame++;
+        FRAME_SLOT * pSlot = &m_spSlots[nFrame % m_nSlots];
+        m_nActiveWorkers++;
+        pthread_mutex_unlock(&m_Mutex);
+
+        int nBlocks = 0;
+        int nResult = ERROR_SUCCESS;
+        try
+        {
+            nResult = pWorker->pDecompress->DecodeFrame(nFrame, pSlot->pBuffer, &nBlocks);
+        }
+        catch(...)
+        {
+            nResult = ERROR_DECOMPRESSING_FRAME;
+            nBlocks = 0;
+        }
+
+        // a frame that didn't decode at all (DecodeFrame(...) threw or gave up before decoding)
+        // is silence, like one that fails its CRC, so the output doesn't stop at it
+        if (nBlocks <= 0)
+        {
+            nBlocks = (int) pWorker->pDecompress->GetInfo(APE_INFO_FRAME_BLOCKS, nFrame);
+            memset(pSlot->pBuffer, (pWorker->pDecompress->GetInfo(APE_INFO_BITS_PER_SAMPLE) == 8) ? 127 : 0, nBlocks * m_nBlockAlign);
+        }
+
+        pthread_mutex_lock(&m_Mutex);
+        m_nActiveWorkers--;
+        pSlot->nFrame = nFrame;
+        pSlot->nBlocks = nBlocks;
+        pSlot->nResult = nResult;
+        pSlot->bReady = TRUE;
+        pthread_cond_broadcast(&m_condReady);
+    }
+    pthread_mutex_unlock(&m_Mutex);
+}
+
+int CParallelAPEDecompress::GetData(char * pBuffer, int nBlocks, int * pBlocksRetrieved)
+{
+    int nRetVal = ERROR_SUCCESS;
+    if (pBlocksRetrieved) *pBlocksRetrieved = 0;
+    if (m_nSlots <= 0)
+        return ERROR_UNDEFINED;
+
+    // cap (planar output moves on a sample per block, with each channel nBlocks samples after
+    // the one before it)
+    int nBlocksLeft = (int) min((unsigned long long) max(nBlocks, 0), m_nTotalBlocks - m_nCurrentBlock);
+    unsigned char * pOutputBuffer = (unsigned char *) pBuffer;
+    const int nOutputStep = (m_nOutputFormat & APE_OUTPUT_PLANAR) ? 4 : m_nOutputBlockAlign;
+    int nBlocksRetrieved = 0;
+
+    pthread_mutex_lock(&m_Mutex);
+    while (nBlocksLeft > 0)
+    {
+        // wait for the next frame in order
+        FRAME_SLOT * pSlot = &m_spSlots[m_nOutputFrame % m_nSlots];
+        while (pSlot->bReady == FALSE)
+            pthread_cond_wait(&m_condReady, &m_Mutex);
+
+        // report each frame's error once
+        if (pSlot->nResult != ERROR_SUCCESS)
+        {
+            nRetVal = pSlot->nResult;
+            pSlot->nResult = ERROR_SUCCESS;
+        }
+        if (pSlot->nBlocks <= m_nOutputFrameOffsetBlocks)
+            break;
+
+        // copy or convert (the slot belongs to us until we mark it as drained, so no need to hold the lock)
+        int nBlocksThisPass = min(nBlocksLeft, pSlot->nBlocks - m_nOutputFrameOffsetBlocks);
+        pthread_mutex_unlock(&m_Mutex);
+        if (m_pConvertBlocks == NULL)
+            memcpy(pOutputBuffer, &pSlot->pBuffer[m_nOutputFrameOffsetBlocks * m_nBlockAlign], nBlocksThisPass * m_nBlockAlign);
+        else
+            m_pConvertBlocks(&pSlot->pBuffer[m_nOutputFrameOffsetBlocks * m_nBlockAlign], nBlocksThisPass, pOutputBuffer, nBlocks);
+        pthread_mutex_lock(&m_Mutex);
+
+        pOutputBuffer += nBlocksThisPass * nOutputStep;
+        nBlocksLeft -= nBlocksThisPass;
+        nBlocksRetrieved += nBlocksThisPass;
+        m_nOutputFrameOffsetBlocks += nBlocksThisPass;
+
+        // hand the slot back to the workers once it's drained
+        if (m_nOutputFrameOffsetBlocks >= pSlot->nBlocks)
+        {
+            pSlot->bReady = FALSE;
+            m_nOutputFrame++;
+            m_nOutputFrameOffsetBlocks = 0;
+            pthread_cond_broadcast(&m_condWork);
+        }
+    }
+    pthread_mutex_unlock(&m_Mutex);
+
+    // update position
+    m_nCurrentBlock += nBlocksRetrieved;
+    if (pBlocksRetrieved)
+        *pBlocksRetrieved = nBlocksRetrieved;
+
+    return nRetVal;
+}
+
+int CParallelAPEDecompress::Seek(int nBlockOffset)
+{
+    if (m_nSlots <= 0)
+        return ERROR_UNDEFINED;
+
+    // cap (to prevent seeking too far)
+    if (nBlockOffset >= (int) m_nTotalBlocks)
+        nBlockOffset = (int) m_nTotalBlocks - 1;
+    if (nBlockOffset < 0)
+        nBlockOffset = 0;
+
+    pthread_mutex_lock(&m_Mutex);
+
+    // let the frames in flight finish, then throw away everything that's been decoded
+    m_bPaused = TRUE;
+    while (m_nActiveWorkers > 0)
+        pthread_cond_wait(&m_condReady, &m_Mutex);
+
+    for (int z = 0; z < m_nSlots; z++)
+        m_spSlots[z].bReady = FALSE;
+
+    // restart the workers at the new frame (whole frames are decoded, so the offset within the frame is free)
+    m_nOutputFrame = nBlockOffset / m_nBlocksPerFrame;
+    m_nOutputFrameOffsetBlocks = nBlockOffset % m_nBlocksPerFrame;
+    m_nNextDecodeFrame = m_nOutputFrame;
+    m_nCurrentBlock = nBlockOffset;
+    m_bPaused = FALSE;
+    pthread_cond_broadcast(&m_condWork);
+
+    pthread_mutex_unlock(&m_Mutex);
+
+    return ERROR_SUCCESS;
+}
+
+/*****************************************************************************************
+Output format
+*****************************************************************************************/
+int CParallelAPEDecompress::SetOutputFormat(int nFormat)
+{
+    if (m_nSlots <= 0)
+        return ERROR_UNDEFINED;
+
+    CONVERT_BLOCKS_PROC pConvertBlocks = NULL;
+    if (nFormat != APE_OUTPUT_NATIVE)
+    {
+        WAVEFORMATEX wfeInput;
+        m_spAPEInfo->GetInfo(APE_INFO_WAVEFORMATEX, (long) &wfeInput);
+        pConvertBlocks = CPrepare::GetConvertBlocks(&wfeInput, nFormat);
+        if (pConvertBlocks == NULL)
+            return ERROR_BAD_PARAMETER;
+    }
+
+    m_nOutputFormat = nFormat;
+    m_nOutputBlockAlign = (nFormat == APE_OUTPUT_NATIVE) ? m_nBlockAlign : 4 * (int) m_spAPEInfo->GetInfo(APE_INFO_CHANNELS);
+    m_pConvertBlocks = pConvertBlocks;
+    return ERROR_SUCCESS;
+}
+
+/*****************************************************************************************
+Get information from the decompressor
+*****************************************************************************************/
+unsigned long long CParallelAPEDecompress::GetInfo(APE_DECOMPRESS_FIELDS Field, unsigned long long nParam1, unsigned long long nParam2)
+{
+    unsigned long long nRetVal = 0;
+
+    switch (Field)
+    {
+    case APE_DECOMPRESS_CURRENT_BLOCK:
+        nRetVal = m_nCurrentBlock;
+        break;
+    case APE_DECOMPRESS_CURRENT_MS:
+    {
+        unsigned long nSampleRate = m_spAPEInfo->GetInfo(APE_INFO_SAMPLE_RATE, 0, 0);
+        if (nSampleRate > 0)
+            nRetVal = (unsigned long long)((double(m_nCurrentBlock) * double(1000)) / double(nSampleRate));
+        break;
+    }
+    case APE_DECOMPRESS_OUTPUT_FORMAT:
+        nRetVal = m_nOutputFormat;
+        break;
+    case APE_DECOMPRESS_OUTPUT_BLOCK_ALIGN:
+        nRetVal = m_nOutputBlockAlign;
+        break;
+    case APE_DECOMPRESS_TOTAL_BLOCKS:
+        nRetVal = m_nTotalBlocks;
+        break;
+    case APE_DECOMPRESS_LENGTH_MS:
+    {
+        unsigned long nSampleRate = m_spAPEInfo->GetInfo(APE_INFO_SAMPLE_RATE, 0, 0);
+        if (nSampleRate > 0)
+            nRetVal = (unsigned long long)((double(m_nTotalBlocks) * double(1000)) / double(nSampleRate));
+        break;
+    }
+    case APE_DECOMPRESS_CURRENT_BITRATE:
+        nRetVal = m_spAPEInfo->GetInfo(APE_INFO_FRAME_BITRATE, m_nOutputFrame);
+        break;
+    case APE_DECOMPRESS_AVERAGE_BITRATE:
+        nRetVal = m_spAPEInfo->GetInfo(APE_INFO_AVERAGE_BITRATE);
+        break;
+    case APE_DECOMPRESS_STAGE_TIMES:
+    {
+        // added up over the workers (they keep going in the background, so this is a snapshot)
+        APE_STAGE_TIMES * pTotal = (APE_STAGE_TIMES *) nParam1;
+        memset(pTotal, 0, sizeof(APE_STAGE_TIMES));
+        for (int z = 0; z < m_nWorkers; z++)
+        {
+            APE_STAGE_TIMES Times;
+            nRetVal = m_spWorkers[z].pDecompress->GetInfo(APE_DECOMPRESS_STAGE_TIMES, (unsigned long long) &Times);
+            pTotal->nRangeDecode += Times.nRangeDecode;
+            pTotal->nNNFilters += Times.nNNFilters;
+            pTotal->nPrediction += Times.nPrediction;
+            pTotal->nUnprepare += Times.nUnprepare;
+        }
+        break;
+    }
+    default:
+        nRetVal = m_spAPEInfo->GetInfo(Field, nParam1, nParam2);
+    }
+
+    return nRetVal;
+}
+
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <pthread.h>
+#include "MACLib.h"
+#include "Prepare.h"
+
+namespace APE_MONKEY
+{
+
+class CAPEInfo;
+class CAPEDecompress;
+
+/*************************************************************************************************
+CParallelAPEDecompress - decodes several frames at once on a pool of worker threads
+
+Frames are independent (StartFrame() flushes the predictors and the range coder, and the seek
+table gives the byte offset of every frame), so each worker owns a complete CAPEDecompress with
+its own file handle and decodes whole frames into a slot.  GetData(...) hands the slots out in
+frame order, so the caller sees exactly what CAPEDecompress would produce.
+*************************************************************************************************/
+class CParallelAPEDecompress : public IAPEDecompress
+{
+public:
+    CParallelAPEDecompress(int * pErrorCode, const str_utf16 * pFilename, int nThreads = 0);
+    ~CParallelAPEDecompress();
+
+    int GetData(char * pBuffer, int nBlocks, int * pBlocksRetrieved);
+    int Seek(int nBlockOffset);
+
+    unsigned long long GetInfo(APE_DECOMPRESS_FIELDS Field, unsigned long long nParam1 = 0, unsigned long long nParam2 = 0);
+
+    // 32-bit integer or float output (converted as the slots are handed out)
+    int SetOutputFormat(int nFormat);
+
+protected:
+    struct FRAME_SLOT
+    {
+        unsigned char * pBuffer;
+        int nFrame;
+        int nBlocks;
+        int nResult;
+        BOOL bReady;
+    };
+
+    struct WORKER
+    {
+        CParallelAPEDecompress * pOwner;
+        CAPEDecompress * pDecompress;
+        pthread_t hThread;
+        BOOL bThreadCreated;
+    };
+
+    static void * WorkerThread(void * pParam);
+    void WorkerLoop(WORKER * pWorker);
+    void StopWorkers();
+
+    // file info
+    CSmartPtr<CAPEInfo> m_spAPEInfo;
+    int m_nBlockAlign;
+    int m_nBlocksPerFrame;
+    int m_nTotalFrames;
+    unsigned long long m_nTotalBlocks;
+    unsigned long long m_nCurrentBlock;
+
+    // the format GetData(...) hands out (m_pConvertBlocks is NULL for APE_OUTPUT_NATIVE)
+    int m_nOutputFormat;
+    int m_nOutputBlockAlign;
+    CONVERT_BLOCKS_PROC m_pConvertBlocks;
+
+    // workers and the frame slots they decode into (frame N always goes in slot N % m_nSlots)
+    CSmartPtr<WORKER> m_spWorkers;
+    int m_nWorkers;
+    CSmartPtr<FRAME_SLOT> m_spSlots;
+    int m_nSlots;
+
+    // scheduling (everything below is guarded by m_Mutex)
+    pthread_mutex_t m_Mutex;
+    pthread_cond_t m_condWork;
+    pthread_cond_t m_condReady;
+    int m_nOutputFrame;
+    int m_nOutputFrameOffsetBlocks;
+    int m_nNextDecodeFrame;
+    int m_nActiveWorkers;
+    BOOL m_bPaused;
+    BOOL m_bQuit;
+};
+
+}
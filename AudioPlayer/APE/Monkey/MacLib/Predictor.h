@@ -1,5 +1,7 @@
 #pragma once
 
+#include "DecoderState.h"
+
 namespace APE_MONKEY
 {
 
@@ -27,6 +29,10 @@ public:
 
     virtual int DecompressValue(int nA, int nB = 0) = 0;
     virtual int Flush() = 0;
+
+    // save / restore everything DecompressValue(...) carries from one value to the next
+    virtual void SaveState(CDecoderStateWriter & Writer) = 0;
+    virtual void LoadState(CDecoderStateReader & Reader) = 0;
 };
 
 }
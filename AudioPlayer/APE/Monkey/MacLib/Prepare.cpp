@@ -1,6 +1,15 @@
 #include "All.h"
+#include "GlobalFunctions.h"
+#include "MACLib.h"
 #include "Prepare.h"
 
+#ifdef ENABLE_SSE_ASSEMBLY
+    #include <emmintrin.h>
+#endif
+#ifdef ENABLE_NEON_ASSEMBLY
+    #include <arm_neon.h>
+#endif
+
 namespace APE_MONKEY
 {
 
@@ -229,111 +238,286 @@ int CPrepare::Prepare(const unsigned char * pRawData, int nBytes, const WAVEFORM
     return ERROR_SUCCESS;
 }
 
-void CPrepare::Unprepare(int X, int Y, const WAVEFORMATEX * pWaveFormatEx, unsigned char * pOutput, unsigned int * pCRC)
+/*****************************************************************************************
+Unprepare -- (x,y) -> (l,r) and out to PCM, built once for each channel count and bit depth so
+the per-block loop has no format checks in it (pY is ignored for mono)
+*****************************************************************************************/
+__forceinline static void StoreSample24(unsigned char * pOutput, int32 nValue)
 {
-    #define CALCULATE_CRC_BYTE    *pCRC = (*pCRC >> 8) ^ CRC32_TABLE[(*pCRC & 0xFF) ^ *pOutput++];
-    
-    // decompress and convert from (x,y) -> (l,r)
-    if (pWaveFormatEx->nChannels == 2) 
+    uint32 nTemp = (nValue < 0) ? (((uint32) (nValue + 0x800000)) | 0x800000) : (uint32) nValue;
+    pOutput[0] = (unsigned char) ((nTemp >> 0) & 0xFF);
+    pOutput[1] = (unsigned char) ((nTemp >> 8) & 0xFF);
+    pOutput[2] = (unsigned char) ((nTemp >> 16) & 0xFF);
+}
+
+template <int CHANNELS, int BITS> static void UnprepareBlocksTemplate(const int * pX, const int * pY, int nBlocks, unsigned char * pOutput)
+{
+    for (int z = 0; z < nBlocks; z++)
     {
-        if (pWaveFormatEx->wBitsPerSample == 16) 
+        if (CHANNELS == 2)
         {
-            // get the right and left values
-            int nR = X - (Y / 2);
-            int nL = nR + Y;
+            if (BITS == 16)
+            {
+                int nR = pX[z] - (pY[z] / 2);
+                int nL = nR + pY[z];
 
-            // error check (for overflows)
-            if ((nR < -32768) || (nR > 32767) || (nL < -32768) || (nL > 32767))
+                // error check (for overflows)
+                if ((nR < -32768) || (nR > 32767) || (nL < -32768) || (nL > 32767))
+                    throw(-1);
+
+                *(int16 *) &pOutput[0] = (int16) nR;
+                *(int16 *) &pOutput[2] = (int16) nL;
+            }
+            else if (BITS == 8)
             {
-                throw(-1);
+                unsigned char R = (pX[z] - (pY[z] / 2) + 128);
+                pOutput[0] = R;
+                pOutput[1] = (unsigned char) (R + pY[z]);
+            }
+            else
+            {
+                int32 RV = pX[z] - (pY[z] / 2);
+                StoreSample24(&pOutput[0], RV);
+                StoreSample24(&pOutput[3], RV + pY[z]);
             }
-
-            *(int16 *) pOutput = (int16) nR;
-            CALCULATE_CRC_BYTE
-            CALCULATE_CRC_BYTE
-                
-            *(int16 *) pOutput = (int16) nL;
-            CALCULATE_CRC_BYTE
-            CALCULATE_CRC_BYTE
-        }
-        else if (pWaveFormatEx->wBitsPerSample == 8) 
-        {
-            unsigned char R = (X - (Y / 2) + 128);
-            *pOutput = R;
-            CALCULATE_CRC_BYTE
-            *pOutput = (unsigned char) (R + Y);
-            CALCULATE_CRC_BYTE
         }
-        else if (pWaveFormatEx->wBitsPerSample == 24) 
+        else
         {
-            int32 RV, LV;
-
-            RV = X - (Y / 2);
-            LV = RV + Y;
-            
-            uint32 nTemp = 0;
-            if (RV < 0)
-                nTemp = ((uint32) (RV + 0x800000)) | 0x800000;
+            if (BITS == 16)
+                *(int16 *) pOutput = (int16) pX[z];
+            else if (BITS == 8)
+                *pOutput = (unsigned char) (pX[z] + 128);
             else
-                nTemp = (uint32) RV;    
-            
-            *pOutput = (unsigned char) ((nTemp >> 0) & 0xFF);
-            CALCULATE_CRC_BYTE
-            *pOutput = (unsigned char) ((nTemp >> 8) & 0xFF);
-            CALCULATE_CRC_BYTE
-            *pOutput = (unsigned char) ((nTemp >> 16) & 0xFF);
-            CALCULATE_CRC_BYTE
-
-            nTemp = 0;
-            if (LV < 0)
-                nTemp = ((uint32) (LV + 0x800000)) | 0x800000;
-            else
-                nTemp = (uint32) LV;    
-            
-            *pOutput = (unsigned char) ((nTemp >> 0) & 0xFF);
-            CALCULATE_CRC_BYTE
-            
-            *pOutput = (unsigned char) ((nTemp >> 8) & 0xFF);
-            CALCULATE_CRC_BYTE
-            
-            *pOutput = (unsigned char) ((nTemp >> 16) & 0xFF);
-            CALCULATE_CRC_BYTE
+                StoreSample24(pOutput, pX[z]);
         }
+
+        pOutput += CHANNELS * (BITS / 8);
     }
-    else if (pWaveFormatEx->nChannels == 1) 
+}
+
+UNPREPARE_BLOCKS_PROC CPrepare::GetUnprepareBlocks(const WAVEFORMATEX * pWaveFormatEx)
+{
+    if (pWaveFormatEx->nChannels == 2)
     {
-        if (pWaveFormatEx->wBitsPerSample == 16) 
-        {
-            int16 R = X;
-                
-            *(int16 *) pOutput = (int16) R;
-            CALCULATE_CRC_BYTE
-            CALCULATE_CRC_BYTE
-        }
-        else if (pWaveFormatEx->wBitsPerSample == 8) 
+        if (pWaveFormatEx->wBitsPerSample == 16) return UnprepareBlocksTemplate<2, 16>;
+        if (pWaveFormatEx->wBitsPerSample == 8) return UnprepareBlocksTemplate<2, 8>;
+        if (pWaveFormatEx->wBitsPerSample == 24) return UnprepareBlocksTemplate<2, 24>;
+    }
+    else if (pWaveFormatEx->nChannels == 1)
+    {
+        if (pWaveFormatEx->wBitsPerSample == 16) return UnprepareBlocksTemplate<1, 16>;
+        if (pWaveFormatEx->wBitsPerSample == 8) return UnprepareBlocksTemplate<1, 8>;
+        if (pWaveFormatEx->wBitsPerSample == 24) return UnprepareBlocksTemplate<1, 24>;
+    }
+
+    return NULL;
+}
+
+/*****************************************************************************************
+Convert -- PCM (what the frames decode to, and what their CRCs cover) out to 32-bit integer or
+float, interleaved or a channel at a time, eight samples a step with SSE2 or NEON and the
+odd ones at the end one at a time
+
+Every sample is first moved to the top of an int32 (so 8, 16 and 24-bit all have the same full
+scale), then float is that times 2^-31, which is exact for all three.  The output can overlap
+the input as long as no block's output starts after its input does: each step reads its samples
+before it writes, and never writes past where the next step reads from.
+*****************************************************************************************/
+#define CONVERT_KERNEL_PORTABLE     0
+#define CONVERT_KERNEL_SSE          1
+#define CONVERT_KERNEL_NEON         2
+
+#define CONVERT_FLOAT_SCALE         (1.0f / 2147483648.0f)
+
+template <int BITS> __forceinline static int32 LoadSample32(const unsigned char * pInput)
+{
+    if (BITS == 16)
+        return (int32) ((uint32) *(const uint16 *) pInput << 16);
+    else if (BITS == 8)
+        return (int32) ((uint32) (pInput[0] ^ 0x80) << 24);
+    else
+        return (int32) (((uint32) pInput[0] << 8) | ((uint32) pInput[1] << 16) | ((uint32) pInput[2] << 24));
+}
+
+template <int FORMAT> __forceinline static void StoreSample32(unsigned char * pOutput, int32 nValue)
+{
+    if (FORMAT == APE_OUTPUT_FLOAT32)
+        *(float *) pOutput = (float) nValue * CONVERT_FLOAT_SCALE;
+    else
+        *(int32 *) pOutput = nValue;
+}
+
+#ifdef ENABLE_SSE_ASSEMBLY
+template <int BITS> __forceinline static void LoadSamples32SSE(const unsigned char * pInput, __m128i & m0, __m128i & m1)
+{
+    const __m128i mZero = _mm_setzero_si128();
+    if (BITS == 16)
+    {
+        __m128i mInput = _mm_loadu_si128((const __m128i *) pInput);
+        m0 = _mm_unpacklo_epi16(mZero, mInput);
+        m1 = _mm_unpackhi_epi16(mZero, mInput);
+    }
+    else if (BITS == 8)
+    {
+        __m128i mInput = _mm_xor_si128(_mm_loadl_epi64((const __m128i *) pInput), _mm_set1_epi8((char) 0x80));
+        __m128i m16 = _mm_unpacklo_epi8(mZero, mInput);
+        m0 = _mm_unpacklo_epi16(mZero, m16);
+        m1 = _mm_unpackhi_epi16(mZero, m16);
+    }
+    else
+    {
+        m0 = _mm_setr_epi32(LoadSample32<24>(&pInput[0]), LoadSample32<24>(&pInput[3]), LoadSample32<24>(&pInput[6]), LoadSample32<24>(&pInput[9]));
+        m1 = _mm_setr_epi32(LoadSample32<24>(&pInput[12]), LoadSample32<24>(&pInput[15]), LoadSample32<24>(&pInput[18]), LoadSample32<24>(&pInput[21]));
+    }
+}
+
+template <int FORMAT> __forceinline static __m128 ToOutputSSE(__m128i mValue)
+{
+    if (FORMAT == APE_OUTPUT_FLOAT32)
+        return _mm_mul_ps(_mm_cvtepi32_ps(mValue), _mm_set1_ps(CONVERT_FLOAT_SCALE));
+    else
+        return _mm_castsi128_ps(mValue);
+}
+#endif
+
+#ifdef ENABLE_NEON_ASSEMBLY
+template <int BITS> __forceinline static void LoadSamples32NEON(const unsigned char * pInput, int32x4_t & m0, int32x4_t & m1)
+{
+    if (BITS == 16)
+    {
+        int16x8_t mInput = vld1q_s16((const int16_t *) pInput);
+        m0 = vshll_n_s16(vget_low_s16(mInput), 16);
+        m1 = vshll_n_s16(vget_high_s16(mInput), 16);
+    }
+    else if (BITS == 8)
+    {
+        int8x8_t mInput = vreinterpret_s8_u8(veor_u8(vld1_u8(pInput), vdup_n_u8(0x80)));
+        int16x8_t m16 = vshll_n_s8(mInput, 8);
+        m0 = vshll_n_s16(vget_low_s16(m16), 16);
+        m1 = vshll_n_s16(vget_high_s16(m16), 16);
+    }
+    else
+    {
+        int32 aryValues[8];
+        for (int z = 0; z < 8; z++)
+            aryValues[z] = LoadSample32<24>(&pInput[z * 3]);
+        m0 = vld1q_s32(&aryValues[0]);
+        m1 = vld1q_s32(&aryValues[4]);
+    }
+}
+
+template <int FORMAT> __forceinline static void StoreOutputNEON(unsigned char * pOutput, int32x4_t mValue)
+{
+    if (FORMAT == APE_OUTPUT_FLOAT32)
+        vst1q_f32((float *) pOutput, vcvtq_n_f32_s32(mValue, 31));
+    else
+        vst1q_s32((int32_t *) pOutput, mValue);
+}
+#endif
+
+template <int CHANNELS, int BITS, int FORMAT, bool PLANAR, int KERNEL> static void ConvertBlocksTemplate(const unsigned char * pInput, int nBlocks, unsigned char * pOutput, int nChannelStride)
+{
+    // planar stereo splits the blocks between two outputs (planar mono is just interleaved)
+    const bool bSplit = PLANAR && (CHANNELS == 2);
+    unsigned char * pOutput1 = bSplit ? &pOutput[nChannelStride * 4] : pOutput;
+    const int nSamples = nBlocks * CHANNELS;
+    int z = 0;
+
+#ifdef ENABLE_SSE_ASSEMBLY
+    if (KERNEL == CONVERT_KERNEL_SSE)
+    {
+        for (; z + 8 <= nSamples; z += 8)
         {
-            unsigned char R = X + 128;
-            *pOutput = R;
-            CALCULATE_CRC_BYTE
+            __m128i m0, m1;
+            LoadSamples32SSE<BITS>(&pInput[z * (BITS / 8)], m0, m1);
+            __m128 mOutput0 = ToOutputSSE<FORMAT>(m0);
+            __m128 mOutput1 = ToOutputSSE<FORMAT>(m1);
+            if (bSplit)
+            {
+                _mm_storeu_ps((float *) &pOutput[(z / 2) * 4], _mm_shuffle_ps(mOutput0, mOutput1, _MM_SHUFFLE(2, 0, 2, 0)));
+                _mm_storeu_ps((float *) &pOutput1[(z / 2) * 4], _mm_shuffle_ps(mOutput0, mOutput1, _MM_SHUFFLE(3, 1, 3, 1)));
+            }
+            else
+            {
+                _mm_storeu_ps((float *) &pOutput[z * 4], mOutput0);
+                _mm_storeu_ps((float *) &pOutput[z * 4 + 16], mOutput1);
+            }
         }
-        else if (pWaveFormatEx->wBitsPerSample == 24) 
+    }
+#endif
+#ifdef ENABLE_NEON_ASSEMBLY
+    if (KERNEL == CONVERT_KERNEL_NEON)
+    {
+        for (; z + 8 <= nSamples; z += 8)
         {
-            int32 RV = X;
-            
-            uint32 nTemp = 0;
-            if (RV < 0)
-                nTemp = ((uint32) (RV + 0x800000)) | 0x800000;
+            int32x4_t m0, m1;
+            LoadSamples32NEON<BITS>(&pInput[z * (BITS / 8)], m0, m1);
+            if (bSplit)
+            {
+                int32x4x2_t mSplit = vuzpq_s32(m0, m1);
+                StoreOutputNEON<FORMAT>(&pOutput[(z / 2) * 4], mSplit.val[0]);
+                StoreOutputNEON<FORMAT>(&pOutput1[(z / 2) * 4], mSplit.val[1]);
+            }
             else
-                nTemp = (uint32) RV;    
-            
-            *pOutput = (unsigned char) ((nTemp >> 0) & 0xFF);
-            CALCULATE_CRC_BYTE
-            *pOutput = (unsigned char) ((nTemp >> 8) & 0xFF);
-            CALCULATE_CRC_BYTE
-            *pOutput = (unsigned char) ((nTemp >> 16) & 0xFF);
-            CALCULATE_CRC_BYTE
+            {
+                StoreOutputNEON<FORMAT>(&pOutput[z * 4], m0);
+                StoreOutputNEON<FORMAT>(&pOutput[z * 4 + 16], m1);
+            }
         }
     }
+#endif
+
+    for (; z < nSamples; z++)
+    {
+        int32 nValue = LoadSample32<BITS>(&pInput[z * (BITS / 8)]);
+        if (bSplit)
+            StoreSample32<FORMAT>((z & 1) ? &pOutput1[(z / 2) * 4] : &pOutput[(z / 2) * 4], nValue);
+        else
+            StoreSample32<FORMAT>(&pOutput[z * 4], nValue);
+    }
 }
 
-}
\ No newline at end of file
+template <int CHANNELS, int BITS, int FORMAT, bool PLANAR> static CONVERT_BLOCKS_PROC GetConvertBlocksKernel()
+{
+#ifdef ENABLE_SSE_ASSEMBLY
+    if (GetSSEAvailable())
+        return ConvertBlocksTemplate<CHANNELS, BITS, FORMAT, PLANAR, CONVERT_KERNEL_SSE>;
+#endif
+#ifdef ENABLE_NEON_ASSEMBLY
+    if (GetNEONAvailable())
+        return ConvertBlocksTemplate<CHANNELS, BITS, FORMAT, PLANAR, CONVERT_KERNEL_NEON>;
+#endif
+    return ConvertBlocksTemplate<CHANNELS, BITS, FORMAT, PLANAR, CONVERT_KERNEL_PORTABLE>;
+}
+
+template <int CHANNELS, int BITS> static CONVERT_BLOCKS_PROC GetConvertBlocksFormat(int nOutputFormat)
+{
+    switch (nOutputFormat)
+    {
+    case APE_OUTPUT_INT32: return GetConvertBlocksKernel<CHANNELS, BITS, APE_OUTPUT_INT32, false>();
+    case APE_OUTPUT_INT32 | APE_OUTPUT_PLANAR: return GetConvertBlocksKernel<CHANNELS, BITS, APE_OUTPUT_INT32, true>();
+    case APE_OUTPUT_FLOAT32: return GetConvertBlocksKernel<CHANNELS, BITS, APE_OUTPUT_FLOAT32, false>();
+    case APE_OUTPUT_FLOAT32 | APE_OUTPUT_PLANAR: return GetConvertBlocksKernel<CHANNELS, BITS, APE_OUTPUT_FLOAT32, true>();
+    }
+    return NULL;
+}
+
+CONVERT_BLOCKS_PROC CPrepare::GetConvertBlocks(const WAVEFORMATEX * pWaveFormatEx, int nOutputFormat)
+{
+    if (pWaveFormatEx->nChannels == 2)
+    {
+        if (pWaveFormatEx->wBitsPerSample == 16) return GetConvertBlocksFormat<2, 16>(nOutputFormat);
+        if (pWaveFormatEx->wBitsPerSample == 8) return GetConvertBlocksFormat<2, 8>(nOutputFormat);
+        if (pWaveFormatEx->wBitsPerSample == 24) return GetConvertBlocksFormat<2, 24>(nOutputFormat);
+    }
+    else if (pWaveFormatEx->nChannels == 1)
+    {
+        if (pWaveFormatEx->wBitsPerSample == 16) return GetConvertBlocksFormat<1, 16>(nOutputFormat);
+        if (pWaveFormatEx->wBitsPerSample == 8) return GetConvertBlocksFormat<1, 8>(nOutputFormat);
+        if (pWaveFormatEx->wBitsPerSample == 24) return GetConvertBlocksFormat<1, 24>(nOutputFormat);
+    }
+
+    return NULL;
+}
+
+}
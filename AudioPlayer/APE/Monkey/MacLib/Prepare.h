@@ -15,18 +15,31 @@ Tasks:
 
 1) convert data to 32-bit
 2) convert L,R to X,Y
-3) calculate the CRC
+3) calculate the CRC (compression only, decompression CRCs the output in bulk)
 4) do simple analysis
 5) check for the peak value
 *****************************************************************************/
 
 class IPredictorDecompress;
 
+// converts a run of decoded (x,y) blocks to PCM (for one channel count and bit depth)
+typedef void (* UNPREPARE_BLOCKS_PROC)(const int * pX, const int * pY, int nBlocks, unsigned char * pOutput);
+
+// converts a run of PCM blocks to one of the 32-bit output formats (see SetOutputFormat(...) in
+// MACLib.h); with APE_OUTPUT_PLANAR, channel n goes to pOutput + (n * nChannelStride) samples
+typedef void (* CONVERT_BLOCKS_PROC)(const unsigned char * pInput, int nBlocks, unsigned char * pOutput, int nChannelStride);
+
 class CPrepare
 {
 public:
     int Prepare(const unsigned char * pRawData, int nBytes, const WAVEFORMATEX * pWaveFormatEx, int * pOutputX, int * pOutputY, unsigned int * pCRC, int * pSpecialCodes, int * pPeakLevel);
-    void Unprepare(int X, int Y, const WAVEFORMATEX * pWaveFormatEx, unsigned char * pOutput, unsigned int * pCRC);
+
+    // the unprepare for a format (NULL if it isn't one APE stores)
+    static UNPREPARE_BLOCKS_PROC GetUnprepareBlocks(const WAVEFORMATEX * pWaveFormatEx);
+
+    // the conversion from a format's PCM to an output format (NULL for APE_OUTPUT_NATIVE, or
+    // anything that isn't supported)
+    static CONVERT_BLOCKS_PROC GetConvertBlocks(const WAVEFORMATEX * pWaveFormatEx, int nOutputFormat);
 };
 
 }
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "DecoderState.h"
+
 namespace APE_MONKEY
 {
 
@@ -25,6 +27,16 @@ public:
         return m_nLastValue;
     }
 
+    void SaveState(CDecoderStateWriter & Writer) const
+    {
+        Writer.WriteValue(m_nLastValue);
+    }
+
+    void LoadState(CDecoderStateReader & Reader)
+    {
+        m_nLastValue = Reader.ReadValue<int>();
+    }
+
 protected:
     int m_nLastValue;
 };
@@ -27,10 +27,59 @@ const uint32 RANGE_WIDTH_2[64] = {19578,16582,12257,7906,4576,2366,1170,536,261,
 
 #define MODEL_ELEMENTS 64
 
+// shift that matches a division by a power of two
+#if defined(__GNUC__) || defined(__clang__)
+    #define POWER_OF_TWO_SHIFT(VALUE) __builtin_ctz(VALUE)
+#else
+    static __forceinline int POWER_OF_TWO_SHIFT(uint32 nValue) { int nShift = 0; while ((nValue >> nShift) > 1) { nShift++; } return nShift; }
+#endif
+
+/***********************************************************************************
+Symbol lookup -- the overflow total is split into buckets on its high bits, and each
+bucket stores the first symbol that can land in it (so at most a step or two of the
+old linear scan is left, except in the 1-wide tail symbols which are very rare)
+***********************************************************************************/
+#define RANGE_LOOKUP_SHIFT 6
+#define RANGE_LOOKUP_ELEMENTS (RANGE_OVERFLOW_TOTAL_WIDTH >> RANGE_LOOKUP_SHIFT)
+
+class CRangeSymbolLookup
+{
+public:
+    CRangeSymbolLookup(const uint32 * pRangeTotal)
+    {
+        m_pRangeTotal = pRangeTotal;
+
+        int nSymbol = 0;
+        for (int z = 0; z < RANGE_LOOKUP_ELEMENTS; z++)
+        {
+            uint32 nBucketStart = uint32(z) << RANGE_LOOKUP_SHIFT;
+            while (nBucketStart >= m_pRangeTotal[nSymbol + 1]) { nSymbol++; }
+            m_aryFirstSymbol[z] = (unsigned char) nSymbol;
+        }
+    }
+
+    __forceinline int Lookup(uint32 nRangeTotal) const
+    {
+        uint32 nBucket = nRangeTotal >> RANGE_LOOKUP_SHIFT;
+        if (nBucket >= RANGE_LOOKUP_ELEMENTS) nBucket = RANGE_LOOKUP_ELEMENTS - 1;
+
+        int nSymbol = m_aryFirstSymbol[nBucket];
+        while ((nSymbol < (MODEL_ELEMENTS - 1)) && (nRangeTotal >= m_pRangeTotal[nSymbol + 1])) { nSymbol++; }
+        return nSymbol;
+    }
+
+private:
+    const uint32 * m_pRangeTotal;
+    unsigned char m_aryFirstSymbol[RANGE_LOOKUP_ELEMENTS];
+};
+
+static const CRangeSymbolLookup g_RangeSymbolLookup1(RANGE_TOTAL_1);
+static const CRangeSymbolLookup g_RangeSymbolLookup2(RANGE_TOTAL_2);
+
 /***********************************************************************************
 Construction
 ***********************************************************************************/
-CUnBitArray::CUnBitArray(CStdLibFileIO * pIO, int nVersion, int nFurthestReadByte) :
+CUnBitArray::CUnBitArray(CIO * pIO, int nVersion, long long nFurthestReadByte) :
     CUnBitArrayBase(nFurthestReadByte)
 {
     CreateHelper(pIO, 16384, nVersion);
@@ -41,7 +90,8 @@ CUnBitArray::CUnBitArray(CStdLibFileIO * pIO, int nVersion, int nFurthestReadByt
 
 CUnBitArray::~CUnBitArray()
 {
-    SAFE_ARRAY_DELETE(m_pBitArray)
+    SAFE_ARRAY_DELETE(m_pBitArrayBuffer)
+    m_pBitArray = NULL;
 }
 
 unsigned int CUnBitArray::DecodeValue(DECODE_VALUE_METHOD DecodeMethod, int nParam1, int nParam2)
@@ -127,8 +177,8 @@ int CUnBitArray::DecodeValueRange(UNBIT_ARRAY_STATE & BitArrayState)
             // decode
             int nRangeTotal = RangeDecodeFast(RANGE_OVERFLOW_SHIFT);
             
-            // lookup the symbol (must be a faster way than this)
-            while (nRangeTotal >= int(RANGE_TOTAL_2[nOverflow + 1])) { nOverflow++; }
+            // lookup the symbol
+            nOverflow = g_RangeSymbolLookup2.Lookup(uint32(nRangeTotal));
             
             // update
             m_RangeCoderInfo.low -= m_RangeCoderInfo.range * RANGE_TOTAL_2[nOverflow];
@@ -154,7 +204,6 @@ int CUnBitArray::DecodeValueRange(UNBIT_ARRAY_STATE & BitArrayState)
                 int nSplitFactor = 1 << (nPivotValueBits - 16);
 
                 int nPivotValueA = (nPivotValue / nSplitFactor) + 1;
-                int nPivotValueB = nSplitFactor;
 
                 while (m_RangeCoderInfo.range <= BOTTOM_VALUE)
                 {   
@@ -172,7 +221,7 @@ int CUnBitArray::DecodeValueRange(UNBIT_ARRAY_STATE & BitArrayState)
                     m_RangeCoderInfo.low = (m_RangeCoderInfo.low << 8) | ((m_RangeCoderInfo.buffer >> 1) & 0xFF);
                     m_RangeCoderInfo.range <<= 8;
                 }
-                m_RangeCoderInfo.range = m_RangeCoderInfo.range / nPivotValueB;
+                m_RangeCoderInfo.range = m_RangeCoderInfo.range >> (nPivotValueBits - 16); // the split factor is 1 << (nPivotValueBits - 16)
                 int nBaseB = m_RangeCoderInfo.low / m_RangeCoderInfo.range;
                 m_RangeCoderInfo.low -= m_RangeCoderInfo.range * nBaseB;
 
@@ -187,12 +236,21 @@ int CUnBitArray::DecodeValueRange(UNBIT_ARRAY_STATE & BitArrayState)
                     m_RangeCoderInfo.range <<= 8;
                 }
 
-                // decode
-                m_RangeCoderInfo.range = m_RangeCoderInfo.range / nPivotValue;
-                int nBaseLower = m_RangeCoderInfo.low / m_RangeCoderInfo.range;
-                m_RangeCoderInfo.low -= m_RangeCoderInfo.range * nBaseLower;
-
-                nBase = nBaseLower;
+                // decode (avoiding the divisions when the pivot allows it -- a pivot of one is common
+                // for quiet material, and low is always below range in a good stream)
+                if (nPivotValue == 1)
+                {
+                    nBase = (m_RangeCoderInfo.low >= m_RangeCoderInfo.range) ? m_RangeCoderInfo.low / m_RangeCoderInfo.range : 0;
+                }
+                else
+                {
+                    if ((nPivotValue & (nPivotValue - 1)) == 0)
+                        m_RangeCoderInfo.range = m_RangeCoderInfo.range >> POWER_OF_TWO_SHIFT(nPivotValue);
+                    else
+                        m_RangeCoderInfo.range = m_RangeCoderInfo.range / nPivotValue;
+                    nBase = m_RangeCoderInfo.low / m_RangeCoderInfo.range;
+                }
+                m_RangeCoderInfo.low -= m_RangeCoderInfo.range * nBase;
             }
         }
 
@@ -204,9 +262,8 @@ int CUnBitArray::DecodeValueRange(UNBIT_ARRAY_STATE & BitArrayState)
         // decode
         int nRangeTotal = RangeDecodeFast(RANGE_OVERFLOW_SHIFT);
         
-        // lookup the symbol (must be a faster way than this)
-        int nOverflow = 0;
-        while (nRangeTotal >= int(RANGE_TOTAL_1[nOverflow + 1])) { nOverflow++; }
+        // lookup the symbol
+        int nOverflow = g_RangeSymbolLookup1.Lookup(uint32(nRangeTotal));
         
         // update
         m_RangeCoderInfo.low -= m_RangeCoderInfo.range * RANGE_TOTAL_1[nOverflow];
@@ -268,6 +325,19 @@ void CUnBitArray::FlushBitArray()
     m_RangeCoderInfo.range = (unsigned int) 1 << EXTRA_BITS;
 }
 
+void CUnBitArray::SaveState(CDecoderStateWriter & Writer)
+{
+    CUnBitArrayBase::SaveState(Writer);
+    Writer.Write(&m_RangeCoderInfo, sizeof(m_RangeCoderInfo));
+}
+
+int CUnBitArray::LoadState(CDecoderStateReader & Reader)
+{
+    RETURN_ON_ERROR(CUnBitArrayBase::LoadState(Reader))
+    Reader.Read(&m_RangeCoderInfo, sizeof(m_RangeCoderInfo));
+    return Reader.GetError() ? ERROR_BAD_PARAMETER : ERROR_SUCCESS;
+}
+
 void CUnBitArray::Finalize()
 {
     // normalize
@@ -284,6 +354,23 @@ void CUnBitArray::Finalize()
         m_nCurrentBitIndex -= 16;
 }
 
+void CUnBitArray::DecodeValueRangeArray(UNBIT_ARRAY_STATE & BitArrayState, int * pOutputArray, int nElements)
+{
+    // qualified calls so the per-value decode isn't a virtual call
+    for (int z = 0; z < nElements; z++)
+        pOutputArray[z] = CUnBitArray::DecodeValueRange(BitArrayState);
+}
+
+void CUnBitArray::DecodeValueRangeArray(UNBIT_ARRAY_STATE & BitArrayStateY, int * pOutputY, UNBIT_ARRAY_STATE & BitArrayStateX, int * pOutputX, int nElements)
+{
+    // stereo data is stored Y then X for every block
+    for (int z = 0; z < nElements; z++)
+    {
+        pOutputY[z] = CUnBitArray::DecodeValueRange(BitArrayStateY);
+        pOutputX[z] = CUnBitArray::DecodeValueRange(BitArrayStateX);
+    }
+}
+
 void CUnBitArray::GenerateArrayRange(int * pOutputArray, int nElements)
 {
     UNBIT_ARRAY_STATE BitArrayState;
@@ -18,7 +18,7 @@ class CUnBitArray : public CUnBitArrayBase
 {
 public:
     // construction/destruction
-    CUnBitArray(APE_MONKEY::CStdLibFileIO * pIO, int nVersion, int nFurthestReadByte);
+    CUnBitArray(APE_MONKEY::CIO * pIO, int nVersion, long long nFurthestReadByte);
     ~CUnBitArray();
 
     unsigned int DecodeValue(DECODE_VALUE_METHOD DecodeMethod, int nParam1 = 0, int nParam2 = 0);
@@ -26,10 +26,15 @@ public:
     void GenerateArray(int * pOutputArray, int nElements, int nBytesRequired = -1);
     
     int DecodeValueRange(UNBIT_ARRAY_STATE & BitArrayState);
+    void DecodeValueRangeArray(UNBIT_ARRAY_STATE & BitArrayState, int * pOutputArray, int nElements);
+    void DecodeValueRangeArray(UNBIT_ARRAY_STATE & BitArrayStateY, int * pOutputY, UNBIT_ARRAY_STATE & BitArrayStateX, int * pOutputX, int nElements);
 
     void FlushState(UNBIT_ARRAY_STATE & BitArrayState);
     void FlushBitArray();
     void Finalize();
+
+    void SaveState(CDecoderStateWriter & Writer);
+    int LoadState(CDecoderStateReader & Reader);
     
 private:
     void GenerateArrayRange(int * pOutputArray, int nElements);
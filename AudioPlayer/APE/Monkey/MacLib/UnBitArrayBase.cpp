@@ -12,7 +12,7 @@ const uint32 POWERS_OF_TWO_MINUS_ONE[33] = {0,1,3,7,15,31,63,127,255,511,1023,20
 CUnBitArrayBase * CreateUnBitArray(IAPEDecompress * pAPEDecompress, int nVersion)
 {
     // determine the furthest position we should read in the I/O object
-    int nFurthestReadByte = GET_IO(pAPEDecompress)->GetSize();
+    long long nFurthestReadByte = GET_IO(pAPEDecompress)->GetSize();
     if (nFurthestReadByte > 0)
     {
        // terminating data
@@ -36,9 +36,14 @@ CUnBitArrayBase * CreateUnBitArray(IAPEDecompress * pAPEDecompress, int nVersion
     return (CUnBitArrayBase * ) new CUnBitArray(GET_IO(pAPEDecompress), nVersion, nFurthestReadByte);
 }
 
-CUnBitArrayBase::CUnBitArrayBase(int nFurthestReadByte)
+CUnBitArrayBase::CUnBitArrayBase(long long nFurthestReadByte)
 {
     m_nFurthestReadByte = nFurthestReadByte;
+    m_pBitArray = NULL;
+    m_pBitArrayBuffer = NULL;
+    m_pMappedData = NULL;
+    m_nMappedBytes = 0;
+    m_nWindowByte = 0;
 }
 
 CUnBitArrayBase::~CUnBitArrayBase()
@@ -51,6 +56,22 @@ void CUnBitArrayBase::AdvanceToByteBoundary()
     if (nMod != 0) { m_nCurrentBitIndex += 8 - nMod; }
 }
 
+void CUnBitArrayBase::DecodeValueRangeArray(UNBIT_ARRAY_STATE & BitArrayState, int * pOutputArray, int nElements)
+{
+    for (int z = 0; z < nElements; z++)
+        pOutputArray[z] = DecodeValueRange(BitArrayState);
+}
+
+void CUnBitArrayBase::DecodeValueRangeArray(UNBIT_ARRAY_STATE & BitArrayStateY, int * pOutputY, UNBIT_ARRAY_STATE & BitArrayStateX, int * pOutputX, int nElements)
+{
+    // stereo data is stored Y then X for every block
+    for (int z = 0; z < nElements; z++)
+    {
+        pOutputY[z] = DecodeValueRange(BitArrayStateY);
+        pOutputX[z] = DecodeValueRange(BitArrayStateX);
+    }
+}
+
 uint32 CUnBitArrayBase::DecodeValueXBits(uint32 nBits) 
 {
     // get more data if necessary
@@ -74,14 +95,23 @@ uint32 CUnBitArrayBase::DecodeValueXBits(uint32 nBits)
     return (nLeftValue | nRightValue);
 }
 
-int CUnBitArrayBase::FillAndResetBitArray(int nFileLocation, int nNewBitIndex) 
+int CUnBitArrayBase::FillAndResetBitArray(long long nFileLocation, int nNewBitIndex) 
 {
+    // a mapped file just moves the window
+    if (m_pMappedData != NULL)
+    {
+        int nRetVal = FillBitArrayMapped((nFileLocation != -1) ? uint32(nFileLocation) : uint32(m_nWindowByte + m_nBytes));
+        m_nCurrentBitIndex = nNewBitIndex;
+        return nRetVal;
+    }
+
     // seek if necessary
     if (nFileLocation != -1)
     {
         if (m_pIO->Seek(nFileLocation, FILE_BEGIN) != 0)
             return ERROR_IO_READ;
     }
+    long long nWindowByte = m_pIO->GetPosition();
 
     // fill
     m_nCurrentBitIndex = m_nBits; // position at the end of the buffer
@@ -89,6 +119,7 @@ int CUnBitArrayBase::FillAndResetBitArray(int nFileLocation, int nNewBitIndex)
 
     // set bit index
     m_nCurrentBitIndex = nNewBitIndex;
+    m_nWindowByte = nWindowByte;
 
     return nRetVal;
 }
@@ -97,6 +128,14 @@ int CUnBitArrayBase::FillBitArray()
 {
     // get the bit array index
     uint32 nBitArrayIndex = m_nCurrentBitIndex >> 5;
+
+    // a mapped file just moves the window
+    if (m_pMappedData != NULL)
+    {
+        int nRetVal = FillBitArrayMapped(m_nWindowByte + (nBitArrayIndex * 4));
+        m_nCurrentBitIndex = m_nCurrentBitIndex & 31;
+        return nRetVal;
+    }
     
     // move the remaining data to the front
     memmove((void *) (m_pBitArray), (const void *) (m_pBitArray + nBitArrayIndex), m_nBytes - (nBitArrayIndex * 4));
@@ -105,7 +144,7 @@ int CUnBitArrayBase::FillBitArray()
     int nBytesToRead = nBitArrayIndex * 4;
     if (m_nFurthestReadByte > 0)
     {
-        int nFurthestReadBytes = m_nFurthestReadByte - m_pIO->GetPosition();
+        long long nFurthestReadBytes = m_nFurthestReadByte - m_pIO->GetPosition();
         if (nBytesToRead > nFurthestReadBytes)
             nBytesToRead = nFurthestReadBytes;
     }
@@ -121,12 +160,54 @@ int CUnBitArrayBase::FillBitArray()
 
     // adjust the m_Bit pointer
     m_nCurrentBitIndex = m_nCurrentBitIndex & 31;
+    m_nWindowByte += nBitArrayIndex * 4;
     
     // return
     return (nRetVal == 0) ? 0 : ERROR_IO_READ;
 }
 
-    int CUnBitArrayBase::CreateHelper(APE_MONKEY::CStdLibFileIO * pIO, int nBytes, int nVersion)
+void CUnBitArrayBase::SaveState(CDecoderStateWriter & Writer)
+{
+    // the window always starts on a word of the frame data, so the word and the bit within it
+    // are enough to fill the array again exactly as it was
+    Writer.WriteValue<long long>(m_nWindowByte + (m_nCurrentBitIndex >> 5) * 4);
+    Writer.WriteValue<uint32>(m_nCurrentBitIndex & 31);
+}
+
+int CUnBitArrayBase::LoadState(CDecoderStateReader & Reader)
+{
+    long long nWordByte = Reader.ReadValue<long long>();
+    int nBitIndex = (int) Reader.ReadValue<uint32>();
+    if (Reader.GetError() || (nWordByte < 0) || (nBitIndex > 31))
+        return ERROR_BAD_PARAMETER;
+
+    return FillAndResetBitArray(nWordByte, nBitIndex);
+}
+
+int CUnBitArrayBase::FillBitArrayMapped(uint32 nWindowByte)
+{
+    m_nWindowByte = nWindowByte;
+
+    // point right into the mapping when we can
+    if (((nWindowByte & 3) == 0) && (nWindowByte <= m_nMappedBytes) && (m_nBytes <= m_nMappedBytes - nWindowByte))
+    {
+        m_pBitArray = (uint32 *) &m_pMappedData[nWindowByte];
+        m_nGoodBytes = m_nBytes;
+        return 0;
+    }
+
+    // otherwise copy into our buffer (the tail is zeroed just like a short read)
+    m_pBitArray = m_pBitArrayBuffer;
+    m_nGoodBytes = (nWindowByte < m_nMappedBytes) ? min(m_nBytes, m_nMappedBytes - nWindowByte) : 0;
+    if (m_nGoodBytes > 0)
+        memcpy(m_pBitArray, &m_pMappedData[nWindowByte], m_nGoodBytes);
+    if (m_nGoodBytes < m_nBytes)
+        memset(&((unsigned char *) m_pBitArray)[m_nGoodBytes], 0, m_nBytes - m_nGoodBytes);
+
+    return 0;
+}
+
+int CUnBitArrayBase::CreateHelper(APE_MONKEY::CIO * pIO, int nBytes, int nVersion)
 {
     // check the parameters
     if ((pIO == NULL) || (nBytes <= 0)) { return ERROR_BAD_PARAMETER; }
@@ -143,10 +224,26 @@ int CUnBitArrayBase::FillBitArray()
     m_nCurrentBitIndex = 0;
     
     // create the bitarray (we allocate and empty a little extra as buffer insurance, although it should never be necessary)
-    m_pBitArray = new uint32 [m_nElements + 64];
-    memset(m_pBitArray, 0, (m_nElements + 64) * sizeof(uint32));
+    m_pBitArrayBuffer = new uint32 [m_nElements + 64];
+    memset(m_pBitArrayBuffer, 0, (m_nElements + 64) * sizeof(uint32));
+    m_pBitArray = m_pBitArrayBuffer;
+
+    // decode in place if the file is memory mapped (not reading past the furthest read byte)
+    m_pMappedData = pIO->GetMappedBuffer();
+    m_nMappedBytes = 0;
+    m_nWindowByte = 0;
+    if (m_pMappedData != NULL)
+    {
+        long long nMappedBytes = pIO->GetSize();
+        if ((m_nFurthestReadByte > 0) && (m_nFurthestReadByte < nMappedBytes))
+            nMappedBytes = m_nFurthestReadByte;
+        if (nMappedBytes > 0xFFFFFFFFLL - m_nBytes)
+            m_pMappedData = NULL;
+        else
+            m_nMappedBytes = uint32(nMappedBytes);
+    }
     
-    return (m_pBitArray != NULL) ? 0 : ERROR_INSUFFICIENT_MEMORY;
+    return (m_pBitArrayBuffer != NULL) ? 0 : ERROR_INSUFFICIENT_MEMORY;
 }
 
 }
\ No newline at end of file
@@ -1,12 +1,12 @@
 #pragma once
 
-
+#include "DecoderState.h"
 
 namespace APE_MONKEY
 {
 
 class IAPEDecompress;
-class CStdLibFileIO;
+class CIO;
 
 struct UNBIT_ARRAY_STATE
 {
@@ -25,12 +25,12 @@ class CUnBitArrayBase
 {
 public:
     // construction / destruction
-    CUnBitArrayBase(int nFurthestReadByte);
+    CUnBitArrayBase(long long nFurthestReadByte);
     virtual ~CUnBitArrayBase();
     
     // functions
     virtual int FillBitArray();
-    virtual int FillAndResetBitArray(int nFileLocation = -1, int nNewBitIndex = 0);
+    virtual int FillAndResetBitArray(long long nFileLocation = -1, int nNewBitIndex = 0);
         
     virtual void GenerateArray(int * pOutputArray, int nElements, int nBytesRequired = -1) {}
     virtual unsigned int DecodeValue(DECODE_VALUE_METHOD DecodeMethod, int nParam1 = 0, int nParam2 = 0) { return 0; }
@@ -38,12 +38,18 @@ public:
     virtual void AdvanceToByteBoundary();
 
     virtual int DecodeValueRange(UNBIT_ARRAY_STATE & BitArrayState) { return 0; }
+    virtual void DecodeValueRangeArray(UNBIT_ARRAY_STATE & BitArrayState, int * pOutputArray, int nElements);
+    virtual void DecodeValueRangeArray(UNBIT_ARRAY_STATE & BitArrayStateY, int * pOutputY, UNBIT_ARRAY_STATE & BitArrayStateX, int * pOutputX, int nElements);
     virtual void FlushState(UNBIT_ARRAY_STATE & BitArrayState) { }
     virtual void FlushBitArray() { }
     virtual void Finalize() { }
+
+    // the read position (and whatever the decoder carries along); loading refills the array from there
+    virtual void SaveState(CDecoderStateWriter & Writer);
+    virtual int LoadState(CDecoderStateReader & Reader);
     
 protected:
-    virtual int CreateHelper(CStdLibFileIO * pIO, int nBytes, int nVersion);
+    virtual int CreateHelper(CIO * pIO, int nBytes, int nVersion);
     virtual uint32 DecodeValueXBits(uint32 nBits);
     
     uint32 m_nElements;
@@ -52,11 +58,21 @@ protected:
     uint32 m_nGoodBytes;
     
     int m_nVersion;
-    CStdLibFileIO * m_pIO;
-    int m_nFurthestReadByte;
+    CIO * m_pIO;
+    long long m_nFurthestReadByte;
 
     uint32 m_nCurrentBitIndex;
     uint32 * m_pBitArray;
+    uint32 * m_pBitArrayBuffer;
+
+    // decoding straight out of a memory mapped file (m_pBitArray points into the mapping
+    // whenever the window is word aligned and clear of the end, otherwise into our buffer)
+    int FillBitArrayMapped(uint32 nWindowByte);
+    const unsigned char * m_pMappedData;
+    uint32 m_nMappedBytes;
+
+    // file offset of the first byte in the bit array
+    long long m_nWindowByte;
 };
 
 CUnBitArrayBase * CreateUnBitArray(IAPEDecompress * pAPEDecompress, int nVersion);
@@ -20,7 +20,7 @@
 
 #include "All.h"
 #include <string.h>
-#include "MD5.h"
+#include "md5.h"
 
 namespace APE_MONKEY
 {
@@ -237,14 +237,13 @@ void
 MD5Final ( uint8_t   digest [16], 
        MD5_CTX*  context ) 
 {
-    static uint8_t  finalBlock [64];
+    static const uint8_t finalBlock [64] = { 0x80 };   // (read only, so MD5s can run on several threads)
     uint32_t        bits        [2];
     int             byteIndex;
     int             finalBlockLength;
     
     byteIndex        = (context -> count[0] >> 3) & 0x3F;
     finalBlockLength = (byteIndex < 56  ?  56  :  120) - byteIndex;
-    finalBlock[0]    = 0x80;
     
 #if __BYTE_ORDER == __BIG_ENDIAN
     CopyToLittleEndian ( bits, (const uint8_t*) context -> count, 2 );
@@ -19,7 +19,7 @@
 #ifndef MD5SUM_MD5_H
 #define MD5SUM_MD5_H
 
-#import "All.h"
+#include "All.h"
 
 namespace APE_MONKEY
 {
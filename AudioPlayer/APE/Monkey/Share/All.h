@@ -25,7 +25,6 @@ Global includes
     #include <sys/time.h>
     #include <sys/types.h>
     #include <sys/stat.h>
-    #include "NoWindows.h"
 //#endif
 
 #include <stdlib.h>
@@ -33,6 +32,9 @@ Global includes
 #include <stdio.h>
 #include <math.h>
 #include <string.h>
+
+// after the system headers, which may #undef our min / max (glibc's C++ headers do)
+#include "NoWindows.h"
 #include "SmartPtr.h"
 #include "wchar.h"
 #include <assert.h>
@@ -53,6 +55,20 @@ Global compiler settings (useful for porting)
 //    #define ENABLE_ASSEMBLY
 //#endif
 
+// SIMD filter kernels (SSE2 / AVX2 are picked at runtime with CPUID, NEON is picked at compile time)
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+    #define ENABLE_SSE_ASSEMBLY
+    #if defined(__GNUC__) || defined(__clang__)
+        #define ENABLE_AVX_ASSEMBLY
+    #endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    #define ENABLE_NEON_ASSEMBLY
+#endif
+
+// time spent in each decoding stage (a few clock reads per chunk of blocks; the build turns it on
+// for apebench, see APE_DECOMPRESS_STAGE_TIMES)
+//#define ENABLE_STAGE_TIMING
+
 // compression modes
 #define ENABLE_COMPRESSION_MODE_FAST
 #define ENABLE_COMPRESSION_MODE_NORMAL
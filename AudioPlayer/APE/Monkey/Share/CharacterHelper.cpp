@@ -51,46 +51,49 @@ str_utf16 * CAPECharacterHelper::GetUTF16FromANSI(const str_ansi * pANSI)
 
 str_utf16 * CAPECharacterHelper::GetUTF16FromUTF8(const str_utf8 * pUTF8)
 {
-    // get the length
-    int nCharacters = 0; int nIndex = 0;
-    while (pUTF8[nIndex] != 0)
-    {
-        if ((pUTF8[nIndex] & 0x80) == 0)
-            nIndex += 1;
-        else if ((pUTF8[nIndex] & 0xE0) == 0xE0)
-            nIndex += 3;
-        else
-            nIndex += 2;
+    // get the length, then make a UTF-16 string
+    int nCharacters = GetUTF16FromUTF8(pUTF8, NULL, 0);
+    str_utf16 * pUTF16 = new str_utf16 [nCharacters];
+    GetUTF16FromUTF8(pUTF8, pUTF16, nCharacters);
 
-        nCharacters += 1;
-    }
+    return pUTF16; 
+}
 
-    // make a UTF-16 string
-    str_utf16 * pUTF16 = new str_utf16 [nCharacters + 1];
-    nIndex = 0; nCharacters = 0;
+int CAPECharacterHelper::GetUTF16FromUTF8(const str_utf8 * pUTF8, str_utf16 * pUTF16, int nCharacters)
+{
+    // decode what fits, counting everything (a sequence cut short by the terminator ends the string)
+    int nIndex = 0; int nOutput = 0;
     while (pUTF8[nIndex] != 0)
     {
+        str_utf16 nCharacter;
         if ((pUTF8[nIndex] & 0x80) == 0)
         {
-            pUTF16[nCharacters] = pUTF8[nIndex];
+            nCharacter = pUTF8[nIndex];
             nIndex += 1;
         }
         else if ((pUTF8[nIndex] & 0xE0) == 0xE0)
         {
-            pUTF16[nCharacters] = ((pUTF8[nIndex] & 0x1F) << 12) | ((pUTF8[nIndex + 1] & 0x3F) << 6) | (pUTF8[nIndex + 2] & 0x3F);
+            if ((pUTF8[nIndex + 1] == 0) || (pUTF8[nIndex + 2] == 0))
+                break;
+            nCharacter = ((pUTF8[nIndex] & 0x1F) << 12) | ((pUTF8[nIndex + 1] & 0x3F) << 6) | (pUTF8[nIndex + 2] & 0x3F);
             nIndex += 3;
         }
         else
         {
-            pUTF16[nCharacters] = ((pUTF8[nIndex] & 0x3F) << 6) | (pUTF8[nIndex + 1] & 0x3F);
+            if (pUTF8[nIndex + 1] == 0)
+                break;
+            nCharacter = ((pUTF8[nIndex] & 0x3F) << 6) | (pUTF8[nIndex + 1] & 0x3F);
             nIndex += 2;
         }
 
-        nCharacters += 1;
+        if (nOutput < nCharacters)
+            pUTF16[nOutput] = nCharacter;
+        nOutput += 1;
     }
-    pUTF16[nCharacters] = 0;
+    if (nOutput < nCharacters)
+        pUTF16[nOutput] = 0;
 
-    return pUTF16; 
+    return nOutput + 1;
 }
 
 str_utf8 * CAPECharacterHelper::GetUTF8FromANSI(const str_ansi * pANSI)
@@ -15,6 +15,11 @@ public:
     static str_utf16 * GetUTF16FromUTF8(const str_utf8 * pUTF8);
     static str_utf8 * GetUTF8FromANSI(const str_ansi * pANSI);
     static str_utf8 * GetUTF8FromUTF16(const str_utf16 * pUTF16);
+
+    // converts into a buffer instead of allocating one (pUTF16 can be NULL just to count); returns the
+    // characters the whole string takes, with the terminator -- if that's more than nCharacters, the
+    // buffer has as much as fits, unterminated
+    static int GetUTF16FromUTF8(const str_utf8 * pUTF8, str_utf16 * pUTF16, int nCharacters);
 };
 
 }
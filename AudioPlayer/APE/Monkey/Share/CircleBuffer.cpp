@@ -37,6 +37,14 @@ int CCircleBuffer::MaxAdd()
     return nMaxAdd;
 }
 
+int CCircleBuffer::MaxDirectWrite()
+{
+    // the number of bytes that can be written at the direct write pointer in one go (it's
+    // fine to run into the end cap area since UpdateAfterDirectWrite(...) will loop around)
+    int nMaxAdd = MaxAdd();
+    return (m_nTail >= m_nHead) ? min(nMaxAdd, m_nTotal - m_nTail) : nMaxAdd;
+}
+
 int CCircleBuffer::MaxGet()
 {
     return (m_nTail >= m_nHead) ? m_nTail - m_nHead : (m_nEndCap - m_nHead) + m_nTail;
@@ -66,6 +74,34 @@ int CCircleBuffer::Get(unsigned char * pBuffer, int nBytes)
     return nTotalGetBytes;
 }
 
+void CCircleBuffer::GetHead(int nBytes, const unsigned char ** ppFirst, int * pFirstBytes, const unsigned char ** ppSecond, int * pSecondBytes)
+{
+    nBytes = max(min(MaxGet(), nBytes), 0);
+    *ppFirst = &m_pBuffer[m_nHead];
+    *pFirstBytes = min(m_nEndCap - m_nHead, nBytes);
+    *ppSecond = m_pBuffer;
+    *pSecondBytes = nBytes - *pFirstBytes;
+}
+
+void CCircleBuffer::GetTail(int nBytes, const unsigned char ** ppFirst, int * pFirstBytes, const unsigned char ** ppSecond, int * pSecondBytes)
+{
+    nBytes = max(min(MaxGet(), nBytes), 0);
+    if (nBytes <= m_nTail)
+    {
+        *ppFirst = &m_pBuffer[m_nTail - nBytes];
+        *pFirstBytes = nBytes;
+        *ppSecond = m_pBuffer;
+        *pSecondBytes = 0;
+    }
+    else
+    {
+        *ppFirst = &m_pBuffer[m_nEndCap - (nBytes - m_nTail)];
+        *pFirstBytes = nBytes - m_nTail;
+        *ppSecond = m_pBuffer;
+        *pSecondBytes = m_nTail;
+    }
+}
+
 void CCircleBuffer::Empty()
 {
     m_nHead = 0;
@@ -16,6 +16,7 @@ public:
     // query
     int MaxAdd();
     int MaxGet();
+    int MaxDirectWrite();
 
     // direct writing
     __forceinline unsigned char * GetDirectWritePointer()
@@ -28,10 +29,13 @@ public:
     __forceinline void UpdateAfterDirectWrite(int nBytes)
     {
         // update the tail
+        BOOL bAheadOfHead = (m_nTail >= m_nHead);
         m_nTail += nBytes;
 
-        // if the tail enters the "end cap" area, set the end cap and loop around
-        if (m_nTail >= (m_nTotal - m_nMaxDirectWriteBytes))
+        // if the tail enters the "end cap" area, set the end cap and loop around (not if it has
+        // looped around already and is coming up behind the head -- with writes bigger than a
+        // block the last end cap can be past the start of the area, with data still in it)
+        if (bAheadOfHead && (m_nTail >= (m_nTotal - m_nMaxDirectWriteBytes)))
         {
             m_nEndCap = m_nTail;
             m_nTail = 0;
@@ -41,6 +45,14 @@ public:
     // get data
     int Get(unsigned char * pBuffer, int nBytes);
 
+    // the first nBytes (what Get(...) would copy out), in order, as up to two contiguous runs (the
+    // second is empty unless they straddle the loop around) -- nothing is removed
+    void GetHead(int nBytes, const unsigned char ** ppFirst, int * pFirstBytes, const unsigned char ** ppSecond, int * pSecondBytes);
+
+    // the last nBytes added, in order, as up to two contiguous runs (the second is empty unless
+    // they straddle the loop around)
+    void GetTail(int nBytes, const unsigned char ** ppFirst, int * pFirstBytes, const unsigned char ** ppSecond, int * pSecondBytes);
+
     // remove / empty
     void Empty();
     int RemoveHead(int nBytes);
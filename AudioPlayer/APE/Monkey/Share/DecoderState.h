@@ -0,0 +1,85 @@
+#pragma once
+
+#include "All.h"
+
+namespace APE_MONKEY
+{
+
+/*************************************************************************************************
+CDecoderStateWriter / CDecoderStateReader - flat byte streams for saving and restoring the state
+of the decoding components (predictors, filters, bit array)
+
+A writer without a buffer only counts, so the size of a state is found by saving it once.  A
+reader never runs past its buffer; it zero fills and flags an error instead.
+*************************************************************************************************/
+class CDecoderStateWriter
+{
+public:
+    CDecoderStateWriter(unsigned char * pBuffer = NULL)
+    {
+        m_pBuffer = pBuffer;
+        m_nBytes = 0;
+    }
+
+    void Write(const void * pData, int nBytes)
+    {
+        if (m_pBuffer != NULL)
+            memcpy(&m_pBuffer[m_nBytes], pData, nBytes);
+        m_nBytes += nBytes;
+    }
+
+    template <class TYPE> void WriteValue(TYPE Value)
+    {
+        Write(&Value, sizeof(TYPE));
+    }
+
+    int GetBytes() const { return m_nBytes; }
+
+protected:
+    unsigned char * m_pBuffer;
+    int m_nBytes;
+};
+
+class CDecoderStateReader
+{
+public:
+    CDecoderStateReader(const unsigned char * pBuffer, int nBytes)
+    {
+        m_pBuffer = pBuffer;
+        m_nTotalBytes = nBytes;
+        m_nBytes = 0;
+        m_bError = FALSE;
+    }
+
+    void Read(void * pData, int nBytes)
+    {
+        if ((m_bError == FALSE) && (nBytes <= m_nTotalBytes - m_nBytes))
+        {
+            memcpy(pData, &m_pBuffer[m_nBytes], nBytes);
+            m_nBytes += nBytes;
+        }
+        else
+        {
+            memset(pData, 0, nBytes);
+            m_bError = TRUE;
+        }
+    }
+
+    template <class TYPE> TYPE ReadValue()
+    {
+        TYPE Value;
+        Read(&Value, sizeof(TYPE));
+        return Value;
+    }
+
+    int GetBytes() const { return m_nBytes; }
+    BOOL GetError() const { return m_bError; }
+
+protected:
+    const unsigned char * m_pBuffer;
+    int m_nTotalBytes;
+    int m_nBytes;
+    BOOL m_bError;
+};
+
+}
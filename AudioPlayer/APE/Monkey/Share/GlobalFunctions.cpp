@@ -3,10 +3,14 @@
 #include "StdLibFileIO.h"
 #include "CharacterHelper.h"
 
+#if defined(ENABLE_SSE_ASSEMBLY) && !defined(_MSC_VER)
+    #include <cpuid.h>
+#endif
+
 namespace APE_MONKEY
 {
 
-int ReadSafe(CStdLibFileIO * pIO, void * pBuffer, int nBytes)
+int ReadSafe(CIO * pIO, void * pBuffer, int nBytes)
 {
     unsigned int nBytesRead = 0;
     int nRetVal = pIO->Read(pBuffer, nBytes, &nBytesRead);
@@ -19,7 +23,7 @@ int ReadSafe(CStdLibFileIO * pIO, void * pBuffer, int nBytes)
     return nRetVal;
 }
 
-int WriteSafe(CStdLibFileIO * pIO, void * pBuffer, int nBytes)
+int WriteSafe(CIO * pIO, void * pBuffer, int nBytes)
 {
     unsigned int nBytesWritten = 0;
     int nRetVal = pIO->Write(pBuffer, nBytes, &nBytesWritten);
@@ -74,9 +78,10 @@ void FreeAligned(void * pMemory)
 bool GetSSEAvailable()
 {
     bool bSSE = false;
-#ifdef _MSC_VER
+#ifdef ENABLE_SSE_ASSEMBLY
     #define CPU_SSE2 (1 << 26)
 
+#ifdef _MSC_VER
     int cpuInfo[4] = { 0 };
     __cpuid(cpuInfo, 0);
 
@@ -87,10 +92,64 @@ bool GetSSEAvailable()
         bSSE = !!(cpuInfo[3] & CPU_SSE2);
     }
 #else
-    // TODO: fill this in
+    unsigned int nEAX = 0, nEBX = 0, nECX = 0, nEDX = 0;
+    if (__get_cpuid(1, &nEAX, &nEBX, &nECX, &nEDX))
+        bSSE = !!(nEDX & CPU_SSE2);
+#endif
 #endif
 
     return bSSE;
 }
 
-}
\ No newline at end of file
+bool GetAVX2Available()
+{
+    bool bAVX2 = false;
+#ifdef ENABLE_AVX_ASSEMBLY
+    #define CPU_OSXSAVE (1 << 27)
+    #define CPU_AVX (1 << 28)
+    #define CPU_AVX2 (1 << 5)
+
+    // AVX2 needs the CPU flag and the OS saving the YMM registers on a context switch (XCR0 bits 1 and 2)
+    unsigned int nEAX = 0, nEBX = 0, nECX = 0, nEDX = 0;
+    if (__get_cpuid(1, &nEAX, &nEBX, &nECX, &nEDX) && (nECX & CPU_OSXSAVE) && (nECX & CPU_AVX))
+    {
+        unsigned int nXCR0Low = 0, nXCR0High = 0;
+        __asm__ __volatile__ ("xgetbv" : "=a" (nXCR0Low), "=d" (nXCR0High) : "c" (0));
+
+        if (((nXCR0Low & 6) == 6) && (__get_cpuid_max(0, NULL) >= 7))
+        {
+            __cpuid_count(7, 0, nEAX, nEBX, nECX, nEDX);
+            bAVX2 = !!(nEBX & CPU_AVX2);
+        }
+    }
+#endif
+
+    return bAVX2;
+}
+
+bool GetPCLMULAvailable()
+{
+    bool bPCLMUL = false;
+#if defined(ENABLE_SSE_ASSEMBLY) && !defined(_MSC_VER)
+    #define CPU_PCLMULQDQ (1 << 1)
+    #define CPU_SSE41 (1 << 19)
+
+    unsigned int nEAX = 0, nEBX = 0, nECX = 0, nEDX = 0;
+    if (__get_cpuid(1, &nEAX, &nEBX, &nECX, &nEDX))
+        bPCLMUL = ((nECX & CPU_PCLMULQDQ) && (nECX & CPU_SSE41));
+#endif
+
+    return bPCLMUL;
+}
+
+bool GetNEONAvailable()
+{
+#ifdef ENABLE_NEON_ASSEMBLY
+    // NEON is only enabled when the compiler targets it, so it's always there at runtime
+    return true;
+#else
+    return false;
+#endif
+}
+
+}
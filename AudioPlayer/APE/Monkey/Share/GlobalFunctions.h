@@ -6,14 +6,14 @@ namespace APE_MONKEY
 /*************************************************************************************
 Definitions
 *************************************************************************************/
-class CStdLibFileIO;
+class CIO;
 
 /*************************************************************************************
 Read / Write from an IO source and return failure if the number of bytes specified
 isn't read or written
 *************************************************************************************/
-int ReadSafe(CStdLibFileIO * pIO, void * pBuffer, int nBytes);
-int WriteSafe(CStdLibFileIO * pIO, void * pBuffer, int nBytes);
+int ReadSafe(CIO * pIO, void * pBuffer, int nBytes);
+int WriteSafe(CIO * pIO, void * pBuffer, int nBytes);
 
 /*************************************************************************************
 Checks for the existence of a file
@@ -30,5 +30,8 @@ void FreeAligned(void * pMemory);
 Test for CPU features
 *************************************************************************************/
 bool GetSSEAvailable();
+bool GetAVX2Available();
+bool GetPCLMULAvailable();
+bool GetNEONAvailable();
 
 }
@@ -17,6 +17,13 @@ namespace APE_MONKEY
     #define FILE_END        2
 #endif
 
+/*************************************************************************************************
+CIO - the interface everything that reads (or writes) APE data goes through
+
+Offsets are 64-bit.  Besides CStdLibFileIO / CMappedFileIO there are sources for a memory
+buffer (CMemoryIO), a large read-ahead cache in front of another source (CReadAheadIO) and
+anything that can fetch byte ranges on demand (CRangedIO).
+*************************************************************************************************/
 class CIO
 {   
 public:
@@ -25,7 +32,7 @@ public:
     virtual ~CIO() { };
 
     // open / close
-    virtual int Open(const wchar_t * pName, BOOL bOpenReadOnly = FALSE) = 0;
+    virtual int Open(LPCTSTR pName, BOOL bOpenReadOnly = FALSE) = 0;
     virtual int Close() = 0;
     
     // read / write
@@ -33,7 +40,7 @@ public:
     virtual int Write(const void * pBuffer, unsigned int nBytesToWrite, unsigned int * pBytesWritten) = 0;
     
     // seek
-    virtual int Seek(int nDistance, unsigned int nMoveMode) = 0;
+    virtual int Seek(long long nDistance, unsigned int nMoveMode) = 0;
     
     // creation / destruction
     virtual int Create(const wchar_t * pName) = 0;
@@ -43,9 +50,12 @@ public:
     virtual int SetEOF() = 0;
 
     // attributes
-    virtual int GetPosition() = 0;
-    virtual int GetSize() = 0;
-    virtual int GetName(wchar_t * pBuffer) = 0;
+    virtual long long GetPosition() = 0;
+    virtual long long GetSize() = 0;
+    virtual int GetName(char * pBuffer) = 0;
+
+    // the whole source in memory, so frames can be decoded in place (NULL if it isn't)
+    virtual const unsigned char * GetMappedBuffer() { return NULL; }
 };
 
 }
@@ -0,0 +1,156 @@
+#include "All.h"
+#include "MappedFileIO.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+
+namespace APE_MONKEY
+{
+
+CMappedFileIO::CMappedFileIO()
+{
+    m_hFile = -1;
+    m_pMapping = NULL;
+    m_nMappingBytes = 0;
+    m_nPosition = 0;
+}
+
+CMappedFileIO::~CMappedFileIO()
+{
+    Close();
+}
+
+int CMappedFileIO::Open(LPCTSTR pName, BOOL bOpenReadOnly)
+{
+    Close();
+
+    // map regular files
+    int hFile = open(pName, O_RDONLY);
+    if (hFile >= 0)
+    {
+        struct stat FileStat;
+        if ((fstat(hFile, &FileStat) == 0) && S_ISREG(FileStat.st_mode) && (FileStat.st_size > 0))
+        {
+            void * pMapping = mmap(NULL, (size_t) FileStat.st_size, PROT_READ, MAP_PRIVATE, hFile, 0);
+            if (pMapping != MAP_FAILED)
+            {
+                // we mostly stream through the file front to back
+                madvise(pMapping, (size_t) FileStat.st_size, MADV_SEQUENTIAL);
+
+                m_hFile = hFile;
+                m_pMapping = (unsigned char *) pMapping;
+                m_nMappingBytes = FileStat.st_size;
+                m_nPosition = 0;
+                strcpy(m_cFileName, pName);
+                return 0;
+            }
+        }
+        close(hFile);
+    }
+
+    // fall back to stdio for anything else
+    return CStdLibFileIO::Open(pName, bOpenReadOnly);
+}
+
+int CMappedFileIO::Close()
+{
+    if (m_pMapping == NULL)
+        return CStdLibFileIO::Close();
+
+    munmap(m_pMapping, (size_t) m_nMappingBytes);
+    close(m_hFile);
+    m_pMapping = NULL;
+    m_nMappingBytes = 0;
+    m_nPosition = 0;
+    m_hFile = -1;
+    return 0;
+}
+
+int CMappedFileIO::Read(void * pBuffer, unsigned int nBytesToRead, unsigned int * pBytesRead)
+{
+    if (m_pMapping == NULL)
+        return CStdLibFileIO::Read(pBuffer, nBytesToRead, pBytesRead);
+
+    long long nBytesLeft = m_nMappingBytes - m_nPosition;
+    unsigned int nBytesRead = (nBytesLeft <= 0) ? 0 : (unsigned int) min((long long) nBytesToRead, nBytesLeft);
+    if (nBytesRead > 0)
+        memcpy(pBuffer, &m_pMapping[m_nPosition], nBytesRead);
+
+    m_nPosition += nBytesRead;
+    *pBytesRead = nBytesRead;
+    return 0;
+}
+
+int CMappedFileIO::Write(const void * pBuffer, unsigned int nBytesToWrite, unsigned int * pBytesWritten)
+{
+    if (m_pMapping == NULL)
+        return CStdLibFileIO::Write(pBuffer, nBytesToWrite, pBytesWritten);
+
+    // the mapping is read-only
+    *pBytesWritten = 0;
+    return ERROR_IO_WRITE;
+}
+
+int CMappedFileIO::Seek(long long nDistance, unsigned int nMoveMode)
+{
+    if (m_pMapping == NULL)
+        return CStdLibFileIO::Seek(nDistance, nMoveMode);
+
+    long long nNewPosition = nDistance;
+    if (nMoveMode == FILE_CURRENT)
+        nNewPosition += m_nPosition;
+    else if (nMoveMode == FILE_END)
+        nNewPosition += m_nMappingBytes;
+
+    // like fseek(...), seeking past the end is allowed but seeking before the start is not
+    if (nNewPosition < 0)
+        return -1;
+
+    m_nPosition = nNewPosition;
+    return 0;
+}
+
+int CMappedFileIO::SetEOF()
+{
+    if (m_pMapping == NULL)
+        return CStdLibFileIO::SetEOF();
+
+    return -1;
+}
+
+int CMappedFileIO::Create(const wchar_t * pName)
+{
+    // new files are written through stdio
+    Close();
+    return CStdLibFileIO::Create(pName);
+}
+
+long long CMappedFileIO::GetPosition()
+{
+    if (m_pMapping == NULL)
+        return CStdLibFileIO::GetPosition();
+
+    return m_nPosition;
+}
+
+long long CMappedFileIO::GetSize()
+{
+    if (m_pMapping == NULL)
+        return CStdLibFileIO::GetSize();
+
+    return m_nMappingBytes;
+}
+
+int CMappedFileIO::GetHandle()
+{
+    if (m_pMapping == NULL)
+        return CStdLibFileIO::GetHandle();
+
+    return m_hFile;
+}
+
+const unsigned char * CMappedFileIO::GetMappedBuffer()
+{
+    return m_pMapping;
+}
+
+}
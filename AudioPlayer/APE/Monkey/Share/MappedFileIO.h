@@ -0,0 +1,52 @@
+#pragma once
+
+#include "StdLibFileIO.h"
+
+namespace APE_MONKEY
+{
+
+/*************************************************************************************************
+CMappedFileIO - read-only file I/O on top of a memory mapping
+
+Regular files are mapped in Open(...), reads become memcpy's out of the mapping, and
+GetMappedBuffer() hands the mapping to CUnBitArrayBase so frames can be decoded in place.
+Anything that can't be mapped (pipes, stdin, empty files) falls back to the stdio code.
+*************************************************************************************************/
+class CMappedFileIO : public CStdLibFileIO
+{
+public:
+    // construction / destruction
+    CMappedFileIO();
+    ~CMappedFileIO();
+
+    // open / close
+    int Open(LPCTSTR pName, BOOL bOpenReadOnly = FALSE);
+    int Close();
+
+    // read / write
+    int Read(void * pBuffer, unsigned int nBytesToRead, unsigned int * pBytesRead);
+    int Write(const void * pBuffer, unsigned int nBytesToWrite, unsigned int * pBytesWritten);
+
+    // seek
+    int Seek(long long nDistance, unsigned int nMoveMode);
+
+    // other functions
+    int SetEOF();
+
+    // creation / destruction
+    int Create(const wchar_t * pName);
+
+    // attributes
+    long long GetPosition();
+    long long GetSize();
+    int GetHandle();
+    const unsigned char * GetMappedBuffer();
+
+private:
+    int m_hFile;
+    unsigned char * m_pMapping;
+    long long m_nMappingBytes;
+    long long m_nPosition;
+};
+
+}
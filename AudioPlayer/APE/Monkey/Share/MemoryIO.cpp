@@ -0,0 +1,182 @@
+#include "All.h"
+#include "MemoryIO.h"
+
+namespace APE_MONKEY
+{
+
+CMemoryIO::CMemoryIO()
+{
+    m_pData = NULL;
+    m_pOwnedData = NULL;
+    m_nBytes = 0;
+    m_nCapacity = 0;
+    m_nPosition = 0;
+}
+
+CMemoryIO::CMemoryIO(const void * pData, long long nBytes, BOOL bCopy)
+{
+    m_pData = NULL;
+    m_pOwnedData = NULL;
+    m_nBytes = 0;
+    m_nCapacity = 0;
+    m_nPosition = 0;
+
+    if ((pData == NULL) || (nBytes <= 0))
+        return;
+
+    if (bCopy)
+    {
+        if (Reserve(nBytes) != 0)
+            return;
+        memcpy(m_pOwnedData, pData, (size_t) nBytes);
+    }
+    else
+    {
+        m_pData = (const unsigned char *) pData;
+    }
+    m_nBytes = nBytes;
+}
+
+CMemoryIO::~CMemoryIO()
+{
+    Close();
+}
+
+int CMemoryIO::Open(LPCTSTR, BOOL)
+{
+    // there's nothing to open; just start over at the front
+    m_nPosition = 0;
+    return 0;
+}
+
+int CMemoryIO::Close()
+{
+    if (m_pOwnedData != NULL)
+    {
+        free(m_pOwnedData);
+        m_pOwnedData = NULL;
+    }
+
+    m_pData = NULL;
+    m_nBytes = 0;
+    m_nCapacity = 0;
+    m_nPosition = 0;
+    return 0;
+}
+
+int CMemoryIO::Read(void * pBuffer, unsigned int nBytesToRead, unsigned int * pBytesRead)
+{
+    long long nBytesLeft = m_nBytes - m_nPosition;
+    unsigned int nBytesRead = (nBytesLeft <= 0) ? 0 : (unsigned int) min((long long) nBytesToRead, nBytesLeft);
+    if (nBytesRead > 0)
+        memcpy(pBuffer, &m_pData[m_nPosition], nBytesRead);
+
+    m_nPosition += nBytesRead;
+    *pBytesRead = nBytesRead;
+    return 0;
+}
+
+int CMemoryIO::Write(const void * pBuffer, unsigned int nBytesToWrite, unsigned int * pBytesWritten)
+{
+    *pBytesWritten = 0;
+
+    // a borrowed buffer is read-only
+    if ((m_pData != NULL) && (m_pOwnedData == NULL))
+        return ERROR_IO_WRITE;
+
+    long long nEnd = m_nPosition + nBytesToWrite;
+    if (Reserve(nEnd) != 0)
+        return ERROR_IO_WRITE;
+
+    // fill any gap left by seeking past the end with zeros (like a file would)
+    if (m_nPosition > m_nBytes)
+        memset(&m_pOwnedData[m_nBytes], 0, (size_t) (m_nPosition - m_nBytes));
+
+    memcpy(&m_pOwnedData[m_nPosition], pBuffer, nBytesToWrite);
+    m_nPosition = nEnd;
+    m_nBytes = max(m_nBytes, nEnd);
+    *pBytesWritten = nBytesToWrite;
+    return 0;
+}
+
+int CMemoryIO::Seek(long long nDistance, unsigned int nMoveMode)
+{
+    long long nNewPosition = nDistance;
+    if (nMoveMode == FILE_CURRENT)
+        nNewPosition += m_nPosition;
+    else if (nMoveMode == FILE_END)
+        nNewPosition += m_nBytes;
+
+    // like fseek(...), seeking past the end is allowed but seeking before the start is not
+    if (nNewPosition < 0)
+        return -1;
+
+    m_nPosition = nNewPosition;
+    return 0;
+}
+
+int CMemoryIO::Create(const wchar_t *)
+{
+    Close();
+    return 0;
+}
+
+int CMemoryIO::Delete()
+{
+    return Close();
+}
+
+int CMemoryIO::SetEOF()
+{
+    if ((m_pData != NULL) && (m_pOwnedData == NULL))
+        return -1;
+
+    if (m_nPosition > m_nBytes)
+    {
+        if (Reserve(m_nPosition) != 0)
+            return -1;
+        memset(&m_pOwnedData[m_nBytes], 0, (size_t) (m_nPosition - m_nBytes));
+    }
+    m_nBytes = m_nPosition;
+    return 0;
+}
+
+long long CMemoryIO::GetPosition()
+{
+    return m_nPosition;
+}
+
+long long CMemoryIO::GetSize()
+{
+    return m_nBytes;
+}
+
+int CMemoryIO::GetName(char * pBuffer)
+{
+    pBuffer[0] = 0;
+    return 0;
+}
+
+const unsigned char * CMemoryIO::GetMappedBuffer()
+{
+    return m_pData;
+}
+
+int CMemoryIO::Reserve(long long nBytes)
+{
+    if (nBytes <= m_nCapacity)
+        return 0;
+
+    // grow geometrically so a stream of small writes stays linear
+    long long nCapacity = max(nBytes, max(m_nCapacity * 2, (long long) 65536));
+    unsigned char * pNewData = (unsigned char *) realloc(m_pOwnedData, (size_t) nCapacity);
+    if (pNewData == NULL)
+        return ERROR_INSUFFICIENT_MEMORY;
+
+    m_pOwnedData = pNewData;
+    m_pData = pNewData;
+    m_nCapacity = nCapacity;
+    return 0;
+}
+
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "IO.h"
+
+namespace APE_MONKEY
+{
+
+/*************************************************************************************************
+CMemoryIO - I/O over a block of memory
+
+Wraps a buffer that is already in memory (a downloaded file, a cache, an embedded resource) so
+it can be handed to CreateIAPEDecompressEx(...).  GetMappedBuffer() returns the buffer, so frames
+are decoded in place without any copying.  The buffer is either borrowed from the caller (who
+keeps it alive and unchanged) or copied and owned.  A CMemoryIO constructed without a buffer
+owns a growable buffer and accepts writes.
+*************************************************************************************************/
+class CMemoryIO : public CIO
+{
+public:
+    // construction / destruction
+    CMemoryIO();
+    CMemoryIO(const void * pData, long long nBytes, BOOL bCopy = FALSE);
+    ~CMemoryIO();
+
+    // open / close
+    int Open(LPCTSTR pName, BOOL bOpenReadOnly = FALSE);
+    int Close();
+
+    // read / write
+    int Read(void * pBuffer, unsigned int nBytesToRead, unsigned int * pBytesRead);
+    int Write(const void * pBuffer, unsigned int nBytesToWrite, unsigned int * pBytesWritten);
+
+    // seek
+    int Seek(long long nDistance, unsigned int nMoveMode);
+
+    // creation / destruction
+    int Create(const wchar_t * pName);
+    int Delete();
+
+    // other functions
+    int SetEOF();
+
+    // attributes
+    long long GetPosition();
+    long long GetSize();
+    int GetName(char * pBuffer);
+    const unsigned char * GetMappedBuffer();
+
+protected:
+    int Reserve(long long nBytes);
+
+    const unsigned char * m_pData;
+    unsigned char * m_pOwnedData;
+    long long m_nBytes;
+    long long m_nCapacity;
+    long long m_nPosition;
+};
+
+}
@@ -0,0 +1,170 @@
+#include "All.h"
+#include "RangedIO.h"
+
+namespace APE_MONKEY
+{
+
+CRangedIO::CRangedIO(IRangeSource * pSource, BOOL bOwnSource, int nBlockBytes, int nBlocks)
+{
+    m_spSource.Assign(pSource, FALSE, bOwnSource);
+
+    m_nBlockBytes = max(nBlockBytes, 4096);
+    m_nBlocks = max(nBlocks, 2);
+    m_spBlockData.Assign(new unsigned char [(size_t) m_nBlockBytes * m_nBlocks], TRUE);
+    m_spBlocks.Assign(new CACHE_BLOCK [m_nBlocks], TRUE);
+    for (int z = 0; z < m_nBlocks; z++)
+    {
+        m_spBlocks[z].pData = &m_spBlockData[(size_t) m_nBlockBytes * z];
+        m_spBlocks[z].nBlock = -1;
+        m_spBlocks[z].nValidBytes = 0;
+        m_spBlocks[z].nLastUsed = 0;
+    }
+
+    m_nUseCounter = 0;
+    m_nPosition = 0;
+}
+
+CRangedIO::~CRangedIO()
+{
+}
+
+int CRangedIO::Open(LPCTSTR, BOOL)
+{
+    // the source is already "open"; just start over at the front
+    m_nPosition = 0;
+    return (m_spSource != NULL) ? 0 : -1;
+}
+
+int CRangedIO::Close()
+{
+    for (int z = 0; z < m_nBlocks; z++)
+        m_spBlocks[z].nBlock = -1;
+    m_nPosition = 0;
+    return 0;
+}
+
+int CRangedIO::Read(void * pBuffer, unsigned int nBytesToRead, unsigned int * pBytesRead)
+{
+    unsigned char * pOutput = (unsigned char *) pBuffer;
+    unsigned int nBytesRead = 0;
+    int nRetVal = 0;
+
+    while (nBytesRead < nBytesToRead)
+    {
+        CACHE_BLOCK * pBlock = GetBlock(m_nPosition / m_nBlockBytes, &nRetVal);
+        if (pBlock == NULL)
+            break;
+
+        unsigned int nBlockOffset = (unsigned int) (m_nPosition % m_nBlockBytes);
+        if (nBlockOffset >= pBlock->nValidBytes)
+            break; // end of the data
+
+        unsigned int nCopyBytes = min(nBytesToRead - nBytesRead, pBlock->nValidBytes - nBlockOffset);
+        memcpy(&pOutput[nBytesRead], &pBlock->pData[nBlockOffset], nCopyBytes);
+        nBytesRead += nCopyBytes;
+        m_nPosition += nCopyBytes;
+    }
+
+    *pBytesRead = nBytesRead;
+    return nRetVal;
+}
+
+int CRangedIO::Write(const void *, unsigned int, unsigned int * pBytesWritten)
+{
+    *pBytesWritten = 0;
+    return ERROR_IO_WRITE;
+}
+
+int CRangedIO::Seek(long long nDistance, unsigned int nMoveMode)
+{
+    long long nNewPosition = nDistance;
+    if (nMoveMode == FILE_CURRENT)
+        nNewPosition += m_nPosition;
+    else if (nMoveMode == FILE_END)
+        nNewPosition += GetSize();
+
+    if (nNewPosition < 0)
+        return -1;
+
+    m_nPosition = nNewPosition;
+    return 0;
+}
+
+int CRangedIO::Create(const wchar_t *)
+{
+    return -1;
+}
+
+int CRangedIO::Delete()
+{
+    return -1;
+}
+
+int CRangedIO::SetEOF()
+{
+    return -1;
+}
+
+long long CRangedIO::GetPosition()
+{
+    return m_nPosition;
+}
+
+long long CRangedIO::GetSize()
+{
+    return (m_spSource != NULL) ? m_spSource->GetTotalBytes() : 0;
+}
+
+int CRangedIO::GetName(char * pBuffer)
+{
+    pBuffer[0] = 0;
+    return 0;
+}
+
+CRangedIO::CACHE_BLOCK * CRangedIO::GetBlock(long long nBlock, int * pErrorCode)
+{
+    if (m_spSource == NULL)
+    {
+        *pErrorCode = ERROR_IO_READ;
+        return NULL;
+    }
+
+    // look for it (and the least recently used block in case it's not there)
+    CACHE_BLOCK * pVictim = &m_spBlocks[0];
+    for (int z = 0; z < m_nBlocks; z++)
+    {
+        CACHE_BLOCK * pBlock = &m_spBlocks[z];
+        if (pBlock->nBlock == nBlock)
+        {
+            pBlock->nLastUsed = ++m_nUseCounter;
+            return pBlock;
+        }
+        if ((pBlock->nBlock == -1) || ((pVictim->nBlock != -1) && (pBlock->nLastUsed < pVictim->nLastUsed)))
+            pVictim = pBlock;
+    }
+
+    // fetch it (looping, since a range source may return a short read)
+    long long nOffset = nBlock * m_nBlockBytes;
+    unsigned int nValidBytes = 0;
+    pVictim->nBlock = -1;
+    while (nValidBytes < (unsigned int) m_nBlockBytes)
+    {
+        unsigned int nBytesRead = 0;
+        int nRetVal = m_spSource->ReadRange(nOffset + nValidBytes, &pVictim->pData[nValidBytes], m_nBlockBytes - nValidBytes, &nBytesRead);
+        if (nRetVal != 0)
+        {
+            *pErrorCode = ERROR_IO_READ;
+            return NULL;
+        }
+        if (nBytesRead == 0)
+            break;
+        nValidBytes += nBytesRead;
+    }
+
+    pVictim->nBlock = nBlock;
+    pVictim->nValidBytes = nValidBytes;
+    pVictim->nLastUsed = ++m_nUseCounter;
+    return pVictim;
+}
+
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "IO.h"
+
+namespace APE_MONKEY
+{
+
+/*************************************************************************************************
+IRangeSource - anything that can hand out arbitrary byte ranges of a file
+
+An HTTP server that honours Range requests, a partially filled download cache, etc.  ReadRange(...)
+may block, and may return fewer bytes than asked for (but only zero at the end of the data).
+*************************************************************************************************/
+class IRangeSource
+{
+public:
+    virtual ~IRangeSource() { }
+
+    virtual int ReadRange(long long nOffset, void * pBuffer, unsigned int nBytes, unsigned int * pBytesRead) = 0;
+    virtual long long GetTotalBytes() = 0;
+};
+
+/*************************************************************************************************
+CRangedIO - read-only CIO on top of an IRangeSource
+
+Reads are rounded out to fixed size blocks and the most recently used blocks are kept, so the
+decoder's habit of reading the header, then the tag at the end, then the frames in order costs a
+handful of range requests instead of one per read.
+*************************************************************************************************/
+class CRangedIO : public CIO
+{
+public:
+    // construction / destruction
+    CRangedIO(IRangeSource * pSource, BOOL bOwnSource = FALSE, int nBlockBytes = 65536, int nBlocks = 8);
+    ~CRangedIO();
+
+    // open / close
+    int Open(LPCTSTR pName, BOOL bOpenReadOnly = FALSE);
+    int Close();
+
+    // read / write
+    int Read(void * pBuffer, unsigned int nBytesToRead, unsigned int * pBytesRead);
+    int Write(const void * pBuffer, unsigned int nBytesToWrite, unsigned int * pBytesWritten);
+
+    // seek
+    int Seek(long long nDistance, unsigned int nMoveMode);
+
+    // creation / destruction
+    int Create(const wchar_t * pName);
+    int Delete();
+
+    // other functions
+    int SetEOF();
+
+    // attributes
+    long long GetPosition();
+    long long GetSize();
+    int GetName(char * pBuffer);
+
+protected:
+    struct CACHE_BLOCK
+    {
+        unsigned char * pData;
+        long long nBlock;
+        unsigned int nValidBytes;
+        unsigned int nLastUsed;
+    };
+
+    CACHE_BLOCK * GetBlock(long long nBlock, int * pErrorCode);
+
+    CSmartPtr<IRangeSource> m_spSource;
+    int m_nBlockBytes;
+    int m_nBlocks;
+    CSmartPtr<CACHE_BLOCK> m_spBlocks;
+    CSmartPtr<unsigned char> m_spBlockData;
+    unsigned int m_nUseCounter;
+    long long m_nPosition;
+};
+
+}
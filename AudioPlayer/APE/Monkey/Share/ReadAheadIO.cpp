@@ -0,0 +1,217 @@
+#include "All.h"
+#include "ReadAheadIO.h"
+#include "StdLibFileIO.h"
+
+namespace APE_MONKEY
+{
+
+CReadAheadIO::CReadAheadIO(CIO * pSource, BOOL bOwnSource, int nBufferBytes)
+{
+    if (pSource != NULL)
+        m_spSource.Assign(pSource, FALSE, bOwnSource);
+
+    m_nBufferBytes = max(nBufferBytes, 4096);
+    m_spBuffer.Assign(new unsigned char [m_nBufferBytes], TRUE);
+
+    m_nBufferStart = 0;
+    m_nBufferValidBytes = 0;
+    m_nPosition = (pSource != NULL) ? pSource->GetPosition() : 0;
+    m_nSourcePosition = m_nPosition;
+}
+
+CReadAheadIO::~CReadAheadIO()
+{
+}
+
+int CReadAheadIO::Open(LPCTSTR pName, BOOL bOpenReadOnly)
+{
+    if (m_spSource == NULL)
+        m_spSource.Assign(new CStdLibFileIO);
+
+    InvalidateBuffer();
+    m_nPosition = 0;
+    m_nSourcePosition = 0;
+    return m_spSource->Open(pName, bOpenReadOnly);
+}
+
+int CReadAheadIO::Close()
+{
+    InvalidateBuffer();
+    m_nPosition = 0;
+    m_nSourcePosition = 0;
+    return (m_spSource != NULL) ? m_spSource->Close() : -1;
+}
+
+int CReadAheadIO::Read(void * pBuffer, unsigned int nBytesToRead, unsigned int * pBytesRead)
+{
+    *pBytesRead = 0;
+    if (m_spSource == NULL)
+        return ERROR_IO_READ;
+
+    unsigned char * pOutput = (unsigned char *) pBuffer;
+    unsigned int nBytesRead = 0;
+    int nRetVal = 0;
+
+    while (nBytesRead < nBytesToRead)
+    {
+        // copy whatever the buffer already has
+        long long nBufferOffset = m_nPosition - m_nBufferStart;
+        if ((nBufferOffset >= 0) && (nBufferOffset < m_nBufferValidBytes))
+        {
+            unsigned int nCopyBytes = (unsigned int) min((long long) (nBytesToRead - nBytesRead), m_nBufferValidBytes - nBufferOffset);
+            memcpy(&pOutput[nBytesRead], &m_spBuffer[(int) nBufferOffset], nCopyBytes);
+            nBytesRead += nCopyBytes;
+            m_nPosition += nCopyBytes;
+            continue;
+        }
+
+        // big reads skip the buffer
+        unsigned int nBytesLeft = nBytesToRead - nBytesRead;
+        if (nBytesLeft >= (unsigned int) m_nBufferBytes)
+        {
+            if ((m_nSourcePosition != m_nPosition) && (m_spSource->Seek(m_nPosition, FILE_BEGIN) != 0))
+            {
+                nRetVal = ERROR_IO_READ;
+                break;
+            }
+
+            unsigned int nDirectBytes = 0;
+            nRetVal = m_spSource->Read(&pOutput[nBytesRead], nBytesLeft, &nDirectBytes);
+            nBytesRead += nDirectBytes;
+            m_nPosition += nDirectBytes;
+            m_nSourcePosition = m_nPosition;
+            break;
+        }
+
+        // refill
+        nRetVal = FillBuffer();
+        if ((nRetVal != 0) || (m_nBufferValidBytes == 0))
+            break;
+    }
+
+    *pBytesRead = nBytesRead;
+    return nRetVal;
+}
+
+int CReadAheadIO::Write(const void * pBuffer, unsigned int nBytesToWrite, unsigned int * pBytesWritten)
+{
+    InvalidateBuffer();
+
+    *pBytesWritten = 0;
+    if (m_spSource == NULL)
+        return ERROR_IO_WRITE;
+    if ((m_nSourcePosition != m_nPosition) && (m_spSource->Seek(m_nPosition, FILE_BEGIN) != 0))
+        return ERROR_IO_WRITE;
+
+    int nRetVal = m_spSource->Write(pBuffer, nBytesToWrite, pBytesWritten);
+    m_nPosition += *pBytesWritten;
+    m_nSourcePosition = m_nPosition;
+    return nRetVal;
+}
+
+int CReadAheadIO::Seek(long long nDistance, unsigned int nMoveMode)
+{
+    long long nNewPosition = nDistance;
+    if (nMoveMode == FILE_CURRENT)
+        nNewPosition += m_nPosition;
+    else if (nMoveMode == FILE_END)
+        nNewPosition += GetSize();
+
+    if (nNewPosition < 0)
+        return -1;
+
+    // the source is only moved when we actually need to read from it
+    m_nPosition = nNewPosition;
+    return 0;
+}
+
+int CReadAheadIO::Create(const wchar_t * pName)
+{
+    if (m_spSource == NULL)
+        m_spSource.Assign(new CStdLibFileIO);
+
+    InvalidateBuffer();
+    m_nPosition = 0;
+    m_nSourcePosition = 0;
+    return m_spSource->Create(pName);
+}
+
+int CReadAheadIO::Delete()
+{
+    if (m_spSource == NULL)
+        return -1;
+
+    InvalidateBuffer();
+    return m_spSource->Delete();
+}
+
+int CReadAheadIO::SetEOF()
+{
+    if (m_spSource == NULL)
+        return -1;
+
+    InvalidateBuffer();
+    if ((m_nSourcePosition != m_nPosition) && (m_spSource->Seek(m_nPosition, FILE_BEGIN) != 0))
+        return -1;
+
+    m_nSourcePosition = m_nPosition;
+    return m_spSource->SetEOF();
+}
+
+long long CReadAheadIO::GetPosition()
+{
+    return m_nPosition;
+}
+
+long long CReadAheadIO::GetSize()
+{
+    if (m_spSource == NULL)
+        return 0;
+
+    long long nSize = m_spSource->GetSize();
+
+    // some sources find the size by seeking around, so don't trust where they left off
+    m_nSourcePosition = m_spSource->GetPosition();
+    return nSize;
+}
+
+int CReadAheadIO::GetName(char * pBuffer)
+{
+    if (m_spSource == NULL)
+        return -1;
+
+    return m_spSource->GetName(pBuffer);
+}
+
+const unsigned char * CReadAheadIO::GetMappedBuffer()
+{
+    if (m_spSource == NULL)
+        return NULL;
+
+    // nothing to gain from a read buffer on top of memory, so let the decoder use it directly
+    return m_spSource->GetMappedBuffer();
+}
+
+int CReadAheadIO::FillBuffer()
+{
+    InvalidateBuffer();
+
+    if ((m_nSourcePosition != m_nPosition) && (m_spSource->Seek(m_nPosition, FILE_BEGIN) != 0))
+        return ERROR_IO_READ;
+
+    unsigned int nBytesRead = 0;
+    int nRetVal = m_spSource->Read(m_spBuffer, m_nBufferBytes, &nBytesRead);
+
+    m_nBufferStart = m_nPosition;
+    m_nBufferValidBytes = (int) nBytesRead;
+    m_nSourcePosition = m_nPosition + nBytesRead;
+    return nRetVal;
+}
+
+void CReadAheadIO::InvalidateBuffer()
+{
+    m_nBufferStart = 0;
+    m_nBufferValidBytes = 0;
+}
+
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "IO.h"
+
+namespace APE_MONKEY
+{
+
+/*************************************************************************************************
+CReadAheadIO - a large read buffer in front of another CIO
+
+The decoder reads a frame at a time and reads the header, seek table and tags in small pieces
+from all over the file.  On sources where every call is expensive (a socket, a slow card, a
+cache that locks) this turns those into a few big sequential reads.  Seeks that land inside the
+buffer don't touch the source at all.  Writes go straight through and drop the buffer.
+*************************************************************************************************/
+class CReadAheadIO : public CIO
+{
+public:
+    // construction / destruction (with no source, Open(...) opens a CStdLibFileIO)
+    CReadAheadIO(CIO * pSource = NULL, BOOL bOwnSource = TRUE, int nBufferBytes = 262144);
+    ~CReadAheadIO();
+
+    // open / close
+    int Open(LPCTSTR pName, BOOL bOpenReadOnly = FALSE);
+    int Close();
+
+    // read / write
+    int Read(void * pBuffer, unsigned int nBytesToRead, unsigned int * pBytesRead);
+    int Write(const void * pBuffer, unsigned int nBytesToWrite, unsigned int * pBytesWritten);
+
+    // seek
+    int Seek(long long nDistance, unsigned int nMoveMode);
+
+    // creation / destruction
+    int Create(const wchar_t * pName);
+    int Delete();
+
+    // other functions
+    int SetEOF();
+
+    // attributes
+    long long GetPosition();
+    long long GetSize();
+    int GetName(char * pBuffer);
+    const unsigned char * GetMappedBuffer();
+
+protected:
+    int FillBuffer();
+    void InvalidateBuffer();
+
+    CSmartPtr<CIO> m_spSource;
+    CSmartPtr<unsigned char> m_spBuffer;
+    int m_nBufferBytes;
+
+    // the buffer holds the source bytes [m_nBufferStart, m_nBufferStart + m_nBufferValidBytes)
+    long long m_nBufferStart;
+    int m_nBufferValidBytes;
+
+    // where the caller thinks it is (the source itself is left wherever the last fill put it)
+    long long m_nPosition;
+    long long m_nSourcePosition;
+};
+
+}
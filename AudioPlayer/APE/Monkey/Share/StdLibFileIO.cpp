@@ -164,7 +164,7 @@ int CStdLibFileIO::Write(const void * pBuffer, unsigned  int nBytesToWrite, unsi
 
 int CStdLibFileIO::Seek(long long nDistance, unsigned int nMoveMode)
 {
-    return fseek(m_pFile, nDistance, nMoveMode);
+    return fseeko(m_pFile, (off_t) nDistance, nMoveMode);
 }
 
 int CStdLibFileIO::SetEOF()
@@ -174,18 +174,22 @@ int CStdLibFileIO::SetEOF()
 
 long long CStdLibFileIO::GetPosition()
 {
-    fpos_t fPosition;
+    // (fpos_t is only an offset on Darwin; glibc makes it a struct)
+    if (m_pFile == NULL)
+        return 0;
 
-    memset(&fPosition, 0, sizeof(fPosition));
-    if (m_pFile != NULL) {
-        fgetpos(m_pFile, &fPosition);
-    }
-    
-    return fPosition;
+    return (long long) ftello(m_pFile);
 }
 
 long long CStdLibFileIO::GetSize()
 {
+    // ask the file system for regular files instead of seeking to the end and back
+    // (anything still buffered for writing is past the stat size, but fseek(...) flushes
+    // so until then writes are sequential and the position is the end)
+    struct stat FileStat;
+    if ((m_pFile != NULL) && (fstat(GetHandle(), &FileStat) == 0) && S_ISREG(FileStat.st_mode))
+        return max((long long) FileStat.st_size, GetPosition());
+
     long long nCurrentPosition = GetPosition();
     Seek(0, FILE_END);
     long long nLength = GetPosition();
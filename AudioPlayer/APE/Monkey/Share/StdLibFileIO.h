@@ -12,38 +12,38 @@ namespace APE_MONKEY
 
 using namespace APE_MONKEY;
     
-class CStdLibFileIO// : public CIO
+class CStdLibFileIO : public CIO
 {
 public:
     // construction / destruction
     CStdLibFileIO();
-    ~CStdLibFileIO();
+    virtual ~CStdLibFileIO();
 
     // open / close
-    int Open(LPCTSTR pName, BOOL bOpenReadOnly = FALSE);
-    int Close();
+    virtual int Open(LPCTSTR pName, BOOL bOpenReadOnly = FALSE);
+    virtual int Close();
     
     // read / write
-    int Read(void * pBuffer, unsigned int nBytesToRead, unsigned int * pBytesRead);
-    int Write(const void * pBuffer, unsigned int nBytesToWrite, unsigned int * pBytesWritten);
+    virtual int Read(void * pBuffer, unsigned int nBytesToRead, unsigned int * pBytesRead);
+    virtual int Write(const void * pBuffer, unsigned int nBytesToWrite, unsigned int * pBytesWritten);
     
     // seek
-    int Seek(long long nDistance, unsigned int nMoveMode);
+    virtual int Seek(long long nDistance, unsigned int nMoveMode);
     
     // other functions
-    int SetEOF();
+    virtual int SetEOF();
 
     // creation / destruction
-    int Create(const wchar_t * pName);
-    int Delete();
+    virtual int Create(const wchar_t * pName);
+    virtual int Delete();
 
     // attributes
-    long long GetPosition();
-    long long GetSize();
-    int GetName(char * pBuffer);
-    int GetHandle();
+    virtual long long GetPosition();
+    virtual long long GetSize();
+    virtual int GetName(char * pBuffer);
+    virtual int GetHandle();
 
-private:
+protected:
     
     char m_cFileName[MAX_PATH];
     BOOL m_bReadOnly;
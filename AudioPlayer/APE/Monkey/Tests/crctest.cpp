@@ -0,0 +1,102 @@
+/*****************************************************************************************
+crctest - checks CRC32UpdateRepeat(...) (the closed form a silent frame's CRC is taken with)
+against CRC32Update(...) over a buffer of the same byte
+
+Usage:
+    crctest
+
+Every run length from 0 to 300 is checked, then lengths around the powers of two and the
+frame sizes (a whole silent frame at every level, mono to 24-bit stereo), then random ones up
+to a few MB.  Each is done for the bytes a silent frame can be made of (0, and 127 / 128 for
+8 bit) and a couple of others, from a few starting CRCs (including the 0xFFFFFFFF a frame
+starts from).
+
+The exit code is 0 if everything matched and 1 if anything didn't.
+*****************************************************************************************/
+#include "All.h"
+#include "CRC.h"
+
+using namespace APE_MONKEY;
+
+/*****************************************************************************************
+Random numbers (the same every run)
+*****************************************************************************************/
+static unsigned int g_nSeed = 1;
+
+static int GetRandom()
+{
+    g_nSeed = g_nSeed * 1103515245 + 12345;
+    return int((g_nSeed >> 8) & 0xFFFF);
+}
+
+/*****************************************************************************************
+Checking one run length
+*****************************************************************************************/
+static int CheckLength(const unsigned char * pBuffers, int nBufferBytes, int nBytes, int * pChecks)
+{
+    const unsigned char aryBytes[5] = { 0, 127, 128, 0x5A, 0xFF };
+    const uint32 aryCRCs[3] = { 0xFFFFFFFF, 0, 0x12345678 };
+
+    int nFailures = 0;
+    for (int nByte = 0; nByte < 5; nByte++)
+    {
+        for (int nStart = 0; nStart < 3; nStart++)
+        {
+            uint32 nExpected = CRC32Update(aryCRCs[nStart], &pBuffers[nByte * nBufferBytes], nBytes);
+            uint32 nRepeat = CRC32UpdateRepeat(aryCRCs[nStart], aryBytes[nByte], nBytes);
+            if (nRepeat != nExpected)
+            {
+                if (nFailures < 10)
+                    printf("FAILED: %d bytes of 0x%02X from 0x%08X: 0x%08X, expected 0x%08X\n", nBytes, aryBytes[nByte], aryCRCs[nStart], nRepeat, nExpected);
+                nFailures++;
+            }
+            (*pChecks)++;
+        }
+    }
+    return nFailures;
+}
+
+int main(int argc, char * argv[])
+{
+    if (argc > 1)
+    {
+        printf("usage: crctest\n");
+        return 2;
+    }
+
+    // a buffer of each byte, long enough for a frame of insane 24-bit stereo
+    const int nBufferBytes = 1179648 * 6 + 4096;
+    const unsigned char aryBytes[5] = { 0, 127, 128, 0x5A, 0xFF };
+    CSmartPtr<unsigned char> spBuffers(new unsigned char [5 * nBufferBytes], TRUE);
+    for (int nByte = 0; nByte < 5; nByte++)
+        memset(&spBuffers[nByte * nBufferBytes], aryBytes[nByte], nBufferBytes);
+
+    int nFailures = 0;
+    int nChecks = 0;
+
+    // every short run
+    for (int nBytes = 0; nBytes <= 300; nBytes++)
+        nFailures += CheckLength(spBuffers, nBufferBytes, nBytes, &nChecks);
+
+    // around the powers of two
+    for (int nBit = 9; (1 << nBit) < nBufferBytes; nBit++)
+    {
+        for (int nOffset = -1; nOffset <= 1; nOffset++)
+            nFailures += CheckLength(spBuffers, nBufferBytes, (1 << nBit) + nOffset, &nChecks);
+    }
+
+    // whole frames (73728 blocks up to level 3000, 294912 at 4000 and 1179648 at 5000)
+    const int aryFrameBlocks[3] = { 73728, 294912, 1179648 };
+    for (int nFrame = 0; nFrame < 3; nFrame++)
+    {
+        for (int nBlockAlign = 1; nBlockAlign <= 6; nBlockAlign++)
+            nFailures += CheckLength(spBuffers, nBufferBytes, aryFrameBlocks[nFrame] * nBlockAlign, &nChecks);
+    }
+
+    // and anything else
+    for (int z = 0; z < 50; z++)
+        nFailures += CheckLength(spBuffers, nBufferBytes, ((GetRandom() << 8) | (GetRandom() & 0xFF)) % nBufferBytes, &nChecks);
+
+    printf("%d runs checked, %d failed\n", nChecks, nFailures);
+    return (nFailures == 0) ? 0 : 1;
+}
@@ -0,0 +1,46 @@
+# Encodes a synthetic WAV on the calling thread and with the frame-parallel compressor, checks
+# the files come out byte for byte the same, and decodes one to check the PCM survived.
+#
+#   cmake -DMAKEWAV=... -DAPEENCODE=... -DAPEBENCH=... -DLEVEL=2000 -DCHANNELS=2 -DBITS=16
+#         -DTHREADS=3 -DWORK_DIR=... -P encodetest.cmake
+
+foreach(VARIABLE MAKEWAV APEENCODE APEBENCH LEVEL CHANNELS BITS THREADS WORK_DIR)
+    if(NOT DEFINED ${VARIABLE})
+        message(FATAL_ERROR "encodetest: ${VARIABLE} isn't set")
+    endif()
+endforeach()
+
+file(MAKE_DIRECTORY ${WORK_DIR})
+set(NAME "level${LEVEL}_c${CHANNELS}_b${BITS}")
+
+function(run)
+    execute_process(COMMAND ${ARGN} RESULT_VARIABLE RESULT OUTPUT_VARIABLE OUTPUT ERROR_VARIABLE OUTPUT)
+    if(NOT RESULT EQUAL 0)
+        string(REPLACE ";" " " COMMAND_LINE "${ARGN}")
+        message(FATAL_ERROR "encodetest: '${COMMAND_LINE}' failed (${RESULT}):\n${OUTPUT}")
+    endif()
+    set(OUTPUT "${OUTPUT}" PARENT_SCOPE)
+endfunction()
+
+# the WAV and the MD5 of its PCM
+run(${MAKEWAV} -c ${CHANNELS} -b ${BITS} ${WORK_DIR}/${NAME}.wav)
+string(REGEX MATCH "md5 ([0-9a-f]+)" MATCHED "${OUTPUT}")
+if(NOT MATCHED)
+    message(FATAL_ERROR "encodetest: makewav didn't print an MD5:\n${OUTPUT}")
+endif()
+set(PCM_MD5 ${CMAKE_MATCH_1})
+
+# on the calling thread (-t 1), one worker per core (-t 0) and THREADS workers
+run(${APEENCODE} -c ${LEVEL} -t 1 ${WORK_DIR}/${NAME}.wav ${WORK_DIR}/${NAME}_t1.ape)
+file(MD5 ${WORK_DIR}/${NAME}_t1.ape SERIAL_MD5)
+foreach(WORKERS 0 ${THREADS})
+    run(${APEENCODE} -c ${LEVEL} -t ${WORKERS} ${WORK_DIR}/${NAME}.wav ${WORK_DIR}/${NAME}_t${WORKERS}.ape)
+    file(MD5 ${WORK_DIR}/${NAME}_t${WORKERS}.ape PARALLEL_MD5)
+    if(NOT PARALLEL_MD5 STREQUAL SERIAL_MD5)
+        message(FATAL_ERROR "encodetest: ${NAME} encoded with -t ${WORKERS} differs from -t 1")
+    endif()
+endforeach()
+
+# and back
+run(${APEBENCH} -n 1 -c ${PCM_MD5} ${WORK_DIR}/${NAME}_t${THREADS}.ape)
+message(STATUS "${NAME}: the same with 1, 0 and ${THREADS} threads, decodes to ${PCM_MD5}")
@@ -0,0 +1,158 @@
+/*****************************************************************************************
+makewav - writes a synthetic WAV file for the encoder tests and prints the MD5 of its PCM
+
+Usage:
+    makewav [-c channels] [-b bits] [-n blocks] [-z block] out.wav
+
+    -c channels     1 or 2 (default 2)
+    -b bits         8, 16 or 24 (default 16)
+    -n blocks       length in blocks at 44.1 kHz (default 200000, a few frames at the lower
+                    levels)
+    -z block        a frame of digital silence from this block on as well (73728 blocks, a
+                    whole frame at levels 1000 to 3000 if block is a multiple of that)
+
+The audio is a tone per channel with a quieter one on top and a few LSBs of noise, a stretch
+of silence, and a stretch of full scale square wave (so the encoder sees runs of zeros and
+the largest values there are as well as music-like input).  The same arguments always give
+the same file.  There's a LIST chunk before the audio, which the APE file has to keep.
+
+The MD5 printed is of the PCM alone (what apebench prints for a decode of the encoded file).
+*****************************************************************************************/
+#include "All.h"
+#include "md5.h"
+
+using namespace APE_MONKEY;
+
+static void Usage()
+{
+    printf("usage: makewav [-c channels] [-b bits] [-n blocks] [-z block] out.wav\n");
+}
+
+static unsigned int g_nSeed = 1;
+static int g_nSilentFrameBlock = -1;
+
+static int GetRandom()
+{
+    g_nSeed = g_nSeed * 1103515245 + 12345;
+    return int((g_nSeed >> 8) & 0xFFFF);
+}
+
+static void PutValue(unsigned char * pBuffer, unsigned int nValue, int nBytes)
+{
+    for (int z = 0; z < nBytes; z++)
+        pBuffer[z] = (unsigned char) (nValue >> (z * 8));
+}
+
+static int GetSample(int nBlock, int nChannel, int nBits)
+{
+    const double dScale = double((1 << (nBits - 1)) - 1);
+
+    // silence, then a full scale square wave, then the tones again
+    if ((nBlock >= 50000) && (nBlock < 56000))
+        return 0;
+    if ((g_nSilentFrameBlock >= 0) && (nBlock >= g_nSilentFrameBlock) && (nBlock < g_nSilentFrameBlock + 73728))
+        return 0;
+    if ((nBlock >= 56000) && (nBlock < 60000))
+        return (((nBlock / 50) + nChannel) & 1) ? int(dScale) : -int(dScale) - 1;
+
+    double dTime = double(nBlock) / 44100.0;
+    double dValue = 0.3 * sin(2.0 * M_PI * (220.0 + 110.0 * nChannel) * dTime) + 0.05 * sin(2.0 * M_PI * 1230.0 * dTime + nChannel);
+    return int(dValue * dScale) + (GetRandom() % 5) - 2;
+}
+
+int main(int argc, char * argv[])
+{
+    int nChannels = 2;
+    int nBits = 16;
+    int nBlocks = 200000;
+    const char * pFilename = NULL;
+
+    for (int z = 1; z < argc; z++)
+    {
+        if ((strcmp(argv[z], "-c") == 0) && (z + 1 < argc))
+            nChannels = atoi(argv[++z]);
+        else if ((strcmp(argv[z], "-b") == 0) && (z + 1 < argc))
+            nBits = atoi(argv[++z]);
+        else if ((strcmp(argv[z], "-n") == 0) && (z + 1 < argc))
+            nBlocks = atoi(argv[++z]);
+        else if ((strcmp(argv[z], "-z") == 0) && (z + 1 < argc))
+            g_nSilentFrameBlock = atoi(argv[++z]);
+        else if ((argv[z][0] != '-') && (pFilename == NULL))
+            pFilename = argv[z];
+        else
+        {
+            Usage();
+            return 2;
+        }
+    }
+    if ((pFilename == NULL) || ((nChannels != 1) && (nChannels != 2)) || ((nBits != 8) && (nBits != 16) && (nBits != 24)) || (nBlocks <= 0))
+    {
+        Usage();
+        return 2;
+    }
+
+    // the PCM (8-bit is unsigned, the rest signed little-endian)
+    const int nSampleBytes = nBits / 8;
+    const int nBlockAlign = nSampleBytes * nChannels;
+    const unsigned int nAudioBytes = (unsigned int) nBlocks * nBlockAlign;
+    CSmartPtr<unsigned char> spAudio(new unsigned char [nAudioBytes], TRUE);
+    g_nSeed = unsigned(nChannels * 100 + nBits);
+    for (int nBlock = 0; nBlock < nBlocks; nBlock++)
+    {
+        for (int nChannel = 0; nChannel < nChannels; nChannel++)
+        {
+            int nValue = GetSample(nBlock, nChannel, nBits);
+            if (nBits == 8)
+                nValue += 128;
+            PutValue(&spAudio[nBlock * nBlockAlign + nChannel * nSampleBytes], (unsigned int) nValue, nSampleBytes);
+        }
+    }
+
+    // RIFF, fmt, LIST, data
+    const char cList[] = "INFOISFT\x08\0\0\0makewav";
+    const unsigned int nListBytes = sizeof(cList);
+    unsigned char cHeader[12 + 24 + 8 + nListBytes + 8];
+    unsigned char * pHeader = cHeader;
+    memcpy(pHeader, "RIFF", 4);
+    PutValue(&pHeader[4], (unsigned int) (sizeof(cHeader) - 8 + nAudioBytes), 4);
+    memcpy(&pHeader[8], "WAVE", 4);
+    pHeader += 12;
+    memcpy(pHeader, "fmt ", 4);
+    PutValue(&pHeader[4], 16, 4);
+    PutValue(&pHeader[8], 1, 2); // WAVE_FORMAT_PCM
+    PutValue(&pHeader[10], nChannels, 2);
+    PutValue(&pHeader[12], 44100, 4);
+    PutValue(&pHeader[16], 44100 * nBlockAlign, 4);
+    PutValue(&pHeader[20], nBlockAlign, 2);
+    PutValue(&pHeader[22], nBits, 2);
+    pHeader += 24;
+    memcpy(pHeader, "LIST", 4);
+    PutValue(&pHeader[4], nListBytes, 4);
+    memcpy(&pHeader[8], cList, nListBytes);
+    pHeader += 8 + nListBytes;
+    memcpy(pHeader, "data", 4);
+    PutValue(&pHeader[4], nAudioBytes, 4);
+
+    FILE * pFile = fopen(pFilename, "wb");
+    if (pFile == NULL)
+    {
+        printf("%s: can't create\n", pFilename);
+        return 1;
+    }
+    BOOL bWritten = (fwrite(cHeader, 1, sizeof(cHeader), pFile) == sizeof(cHeader)) && (fwrite(spAudio, 1, nAudioBytes, pFile) == nAudioBytes);
+    if ((fclose(pFile) != 0) || (bWritten == FALSE))
+    {
+        printf("%s: can't write\n", pFilename);
+        return 1;
+    }
+
+    CMD5Helper MD5;
+    MD5.AddData(spAudio, (int) nAudioBytes);
+    unsigned char cMD5[16];
+    MD5.GetResult(cMD5);
+    printf("md5 ");
+    for (int z = 0; z < 16; z++)
+        printf("%02x", cMD5[z]);
+    printf("\n");
+    return 0;
+}
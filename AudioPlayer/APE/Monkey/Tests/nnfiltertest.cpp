@@ -0,0 +1,268 @@
+/*****************************************************************************************
+nnfiltertest - checks every NN filter kernel this CPU has against a plain scalar model
+
+Usage:
+    nnfiltertest [-n samples]
+
+For each order / shift pair the format uses (16/11, 64/11, 256/13, 32/10 and 1280/15) and
+both adapt versions (before and after 3.98), CNNFilter and CNNFilterFast are run with each
+kernel (portable, SSE2, AVX2, NEON -- the ones that aren't there are skipped) over the same
+random input, fed in chunks of random sizes so the roll buffers roll at every offset.  Each
+output has to match the model, and the saved state (coefficients, history and running
+average) has to match the portable CNNFilter's at the end.
+
+The input mixes small values, ones past 16 bits (so the history saturates) and runs of zero
+(so the adapt step skips), which is what takes the 16-bit coefficients and the 32-bit dot
+product sums round.
+
+The exit code is 0 if everything matched and 1 if anything didn't.
+*****************************************************************************************/
+#include "All.h"
+#include "GlobalFunctions.h"
+#include "DecoderState.h"
+#include "NNFilter.h"
+
+using namespace APE_MONKEY;
+
+/*****************************************************************************************
+Random numbers (the same every run)
+*****************************************************************************************/
+static unsigned int g_nSeed = 1;
+
+static int GetRandom()
+{
+    g_nSeed = g_nSeed * 1103515245 + 12345;
+    return int((g_nSeed >> 8) & 0xFFFF);
+}
+
+static int GetRandomInput(int nSample)
+{
+    if ((nSample % 4096) < 48)
+        return 0;
+    int nValue = GetRandom() - 32768;
+    switch (GetRandom() % 16)
+    {
+        case 0: return nValue * 2000;
+        case 1: case 2: return nValue * 4;
+        default: return nValue / 16;
+    }
+}
+
+/*****************************************************************************************
+The scalar model (the filter written out as a straight loop over plain arrays)
+*****************************************************************************************/
+class CNNFilterModel
+{
+public:
+    CNNFilterModel(int nOrder, int nShift, int nVersion)
+    {
+        m_nOrder = nOrder;
+        m_nShift = nShift;
+        m_nVersion = nVersion;
+        m_spInput.Assign(new short [nOrder], TRUE);
+        m_spDeltaM.Assign(new short [nOrder], TRUE);
+        m_spM.Assign(new short [nOrder], TRUE);
+        memset(m_spInput, 0, nOrder * sizeof(short));
+        memset(m_spDeltaM, 0, nOrder * sizeof(short));
+        memset(m_spM, 0, nOrder * sizeof(short));
+        m_nRunningAverage = 0;
+    }
+
+    int Decompress(int nInput)
+    {
+        int nDotProduct = 0;
+        for (int z = 0; z < m_nOrder; z++)
+            nDotProduct = int(unsigned(nDotProduct) + unsigned(m_spInput[z] * m_spM[z]));
+
+        for (int z = 0; z < m_nOrder; z++)
+        {
+            if (nInput < 0)
+                m_spM[z] = short(m_spM[z] + m_spDeltaM[z]);
+            else if (nInput > 0)
+                m_spM[z] = short(m_spM[z] - m_spDeltaM[z]);
+        }
+
+        int nOutput = nInput + ((nDotProduct + (1 << (m_nShift - 1))) >> m_nShift);
+
+        short nDeltaM;
+        int nTempABS = abs(nOutput);
+        if (m_nVersion >= 3980)
+        {
+            if (nTempABS > (m_nRunningAverage * 3))
+                nDeltaM = short(((nOutput >> 25) & 64) - 32);
+            else if (nTempABS > (m_nRunningAverage * 4) / 3)
+                nDeltaM = short(((nOutput >> 26) & 32) - 16);
+            else if (nTempABS > 0)
+                nDeltaM = short(((nOutput >> 27) & 16) - 8);
+            else
+                nDeltaM = 0;
+            m_nRunningAverage += (nTempABS - m_nRunningAverage) / 16;
+        }
+        else
+        {
+            nDeltaM = short((nOutput == 0) ? 0 : ((nOutput >> 28) & 8) - 4);
+        }
+
+        // shift the history along by one
+        memmove(&m_spInput[0], &m_spInput[1], (m_nOrder - 1) * sizeof(short));
+        memmove(&m_spDeltaM[0], &m_spDeltaM[1], (m_nOrder - 1) * sizeof(short));
+        m_spInput[m_nOrder - 1] = short((nOutput == short(nOutput)) ? nOutput : (nOutput >> 31) ^ 0x7FFF);
+        m_spDeltaM[m_nOrder - 1] = nDeltaM;
+
+        if (m_nVersion >= 3980)
+        {
+            m_spDeltaM[m_nOrder - 2] >>= 1;
+            m_spDeltaM[m_nOrder - 3] >>= 1;
+            m_spDeltaM[m_nOrder - 9] >>= 1;
+        }
+        else
+        {
+            m_spDeltaM[m_nOrder - 5] >>= 1;
+            m_spDeltaM[m_nOrder - 9] >>= 1;
+        }
+
+        return nOutput;
+    }
+
+private:
+    int m_nOrder;
+    int m_nShift;
+    int m_nVersion;
+    CSmartPtr<short> m_spInput;
+    CSmartPtr<short> m_spDeltaM;
+    CSmartPtr<short> m_spM;
+    int m_nRunningAverage;
+};
+
+/*****************************************************************************************
+Running one filter against the model
+*****************************************************************************************/
+static const char * GetKernelName(int nKernel)
+{
+    switch (nKernel)
+    {
+        case NN_KERNEL_SSE: return "SSE2";
+        case NN_KERNEL_AVX2: return "AVX2";
+        case NN_KERNEL_NEON: return "NEON";
+        default: return "portable";
+    }
+}
+
+template <class FILTER> static int GetSavedState(FILTER & Filter, CSmartPtr<unsigned char> & spState)
+{
+    CDecoderStateWriter Counter;
+    Filter.SaveState(Counter);
+    spState.Assign(new unsigned char [Counter.GetBytes()], TRUE);
+    CDecoderStateWriter Writer(spState);
+    Filter.SaveState(Writer);
+    return Writer.GetBytes();
+}
+
+template <class FILTER> static int CheckFilter(FILTER & Filter, const char * pName, int nOrder, int nShift, int nVersion, int nKernel,
+    const int * pInput, const int * pExpected, int nSamples, const unsigned char * pExpectedState, int nExpectedStateBytes)
+{
+    CSmartPtr<int> spData(new int [nSamples], TRUE);
+    memcpy(spData, pInput, nSamples * sizeof(int));
+
+    g_nSeed = unsigned(nOrder * 7 + nKernel);
+    for (int nStart = 0; nStart < nSamples; )
+    {
+        int nElements = 1 + (GetRandom() % 700);
+        nElements = min(nElements, nSamples - nStart);
+        Filter.DecompressArray(&spData[nStart], nElements);
+        nStart += nElements;
+    }
+
+    for (int z = 0; z < nSamples; z++)
+    {
+        if (spData[z] != pExpected[z])
+        {
+            printf("%s %d/%d version %d %s: sample %d is %d, should be %d\n", pName, nOrder, nShift, nVersion,
+                GetKernelName(nKernel), z, spData[z], pExpected[z]);
+            return 1;
+        }
+    }
+
+    CSmartPtr<unsigned char> spState;
+    int nStateBytes = GetSavedState(Filter, spState);
+    if ((pExpectedState != NULL) && ((nStateBytes != nExpectedStateBytes) || (memcmp(spState, pExpectedState, nStateBytes) != 0)))
+    {
+        printf("%s %d/%d version %d %s: the saved state differs\n", pName, nOrder, nShift, nVersion, GetKernelName(nKernel));
+        return 1;
+    }
+
+    return 0;
+}
+
+template <int ORDER, int SHIFT> static int CheckOrder(int nVersion, int nSamples, int * pnChecks)
+{
+    // the input and what the model makes of it
+    CSmartPtr<int> spInput(new int [nSamples], TRUE);
+    CSmartPtr<int> spExpected(new int [nSamples], TRUE);
+    g_nSeed = unsigned(ORDER + nVersion);
+    CNNFilterModel Model(ORDER, SHIFT, nVersion);
+    for (int z = 0; z < nSamples; z++)
+    {
+        spInput[z] = GetRandomInput(z);
+        spExpected[z] = Model.Decompress(spInput[z]);
+    }
+
+    // the kernels there are
+    int aryKernels[4];
+    int nKernels = 0;
+    aryKernels[nKernels++] = NN_KERNEL_PORTABLE;
+    if (GetSSEAvailable()) aryKernels[nKernels++] = NN_KERNEL_SSE;
+    if (GetAVX2Available()) aryKernels[nKernels++] = NN_KERNEL_AVX2;
+    if (GetNEONAvailable()) aryKernels[nKernels++] = NN_KERNEL_NEON;
+
+    // the portable CNNFilter's state is what everything else has to end up with
+    CSmartPtr<unsigned char> spState;
+    int nStateBytes = 0;
+    int nFailures = 0;
+    for (int z = 0; z < nKernels; z++)
+    {
+        CNNFilter Filter(ORDER, SHIFT, nVersion, aryKernels[z]);
+        Filter.Flush();
+        nFailures += CheckFilter(Filter, "CNNFilter", ORDER, SHIFT, nVersion, aryKernels[z], spInput, spExpected, nSamples, spState, nStateBytes);
+        if (z == 0)
+            nStateBytes = GetSavedState(Filter, spState);
+
+        CNNFilterFast<ORDER, SHIFT> FilterFast(nVersion, aryKernels[z]);
+        nFailures += CheckFilter(FilterFast, "CNNFilterFast", ORDER, SHIFT, nVersion, aryKernels[z], spInput, spExpected, nSamples, spState, nStateBytes);
+
+        *pnChecks += 2;
+    }
+
+    return nFailures;
+}
+
+int main(int argc, char * argv[])
+{
+    int nSamples = 200000;
+    for (int z = 1; z < argc; z++)
+    {
+        if ((strcmp(argv[z], "-n") == 0) && (z + 1 < argc) && (atoi(argv[z + 1]) > 0))
+            nSamples = atoi(argv[++z]);
+        else
+        {
+            printf("usage: nnfiltertest [-n samples]\n");
+            return 2;
+        }
+    }
+
+    int nFailures = 0;
+    int nChecks = 0;
+    const int aryVersions[2] = { 3970, 3990 };
+    for (int z = 0; z < 2; z++)
+    {
+        nFailures += CheckOrder<16, 11>(aryVersions[z], nSamples, &nChecks);
+        nFailures += CheckOrder<64, 11>(aryVersions[z], nSamples, &nChecks);
+        nFailures += CheckOrder<256, 13>(aryVersions[z], nSamples, &nChecks);
+        nFailures += CheckOrder<32, 10>(aryVersions[z], nSamples, &nChecks);
+        nFailures += CheckOrder<1280, 15>(aryVersions[z], nSamples, &nChecks);
+    }
+
+    printf("%d filters checked (SSE2 %s, AVX2 %s, NEON %s), %d failed\n", nChecks,
+        GetSSEAvailable() ? "yes" : "no", GetAVX2Available() ? "yes" : "no", GetNEONAvailable() ? "yes" : "no", nFailures);
+    return (nFailures == 0) ? 0 : 1;
+}
@@ -0,0 +1,335 @@
+/*****************************************************************************************
+rangediotest - checks CRangedIO against range sources that misbehave the ways servers do
+
+Usage:
+    rangediotest [file.ape]
+
+CRangedIO reads from a fake IRangeSource over random bytes, one that either hands back what
+was asked for, hands back random short pieces of it, or stands in for a server that ignores
+the Range header and answers every request with the whole file (the bytes in front of the
+offset are skipped, like HTTP_Range_Source does).  Each source is checked with random seeks
+and reads (many straddling blocks, some running off the end), and the cache with counted
+requests: a read over several blocks fetches each once, a block read again isn't fetched,
+the least recently used block is the one that goes, and a failed fetch is retried on the
+next read.
+
+With a file, it's also decoded through CRangedIO over each source, and the MD5 of the PCM
+has to be the one decoding it from disk gives.
+
+The exit code is 0 if everything checked out and 1 if anything didn't.
+*****************************************************************************************/
+#include "All.h"
+#include "MACLib.h"
+#include "RangedIO.h"
+#include "CharacterHelper.h"
+#include "md5.h"
+
+using namespace APE_MONKEY;
+
+#define RANGE_SOURCE_EXACT              0
+#define RANGE_SOURCE_SHORT_READS        1
+#define RANGE_SOURCE_IGNORES_RANGE      2
+
+static const char * g_aryModeNames[3] = { "exact", "short reads", "ignores Range" };
+
+/*****************************************************************************************
+Random numbers (the same every run)
+*****************************************************************************************/
+static unsigned int g_nSeed = 1;
+
+static int GetRandom()
+{
+    g_nSeed = g_nSeed * 1103515245 + 12345;
+    return int((g_nSeed >> 8) & 0xFFFF);
+}
+
+/*****************************************************************************************
+The fake range source
+*****************************************************************************************/
+class CFakeRangeSource : public IRangeSource
+{
+public:
+    CFakeRangeSource(const unsigned char * pData, long long nBytes, int nMode)
+    {
+        m_pData = pData;
+        m_nBytes = nBytes;
+        m_nMode = nMode;
+        m_nRequests = 0;
+        m_nBytesSent = 0;
+        m_nFailRequest = -1;
+    }
+
+    int ReadRange(long long nOffset, void * pBuffer, unsigned int nBytes, unsigned int * pBytesRead)
+    {
+        *pBytesRead = 0;
+        if (m_nRequests++ == m_nFailRequest)
+            return ERROR_IO_READ;
+        if ((nOffset < 0) || (nOffset >= m_nBytes))
+            return 0;
+
+        unsigned int nAvailable = (unsigned int) min((long long) nBytes, m_nBytes - nOffset);
+        if (m_nMode == RANGE_SOURCE_SHORT_READS)
+        {
+            // anything from a byte to all of it
+            unsigned int nPiece = 1 + (unsigned int) GetRandom() % ((GetRandom() % 4 == 0) ? 16 : nAvailable);
+            nAvailable = min(nAvailable, nPiece);
+        }
+        else if (m_nMode == RANGE_SOURCE_IGNORES_RANGE)
+        {
+            // the response starts at the front of the file, so read up to the offset and drop it
+            long long nArrived = 0;
+            while (nArrived < nOffset)
+            {
+                long long nChunk = 1 + GetRandom() % 16384;
+                nChunk = min(nChunk, nOffset - nArrived);
+                nArrived += nChunk;
+                m_nBytesSent += nChunk;
+            }
+        }
+
+        memcpy(pBuffer, &m_pData[nOffset], nAvailable);
+        m_nBytesSent += nAvailable;
+        *pBytesRead = nAvailable;
+        return 0;
+    }
+
+    long long GetTotalBytes()
+    {
+        return m_nBytes;
+    }
+
+    int m_nRequests;
+    long long m_nBytesSent;
+    int m_nFailRequest;         // the request (counting from 0) that fails, or -1
+
+protected:
+    const unsigned char * m_pData;
+    long long m_nBytes;
+    int m_nMode;
+};
+
+/*****************************************************************************************
+Checks
+*****************************************************************************************/
+#define CHECK(CONDITION, ...) \
+    if (!(CONDITION)) { printf(__VA_ARGS__); printf("\n"); return 1; }
+
+static int ReadAt(CRangedIO & IO, long long nOffset, unsigned char * pBuffer, unsigned int nBytes, unsigned int * pBytesRead)
+{
+    IO.Seek(nOffset, FILE_BEGIN);
+    return IO.Read(pBuffer, nBytes, pBytesRead);
+}
+
+static int CheckRandomReads(const unsigned char * pData, long long nBytes, int nMode)
+{
+    const int nBlockBytes = 4096;
+    CFakeRangeSource Source(pData, nBytes, nMode);
+    CRangedIO IO(&Source, FALSE, nBlockBytes, 8);
+    CHECK(IO.GetSize() == nBytes, "%s: the size is %lld, should be %lld", g_aryModeNames[nMode], IO.GetSize(), nBytes)
+
+    CSmartPtr<unsigned char> spBuffer(new unsigned char [4 * nBlockBytes], TRUE);
+    g_nSeed = 2 + nMode;
+    for (int z = 0; z < 20000; z++)
+    {
+        // somewhere (now and then from the current position, or from the end, or past it)
+        long long nOffset = ((long long) GetRandom() << 16 | GetRandom()) % (nBytes + 100);
+        switch (GetRandom() % 8)
+        {
+            case 0: CHECK(IO.Seek(nOffset - IO.GetPosition(), FILE_CURRENT) == 0, "%s: seek failed", g_aryModeNames[nMode]) break;
+            case 1: CHECK(IO.Seek(nOffset - nBytes, FILE_END) == 0, "%s: seek failed", g_aryModeNames[nMode]) break;
+            default: CHECK(IO.Seek(nOffset, FILE_BEGIN) == 0, "%s: seek failed", g_aryModeNames[nMode]) break;
+        }
+        CHECK(IO.GetPosition() == nOffset, "%s: the position is %lld, should be %lld", g_aryModeNames[nMode], IO.GetPosition(), nOffset)
+
+        // up to four blocks' worth
+        unsigned int nBytesToRead = (unsigned int) (GetRandom() % (4 * nBlockBytes));
+        unsigned int nExpected = (unsigned int) max(0LL, min((long long) nBytesToRead, nBytes - nOffset));
+        unsigned int nBytesRead = 0;
+        int nResult = IO.Read(spBuffer, nBytesToRead, &nBytesRead);
+        CHECK(nResult == 0, "%s: read of %u at %lld failed (error %d)", g_aryModeNames[nMode], nBytesToRead, nOffset, nResult)
+        CHECK(nBytesRead == nExpected, "%s: read of %u at %lld got %u bytes, should be %u", g_aryModeNames[nMode], nBytesToRead, nOffset, nBytesRead, nExpected)
+        CHECK((nExpected == 0) || (memcmp(spBuffer, &pData[nOffset], nExpected) == 0), "%s: read of %u at %lld got the wrong bytes", g_aryModeNames[nMode], nBytesToRead, nOffset)
+        CHECK(IO.GetPosition() == nOffset + nExpected, "%s: the position after a read is %lld, should be %lld", g_aryModeNames[nMode], IO.GetPosition(), nOffset + nExpected)
+    }
+
+    CHECK(IO.Seek(-1, FILE_BEGIN) != 0, "%s: a seek in front of the start worked", g_aryModeNames[nMode])
+    return 0;
+}
+
+static int CheckCaching(const unsigned char * pData, long long nBytes)
+{
+    const int nBlockBytes = 4096;
+    unsigned char cBuffer[4 * 4096];
+    unsigned int nBytesRead = 0;
+
+    // a read over four blocks fetches each once, and again it fetches nothing
+    {
+        CFakeRangeSource Source(pData, nBytes, RANGE_SOURCE_EXACT);
+        CRangedIO IO(&Source, FALSE, nBlockBytes, 8);
+        CHECK(ReadAt(IO, 4000, cBuffer, 10000, &nBytesRead) == 0, "straddling read failed")
+        CHECK((nBytesRead == 10000) && (memcmp(cBuffer, &pData[4000], 10000) == 0), "straddling read got the wrong bytes")
+        CHECK(Source.m_nRequests == 4, "straddling read took %d requests, should be 4", Source.m_nRequests)
+        CHECK(ReadAt(IO, 100, cBuffer, 16000, &nBytesRead) == 0, "cached read failed")
+        CHECK(Source.m_nRequests == 4, "cached read took %d more requests", Source.m_nRequests - 4)
+    }
+
+    // with four blocks the least recently used one goes
+    {
+        CFakeRangeSource Source(pData, nBytes, RANGE_SOURCE_EXACT);
+        CRangedIO IO(&Source, FALSE, nBlockBytes, 4);
+        const int aryBlocks[] = { 0, 1, 2, 3, 0, 4, 0, 2, 3, 1, 4 };
+        const int aryRequests[] = { 1, 2, 3, 4, 4, 5, 5, 5, 5, 6, 7 }; // 4 pushes 1 out, then 1 pushes 4 out
+        for (int z = 0; z < int(sizeof(aryBlocks) / sizeof(aryBlocks[0])); z++)
+        {
+            CHECK(ReadAt(IO, (long long) aryBlocks[z] * nBlockBytes + 7, cBuffer, 1, &nBytesRead) == 0, "read of block %d failed", aryBlocks[z])
+            CHECK((nBytesRead == 1) && (cBuffer[0] == pData[aryBlocks[z] * nBlockBytes + 7]), "read of block %d got the wrong byte", aryBlocks[z])
+            CHECK(Source.m_nRequests == aryRequests[z], "read %d (block %d): %d requests so far, should be %d", z, aryBlocks[z], Source.m_nRequests, aryRequests[z])
+        }
+    }
+
+    // a source that returns a piece at a time is asked until the block is full
+    {
+        CFakeRangeSource Source(pData, nBytes, RANGE_SOURCE_SHORT_READS);
+        CRangedIO IO(&Source, FALSE, nBlockBytes, 8);
+        g_nSeed = 7;
+        CHECK(ReadAt(IO, nBlockBytes, cBuffer, nBlockBytes, &nBytesRead) == 0, "short read source: read failed")
+        CHECK((nBytesRead == (unsigned int) nBlockBytes) && (memcmp(cBuffer, &pData[nBlockBytes], nBlockBytes) == 0), "short read source: got the wrong bytes")
+        CHECK(Source.m_nRequests > 1, "short read source: one request filled a block")
+    }
+
+    // the last block is short, and reads stop at the end
+    {
+        CFakeRangeSource Source(pData, nBytes, RANGE_SOURCE_EXACT);
+        CRangedIO IO(&Source, FALSE, nBlockBytes, 8);
+        CHECK(ReadAt(IO, nBytes - 10, cBuffer, 100, &nBytesRead) == 0, "read at the end failed")
+        CHECK((nBytesRead == 10) && (memcmp(cBuffer, &pData[nBytes - 10], 10) == 0), "read at the end got %u bytes, should be 10", nBytesRead)
+        CHECK((ReadAt(IO, nBytes, cBuffer, 100, &nBytesRead) == 0) && (nBytesRead == 0), "read past the end got %u bytes", nBytesRead)
+    }
+
+    // a failed fetch is reported, and doesn't leave a block behind that the next read would take
+    {
+        CFakeRangeSource Source(pData, nBytes, RANGE_SOURCE_EXACT);
+        CRangedIO IO(&Source, FALSE, nBlockBytes, 8);
+        Source.m_nFailRequest = 1;
+        int nResult = ReadAt(IO, nBlockBytes - 100, cBuffer, 200, &nBytesRead);
+        CHECK((nResult == ERROR_IO_READ) && (nBytesRead == 100), "failed fetch: error %d with %u bytes, should be %d with 100", nResult, nBytesRead, ERROR_IO_READ)
+        CHECK(ReadAt(IO, nBlockBytes, cBuffer, 200, &nBytesRead) == 0, "read after a failed fetch failed")
+        CHECK((nBytesRead == 200) && (memcmp(cBuffer, &pData[nBlockBytes], 200) == 0), "read after a failed fetch got the wrong bytes")
+        CHECK(Source.m_nRequests == 3, "read after a failed fetch: %d requests, should be 3", Source.m_nRequests)
+    }
+
+    // with a server that ignores Range, reading through in order still costs a request a block
+    {
+        CFakeRangeSource Source(pData, nBytes, RANGE_SOURCE_IGNORES_RANGE);
+        CRangedIO IO(&Source, FALSE, nBlockBytes, 8);
+        IO.Seek(0, FILE_BEGIN);
+        long long nTotalRead = 0;
+        while (TRUE)
+        {
+            CHECK(IO.Read(cBuffer, 1000, &nBytesRead) == 0, "ignored Range: read at %lld failed", nTotalRead)
+            if (nBytesRead == 0)
+                break;
+            CHECK(memcmp(cBuffer, &pData[nTotalRead], nBytesRead) == 0, "ignored Range: read at %lld got the wrong bytes", nTotalRead)
+            nTotalRead += nBytesRead;
+        }
+        // (the last block is short, so the source is asked once more, and says that's the end)
+        int nRequests = int((nBytes + nBlockBytes - 1) / nBlockBytes) + 1;
+        CHECK(nTotalRead == nBytes, "ignored Range: read %lld bytes, should be %lld", nTotalRead, nBytes)
+        CHECK(Source.m_nRequests == nRequests, "ignored Range: %d requests, should be %d", Source.m_nRequests, nRequests)
+        CHECK(Source.m_nBytesSent > nBytes, "ignored Range: the server sent %lld bytes", Source.m_nBytesSent)
+    }
+
+    return 0;
+}
+
+/*****************************************************************************************
+Decoding through CRangedIO
+*****************************************************************************************/
+static int GetDecodedMD5(IAPEDecompress * pDecompress, unsigned char cMD5[16])
+{
+    const int nBlocksPerCall = 4096;
+    int nBlockAlign = (int) pDecompress->GetInfo(APE_INFO_BLOCK_ALIGN);
+    CSmartPtr<char> spBuffer(new char [nBlocksPerCall * nBlockAlign], TRUE);
+    CMD5Helper MD5;
+    int nRetVal = ERROR_SUCCESS;
+    while (TRUE)
+    {
+        int nBlocksRetrieved = 0;
+        int nResult = pDecompress->GetData(spBuffer, nBlocksPerCall, &nBlocksRetrieved);
+        if (nResult != ERROR_SUCCESS)
+            nRetVal = nResult;
+        if (nBlocksRetrieved <= 0)
+            break;
+        MD5.AddData(spBuffer, nBlocksRetrieved * nBlockAlign);
+    }
+    MD5.GetResult(cMD5);
+    return nRetVal;
+}
+
+static int CheckDecoding(const char * pFilename)
+{
+    // what it decodes to from disk
+    CSmartPtr<str_utf16> spFilenameUTF16(CAPECharacterHelper::GetUTF16FromUTF8((const str_utf8 *) pFilename), TRUE);
+    int nErrorCode = ERROR_SUCCESS;
+    CSmartPtr<IAPEDecompress> spDecompress(CreateIAPEDecompress(spFilenameUTF16, &nErrorCode));
+    CHECK(spDecompress != NULL, "%s: can't open (error %d)", pFilename, nErrorCode)
+    unsigned char cExpectedMD5[16];
+    nErrorCode = GetDecodedMD5(spDecompress, cExpectedMD5);
+    CHECK(nErrorCode == ERROR_SUCCESS, "%s: decoding failed (error %d)", pFilename, nErrorCode)
+
+    // the file
+    FILE * pFile = fopen(pFilename, "rb");
+    CHECK(pFile != NULL, "%s: can't read", pFilename)
+    fseek(pFile, 0, SEEK_END);
+    long long nBytes = ftell(pFile);
+    fseek(pFile, 0, SEEK_SET);
+    CSmartPtr<unsigned char> spData(new unsigned char [(size_t) max(nBytes, 1LL)], TRUE);
+    BOOL bRead = (nBytes > 0) && (fread(spData, 1, (size_t) nBytes, pFile) == (size_t) nBytes);
+    fclose(pFile);
+    CHECK(bRead, "%s: can't read", pFilename)
+
+    // through each source
+    for (int nMode = RANGE_SOURCE_EXACT; nMode <= RANGE_SOURCE_IGNORES_RANGE; nMode++)
+    {
+        g_nSeed = 11 + nMode;
+        CFakeRangeSource Source(spData, nBytes, nMode);
+        CRangedIO IO(&Source, FALSE, 65536, 16);
+        spDecompress.Assign(CreateIAPEDecompressEx(&IO, &nErrorCode));
+        CHECK(spDecompress != NULL, "%s (%s): can't open through CRangedIO (error %d)", pFilename, g_aryModeNames[nMode], nErrorCode)
+
+        unsigned char cMD5[16];
+        nErrorCode = GetDecodedMD5(spDecompress, cMD5);
+        spDecompress.Delete();
+        CHECK(nErrorCode == ERROR_SUCCESS, "%s (%s): decoding through CRangedIO failed (error %d)", pFilename, g_aryModeNames[nMode], nErrorCode)
+        CHECK(memcmp(cMD5, cExpectedMD5, 16) == 0, "%s (%s): decoding through CRangedIO gave a different MD5", pFilename, g_aryModeNames[nMode])
+        printf("%s (%s): decoded the same, %d requests\n", pFilename, g_aryModeNames[nMode], Source.m_nRequests);
+    }
+
+    return 0;
+}
+
+int main(int argc, char * argv[])
+{
+    if ((argc > 2) || ((argc == 2) && (argv[1][0] == '-')))
+    {
+        printf("usage: rangediotest [file.ape]\n");
+        return 2;
+    }
+
+    // random bytes, not a whole number of blocks
+    const long long nBytes = 1000003;
+    CSmartPtr<unsigned char> spData(new unsigned char [nBytes], TRUE);
+    g_nSeed = 1;
+    for (long long z = 0; z < nBytes; z++)
+        spData[z] = (unsigned char) GetRandom();
+
+    int nFailures = 0;
+    for (int nMode = RANGE_SOURCE_EXACT; nMode <= RANGE_SOURCE_IGNORES_RANGE; nMode++)
+        nFailures += CheckRandomReads(spData, nBytes, nMode);
+    nFailures += CheckCaching(spData, nBytes);
+    if (argc == 2)
+        nFailures += CheckDecoding(argv[1]);
+
+    printf("%s\n", (nFailures == 0) ? "all good" : "failed");
+    return (nFailures == 0) ? 0 : 1;
+}
@@ -0,0 +1,655 @@
+/*****************************************************************************************
+apebench - decodes an APE file as fast as it can and reports where the time went
+
+Usage:
+    apebench [-b blocks] [-t threads] [-n runs] [-m] [-v mode] [-o format] [-s blocks] [-k seeks] [-c md5] [-e error] file.ape
+    apebench -f [-n runs]
+
+    -b blocks       blocks per GetData(...) call (default 4096)
+    -t threads      0 decodes on the calling thread with CAPEDecompress (default), anything
+                    else uses CParallelAPEDecompress with that many workers
+    -n runs         decode the file this many times and report the fastest run (default 3)
+    -m              read the whole file into memory first, so the disk is out of the picture
+                    (only with -t 0)
+    -v mode         how the frame CRCs are checked: inline (default), async (on a thread of
+                    their own, a bad frame counts as a decoder error) or none (only with -t 0)
+    -o format       what GetData(...) hands out: native (default), int32 or float32, and
+                    int32-planar or float32-planar for a channel at a time (the MD5 is then
+                    of the converted output, a channel at a time for each call)
+    -s blocks       every this many blocks, save a snapshot and carry on in a new decompressor
+                    restored from it (only with -t 0); the MD5 has to come out the same
+    -k seeks        afterwards, seek this many times to random blocks and read a random number
+                    of blocks from there, and check them against a straight decode of the file
+                    (whose MD5 has to be the one the runs printed); this is done without a seek
+                    index, with one built up front, with one built as the file plays and with
+                    one saved and loaded again (an index saved for a changed file has to be
+                    refused) (only with -t 0 and native output)
+    -c md5          the MD5 the decoded PCM has to have (as printed by an earlier run); the
+                    exit code is 1 if it doesn't match
+    -e error        the decoder error the file has to give (a damaged file, e.g. 1009 for a
+                    frame that fails its CRC); the exit code is 1 if it gives none or another
+    -f              no file: time the NN filters of each compression level on synthetic
+                    residuals, and how much of that the history roll copies account for
+
+The stage breakdown needs a library built with ENABLE_STAGE_TIMING (the CMake build does that
+unless APE_STAGE_TIMING is turned off).
+*****************************************************************************************/
+#include "All.h"
+#include "MACLib.h"
+#include "CharacterHelper.h"
+#include "MemoryIO.h"
+#include "NewPredictor.h"
+#include "md5.h"
+
+using namespace APE_MONKEY;
+
+static void Usage()
+{
+    printf("usage: apebench [-b blocks] [-t threads] [-n runs] [-m] [-v inline|async|none] [-o format] [-s blocks] [-k seeks] [-c md5] [-e error] file.ape\n");
+    printf("       apebench -f [-n runs]\n");
+}
+
+/*****************************************************************************************
+NN filter microbenchmark -- each level's filters over the same synthetic residuals, with
+the roll copies timed on their own (every NN_WINDOW_ELEMENTS samples each filter moves its
+input and adapt history, ORDER shorts apiece, back to the start of its buffers)
+*****************************************************************************************/
+static void BenchmarkFilters(int nRuns)
+{
+    struct FILTER_LEVEL { const char * pName; int nCompressionLevel; int nHistoryShorts; const char * pOrders; };
+    const FILTER_LEVEL aryLevels[] = {
+        { "normal", COMPRESSION_LEVEL_NORMAL, 16, "16/11" },
+        { "high", COMPRESSION_LEVEL_HIGH, 64, "64/11" },
+        { "extra high", COMPRESSION_LEVEL_EXTRA_HIGH, 32 + 256, "32/10 + 256/13" },
+        { "insane", COMPRESSION_LEVEL_INSANE, 16 + 256 + 1280, "16/11 + 256/13 + 1280/15" },
+    };
+
+    const int nSamples = 1 << 20;
+    CSmartPtr<int> spResiduals(new int [nSamples], TRUE);
+    CSmartPtr<int> spData(new int [nSamples], TRUE);
+    unsigned int nSeed = 1;
+    for (int z = 0; z < nSamples; z++)
+    {
+        nSeed = nSeed * 1103515245 + 12345;
+        spResiduals[z] = int((nSeed >> 16) % 2001) - 1000;
+    }
+
+    CSmartPtr<short> spRoll(new short [NN_WINDOW_ELEMENTS + 16 + 256 + 1280], TRUE);
+    memset(spRoll.GetPtr(), 0, (NN_WINDOW_ELEMENTS + 16 + 256 + 1280) * sizeof(short));
+
+    printf("NN filters, %d samples per level, fastest of %d runs:\n", nSamples, nRuns);
+    for (size_t nLevel = 0; nLevel < sizeof(aryLevels) / sizeof(aryLevels[0]); nLevel++)
+    {
+        TICK_COUNT_TYPE nBestFilter = 0, nBestRoll = 0;
+        for (int nRun = 0; nRun < nRuns; nRun++)
+        {
+            CPredictorDecompress3950toCurrent Predictor(aryLevels[nLevel].nCompressionLevel, MAC_FILE_VERSION_NUMBER);
+            Predictor.Flush();
+            memcpy(spData.GetPtr(), spResiduals.GetPtr(), nSamples * sizeof(int));
+
+            TICK_COUNT_TYPE nStart, nFinish;
+            TICK_COUNT_READ(nStart);
+            for (int z = 0; z < nSamples; z += 4096)
+                Predictor.DecompressNNFilters(&spData[z], 4096);
+            TICK_COUNT_READ(nFinish);
+            if ((nRun == 0) || (nFinish - nStart < nBestFilter))
+                nBestFilter = nFinish - nStart;
+
+            // the same copies the rolls do (two histories per filter)
+            TICK_COUNT_READ(nStart);
+            for (int z = 0; z < nSamples / NN_WINDOW_ELEMENTS; z++)
+            {
+                memmove(&spRoll[0], &spRoll[NN_WINDOW_ELEMENTS], aryLevels[nLevel].nHistoryShorts * sizeof(short));
+                memmove(&spRoll[0], &spRoll[NN_WINDOW_ELEMENTS], aryLevels[nLevel].nHistoryShorts * sizeof(short));
+            }
+            TICK_COUNT_READ(nFinish);
+            if ((nRun == 0) || (nFinish - nStart < nBestRoll))
+                nBestRoll = nFinish - nStart;
+        }
+
+        printf("  %-11s %-25s %7.2f ns/sample, roll copies %5.2f ns/sample (%.1f%%)\n",
+            aryLevels[nLevel].pName, aryLevels[nLevel].pOrders,
+            double(nBestFilter) * 1e9 / TICK_COUNT_FREQ / nSamples, double(nBestRoll) * 1e9 / TICK_COUNT_FREQ / nSamples,
+            (nBestFilter > 0) ? double(nBestRoll) * 100.0 / double(nBestFilter) : 0.0);
+    }
+}
+
+static BOOL ReadWholeFile(const char * pFilename, CSmartPtr<unsigned char> & spData, long long * pBytes)
+{
+    FILE * pFile = fopen(pFilename, "rb");
+    if (pFile == NULL)
+        return FALSE;
+
+    fseeko(pFile, 0, SEEK_END);
+    *pBytes = (long long) ftello(pFile);
+    fseeko(pFile, 0, SEEK_SET);
+
+    spData.Assign(new unsigned char [(size_t) max(*pBytes, 1LL)], TRUE);
+    BOOL bRetVal = (fread(spData.GetPtr(), 1, (size_t) *pBytes, pFile) == (size_t) *pBytes);
+    fclose(pFile);
+    return bRetVal;
+}
+
+struct RUN_RESULT
+{
+    int nResult;
+    long long nBlocks;
+    TICK_COUNT_TYPE nTicks;
+    APE_STAGE_TIMES StageTimes;
+    BOOL bStageTimes;
+    char cMD5[33];
+    int nSnapshots;
+    int nLargestSnapshotBytes;
+};
+
+// counts the frames the verifier's thread finds bad (read once the decompressor is gone)
+class CFrameErrorCounter : public IAPEFrameErrorCallback
+{
+public:
+    CFrameErrorCounter() { m_nFrames = 0; }
+    void FrameError(int) { m_nFrames++; }
+    int m_nFrames;
+};
+
+static IAPEDecompress * OpenDecompress(const char * pFilename, const str_utf16 * pFilenameUTF16, int nThreads,
+    int nVerifyMode, int nOutputFormat, CIO * pMemoryIO, CFrameErrorCounter * pFrameErrors)
+{
+    int nErrorCode = ERROR_SUCCESS;
+    IAPEDecompress * pDecompress = NULL;
+    if (pMemoryIO != NULL)
+    {
+        pMemoryIO->Seek(0, FILE_BEGIN);
+        pDecompress = CreateIAPEDecompressEx(pMemoryIO, &nErrorCode);
+    }
+    else if (nThreads > 0)
+    {
+        pDecompress = CreateIAPEDecompressParallel(pFilenameUTF16, nThreads, &nErrorCode);
+    }
+    else
+    {
+        pDecompress = CreateIAPEDecompress(pFilenameUTF16, &nErrorCode);
+    }
+    if (pDecompress == NULL)
+    {
+        printf("%s: can't open (error %d)\n", pFilename, nErrorCode);
+        return NULL;
+    }
+
+    if ((nVerifyMode != APE_VERIFY_INLINE) && (pDecompress->SetVerifyMode(nVerifyMode, pFrameErrors) != ERROR_SUCCESS))
+    {
+        printf("%s: can't change the verify mode\n", pFilename);
+        delete pDecompress;
+        return NULL;
+    }
+
+    if ((nOutputFormat != APE_OUTPUT_NATIVE) && (pDecompress->SetOutputFormat(nOutputFormat) != ERROR_SUCCESS))
+    {
+        printf("%s: can't change the output format\n", pFilename);
+        delete pDecompress;
+        return NULL;
+    }
+
+    return pDecompress;
+}
+
+// saves a snapshot and swaps the decompressor for a new one restored from it
+static int HandOver(IAPEDecompress ** ppDecompress, const char * pFilename, const str_utf16 * pFilenameUTF16,
+    int nVerifyMode, int nOutputFormat, CIO * pMemoryIO, CFrameErrorCounter * pFrameErrors, RUN_RESULT * pRun)
+{
+    int nBytes = 0;
+    RETURN_ON_ERROR((*ppDecompress)->SaveSnapshot(NULL, &nBytes))
+    CSmartPtr<unsigned char> spSnapshot(new unsigned char [nBytes], TRUE);
+    RETURN_ON_ERROR((*ppDecompress)->SaveSnapshot(spSnapshot, &nBytes))
+    pRun->nSnapshots++;
+    pRun->nLargestSnapshotBytes = max(pRun->nLargestSnapshotBytes, nBytes);
+
+    // (a memory IO is shared, so the old decompressor has to go first)
+    delete *ppDecompress;
+    *ppDecompress = OpenDecompress(pFilename, pFilenameUTF16, 0, nVerifyMode, nOutputFormat, pMemoryIO, pFrameErrors);
+    if (*ppDecompress == NULL)
+        return ERROR_UNDEFINED;
+    return (*ppDecompress)->RestoreSnapshot(spSnapshot, nBytes);
+}
+
+static int DecodeOnce(const char * pFilename, const str_utf16 * pFilenameUTF16, int nBlocksPerCall, int nThreads,
+    int nVerifyMode, int nOutputFormat, int nSnapshotBlocks, CIO * pMemoryIO, RUN_RESULT * pRun)
+{
+    memset(pRun, 0, sizeof(RUN_RESULT));
+
+    CFrameErrorCounter FrameErrors;
+    IAPEDecompress * pDecompress = OpenDecompress(pFilename, pFilenameUTF16, nThreads, nVerifyMode, nOutputFormat, pMemoryIO, &FrameErrors);
+    if (pDecompress == NULL)
+        return ERROR_UNDEFINED;
+
+    int nBlockAlign = (int) pDecompress->GetInfo(APE_DECOMPRESS_OUTPUT_BLOCK_ALIGN);
+    int nPlanes = (nOutputFormat & APE_OUTPUT_PLANAR) ? (int) pDecompress->GetInfo(APE_INFO_CHANNELS) : 1;
+    CSmartPtr<char> spBuffer(new char [nBlocksPerCall * nBlockAlign], TRUE);
+    CMD5Helper MD5;
+    long long nNextSnapshotBlock = nSnapshotBlocks;
+
+    TICK_COUNT_TYPE nStart, nFinish;
+    TICK_COUNT_READ(nStart);
+    while (TRUE)
+    {
+        if ((nSnapshotBlocks > 0) && (pRun->nBlocks >= nNextSnapshotBlock))
+        {
+            nNextSnapshotBlock += nSnapshotBlocks;
+            int nResult = HandOver(&pDecompress, pFilename, pFilenameUTF16, nVerifyMode, nOutputFormat, pMemoryIO, &FrameErrors, pRun);
+            if (pDecompress == NULL)
+                return ERROR_UNDEFINED;
+            if (nResult != ERROR_SUCCESS)
+            {
+                printf("%s: snapshot at block %lld failed (error %d)\n", pFilename, pRun->nBlocks, nResult);
+                delete pDecompress;
+                return nResult;
+            }
+        }
+
+        int nBlocksRetrieved = 0;
+        int nResult = pDecompress->GetData(spBuffer, nBlocksPerCall, &nBlocksRetrieved);
+        if ((nResult != ERROR_SUCCESS) && (pRun->nResult == ERROR_SUCCESS))
+            pRun->nResult = nResult;
+        if (nBlocksRetrieved <= 0)
+            break;
+
+        for (int nPlane = 0; nPlane < nPlanes; nPlane++)
+            MD5.AddData(&spBuffer[nPlane * nBlocksPerCall * (nBlockAlign / nPlanes)], nBlocksRetrieved * (nBlockAlign / nPlanes));
+        pRun->nBlocks += nBlocksRetrieved;
+    }
+    TICK_COUNT_READ(nFinish);
+    pRun->nTicks = nFinish - nStart;
+
+    pRun->bStageTimes = (pDecompress->GetInfo(APE_DECOMPRESS_STAGE_TIMES, (unsigned long long) &pRun->StageTimes) == ERROR_SUCCESS);
+
+    unsigned char cMD5[16];
+    MD5.GetResult(cMD5);
+    for (int z = 0; z < 16; z++)
+        sprintf(&pRun->cMD5[z * 2], "%02x", cMD5[z]);
+
+    delete pDecompress;
+    if ((FrameErrors.m_nFrames > 0) && (pRun->nResult == ERROR_SUCCESS))
+        pRun->nResult = ERROR_INVALID_CHECKSUM;
+    return ERROR_SUCCESS;
+}
+
+/*****************************************************************************************
+Seek check -- random seeks and reads against a straight decode, with and without a seek index
+*****************************************************************************************/
+#define SEEK_CHECK_CHECKPOINT_BLOCKS    4096
+
+static unsigned int g_nSeekSeed = 1;
+
+static int GetSeekRandom()
+{
+    g_nSeekSeed = g_nSeekSeed * 1103515245 + 12345;
+    return int((g_nSeekSeed >> 1) & 0x7FFFFFFF);
+}
+
+// decodes the whole file into memory and gives the MD5 of it
+static int DecodeReference(const char * pFilename, const str_utf16 * pFilenameUTF16, CSmartPtr<unsigned char> & spPCM, long long * pBlocks, char * pMD5)
+{
+    int nErrorCode = ERROR_SUCCESS;
+    CSmartPtr<IAPEDecompress> spDecompress(CreateIAPEDecompress(pFilenameUTF16, &nErrorCode));
+    if (spDecompress == NULL)
+    {
+        printf("%s: can't open (error %d)\n", pFilename, nErrorCode);
+        return nErrorCode;
+    }
+
+    int nBlockAlign = (int) spDecompress->GetInfo(APE_INFO_BLOCK_ALIGN);
+    long long nTotalBlocks = (long long) spDecompress->GetInfo(APE_DECOMPRESS_TOTAL_BLOCKS);
+    spPCM.Assign(new unsigned char [(size_t) max(nTotalBlocks * nBlockAlign, 1LL)], TRUE);
+
+    long long nBlocks = 0;
+    while (nBlocks < nTotalBlocks)
+    {
+        int nBlocksRetrieved = 0;
+        int nBlocksToGet = (int) min(nTotalBlocks - nBlocks, 65536LL);
+        nErrorCode = spDecompress->GetData((char *) &spPCM[nBlocks * nBlockAlign], nBlocksToGet, &nBlocksRetrieved);
+        if ((nErrorCode != ERROR_SUCCESS) || (nBlocksRetrieved <= 0))
+        {
+            printf("%s: the straight decode stopped at block %lld (error %d)\n", pFilename, nBlocks, nErrorCode);
+            return (nErrorCode != ERROR_SUCCESS) ? nErrorCode : ERROR_UNDEFINED;
+        }
+        nBlocks += nBlocksRetrieved;
+    }
+    *pBlocks = nBlocks;
+
+    CMD5Helper MD5;
+    MD5.AddData(spPCM, (unsigned int) (nBlocks * nBlockAlign));
+    unsigned char cMD5[16];
+    MD5.GetResult(cMD5);
+    for (int z = 0; z < 16; z++)
+        sprintf(&pMD5[z * 2], "%02x", cMD5[z]);
+    return ERROR_SUCCESS;
+}
+
+// seeks around a decompressor and compares what comes back with the straight decode (the
+// same seed every time, so each pass makes the same seeks)
+static int CheckSeeks(IAPEDecompress * pDecompress, const char * pName, int nSeeks, int nBlocksPerCall,
+    const unsigned char * pPCM, long long nTotalBlocks)
+{
+    int nBlockAlign = (int) pDecompress->GetInfo(APE_INFO_BLOCK_ALIGN);
+    CSmartPtr<char> spBuffer(new char [nBlocksPerCall * nBlockAlign], TRUE);
+
+    TICK_COUNT_TYPE nStart, nFinish;
+    TICK_COUNT_READ(nStart);
+    g_nSeekSeed = 1;
+    for (int nSeek = 0; nSeek < nSeeks; nSeek++)
+    {
+        // now and then the last block, so a read runs off the end
+        long long nBlock = ((nSeek % 16) == 15) ? (nTotalBlocks - 1) : (long long) (GetSeekRandom() % (int) max(nTotalBlocks, 1LL));
+        int nBlocksToRead = 1 + (GetSeekRandom() % (3 * nBlocksPerCall));
+        int nErrorCode = pDecompress->Seek((int) nBlock);
+        if (nErrorCode != ERROR_SUCCESS)
+        {
+            printf("seeks, %s: seek %d to block %lld failed (error %d)\n", pName, nSeek, nBlock, nErrorCode);
+            return nErrorCode;
+        }
+
+        long long nExpectedBlocks = min((long long) nBlocksToRead, nTotalBlocks - nBlock);
+        long long nBlocksRead = 0;
+        while (nBlocksRead < nBlocksToRead)
+        {
+            int nBlocksRetrieved = 0;
+            nErrorCode = pDecompress->GetData(spBuffer, min(nBlocksPerCall, (int) (nBlocksToRead - nBlocksRead)), &nBlocksRetrieved);
+            if (nErrorCode != ERROR_SUCCESS)
+            {
+                printf("seeks, %s: reading at block %lld failed (error %d)\n", pName, nBlock + nBlocksRead, nErrorCode);
+                return nErrorCode;
+            }
+            if (nBlocksRetrieved <= 0)
+                break;
+            if ((nBlock + nBlocksRead + nBlocksRetrieved > nTotalBlocks) ||
+                (memcmp(spBuffer, &pPCM[(nBlock + nBlocksRead) * nBlockAlign], nBlocksRetrieved * nBlockAlign) != 0))
+            {
+                printf("seeks, %s: after seek %d to block %lld, the blocks at %lld differ from the straight decode\n", pName, nSeek, nBlock, nBlock + nBlocksRead);
+                return ERROR_UNDEFINED;
+            }
+            nBlocksRead += nBlocksRetrieved;
+        }
+        if (nBlocksRead != nExpectedBlocks)
+        {
+            printf("seeks, %s: after seek %d to block %lld, %lld blocks came back instead of %lld\n", pName, nSeek, nBlock, nBlocksRead, nExpectedBlocks);
+            return ERROR_UNDEFINED;
+        }
+    }
+    TICK_COUNT_READ(nFinish);
+
+    printf("seeks, %s: %d matched, %.3f ms each\n", pName, nSeeks, double(nFinish - nStart) * 1000.0 / TICK_COUNT_FREQ / max(nSeeks, 1));
+    return ERROR_SUCCESS;
+}
+
+static int CheckSeeking(const char * pFilename, const str_utf16 * pFilenameUTF16, int nSeeks, int nBlocksPerCall, const char * pLinearMD5)
+{
+    // the straight decode everything is checked against (and it has to be what the runs decoded)
+    CSmartPtr<unsigned char> spPCM;
+    long long nTotalBlocks = 0;
+    char cMD5[33];
+    RETURN_ON_ERROR(DecodeReference(pFilename, pFilenameUTF16, spPCM, &nTotalBlocks, cMD5))
+    if (strcmp(cMD5, pLinearMD5) != 0)
+    {
+        printf("seeks: the straight decode's md5 %s isn't the runs' %s\n", cMD5, pLinearMD5);
+        return ERROR_UNDEFINED;
+    }
+
+    // no index, one built up front, one built as the file plays
+    int nErrorCode = ERROR_SUCCESS;
+    CMemoryIO Sidecar;
+    for (int nPass = 0; nPass < 3; nPass++)
+    {
+        CSmartPtr<IAPEDecompress> spDecompress(CreateIAPEDecompress(pFilenameUTF16, &nErrorCode));
+        if (spDecompress == NULL)
+            return nErrorCode;
+        if ((nPass > 0) && ((nErrorCode = spDecompress->CreateSeekIndex(SEEK_CHECK_CHECKPOINT_BLOCKS, (nPass == 1) ? TRUE : FALSE)) != ERROR_SUCCESS))
+        {
+            printf("seeks: can't create a seek index (error %d)\n", nErrorCode);
+            return nErrorCode;
+        }
+        const char * aryNames[3] = { "no index", "built index", "index built as it plays" };
+        RETURN_ON_ERROR(CheckSeeks(spDecompress, aryNames[nPass], nSeeks, nBlocksPerCall, spPCM, nTotalBlocks))
+
+        // the full index is what goes in the sidecar
+        if ((nPass == 1) && ((nErrorCode = spDecompress->SaveSeekIndex(&Sidecar)) != ERROR_SUCCESS))
+        {
+            printf("seeks: can't save the seek index (error %d)\n", nErrorCode);
+            return nErrorCode;
+        }
+    }
+
+    // the sidecar loaded into a new decompressor
+    CSmartPtr<IAPEDecompress> spDecompress(CreateIAPEDecompress(pFilenameUTF16, &nErrorCode));
+    if (spDecompress == NULL)
+        return nErrorCode;
+    RETURN_ON_ERROR(spDecompress->CreateSeekIndex(SEEK_CHECK_CHECKPOINT_BLOCKS))
+    Sidecar.Seek(0, FILE_BEGIN);
+    if ((nErrorCode = spDecompress->LoadSeekIndex(&Sidecar)) != ERROR_SUCCESS)
+    {
+        printf("seeks: can't load the saved seek index (error %d)\n", nErrorCode);
+        return nErrorCode;
+    }
+    RETURN_ON_ERROR(CheckSeeks(spDecompress, "loaded index", nSeeks, nBlocksPerCall, spPCM, nTotalBlocks))
+    spDecompress.Delete();
+
+    // a changed file (here one with a byte on the end) mustn't take the index
+    CSmartPtr<unsigned char> spFileData;
+    long long nFileBytes = 0;
+    if (ReadWholeFile(pFilename, spFileData, &nFileBytes) == FALSE)
+    {
+        printf("%s: can't read\n", pFilename);
+        return ERROR_IO_READ;
+    }
+    CMemoryIO ChangedFile(spFileData.GetPtr(), nFileBytes, TRUE);
+    unsigned int nBytesWritten = 0;
+    unsigned char cPadding = 0;
+    ChangedFile.Seek(0, FILE_END);
+    ChangedFile.Write(&cPadding, 1, &nBytesWritten);
+    ChangedFile.Seek(0, FILE_BEGIN);
+    spDecompress.Assign(CreateIAPEDecompressEx(&ChangedFile, &nErrorCode));
+    if (spDecompress == NULL)
+    {
+        printf("seeks: can't open the changed file (error %d)\n", nErrorCode);
+        return nErrorCode;
+    }
+    RETURN_ON_ERROR(spDecompress->CreateSeekIndex(SEEK_CHECK_CHECKPOINT_BLOCKS))
+    Sidecar.Seek(0, FILE_BEGIN);
+    if (spDecompress->LoadSeekIndex(&Sidecar) != ERROR_INVALID_INPUT_FILE)
+    {
+        printf("seeks: the seek index was loaded for a changed file\n");
+        return ERROR_UNDEFINED;
+    }
+    printf("seeks: an index saved for another file is refused\n");
+
+    return ERROR_SUCCESS;
+}
+
+static void PrintStage(const char * pName, TICK_COUNT_TYPE nTicks, TICK_COUNT_TYPE nTotalTicks)
+{
+    printf("  %-16s %9.1f ms  %5.1f%%\n", pName, double(nTicks) * 1000.0 / TICK_COUNT_FREQ,
+        (nTotalTicks > 0) ? double(nTicks) * 100.0 / double(nTotalTicks) : 0.0);
+}
+
+int main(int argc, char * argv[])
+{
+    int nBlocksPerCall = 4096;
+    int nThreads = 0;
+    int nRuns = 3;
+    BOOL bMemory = FALSE;
+    int nVerifyMode = APE_VERIFY_INLINE;
+    int nOutputFormat = APE_OUTPUT_NATIVE;
+    int nSnapshotBlocks = 0;
+    int nSeeks = 0;
+    BOOL bFilters = FALSE;
+    const char * pExpectedMD5 = NULL;
+    int nExpectedResult = ERROR_SUCCESS;
+    const char * pFilename = NULL;
+
+    for (int z = 1; z < argc; z++)
+    {
+        if ((strcmp(argv[z], "-b") == 0) && (z + 1 < argc))
+            nBlocksPerCall = atoi(argv[++z]);
+        else if ((strcmp(argv[z], "-t") == 0) && (z + 1 < argc))
+            nThreads = atoi(argv[++z]);
+        else if ((strcmp(argv[z], "-n") == 0) && (z + 1 < argc))
+            nRuns = atoi(argv[++z]);
+        else if (strcmp(argv[z], "-m") == 0)
+            bMemory = TRUE;
+        else if ((strcmp(argv[z], "-v") == 0) && (z + 1 < argc))
+        {
+            z++;
+            nVerifyMode = (strcmp(argv[z], "inline") == 0) ? APE_VERIFY_INLINE : (strcmp(argv[z], "async") == 0) ? APE_VERIFY_ASYNC :
+                (strcmp(argv[z], "none") == 0) ? APE_VERIFY_NONE : -1;
+        }
+        else if ((strcmp(argv[z], "-o") == 0) && (z + 1 < argc))
+        {
+            z++;
+            nOutputFormat = (strcmp(argv[z], "native") == 0) ? APE_OUTPUT_NATIVE : (strcmp(argv[z], "int32") == 0) ? APE_OUTPUT_INT32 :
+                (strcmp(argv[z], "float32") == 0) ? APE_OUTPUT_FLOAT32 : (strcmp(argv[z], "int32-planar") == 0) ? (APE_OUTPUT_INT32 | APE_OUTPUT_PLANAR) :
+                (strcmp(argv[z], "float32-planar") == 0) ? (APE_OUTPUT_FLOAT32 | APE_OUTPUT_PLANAR) : -1;
+        }
+        else if ((strcmp(argv[z], "-s") == 0) && (z + 1 < argc))
+            nSnapshotBlocks = atoi(argv[++z]);
+        else if ((strcmp(argv[z], "-k") == 0) && (z + 1 < argc))
+            nSeeks = atoi(argv[++z]);
+        else if (strcmp(argv[z], "-f") == 0)
+            bFilters = TRUE;
+        else if ((strcmp(argv[z], "-c") == 0) && (z + 1 < argc))
+            pExpectedMD5 = argv[++z];
+        else if ((strcmp(argv[z], "-e") == 0) && (z + 1 < argc))
+            nExpectedResult = atoi(argv[++z]);
+        else if ((argv[z][0] != '-') && (pFilename == NULL))
+            pFilename = argv[z];
+        else
+        {
+            Usage();
+            return 2;
+        }
+    }
+    if (bFilters && (pFilename == NULL) && (nRuns > 0))
+    {
+        BenchmarkFilters(nRuns);
+        return 0;
+    }
+    if ((pFilename == NULL) || (nBlocksPerCall <= 0) || (nThreads < 0) || (nRuns <= 0) || (bMemory && (nThreads > 0)) ||
+        (nVerifyMode < 0) || (nOutputFormat < 0) || (nSnapshotBlocks < 0) || ((nSnapshotBlocks > 0) && (nThreads > 0)) || ((nVerifyMode != APE_VERIFY_INLINE) && (nThreads > 0)) ||
+        (nSeeks < 0) || ((nSeeks > 0) && ((nThreads > 0) || (nOutputFormat != APE_OUTPUT_NATIVE))))
+    {
+        Usage();
+        return 2;
+    }
+
+    CSmartPtr<str_utf16> spFilenameUTF16(CAPECharacterHelper::GetUTF16FromUTF8((const str_utf8 *) pFilename), TRUE);
+
+    CSmartPtr<unsigned char> spFileData;
+    CSmartPtr<CMemoryIO> spMemoryIO;
+    if (bMemory)
+    {
+        long long nFileBytes = 0;
+        if (ReadWholeFile(pFilename, spFileData, &nFileBytes) == FALSE)
+        {
+            printf("%s: can't read\n", pFilename);
+            return 2;
+        }
+        spMemoryIO.Assign(new CMemoryIO(spFileData.GetPtr(), nFileBytes));
+    }
+
+    // describe the file
+    int nErrorCode = ERROR_SUCCESS;
+    CSmartPtr<IAPEDecompress> spInfo(CreateIAPEDecompress(spFilenameUTF16, &nErrorCode));
+    if (spInfo == NULL)
+    {
+        printf("%s: can't open (error %d)\n", pFilename, nErrorCode);
+        return 2;
+    }
+    int nSampleRate = (int) spInfo->GetInfo(APE_INFO_SAMPLE_RATE);
+    int nBlockAlign = (int) spInfo->GetInfo(APE_INFO_BLOCK_ALIGN);
+    long long nTotalBlocks = (long long) spInfo->GetInfo(APE_DECOMPRESS_TOTAL_BLOCKS);
+    long long nAPEBytes = (long long) spInfo->GetInfo(APE_INFO_APE_TOTAL_BYTES);
+    printf("%s: version %.2f, level %d, %d Hz, %d bit, %d ch, %lld blocks (%.1f s)\n", pFilename,
+        double(spInfo->GetInfo(APE_INFO_FILE_VERSION)) / 1000.0, (int) spInfo->GetInfo(APE_INFO_COMPRESSION_LEVEL), nSampleRate,
+        (int) spInfo->GetInfo(APE_INFO_BITS_PER_SAMPLE), (int) spInfo->GetInfo(APE_INFO_CHANNELS),
+        nTotalBlocks, (nSampleRate > 0) ? double(nTotalBlocks) / nSampleRate : 0.0);
+    spInfo.Delete();
+
+    printf("%d blocks per call, %s, %s, CRCs %s, %s%s output\n", nBlocksPerCall,
+        (nThreads > 0) ? "parallel" : "single thread", bMemory ? "from memory" : "from file",
+        (nVerifyMode == APE_VERIFY_ASYNC) ? "on a thread" : (nVerifyMode == APE_VERIFY_NONE) ? "not checked" : "inline",
+        ((nOutputFormat & ~APE_OUTPUT_PLANAR) == APE_OUTPUT_FLOAT32) ? "float32" : ((nOutputFormat & ~APE_OUTPUT_PLANAR) == APE_OUTPUT_INT32) ? "int32" : "native",
+        (nOutputFormat & APE_OUTPUT_PLANAR) ? " planar" : "");
+    if (nThreads > 0)
+        printf("%d threads\n", nThreads);
+
+    // decode (the fastest run is the one that counts)
+    RUN_RESULT Best;
+    memset(&Best, 0, sizeof(Best));
+    BOOL bMD5Stable = TRUE;
+    for (int nRun = 0; nRun < nRuns; nRun++)
+    {
+        RUN_RESULT Run;
+        if (DecodeOnce(pFilename, spFilenameUTF16, nBlocksPerCall, nThreads, nVerifyMode, nOutputFormat, nSnapshotBlocks, spMemoryIO, &Run) != ERROR_SUCCESS)
+            return 2;
+
+        double dSeconds = double(Run.nTicks) / TICK_COUNT_FREQ;
+        printf("run %d: %.1f ms\n", nRun + 1, dSeconds * 1000.0);
+
+        if ((nRun > 0) && (strcmp(Run.cMD5, Best.cMD5) != 0))
+            bMD5Stable = FALSE;
+        if ((nRun == 0) || (Run.nTicks < Best.nTicks))
+            Best = Run;
+    }
+
+    double dSeconds = max(double(Best.nTicks) / TICK_COUNT_FREQ, 1e-9);
+    double dPCMBytes = double(Best.nBlocks) * nBlockAlign;
+    printf("decoded %lld blocks in %.1f ms: %.1f MB/s PCM, %.1f MB/s APE, %.1fx realtime\n",
+        Best.nBlocks, dSeconds * 1000.0, dPCMBytes / dSeconds / 1e6, double(nAPEBytes) / dSeconds / 1e6,
+        (nSampleRate > 0) ? (double(Best.nBlocks) / nSampleRate) / dSeconds : 0.0);
+    if (nSnapshotBlocks > 0)
+        printf("handed over through %d snapshots, the largest %d bytes\n", Best.nSnapshots, Best.nLargestSnapshotBytes);
+
+    if (Best.bStageTimes)
+    {
+        TICK_COUNT_TYPE nStagedTicks = Best.StageTimes.nRangeDecode + Best.StageTimes.nNNFilters + Best.StageTimes.nPrediction + Best.StageTimes.nUnprepare;
+        TICK_COUNT_TYPE nTotalTicks = max(Best.nTicks * (TICK_COUNT_TYPE) max(nThreads, 1), nStagedTicks);
+        printf("stages%s:\n", (nThreads > 0) ? " (all threads)" : "");
+        PrintStage("range decoding", Best.StageTimes.nRangeDecode, nTotalTicks);
+        PrintStage("NN filters", Best.StageTimes.nNNFilters, nTotalTicks);
+        PrintStage("predictor", Best.StageTimes.nPrediction, nTotalTicks);
+        PrintStage("unprepare / CRC", Best.StageTimes.nUnprepare, nTotalTicks);
+        if (nThreads == 0)
+            PrintStage("other", nTotalTicks - nStagedTicks, nTotalTicks);
+    }
+    else
+    {
+        printf("stages: not available (library built without ENABLE_STAGE_TIMING)\n");
+    }
+
+    // check the output
+    int nExitCode = 0;
+    printf("md5 %s", Best.cMD5);
+    if (Best.nResult != ERROR_SUCCESS)
+        printf(", decoder error %d", Best.nResult);
+    if (Best.nResult != nExpectedResult)
+    {
+        if (nExpectedResult != ERROR_SUCCESS)
+            printf(", EXPECTED ERROR %d", nExpectedResult);
+        nExitCode = 1;
+    }
+    if (bMD5Stable == FALSE)
+    {
+        printf(", CHANGES BETWEEN RUNS");
+        nExitCode = 1;
+    }
+    if (pExpectedMD5 != NULL)
+    {
+        BOOL bMatch = (strcasecmp(pExpectedMD5, Best.cMD5) == 0);
+        printf(", %s", bMatch ? "matches" : "MISMATCH");
+        if (bMatch == FALSE)
+            nExitCode = 1;
+    }
+    printf("\n");
+
+    if ((nSeeks > 0) && (CheckSeeking(pFilename, spFilenameUTF16, nSeeks, nBlocksPerCall, Best.cMD5) != ERROR_SUCCESS))
+        nExitCode = 1;
+
+    return nExitCode;
+}
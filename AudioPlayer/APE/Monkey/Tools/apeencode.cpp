@@ -0,0 +1,208 @@
+/*****************************************************************************************
+apeencode - compresses a WAV file to APE
+
+Usage:
+    apeencode [-c level] [-t threads] in.wav out.ape
+
+    -c level        compression level: 1000 (fast), 2000 (normal, the default), 3000 (high),
+                    4000 (extra high) or 5000 (insane)
+    -t threads      1 encodes on the calling thread (default), anything else encodes frames on
+                    that many workers (0 = one per core); the file is the same either way
+
+Everything in the WAV before the audio (the RIFF header and any other chunks) and after it
+is stored in the APE file, so decoding gives back the original WAV byte for byte.
+*****************************************************************************************/
+#include "All.h"
+#include "MACLib.h"
+#include "CharacterHelper.h"
+
+using namespace APE_MONKEY;
+
+#define ENCODE_READ_BYTES   (1024 * 1024)
+
+static void Usage()
+{
+    printf("usage: apeencode [-c level] [-t threads] in.wav out.ape\n");
+}
+
+/*****************************************************************************************
+WAV parsing -- finds the format and where the audio is (the header data is everything
+before the audio, the terminating data everything after it)
+*****************************************************************************************/
+struct WAV_LAYOUT
+{
+    WAVEFORMATEX wfeInput;
+    long long nHeaderBytes;
+    long long nAudioBytes;
+    long long nTerminatingBytes;
+};
+
+static BOOL ReadBytes(FILE * pFile, void * pBuffer, size_t nBytes)
+{
+    return (fread(pBuffer, 1, nBytes, pFile) == nBytes) ? TRUE : FALSE;
+}
+
+static BOOL ParseWAV(FILE * pFile, WAV_LAYOUT * pLayout)
+{
+    fseeko(pFile, 0, SEEK_END);
+    long long nFileBytes = ftello(pFile);
+    fseeko(pFile, 0, SEEK_SET);
+
+    unsigned char cRIFF[12];
+    if ((ReadBytes(pFile, cRIFF, 12) == FALSE) || (memcmp(cRIFF, "RIFF", 4) != 0) || (memcmp(&cRIFF[8], "WAVE", 4) != 0))
+        return FALSE;
+
+    BOOL bFormat = FALSE;
+    while (TRUE)
+    {
+        unsigned char cChunk[8];
+        if (ReadBytes(pFile, cChunk, 8) == FALSE)
+            return FALSE;
+        long long nChunkBytes = cChunk[4] | (cChunk[5] << 8) | (cChunk[6] << 16) | ((long long) cChunk[7] << 24);
+
+        if (memcmp(cChunk, "fmt ", 4) == 0)
+        {
+            // the first 16 bytes are the same for WAVE_FORMAT_PCM and WAVE_FORMAT_EXTENSIBLE
+            unsigned char cFormat[16];
+            if ((nChunkBytes < 16) || (ReadBytes(pFile, cFormat, 16) == FALSE))
+                return FALSE;
+            int nFormatTag = cFormat[0] | (cFormat[1] << 8);
+            int nChannels = cFormat[2] | (cFormat[3] << 8);
+            int nSampleRate = cFormat[4] | (cFormat[5] << 8) | (cFormat[6] << 16) | (cFormat[7] << 24);
+            int nBitsPerSample = cFormat[14] | (cFormat[15] << 8);
+            if ((nFormatTag != 1) && (nFormatTag != 0xFFFE))
+                return FALSE;
+            FillWaveFormatEx(&pLayout->wfeInput, nSampleRate, nBitsPerSample, nChannels);
+            bFormat = TRUE;
+            fseeko(pFile, ((nChunkBytes + 1) & ~1LL) - 16, SEEK_CUR);
+        }
+        else if (memcmp(cChunk, "data", 4) == 0)
+        {
+            if (bFormat == FALSE)
+                return FALSE;
+
+            // a data chunk that runs past the end of the file (streamed WAVs) ends at the end
+            pLayout->nHeaderBytes = ftello(pFile);
+            pLayout->nAudioBytes = min(nChunkBytes, nFileBytes - pLayout->nHeaderBytes);
+            pLayout->nAudioBytes -= pLayout->nAudioBytes % pLayout->wfeInput.nBlockAlign;
+            pLayout->nTerminatingBytes = nFileBytes - pLayout->nHeaderBytes - pLayout->nAudioBytes;
+            return TRUE;
+        }
+        else
+        {
+            fseeko(pFile, (nChunkBytes + 1) & ~1LL, SEEK_CUR);
+        }
+    }
+}
+
+int main(int argc, char * argv[])
+{
+    int nCompressionLevel = COMPRESSION_LEVEL_NORMAL;
+    int nThreads = 1;
+    const char * pInputFilename = NULL;
+    const char * pOutputFilename = NULL;
+
+    for (int z = 1; z < argc; z++)
+    {
+        if ((strcmp(argv[z], "-c") == 0) && (z + 1 < argc))
+            nCompressionLevel = atoi(argv[++z]);
+        else if ((strcmp(argv[z], "-t") == 0) && (z + 1 < argc))
+            nThreads = atoi(argv[++z]);
+        else if ((argv[z][0] != '-') && (pInputFilename == NULL))
+            pInputFilename = argv[z];
+        else if ((argv[z][0] != '-') && (pOutputFilename == NULL))
+            pOutputFilename = argv[z];
+        else
+        {
+            Usage();
+            return 2;
+        }
+    }
+    if ((pInputFilename == NULL) || (pOutputFilename == NULL) || (nThreads < 0) ||
+        (nCompressionLevel < COMPRESSION_LEVEL_FAST) || (nCompressionLevel > COMPRESSION_LEVEL_INSANE) || (nCompressionLevel % 1000 != 0))
+    {
+        Usage();
+        return 2;
+    }
+
+    // read the layout of the WAV
+    FILE * pInput = fopen(pInputFilename, "rb");
+    if (pInput == NULL)
+    {
+        printf("%s: can't open\n", pInputFilename);
+        return 1;
+    }
+    WAV_LAYOUT Layout;
+    if ((ParseWAV(pInput, &Layout) == FALSE) || (Layout.nHeaderBytes > ENCODE_READ_BYTES) || (Layout.nTerminatingBytes > ENCODE_READ_BYTES) ||
+        (Layout.nAudioBytes > 0x7FFFFFFF))
+    {
+        printf("%s: not a WAV file APE can store\n", pInputFilename);
+        fclose(pInput);
+        return 1;
+    }
+
+    CSmartPtr<unsigned char> spBuffer(new unsigned char [ENCODE_READ_BYTES], TRUE);
+    CSmartPtr<unsigned char> spHeader(new unsigned char [(size_t) Layout.nHeaderBytes], TRUE);
+    fseeko(pInput, 0, SEEK_SET);
+    ReadBytes(pInput, spHeader, (size_t) Layout.nHeaderBytes);
+
+    // start
+    int nErrorCode = ERROR_SUCCESS;
+    CSmartPtr<IAPECompress> spCompress((nThreads == 1) ? CreateIAPECompress(&nErrorCode) : CreateIAPECompressParallel(nThreads, &nErrorCode));
+    CSmartPtr<str_utf16> spOutputFilename(CAPECharacterHelper::GetUTF16FromUTF8((const str_utf8 *) pOutputFilename), TRUE);
+    if (nErrorCode == ERROR_SUCCESS)
+        nErrorCode = spCompress->Start(spOutputFilename, &Layout.wfeInput, (int) Layout.nAudioBytes, nCompressionLevel, spHeader, (int) Layout.nHeaderBytes);
+    if (nErrorCode != ERROR_SUCCESS)
+    {
+        printf("%s: can't start (error %d)\n", pOutputFilename, nErrorCode);
+        fclose(pInput);
+        return 1;
+    }
+
+    // encode
+    TICK_COUNT_TYPE nStart, nFinish;
+    TICK_COUNT_READ(nStart);
+    for (long long nBytesLeft = Layout.nAudioBytes; (nBytesLeft > 0) && (nErrorCode == ERROR_SUCCESS); )
+    {
+        int nBytes = (int) min(nBytesLeft, (long long) ENCODE_READ_BYTES);
+        if (ReadBytes(pInput, spBuffer, nBytes) == FALSE)
+            nErrorCode = ERROR_IO_READ;
+        else
+            nErrorCode = spCompress->AddData(spBuffer, nBytes);
+        nBytesLeft -= nBytes;
+    }
+
+    // finish (with whatever followed the audio in the WAV)
+    int nTerminatingBytes = (int) Layout.nTerminatingBytes;
+    if ((nErrorCode == ERROR_SUCCESS) && (ReadBytes(pInput, spBuffer, nTerminatingBytes) == FALSE))
+        nErrorCode = ERROR_IO_READ;
+    if (nErrorCode == ERROR_SUCCESS)
+        nErrorCode = spCompress->Finish(spBuffer, nTerminatingBytes, nTerminatingBytes);
+    spCompress.Delete();
+    TICK_COUNT_READ(nFinish);
+    fclose(pInput);
+
+    if (nErrorCode != ERROR_SUCCESS)
+    {
+        printf("%s: encoding failed (error %d)\n", pOutputFilename, nErrorCode);
+        return 1;
+    }
+
+    // report
+    FILE * pOutput = fopen(pOutputFilename, "rb");
+    long long nOutputBytes = 0;
+    if (pOutput != NULL)
+    {
+        fseeko(pOutput, 0, SEEK_END);
+        nOutputBytes = ftello(pOutput);
+        fclose(pOutput);
+    }
+    double dSeconds = max(double(nFinish - nStart) / TICK_COUNT_FREQ, 1e-9);
+    double dAudioSeconds = double(Layout.nAudioBytes) / max((int) Layout.wfeInput.nAvgBytesPerSec, 1);
+    printf("%s: level %d, %d Hz, %d bit, %d ch, %.1f s of audio\n", pInputFilename, nCompressionLevel,
+        (int) Layout.wfeInput.nSamplesPerSec, (int) Layout.wfeInput.wBitsPerSample, (int) Layout.wfeInput.nChannels, dAudioSeconds);
+    printf("encoded in %.1f ms: %.1f MB/s PCM, %.1fx realtime, %.2f%% of the original size\n", dSeconds * 1000.0,
+        double(Layout.nAudioBytes) / dSeconds / 1048576.0, dAudioSeconds / dSeconds,
+        100.0 * double(nOutputBytes) / max(double(Layout.nHeaderBytes + Layout.nAudioBytes + Layout.nTerminatingBytes), 1.0));
+    return 0;
+}
@@ -0,0 +1,109 @@
+/*****************************************************************************************
+apescan - keeps an index of a library of APE files (the format, length and tag of each) up
+to date
+
+Usage:
+    apescan [-t threads] [-l] library.index directory|file.ape
+
+    -t threads      files read at once (default: one per core)
+    -l              list what's in the index afterwards (path, length, format, artist and
+                    title)
+
+The index is loaded first (if it's there), so only files that are new or have changed size
+or modification time since it was written are read; files that are gone are dropped.
+
+The exit code is 0 if every file could be read, 1 if any couldn't, and 2 for bad arguments
+or if the directory can't be scanned or the index can't be written.
+*****************************************************************************************/
+#include "All.h"
+#include "MACLib.h"
+#include "APELibraryIndex.h"
+
+using namespace APE_MONKEY;
+
+static void Usage()
+{
+    printf("usage: apescan [-t threads] [-l] library.index directory|file.ape\n");
+}
+
+static void List(CAPELibraryIndex & Index)
+{
+    for (int z = 0; z < Index.GetEntries(); z++)
+    {
+        const APE_LIBRARY_ENTRY * pEntry = Index.GetEntry(z);
+        if (pEntry->nResult != ERROR_SUCCESS)
+        {
+            printf("%s: can't read (error %d)\n", Index.GetPath(pEntry), pEntry->nResult);
+            continue;
+        }
+
+        const char * pArtist = Index.GetTagField(pEntry, "Artist");
+        const char * pTitle = Index.GetTagField(pEntry, "Title");
+        printf("%s: %d:%02d, %d Hz, %d bit, %d ch, level %d, %d kbps, %s - %s\n", Index.GetPath(pEntry),
+            pEntry->nLengthMS / 60000, (pEntry->nLengthMS / 1000) % 60, pEntry->nSampleRate, (int) pEntry->nBitsPerSample,
+            (int) pEntry->nChannels, (int) pEntry->nCompressionLevel, pEntry->nAverageBitrate,
+            (pArtist != NULL) ? pArtist : "?", (pTitle != NULL) ? pTitle : "?");
+    }
+}
+
+int main(int argc, char * argv[])
+{
+    int nThreads = 0;
+    BOOL bList = FALSE;
+    const char * pIndexFilename = NULL;
+    const char * pPath = NULL;
+
+    for (int z = 1; z < argc; z++)
+    {
+        if ((strcmp(argv[z], "-t") == 0) && (z + 1 < argc))
+            nThreads = atoi(argv[++z]);
+        else if (strcmp(argv[z], "-l") == 0)
+            bList = TRUE;
+        else if ((argv[z][0] != '-') && (pIndexFilename == NULL))
+            pIndexFilename = argv[z];
+        else if ((argv[z][0] != '-') && (pPath == NULL))
+            pPath = argv[z];
+        else
+        {
+            Usage();
+            return 2;
+        }
+    }
+    if ((pIndexFilename == NULL) || (pPath == NULL) || (nThreads < 0))
+    {
+        Usage();
+        return 2;
+    }
+
+    // load what we had (a missing or broken index just means everything is read)
+    CAPELibraryIndex Index;
+    TICK_COUNT_TYPE nStart, nLoaded, nScanned;
+    TICK_COUNT_READ(nStart);
+    BOOL bLoaded = (Index.Load(pIndexFilename) == ERROR_SUCCESS) ? TRUE : FALSE;
+    TICK_COUNT_READ(nLoaded);
+
+    // scan
+    int nErrorCode = Index.Scan(pPath, nThreads);
+    TICK_COUNT_READ(nScanned);
+    if (nErrorCode != ERROR_SUCCESS)
+    {
+        printf("%s: can't scan (error %d)\n", pPath, nErrorCode);
+        return 2;
+    }
+    nErrorCode = Index.Save(pIndexFilename);
+    if (nErrorCode != ERROR_SUCCESS)
+    {
+        printf("%s: can't write (error %d)\n", pIndexFilename, nErrorCode);
+        return 2;
+    }
+
+    // report
+    if (bList)
+        List(Index);
+    printf("%d files: %d read, %d unchanged, %d couldn't be read\n", Index.GetEntries(), Index.GetFilesRead(),
+        Index.GetFilesReused(), Index.GetFilesFailed());
+    printf("index %s in %.1f ms, scanned in %.1f ms, %lld bytes\n", bLoaded ? "loaded" : "started",
+        double(nLoaded - nStart) * 1000.0 / TICK_COUNT_FREQ, double(nScanned - nLoaded) * 1000.0 / TICK_COUNT_FREQ,
+        Index.GetIndexBytes());
+    return (Index.GetFilesFailed() > 0) ? 1 : 0;
+}
@@ -0,0 +1,309 @@
+/*****************************************************************************************
+apeverify - checks APE files end to end (every frame's CRC and the stored MD5) and writes
+a JSON report
+
+Usage:
+    apeverify [-j files] [-t threads] [-o report.json] file.ape|directory ...
+
+    -j files        files checked at once (default: one per core, but no more than there
+                    are files)
+    -t threads      frame decoding threads per file (default: the cores left over once the
+                    files are shared out, at least 1)
+    -o report.json  where the report goes (default: standard output)
+
+Directories are searched (recursively) for .ape files.  Each file is read once: its frames
+are decoded on the file's threads while the MD5 runs over the same mapping, and the files
+are spread over the cores, so a big library keeps both the disks and the cores busy.
+
+The exit code is 0 if every file checked out, 1 if any didn't (or couldn't be read), and 2
+for bad arguments.
+*****************************************************************************************/
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "All.h"
+#include "MACLib.h"
+#include "APEFileVerifier.h"
+#include "CharacterHelper.h"
+
+using namespace APE_MONKEY;
+
+static void Usage()
+{
+    printf("usage: apeverify [-j files] [-t threads] [-o report.json] file.ape|directory ...\n");
+}
+
+/*****************************************************************************************
+Finding the files
+*****************************************************************************************/
+static BOOL IsAPEFilename(const char * pName)
+{
+    size_t nLength = strlen(pName);
+    return ((nLength > 4) && (strcasecmp(&pName[nLength - 4], ".ape") == 0)) ? TRUE : FALSE;
+}
+
+static void AddPath(const std::string & strPath, BOOL bNamed, std::vector<std::string> & aryFiles)
+{
+    struct stat Stat;
+    if (stat(strPath.c_str(), &Stat) != 0)
+    {
+        // a missing file that was asked for by name shows up in the report as an error
+        if (bNamed)
+            aryFiles.push_back(strPath);
+        return;
+    }
+
+    if (S_ISDIR(Stat.st_mode))
+    {
+        // don't follow links to directories (they can go round in circles)
+        struct stat LinkStat;
+        if ((bNamed == FALSE) && (lstat(strPath.c_str(), &LinkStat) == 0) && S_ISLNK(LinkStat.st_mode))
+            return;
+
+        DIR * pDirectory = opendir(strPath.c_str());
+        if (pDirectory == NULL)
+            return;
+        struct dirent * pEntry;
+        while ((pEntry = readdir(pDirectory)) != NULL)
+        {
+            if ((strcmp(pEntry->d_name, ".") == 0) || (strcmp(pEntry->d_name, "..") == 0))
+                continue;
+            std::string strChild = strPath;
+            if (strChild.empty() || (strChild[strChild.size() - 1] != '/'))
+                strChild += '/';
+            strChild += pEntry->d_name;
+            AddPath(strChild, FALSE, aryFiles);
+        }
+        closedir(pDirectory);
+    }
+    else if (bNamed || (S_ISREG(Stat.st_mode) && IsAPEFilename(strPath.c_str())))
+    {
+        aryFiles.push_back(strPath);
+    }
+}
+
+/*****************************************************************************************
+Checking them (files are handed out to the file threads in order)
+*****************************************************************************************/
+struct FILE_RESULT
+{
+    int nResult;
+    int nMD5Status;
+    int nTotalFrames;
+    std::vector<int> aryBadFrames;
+    long long nBytes;
+    double dSeconds;
+};
+
+struct VERIFY_JOB
+{
+    const std::vector<std::string> * pFiles;
+    std::vector<FILE_RESULT> * pResults;
+    int nFrameThreads;
+    int nNextFile;
+    pthread_mutex_t Mutex;
+};
+
+static void VerifyFile(const std::string & strFile, int nFrameThreads, FILE_RESULT * pResult)
+{
+    pResult->nResult = ERROR_SUCCESS;
+    pResult->nMD5Status = APE_MD5_NOT_STORED;
+    pResult->nTotalFrames = 0;
+    pResult->nBytes = 0;
+
+    TICK_COUNT_TYPE nStart, nFinish;
+    TICK_COUNT_READ(nStart);
+
+    CSmartPtr<str_utf16> spFilenameUTF16(CAPECharacterHelper::GetUTF16FromUTF8((const str_utf8 *) strFile.c_str()), TRUE);
+    int nErrorCode = ERROR_SUCCESS;
+    CAPEFileVerifier Verifier(&nErrorCode, spFilenameUTF16, nFrameThreads);
+    if (nErrorCode == ERROR_SUCCESS)
+        nErrorCode = Verifier.Verify();
+
+    pResult->nResult = nErrorCode;
+    pResult->nMD5Status = Verifier.GetMD5Status();
+    pResult->nTotalFrames = Verifier.GetTotalFrames();
+    pResult->nBytes = Verifier.GetFileBytes();
+    for (int z = 0; z < Verifier.GetTotalFrames(); z++)
+    {
+        if (Verifier.IsFrameBad(z))
+            pResult->aryBadFrames.push_back(z);
+    }
+
+    TICK_COUNT_READ(nFinish);
+    pResult->dSeconds = double(nFinish - nStart) / TICK_COUNT_FREQ;
+}
+
+static void * FileThread(void * pParam)
+{
+    VERIFY_JOB * pJob = (VERIFY_JOB *) pParam;
+    while (TRUE)
+    {
+        pthread_mutex_lock(&pJob->Mutex);
+        int nFile = pJob->nNextFile++;
+        pthread_mutex_unlock(&pJob->Mutex);
+        if (nFile >= (int) pJob->pFiles->size())
+            break;
+
+        const std::string & strFile = (*pJob->pFiles)[nFile];
+        FILE_RESULT * pResult = &(*pJob->pResults)[nFile];
+        VerifyFile(strFile, pJob->nFrameThreads, pResult);
+        fprintf(stderr, "%s: %s\n", strFile.c_str(), (pResult->nResult == ERROR_SUCCESS) ? "ok" :
+            (pResult->nResult == ERROR_INVALID_CHECKSUM) ? "BAD" : "can't check");
+    }
+    return NULL;
+}
+
+/*****************************************************************************************
+The report
+*****************************************************************************************/
+static void WriteJSONString(FILE * pFile, const std::string & strValue)
+{
+    fputc('"', pFile);
+    for (size_t z = 0; z < strValue.size(); z++)
+    {
+        unsigned char c = (unsigned char) strValue[z];
+        if ((c == '"') || (c == '\\'))
+            fprintf(pFile, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(pFile, "\\u%04x", c);
+        else
+            fputc(c, pFile);
+    }
+    fputc('"', pFile);
+}
+
+static const char * GetStatusName(int nResult)
+{
+    return (nResult == ERROR_SUCCESS) ? "ok" : (nResult == ERROR_INVALID_CHECKSUM) ? "bad" : "error";
+}
+
+static const char * GetMD5StatusName(int nMD5Status)
+{
+    switch (nMD5Status)
+    {
+    case APE_MD5_MATCH: return "match";
+    case APE_MD5_MISMATCH: return "mismatch";
+    case APE_MD5_INVALID: return "invalid";
+    default: return "not stored";
+    }
+}
+
+static void WriteReport(FILE * pFile, const std::vector<std::string> & aryFiles, const std::vector<FILE_RESULT> & aryResults,
+    int nFileThreads, int nFrameThreads, double dSeconds)
+{
+    int nOK = 0, nBad = 0, nErrors = 0;
+    long long nBytes = 0;
+
+    fprintf(pFile, "{\n  \"files\": [");
+    for (size_t z = 0; z < aryFiles.size(); z++)
+    {
+        const FILE_RESULT & Result = aryResults[z];
+        if (Result.nResult == ERROR_SUCCESS) nOK++;
+        else if (Result.nResult == ERROR_INVALID_CHECKSUM) nBad++;
+        else nErrors++;
+        nBytes += Result.nBytes;
+
+        fprintf(pFile, "%s\n    { \"path\": ", (z > 0) ? "," : "");
+        WriteJSONString(pFile, aryFiles[z]);
+        fprintf(pFile, ", \"status\": \"%s\", \"error\": %d, \"md5\": \"%s\", \"frames\": %d, \"bad_frames\": [",
+            GetStatusName(Result.nResult), Result.nResult, GetMD5StatusName(Result.nMD5Status), Result.nTotalFrames);
+        for (size_t nFrame = 0; nFrame < Result.aryBadFrames.size(); nFrame++)
+            fprintf(pFile, "%s%d", (nFrame > 0) ? ", " : "", Result.aryBadFrames[nFrame]);
+        fprintf(pFile, "], \"bytes\": %lld, \"seconds\": %.3f }", Result.nBytes, Result.dSeconds);
+    }
+    fprintf(pFile, "%s],\n", aryFiles.empty() ? "" : "\n  ");
+
+    fprintf(pFile, "  \"summary\": { \"files\": %d, \"ok\": %d, \"bad\": %d, \"errors\": %d, \"bytes\": %lld, \"seconds\": %.3f, "
+        "\"file_threads\": %d, \"frame_threads\": %d }\n}\n",
+        (int) aryFiles.size(), nOK, nBad, nErrors, nBytes, dSeconds, nFileThreads, nFrameThreads);
+}
+
+int main(int argc, char * argv[])
+{
+    int nFileThreads = 0;
+    int nFrameThreads = 0;
+    const char * pReportFilename = NULL;
+    std::vector<std::string> aryFiles;
+
+    for (int z = 1; z < argc; z++)
+    {
+        if ((strcmp(argv[z], "-j") == 0) && (z + 1 < argc))
+            nFileThreads = atoi(argv[++z]);
+        else if ((strcmp(argv[z], "-t") == 0) && (z + 1 < argc))
+            nFrameThreads = atoi(argv[++z]);
+        else if ((strcmp(argv[z], "-o") == 0) && (z + 1 < argc))
+            pReportFilename = argv[++z];
+        else if (argv[z][0] != '-')
+            AddPath(argv[z], TRUE, aryFiles);
+        else
+        {
+            Usage();
+            return 2;
+        }
+    }
+    if (aryFiles.empty() || (nFileThreads < 0) || (nFrameThreads < 0))
+    {
+        Usage();
+        return 2;
+    }
+    std::sort(aryFiles.begin(), aryFiles.end());
+
+    // share the cores out: files first (each file's MD5 runs on its own thread), then frames
+    int nCores = max((int) sysconf(_SC_NPROCESSORS_ONLN), 1);
+    if (nFileThreads == 0)
+        nFileThreads = nCores;
+    nFileThreads = min(nFileThreads, (int) aryFiles.size());
+    if (nFrameThreads == 0)
+        nFrameThreads = max(nCores / nFileThreads, 1);
+
+    FILE * pReport = stdout;
+    if (pReportFilename != NULL)
+    {
+        pReport = fopen(pReportFilename, "w");
+        if (pReport == NULL)
+        {
+            printf("%s: can't create\n", pReportFilename);
+            return 2;
+        }
+    }
+
+    // check
+    std::vector<FILE_RESULT> aryResults(aryFiles.size());
+    VERIFY_JOB Job;
+    Job.pFiles = &aryFiles;
+    Job.pResults = &aryResults;
+    Job.nFrameThreads = nFrameThreads;
+    Job.nNextFile = 0;
+    pthread_mutex_init(&Job.Mutex, NULL);
+
+    TICK_COUNT_TYPE nStart, nFinish;
+    TICK_COUNT_READ(nStart);
+    std::vector<pthread_t> aryThreads;
+    for (int z = 0; z < nFileThreads; z++)
+    {
+        pthread_t hThread;
+        if (pthread_create(&hThread, NULL, FileThread, &Job) == 0)
+            aryThreads.push_back(hThread);
+    }
+    if (aryThreads.empty())
+        FileThread(&Job);
+    for (size_t z = 0; z < aryThreads.size(); z++)
+        pthread_join(aryThreads[z], NULL);
+    TICK_COUNT_READ(nFinish);
+    pthread_mutex_destroy(&Job.Mutex);
+
+    // report
+    WriteReport(pReport, aryFiles, aryResults, nFileThreads, nFrameThreads, double(nFinish - nStart) / TICK_COUNT_FREQ);
+    if (pReport != stdout)
+        fclose(pReport);
+
+    for (size_t z = 0; z < aryResults.size(); z++)
+    {
+        if (aryResults[z].nResult != ERROR_SUCCESS)
+            return 1;
+    }
+    return 0;
+}
@@ -129,6 +129,11 @@ typedef struct {
  * The decode queue size.
  */
 @property (nonatomic,assign) unsigned decodeQueueSize;
+/**
+ * The number of decoded buffers (of bufferSize bytes) a locally decoded
+ * stream, such as APE, may run ahead of the output.
+ */
+@property (nonatomic,assign) unsigned decodeAheadBufferCount;
 /**
  * The HTTP connection buffer size.
  */
@@ -85,6 +85,7 @@ static NSInteger sortCacheObjects(id co1, id co2, void *keyForSorting)
 //        self.bufferSize     = 65536; //2*32*1024
         self.maxPacketDescs = 512; //2^9
         self.decodeQueueSize = 128; //2^7
+        self.decodeAheadBufferCount = 16; //2^4
         self.httpConnectionBufferSize = 1024; //2^10
         self.outputSampleRate = 44100;
         self.outputNumChannels = 2;
@@ -653,6 +654,7 @@ public:
     config.bufferSize               = c->bufferSize;
     config.maxPacketDescs           = c->maxPacketDescs;
     config.decodeQueueSize          = c->decodeQueueSize;
+    config.decodeAheadBufferCount   = c->decodeAheadBufferCount;
     config.httpConnectionBufferSize = c->httpConnectionBufferSize;
     config.outputSampleRate         = c->outputSampleRate;
     config.outputNumChannels        = c->outputNumChannels;
@@ -1222,6 +1224,7 @@ public:
         c->bufferSize               = configuration.bufferSize;
         c->maxPacketDescs           = configuration.maxPacketDescs;
         c->decodeQueueSize          = configuration.decodeQueueSize;
+        c->decodeAheadBufferCount   = configuration.decodeAheadBufferCount;
         c->httpConnectionBufferSize = configuration.httpConnectionBufferSize;
         c->outputSampleRate         = configuration.outputSampleRate;
         c->outputNumChannels        = configuration.outputNumChannels;
@@ -0,0 +1,259 @@
+/*
+ * This file is part of the FreeStreamer project,
+ * (C)Copyright 2011-2015 Matias Muhonen <mmu@iki.fi>
+ * See the file ''LICENSE'' for using the code.
+ *
+ * https://github.com/muhku/FreeStreamer
+ */
+
+#include "ape_http_stream.h"
+
+namespace astreamer {
+    
+/* HTTP_Range_Source */
+    
+HTTP_Range_Source::HTTP_Range_Source(CFURLRef url) :
+    m_httpStream(new HTTP_Stream()),
+    m_runLoop((CFRunLoopRef)CFRetain(CFRunLoopGetCurrent())),
+    m_source(this)
+{
+    m_httpStream->m_delegate = this;
+    m_httpStream->setUrl(url);
+}
+    
+HTTP_Range_Source::~HTTP_Range_Source()
+{
+    m_httpStream->m_delegate = 0;
+    m_httpStream->close();
+    delete m_httpStream, m_httpStream = 0;
+    
+    CFRelease(m_runLoop), m_runLoop = 0;
+}
+    
+void HTTP_Range_Source::destroy()
+{
+    cancel();
+    
+    /* Blocks already posted to the run loop still refer to us, so go after them */
+    HTTP_Range_Source *THIS = this;
+    performOnStreamThread(^{
+        delete THIS;
+    });
+}
+    
+int HTTP_Range_Source::ReadRange(long long nOffset, void *pBuffer, unsigned int nBytes, unsigned int *pBytesRead)
+{
+    // Only ever on the decoding thread: the bytes come in on the run loop
+    ASSERT(CFRunLoopGetCurrent() != m_runLoop);
+    
+    return (m_source.read((uint64_t)nOffset, pBuffer, nBytes, pBytesRead) ? ERROR_SUCCESS : ERROR_IO_READ);
+}
+    
+long long HTTP_Range_Source::GetTotalBytes()
+{
+    ASSERT(CFRunLoopGetCurrent() != m_runLoop);
+    
+    return m_source.totalBytes();
+}
+    
+size_t HTTP_Range_Source::contentLength()
+{
+    return m_source.contentLength();
+}
+    
+void HTTP_Range_Source::cancel()
+{
+    m_source.cancel();
+}
+    
+void HTTP_Range_Source::resume()
+{
+    m_source.resume();
+}
+    
+/* Range_Transport; called with the source locked, so both only queue the work */
+    
+void HTTP_Range_Source::openRequest(unsigned generation, uint64_t offset, int64_t totalBytes)
+{
+    performOnStreamThread(^{
+        m_httpStream->close();
+        
+        if (!m_source.requestStarting(generation)) {
+            return;
+        }
+        
+        bool success;
+        
+        if (offset > 0) {
+            Input_Stream_Position position;
+            position.start = offset;
+            position.end = (totalBytes > 0 ? totalBytes - 1 : 0);
+            
+            success = m_httpStream->open(position);
+        } else {
+            success = m_httpStream->open();
+        }
+        
+        if (!success) {
+            m_source.responseFailed();
+        }
+    });
+}
+    
+void HTTP_Range_Source::resumeRequest(unsigned generation)
+{
+    performOnStreamThread(^{
+        if (m_source.isCurrent(generation)) {
+            m_httpStream->setScheduledInRunLoop(true);
+        }
+    });
+}
+    
+/* Input_Stream_Delegate; these are called on the run loop thread */
+    
+void HTTP_Range_Source::streamIsReadyRead(bool bUnsupportCodec, AudioStreamBasicDescription* dstFormat)
+{
+    m_source.responseStarted(m_httpStream->contentLength());
+}
+    
+void HTTP_Range_Source::streamHasBytesAvailable(UInt8 *data, UInt32 numBytes)
+{
+    if (m_source.dataAvailable(data, numBytes)) {
+        // HTTP_Stream holds on to the rest until it's scheduled again
+        m_httpStream->setScheduledInRunLoop(false);
+    }
+}
+    
+void HTTP_Range_Source::streamEndEncountered()
+{
+    m_source.responseEnded();
+}
+    
+void HTTP_Range_Source::streamErrorOccurred(CFStringRef errorDesc)
+{
+    m_source.responseFailed();
+}
+    
+void HTTP_Range_Source::streamMetaDataAvailable(std::map<CFStringRef,CFStringRef> metaData)
+{
+    // The APE tag is read by the decoder
+}
+    
+void HTTP_Range_Source::streamMetaDataByteSizeAvailable(UInt32 sizeInBytes)
+{
+}
+    
+/* private */
+    
+void HTTP_Range_Source::performOnStreamThread(void (^block)())
+{
+    /*
+     * HTTP_Stream must only be touched on the run loop it's scheduled in.
+     * The block is always queued (never run inline), so this is safe to
+     * call with the source locked.
+     */
+    CFRunLoopPerformBlock(m_runLoop, kCFRunLoopCommonModes, block);
+    CFRunLoopWakeUp(m_runLoop);
+}
+    
+/* APEHTTP_Stream */
+    
+APEHTTP_Stream::APEHTTP_Stream() :
+    APEFile_Stream(),
+    m_rangeSource(0),
+    m_rangedIO(0)
+{
+}
+    
+APEHTTP_Stream::~APEHTTP_Stream()
+{
+    close();
+    
+    releaseSource();
+}
+    
+size_t APEHTTP_Stream::contentLength()
+{
+    return (m_rangeSource ? m_rangeSource->contentLength() : 0);
+}
+    
+void APEHTTP_Stream::close()
+{
+    if (m_rangeSource) {
+        // Fail the read the decoding thread may be waiting in, so close() can join it
+        m_rangeSource->cancel();
+    }
+    
+    APEFile_Stream::close();
+    
+    if (m_rangeSource) {
+        // The thread is gone; the next open() reads again
+        m_rangeSource->resume();
+    }
+}
+    
+void APEHTTP_Stream::setUrl(CFURLRef url)
+{
+    releaseSource();
+    
+    APEFile_Stream::setUrl(url);
+    
+    if (url) {
+        // Created here on the run loop, whose thread the HTTP callbacks come in on
+        m_rangeSource = new HTTP_Range_Source(url);
+        
+        // Blocks outlive the decompressor, so a seek doesn't download the header and seek table again
+        m_rangedIO = new APE_MONKEY::CRangedIO(m_rangeSource, FALSE, 65536, 16);
+    }
+}
+    
+bool APEHTTP_Stream::canHandleUrl(CFURLRef url)
+{
+    if (!url || !HTTP_Stream::canHandleUrl(url)) {
+        return false;
+    }
+    
+    bool apeFile = false;
+    CFStringRef path = CFURLCopyPath(url);
+    
+    if (path) {
+        const CFStringCompareFlags flags = kCFCompareCaseInsensitive | kCFCompareBackwards | kCFCompareAnchored;
+        
+        apeFile = (CFStringFind(path, CFSTR(".ape"), flags).location != kCFNotFound ||
+                   CFStringFind(path, CFSTR(".mac"), flags).location != kCFNotFound ||
+                   CFStringFind(path, CFSTR(".41000"), flags).location != kCFNotFound);
+        
+        CFRelease(path);
+    }
+    
+    return apeFile;
+}
+    
+/* protected */
+    
+IAPEDecompress *APEHTTP_Stream::createDecompress(int *pErrorCode)
+{
+    if (!m_rangedIO) {
+        *pErrorCode = ERROR_INVALID_INPUT_FILE;
+        return NULL;
+    }
+    
+    // On the decoding thread: the header and seek table are read over the network here
+    return CreateIAPEDecompressEx(m_rangedIO, pErrorCode);
+}
+    
+/* private */
+    
+void APEHTTP_Stream::releaseSource()
+{
+    if (m_rangedIO) {
+        delete m_rangedIO, m_rangedIO = 0;
+    }
+    
+    if (m_rangeSource) {
+        m_rangeSource->destroy();
+        m_rangeSource = 0;
+    }
+}
+
+} // namespace astreamer
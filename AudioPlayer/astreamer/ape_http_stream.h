@@ -0,0 +1,104 @@
+/*
+ * This file is part of the FreeStreamer project,
+ * (C)Copyright 2011-2015 Matias Muhonen <mmu@iki.fi>
+ * See the file ''LICENSE'' for using the code.
+ *
+ * https://github.com/muhku/FreeStreamer
+ */
+
+#ifndef ASTREAMER_APE_HTTP_STREAM_H
+#define ASTREAMER_APE_HTTP_STREAM_H
+
+#import "file_stream.h"
+#import "http_stream.h"
+#import "range_source.h"
+#import "RangedIO.h"
+
+namespace astreamer {
+
+/*
+ * Serves byte ranges of a remote file to the APE decoder: a Range_Source
+ * whose requests are HTTP_Streams with a Range header. The HTTP_Stream lives
+ * on the run loop the source was created on, where its callbacks come in, so
+ * ReadRange() must only be called on another thread (the decoding thread).
+ */
+class HTTP_Range_Source : public APE_MONKEY::IRangeSource, public Input_Stream_Delegate, public Range_Transport {
+private:
+    
+    HTTP_Range_Source(const HTTP_Range_Source&);
+    HTTP_Range_Source& operator=(const HTTP_Range_Source&);
+    
+    HTTP_Stream *m_httpStream;
+    CFRunLoopRef m_runLoop;
+    
+    Range_Source m_source;
+    
+    void performOnStreamThread(void (^block)());
+    
+public:
+    HTTP_Range_Source(CFURLRef url);
+    virtual ~HTTP_Range_Source();
+    
+    /* Cancels reads and deletes the source on its run loop (use instead of delete) */
+    void destroy();
+    
+    /* APE_MONKEY::IRangeSource */
+    int ReadRange(long long nOffset, void *pBuffer, unsigned int nBytes, unsigned int *pBytesRead);
+    long long GetTotalBytes();
+    
+    /* Length of the file if the server has told us, 0 otherwise (doesn't block) */
+    size_t contentLength();
+    
+    /* Fails blocked and future reads until resume(), so a decoder stuck on the network can be closed */
+    void cancel();
+    void resume();
+    
+    /* Range_Transport */
+    void openRequest(unsigned generation, uint64_t offset, int64_t totalBytes);
+    void resumeRequest(unsigned generation);
+    
+    /* Input_Stream_Delegate */
+    void streamIsReadyRead(bool bUnsupportCodec=false, AudioStreamBasicDescription* dstFormat=NULL);
+    void streamHasBytesAvailable(UInt8 *data, UInt32 numBytes);
+    void streamEndEncountered();
+    void streamErrorOccurred(CFStringRef errorDesc);
+    void streamMetaDataAvailable(std::map<CFStringRef,CFStringRef> metaData);
+    void streamMetaDataByteSizeAvailable(UInt32 sizeInBytes);
+};
+    
+/*
+ * Plays a remote APE file without downloading it first: the header, seek
+ * table and tag are fetched up front, the frames on demand, and a seek
+ * jumps straight to the frame's APE_INFO_SEEK_BYTE offset. Downloaded blocks
+ * are kept across seeks, so reopening doesn't fetch the header again.
+ */
+class APEHTTP_Stream : public APEFile_Stream {
+private:
+    
+    APEHTTP_Stream(const APEHTTP_Stream&);
+    APEHTTP_Stream& operator=(const APEHTTP_Stream&);
+    
+    HTTP_Range_Source *m_rangeSource;
+    APE_MONKEY::CRangedIO *m_rangedIO;
+    
+    void releaseSource();
+    
+protected:
+    APE_MONKEY::IAPEDecompress *createDecompress(int *pErrorCode);
+    
+public:
+    APEHTTP_Stream();
+    virtual ~APEHTTP_Stream();
+    
+    size_t contentLength();
+    
+    void close();
+    
+    void setUrl(CFURLRef url);
+    
+    static bool canHandleUrl(CFURLRef url);
+};
+
+} // namespace astreamer
+
+#endif // ASTREAMER_APE_HTTP_STREAM_H
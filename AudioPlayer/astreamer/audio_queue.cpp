@@ -305,7 +305,7 @@ void Audio_Queue::handleAudioPackets(UInt32 inNumberBytes, UInt32 inNumberPacket
     for (; i < inNumberPackets; i++) {
         /* Allocate the packet */
         UInt32 size = inPacketDescriptions[i].mDataByteSize;
-        queued_packet_t *packet = (queued_packet_t *)malloc(sizeof(queued_packet_t) + size);
+        queued_packet_t *packet = (queued_packet_t *)m_packetPool.allocate(sizeof(queued_packet_t) + size);
         
         /* Prepare the packet */
         packet->next = NULL;
@@ -413,10 +413,11 @@ void Audio_Queue::cleanup()
     queued_packet_t *cur = m_queuedHead;
     while (cur) {
         queued_packet_t *tmp = cur->next;
-        free(cur);
+        m_packetPool.release(cur);
         cur = tmp;
     }
     m_queuedHead = m_queuedTail = 0;
+    m_packetPool.trim();
     
     m_waitingOnBuffer = false;
     m_lastError = noErr;
@@ -515,7 +516,7 @@ void Audio_Queue::enqueueCachedData()
            break; 
         }
         queued_packet_t *next = cur->next;
-        free(cur);
+        m_packetPool.release(cur);
         cur = next;
     }
     m_queuedHead = cur;
@@ -15,6 +15,8 @@
 
 #include <AudioToolbox/AudioToolbox.h> /* AudioFileStreamID */
 
+#include "packet_pool.h"
+
 namespace astreamer {
     
 class Audio_Queue_Delegate;
@@ -77,6 +79,8 @@ private:
     struct queued_packet *m_queuedHead;
     struct queued_packet *m_queuedTail;
     
+    Packet_Pool m_packetPool;                                        // storage for the queued packets
+    
 public:
     OSStatus m_lastError;
     AudioStreamBasicDescription m_streamDesc;
@@ -11,6 +11,7 @@
 #include "stream_configuration.h"
 #include "http_stream.h"
 #include "file_stream.h"
+#include "ape_http_stream.h"
 #include "caching_stream.h"
 
 #include <CommonCrypto/CommonDigest.h>
@@ -268,12 +269,17 @@ void Audio_Stream::close(bool closeParser)
     queued_packet_t *cur = m_queuedHead;
     while (cur) {
         queued_packet_t *tmp = cur->next;
-        free(cur);
+        m_packetPool.release(cur);
         cur = tmp;
     }
     m_queuedHead = m_queuedTail = 0, m_playPacket = 0;
     m_cachedDataSize = 0;
     
+    Packet_Pool::Statistics poolStatistics = m_packetPool.statistics();
+    AS_TRACE("%s: packet pool hits %llu, misses %llu, bytes retained %lu\n", __PRETTY_FUNCTION__,
+             poolStatistics.hits, poolStatistics.misses, (unsigned long)poolStatistics.bytesRetained);
+    m_packetPool.trim();
+    
     AS_TRACE("%s: leave\n", __PRETTY_FUNCTION__);
 }
     
@@ -462,7 +468,13 @@ void Audio_Stream::seekToOffset(float offset)
         m_converterRunOutOfData = false;
         m_discontinuity = true;
 
-        bool success = m_inputStream->open(position);
+        bool success;
+        if (m_localUnsupportCodecRunning) {
+            // The APE decoder seeks to the exact block; the byte offset would only be a guess
+            success = ((APEFile_Stream*)m_inputStream)->openAtTime(duration * offset);
+        } else {
+            success = m_inputStream->open(position);
+        }
         
         if (success) {
             setSeekOffset(offset);
@@ -545,7 +557,11 @@ void Audio_Stream::setUrl(CFURLRef url)
         delete m_inputStream, m_inputStream = 0;
     }
     
-    if (HTTP_Stream::canHandleUrl(url)) {
+    if (APEHTTP_Stream::canHandleUrl(url)) {
+        // Remote APE is decoded here; it fetches what it needs with range requests
+        m_inputStream = new APEHTTP_Stream();
+        m_inputStream->m_delegate = this;
+    } else if (HTTP_Stream::canHandleUrl(url)) {
         Stream_Configuration *config = Stream_Configuration::configuration();
         
         if (config->cacheEnabled) {
@@ -1578,7 +1594,7 @@ void Audio_Stream::cleanupCachedData()
         
         m_cachedDataSize -= cur->desc.mDataByteSize;
         
-        free(cur);
+        m_packetPool.release(cur);
         cur = tmp;
         if (cur == m_playPacket){
             keepCleaning = false;
@@ -1771,7 +1787,7 @@ void Audio_Stream::streamDataCallback(void *inClientData, UInt32 inNumberBytes,
     for (int i = 0; i < inNumberPackets; i++) {
         /* Allocate the packet */
         UInt32 size = inPacketDescriptions[i].mDataByteSize;
-        queued_packet_t *packet = (queued_packet_t *)malloc(sizeof(queued_packet_t) + size);
+        queued_packet_t *packet = (queued_packet_t *)THIS->m_packetPool.allocate(sizeof(queued_packet_t) + size);
         
         packet->identifier = THIS->m_packetIdentifier;
         
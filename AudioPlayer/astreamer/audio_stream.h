@@ -11,6 +11,7 @@
 
 #import "input_stream.h"
 #include "audio_queue.h"
+#include "packet_pool.h"
 
 #include <AudioToolbox/AudioToolbox.h>
 #include <list>
@@ -176,6 +177,8 @@ private:
     queued_packet_t *m_queuedTail;
     queued_packet_t *m_playPacket;
     
+    Packet_Pool m_packetPool;
+    
     std::list <queued_packet_t*> m_processedPackets;
     
     size_t m_cachedDataSize;
@@ -12,6 +12,11 @@
 #include "player_debug.h"
 #include "URLDecoder.h"
 
+#include <algorithm>
+
+/* m_seekBlock for the first seek, to where open() was asked to start */
+static const size_t kOpenBlock = (size_t)-1;
+
 namespace astreamer {
     
 File_Stream::File_Stream() :
@@ -400,11 +405,25 @@ void File_Stream::readCallBack(CFReadStreamRef stream, CFStreamEventType eventTy
     
 ////////APEStream  begin//////////
     APEFile_Stream::APEFile_Stream() :
-    m_url(0),
+    m_contentType(0),
+    m_ring(0),
+    m_decodeThreadRunning(false),
+    m_decodeWakeup(0),
+    m_runLoop(0),
+    m_drainSource(0),
+    m_openState(kOpening),
+    m_openReported(false),
+    m_openSeconds(-1),
+    m_epoch(0),
+    m_seekBlock(0),
+    m_quit(false),
     m_scheduledInRunLoop(false),
-    m_fileReadBuffer(0),
-    m_pDecompress(NULL),
-    m_contentType(0)
+    m_durationInSeconds(0),
+    m_sampleRate(0),
+    m_totalBlocks(0),
+    m_session(0),
+    m_url(0),
+    m_pDecompress(NULL)
     {
     }
     
@@ -412,15 +431,6 @@ void File_Stream::readCallBack(CFReadStreamRef stream, CFStreamEventType eventTy
     {
         close();
         
-        if (m_fileReadBuffer) {
-            delete [] m_fileReadBuffer, m_fileReadBuffer = 0;
-        }
-        
-        if(m_pDecompress)
-        {
-            delete m_pDecompress;
-            m_pDecompress = NULL;
-        }
         if (m_url) {
             CFRelease(m_url), m_url = 0;
         }
@@ -428,9 +438,6 @@ void File_Stream::readCallBack(CFReadStreamRef stream, CFStreamEventType eventTy
         if (m_contentType) {
             CFRelease(m_contentType);
         }
-        
-        pthread_mutex_destroy(&mutex);
-        pthread_cond_destroy(&cond);
     }
     
     Input_Stream_Position APEFile_Stream::position()
@@ -542,194 +549,139 @@ void File_Stream::readCallBack(CFReadStreamRef stream, CFStreamEventType eventTy
     
     bool APEFile_Stream::open(const Input_Stream_Position& position)
     {
-        bool success = false;
-        CFStreamClientContext CTX = { 0, this, NULL, NULL, NULL };
+        return openDecompress(position, -1);
+    }
+    
+    bool APEFile_Stream::openAtTime(double seconds)
+    {
+        Input_Stream_Position position;
+        position.start = 0;
+        position.end = 0;
+        
+        return openDecompress(position, std::max(seconds, 0.0));
+    }
+    
+    bool APEFile_Stream::openDecompress(const Input_Stream_Position& position, double seconds)
+    {
+        /* Already open */
+        if (m_decodeThreadRunning) {
+            return false;
+        }
         
         if (!m_url) {
-            goto out;
+            ASSERT(false);
+            return false;
         }
         
         /* Reset state */
         m_position = position;
-        success = true;
-        
-    out:
+        m_openSeconds = seconds;
         
-        if (success) {
-            if(m_url!=NULL)
-            {
-                //CFStringRef CFURLGetString ( CFURLRef anURL );
-                //CFStringRef strUrl = CFURLGetString(url);
-                CFStringRef strCompleteUrl = CFURLGetString(m_url);
-                CFRange range = CFRangeMake(7, CFStringGetLength(strCompleteUrl)-7);
-                CFStringRef strUrl = CFStringCreateWithSubstring(NULL, strCompleteUrl, range);
-                const char* cUrl = CFStringGetCStringPtr(strUrl, kCFStringEncodingUTF8);
-                URLDecoder urlDec;
-                std::string decodeURL = urlDec.decode(string(cUrl));
-                CSmartPtr<str_utf16> fileNameUtf16 = APE_MONKEY::CAPECharacterHelper::GetUTF16FromANSI(decodeURL.c_str());
-                int error = 0;
-                m_pDecompress = CreateIAPEDecompress(fileNameUtf16, &error);
-                if(m_pDecompress!=NULL)
-                {
-                    m_totalBlocks = m_pDecompress->GetInfo(APE_INFO_TOTAL_BLOCKS);
-                    m_sampleRate = m_pDecompress->GetInfo(APE_INFO_SAMPLE_RATE);
-                    m_durationInSeconds = m_totalBlocks/m_sampleRate;
-                    int chanel = m_pDecompress->GetInfo(APE_INFO_CHANNELS);
-                    int bps = m_pDecompress->GetInfo(APE_INFO_BITS_PER_SAMPLE);
-                    
-                    ASSERT(position.start<=position.end);
-                    size_t nBlockOffset;
-                    if(position.start==position.end && position.start==0)
-                    {
-                        nBlockOffset = 0;
-                    }
-                    else
-                    {
-                        nBlockOffset = ((position.start*1.0)/position.end) * m_totalBlocks;
-                    }
-                    m_pDecompress->Seek(nBlockOffset);
-                    FillOutASBDForLPCM(m_dstFormat, m_sampleRate, chanel, bps, bps, false, false);
-                }
-                else
-                {
-                    if(m_delegate)
-                    {
-                        m_delegate->streamErrorOccurred(CFSTR("fail to open APE file"));
-                    }
-                }
-            }
+        if (m_delegate) {
+            /*
+             * The decoding thread opens the file and starts with a seek to where we were asked
+             * to open; the drain tells the delegate whether that worked.
+             */
+            __atomic_store_n(&m_seekBlock, kOpenBlock, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&m_epoch, 1, __ATOMIC_RELEASE);
             
-            if (m_delegate) {
-                m_delegate->streamIsReadyRead(true, &m_dstFormat);
-                
-                //创建线程
-                m_queue = dispatch_queue_create("com.wenyu.kwplayermac", DISPATCH_QUEUE_SERIAL);
-                pthread_mutexattr_t attr;
-                pthread_mutexattr_init(&attr);
-                pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
-                pthread_mutex_init(&mutex, &attr);
-                
-                pthread_cond_init(&cond, NULL);
-                dispatch_async(m_queue, ^{
-                    const int BLOCK_SIZE = 7168;
-                    int nBlockDecoded = 0;
-                    int bufferSize = Stream_Configuration::configuration()->bufferSize;
-                    UInt8* pBuffer = new UInt8[bufferSize];
-                    memset(pBuffer, 0, bufferSize);
-                    int result  = ERROR_SUCCESS;
-                    if(m_pDecompress!=NULL)
-                    {
-                        result = m_pDecompress->GetData((char*)pBuffer, BLOCK_SIZE, &nBlockDecoded);
-                    }
-                    while ((nBlockDecoded > 0 && result == ERROR_SUCCESS)) {
-                        FS_TRACE("ZQ function %s, lock before\n", __PRETTY_FUNCTION__);
-                        pthread_mutex_lock(&mutex);
-                        FS_TRACE("ZQ function %s, lock after\n", __PRETTY_FUNCTION__);
-                        if(!m_scheduledInRunLoop)
-                        {
-                            FS_TRACE("ZQ function %s, wait before\n", __PRETTY_FUNCTION__);
-                            pthread_cond_wait(&cond, &mutex);
-                            FS_TRACE("ZQ function %s, wait after\n", __PRETTY_FUNCTION__);
-                        }
-                        if(m_pDecompress==NULL)
-                        {
-                            FS_TRACE("ZQ function %s, (m_pDecompress==NULL) unlock before\n", __PRETTY_FUNCTION__);
-                            pthread_mutex_unlock(&mutex);
-                            FS_TRACE("ZQ function %s, (m_pDecompress==NULL) unlock after\n", __PRETTY_FUNCTION__);
-                            break;
-                        }
-                        FS_TRACE("m_pDecompress=0x%p, if m_scheduledInRunLoop=true\n", m_pDecompress);
-                        UInt32 actualBufferSize = nBlockDecoded * m_pDecompress->GetInfo(APE_MONKEY::APE_INFO_BYTES_PER_SAMPLE) * m_pDecompress->GetInfo(APE_MONKEY::APE_INFO_CHANNELS);
-                        
-                        if(m_delegate!=NULL)
-                        {
-                            FS_TRACE("ZQ function %s, streamHasBytesAvailable before\n", __PRETTY_FUNCTION__);
-                            m_delegate->streamHasBytesAvailable(pBuffer, (UInt32)actualBufferSize);
-                            FS_TRACE("ZQ function %s, streamHasBytesAvailable after\n", __PRETTY_FUNCTION__);
-                        }
-                        memset(pBuffer, 0, bufferSize);
-                        result = m_pDecompress->GetData((char*)pBuffer, BLOCK_SIZE, &nBlockDecoded);
-                        FS_TRACE("ZQ function %s, unlock before\n", __PRETTY_FUNCTION__);
-                        pthread_mutex_unlock(&mutex);
-                        FS_TRACE("ZQ function %s, unlock after\n", __PRETTY_FUNCTION__);
-                    }
-                    if(result!=ERROR_SUCCESS)
-                    {
-                        CFStringRef errorDesc = CFSTR("fail to decompress file");
-                        if(m_delegate!=NULL)
-                        {
-                            FS_TRACE("ZQ function %s, streamErrorOccurred before\n", __PRETTY_FUNCTION__);
-                            m_delegate->streamErrorOccurred(errorDesc);
-                            FS_TRACE("ZQ function %s, streamErrorOccurred after\n", __PRETTY_FUNCTION__);
-                        }
-                    }
-                    else
-                    {
-                        if(m_delegate!=NULL)
-                        {
-                            FS_TRACE("ZQ function %s, streamEndEncountered before\n", __PRETTY_FUNCTION__);
-                            m_delegate->streamEndEncountered();
-                            FS_TRACE("ZQ function %s, streamEndEncountered after\n", __PRETTY_FUNCTION__);
-                        }
-                    }
-                    delete[] pBuffer;
-                    pBuffer = NULL;
-                });//end dispatch_async
-                setScheduledInRunLoop(true);
+            if (!startDecoding()) {
+                m_delegate->streamErrorOccurred(CFSTR("fail to start decoding"));
+                return true;
             }
+            setScheduledInRunLoop(true);
+        }
+        return true;
+    }
+    
+    int APEFile_Stream::prepareDecompress(size_t *pBlockOffset)
+    {
+        int error = ERROR_UNDEFINED;
+        m_pDecompress = createDecompress(&error);
+        if (!m_pDecompress) {
+            return (error != ERROR_SUCCESS ? error : ERROR_UNDEFINED);
+        }
+        
+        m_totalBlocks = m_pDecompress->GetInfo(APE_INFO_TOTAL_BLOCKS);
+        m_sampleRate = m_pDecompress->GetInfo(APE_INFO_SAMPLE_RATE);
+        m_durationInSeconds = m_totalBlocks/m_sampleRate;
+        int chanel = m_pDecompress->GetInfo(APE_INFO_CHANNELS);
+        int bps = m_pDecompress->GetInfo(APE_INFO_BITS_PER_SAMPLE);
+        
+        /*
+         * Keep decoder checkpoints inside the frames as we play, so seeking back doesn't decode
+         * from the start of a frame (up to 27 seconds of audio at Insane). The higher levels
+         * carry more state per checkpoint, so they get fewer of them: a few MB for a long track.
+         */
+        const int compressionLevel = (int)m_pDecompress->GetInfo(APE_INFO_COMPRESSION_LEVEL);
+        m_pDecompress->CreateSeekIndex(compressionLevel >= COMPRESSION_LEVEL_INSANE ? 65536 :
+                                       compressionLevel >= COMPRESSION_LEVEL_EXTRA_HIGH ? 16384 : 8192);
+        
+        /*
+         * Don't hold each frame back until its CRC is checked: blocks are played as they're
+         * decoded and the CRCs are checked on the decoder's verifier thread (see Frame_Error_Trace).
+         */
+        m_pDecompress->SetVerifyMode(APE_VERIFY_ASYNC, &m_frameErrors);
+        
+        /*
+         * Have the decoder hand out float samples (converted with SIMD as each buffer is filled),
+         * which the audio queue plays as they are whatever the file's bit depth; if it can't,
+         * the file's own PCM is played.
+         */
+        const bool floatOutput = (m_pDecompress->SetOutputFormat(APE_OUTPUT_FLOAT32) == ERROR_SUCCESS);
+        
+        ASSERT(m_position.start<=m_position.end);
+        size_t nBlockOffset;
+        if (m_openSeconds >= 0)
+        {
+            nBlockOffset = std::min((size_t)llround(m_openSeconds * m_sampleRate), (size_t)m_totalBlocks);
+        }
+        else if(m_position.start==m_position.end && m_position.start==0)
+        {
+            nBlockOffset = 0;
         }
         else
         {
-            ASSERT(false);
+            nBlockOffset = ((m_position.start*1.0)/m_position.end) * m_totalBlocks;
         }
-        return success;
+        *pBlockOffset = nBlockOffset;
+        
+        if (floatOutput) {
+            FillOutASBDForLPCM(m_dstFormat, m_sampleRate, chanel, 32, 32, true, false);
+        } else {
+            FillOutASBDForLPCM(m_dstFormat, m_sampleRate, chanel, bps, bps, false, false);
+        }
+        
+        Stream_Configuration *config = Stream_Configuration::configuration();
+        
+        const size_t blockAlign = m_pDecompress->GetInfo(APE_DECOMPRESS_OUTPUT_BLOCK_ALIGN);
+        const size_t bufferSize = std::max((size_t)config->bufferSize / blockAlign, (size_t)1) * blockAlign;
+        
+        m_ring = new PCM_Ring(std::max(config->decodeAheadBufferCount, 2u), bufferSize);
+        return ERROR_SUCCESS;
     }
     
     void APEFile_Stream::close()
     {
         FS_TRACE("enter %s\n", __PRETTY_FUNCTION__);
-        int nRet = 0;
-        FS_TRACE("ZQ function %s, trylock after nRet =%d\n", __PRETTY_FUNCTION__, nRet);
-        FS_TRACE("ZQ function %s, lock before\n", __PRETTY_FUNCTION__);
-        if(IsTryLockSucc())
+        
+        m_session++;
+        m_scheduledInRunLoop = false;
+        
+        stopDecoding();
+        
+        if(m_pDecompress!=NULL)
         {
-            FS_TRACE("ZQ function %s, lock after\n", __PRETTY_FUNCTION__);
-            m_scheduledInRunLoop = false;
-            
-            FS_TRACE("nRet=%d", nRet);
-            if(m_pDecompress!=NULL)
-            {
-                delete m_pDecompress;
-                m_pDecompress = NULL;
-            }
-            
-            FS_TRACE("ZQ function %s, unlock before\n", __PRETTY_FUNCTION__);
-            pthread_mutex_unlock(&mutex);
-            FS_TRACE("ZQ function %s, unlock after\n", __PRETTY_FUNCTION__);
+            delete m_pDecompress;
+            m_pDecompress = NULL;
         }
         FS_TRACE("leave %s\n", __PRETTY_FUNCTION__);
     }
     
-    BOOL APEFile_Stream::IsTryLockSucc()
-    {
-        static int maxTryMutexTimes = 5;
-        int nCurTimes = 0;
-        int nRet = pthread_mutex_trylock(&mutex);
-        while (nRet!=0 || nCurTimes>=maxTryMutexTimes) {
-            nRet =  pthread_mutex_trylock(&mutex);
-            if(nRet==0)
-            {
-                break;
-            }
-            nCurTimes++;
-        }
-        return (nCurTimes<maxTryMutexTimes) ? TRUE : FALSE;
-    }
-    
     void APEFile_Stream::setScheduledInRunLoop(bool scheduledInRunLoop)
     {
         /* The stream has not been opened, or it has been already closed */
-        if (!m_pDecompress) {
+        if (!m_drainSource) {
             return;
         }
         
@@ -737,23 +689,14 @@ void File_Stream::readCallBack(CFReadStreamRef stream, CFStreamEventType eventTy
         if (m_scheduledInRunLoop == scheduledInRunLoop) {
             return;
         }
-        FS_TRACE("enter %s\n", __PRETTY_FUNCTION__);
         
-        FS_TRACE("ZQ function %s, trylock before\n", __PRETTY_FUNCTION__);
-        if(IsTryLockSucc())
-        {
-            FS_TRACE("ZQ function %s, trylock after\n", __PRETTY_FUNCTION__);
-            
-            m_scheduledInRunLoop = scheduledInRunLoop;
-            FS_TRACE("ZQ function %s, signal before\n", __PRETTY_FUNCTION__);
-            pthread_cond_signal(&cond);
-            FS_TRACE("ZQ function %s, signal after\n", __PRETTY_FUNCTION__);
-            
-            FS_TRACE("ZQ function %s, unlock before\n", __PRETTY_FUNCTION__);
-            pthread_mutex_unlock(&mutex);
-            FS_TRACE("ZQ function %s, unlock after\n", __PRETTY_FUNCTION__);
+        m_scheduledInRunLoop = scheduledInRunLoop;
+        
+        if (scheduledInRunLoop) {
+            /* Hand over whatever was decoded while we were paused */
+            CFRunLoopSourceSignal(m_drainSource);
+            CFRunLoopWakeUp(m_runLoop);
         }
-        FS_TRACE("leave %s\n", __PRETTY_FUNCTION__);
     }
     
     size_t APEFile_Stream::durationInSeconds()
@@ -766,26 +709,217 @@ void File_Stream::readCallBack(CFReadStreamRef stream, CFStreamEventType eventTy
         return m_totalBlocks;
     }
     
+    void APEFile_Stream::Frame_Error_Trace::FrameError(int nFrame)
+    {
+        /* On the verifier's thread; the blocks have already been played */
+        FS_TRACE("APE frame %i failed its CRC check\n", nFrame);
+    }
+    
     size_t APEFile_Stream::sampleRate()
     {
         return m_sampleRate;
     }
-    
+
+    IAPEDecompress *APEFile_Stream::createDecompress(int *pErrorCode)
+    {
+        CFStringRef strCompleteUrl = CFURLGetString(m_url);
+        CFRange range = CFRangeMake(7, CFStringGetLength(strCompleteUrl)-7);
+        CFStringRef strUrl = CFStringCreateWithSubstring(NULL, strCompleteUrl, range);
+        const char* cUrl = CFStringGetCStringPtr(strUrl, kCFStringEncodingUTF8);
+        URLDecoder urlDec;
+        std::string decodeURL = urlDec.decode(string(cUrl));
+        CSmartPtr<str_utf16> fileNameUtf16 = APE_MONKEY::CAPECharacterHelper::GetUTF16FromANSI(decodeURL.c_str());
+        return CreateIAPEDecompress(fileNameUtf16, pErrorCode);
+    }
+
     int APEFile_Stream::seek(size_t nBlockOffset)
     {
-        if(IsTryLockSucc())
-        {
-            if(m_pDecompress==NULL)
-            {
-                pthread_mutex_unlock(&mutex);
-                return 0;
-            }
-            int nRet = m_pDecompress->Seek(nBlockOffset);
-            pthread_mutex_unlock(&mutex);
-            return nRet;
+        if (!m_decodeThreadRunning) {
+            return 0;
         }
+        
+        /* Published by the epoch bump; whatever is in the ring now is stale */
+        __atomic_store_n(&m_seekBlock, nBlockOffset, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&m_epoch, 1, __ATOMIC_RELEASE);
+        dispatch_semaphore_signal(m_decodeWakeup);
         return 0;
     }
+    
+    bool APEFile_Stream::startDecoding()
+    {
+        m_decodeWakeup = dispatch_semaphore_create(0);
+        m_quit = false;  /* the thread isn't running yet */
+        m_openState = kOpening;
+        m_openReported = false;
+        
+        CFRunLoopSourceContext ctx = {0, this, NULL, NULL, NULL, NULL, NULL, NULL, NULL, drainCallBack};
+        m_runLoop = (CFRunLoopRef)CFRetain(CFRunLoopGetCurrent());
+        m_drainSource = CFRunLoopSourceCreate(kCFAllocatorDefault, 0, &ctx);
+        CFRunLoopAddSource(m_runLoop, m_drainSource, kCFRunLoopCommonModes);
+        
+        m_decodeThreadRunning = (pthread_create(&m_decodeThread, NULL, decodeThread, this) == 0);
+        if (!m_decodeThreadRunning) {
+            stopDecoding();
+        }
+        return m_decodeThreadRunning;
+    }
+    
+    void APEFile_Stream::stopDecoding()
+    {
+        if (m_decodeThreadRunning) {
+            __atomic_store_n(&m_quit, true, __ATOMIC_RELEASE);
+            dispatch_semaphore_signal(m_decodeWakeup);
+            pthread_join(m_decodeThread, NULL);
+            m_decodeThreadRunning = false;
+        }
+        
+        if (m_drainSource) {
+            CFRunLoopSourceInvalidate(m_drainSource);
+            CFRelease(m_drainSource), m_drainSource = 0;
+        }
+        if (m_runLoop) {
+            CFRelease(m_runLoop), m_runLoop = 0;
+        }
+        if (m_decodeWakeup) {
+            dispatch_release(m_decodeWakeup), m_decodeWakeup = 0;
+        }
+        delete m_ring, m_ring = 0;
+    }
+    
+    void *APEFile_Stream::decodeThread(void *info)
+    {
+        APEFile_Stream *THIS = static_cast<APEFile_Stream*>(info);
+        
+        THIS->decodeLoop();
+        return NULL;
+    }
+    
+    void APEFile_Stream::decodeLoop()
+    {
+        size_t openBlock = 0;
+        const int openResult = prepareDecompress(&openBlock);
+        
+        /* Everything prepareDecompress() filled in goes with the state */
+        __atomic_store_n(&m_openState, (openResult == ERROR_SUCCESS ? kOpened : kOpenFailed), __ATOMIC_RELEASE);
+        CFRunLoopSourceSignal(m_drainSource);
+        CFRunLoopWakeUp(m_runLoop);
+        
+        if (openResult != ERROR_SUCCESS) {
+            return;
+        }
+        
+        const int blockAlign = m_pDecompress->GetInfo(APE_DECOMPRESS_OUTPUT_BLOCK_ALIGN);
+        unsigned epoch = 0;
+        bool finished = false;
+        int seekResult = ERROR_SUCCESS;
+        
+        while (!__atomic_load_n(&m_quit, __ATOMIC_ACQUIRE)) {
+            const unsigned requestedEpoch = __atomic_load_n(&m_epoch, __ATOMIC_ACQUIRE);
+            if (requestedEpoch != epoch) {
+                /*
+                 * The block may already be from a later seek than this epoch; then the
+                 * epoch moves on again next time round and we seek to the same block.
+                 */
+                epoch = requestedEpoch;
+                const size_t seekBlock = __atomic_load_n(&m_seekBlock, __ATOMIC_RELAXED);
+                seekResult = m_pDecompress->Seek((int)(seekBlock == kOpenBlock ? openBlock : seekBlock));
+                finished = false;
+            }
+            
+            PCM_Ring::Buffer *buffer = (finished ? NULL : m_ring->writeBuffer());
+            if (!buffer) {
+                /* Ring full or stream done; wait for the output, a seek or close() */
+                dispatch_semaphore_wait(m_decodeWakeup, DISPATCH_TIME_FOREVER);
+                continue;
+            }
+            
+            /* A seek that failed ends the stream with its error instead of decoding from wherever we are */
+            int nBlocksDecoded = 0;
+            const int result = (seekResult != ERROR_SUCCESS ? seekResult :
+                                m_pDecompress->GetData((char*)buffer->data, (int)(buffer->capacity / blockAlign), &nBlocksDecoded));
+            
+            buffer->numBytes = (result == ERROR_SUCCESS ? nBlocksDecoded * blockAlign : 0);
+            buffer->epoch = epoch;
+            buffer->result = result;
+            buffer->endOfStream = finished = (result != ERROR_SUCCESS || nBlocksDecoded <= 0);
+            m_ring->commitWrite();
+            
+            CFRunLoopSourceSignal(m_drainSource);
+            CFRunLoopWakeUp(m_runLoop);
+        }
+    }
+    
+    void APEFile_Stream::drainCallBack(void *info)
+    {
+        APEFile_Stream *THIS = static_cast<APEFile_Stream*>(info);
+        
+        THIS->drain();
+    }
+    
+    void APEFile_Stream::drain()
+    {
+        const unsigned session = m_session;
+        
+        /* Whether the decoding thread could open the file goes out before any data */
+        const unsigned openState = __atomic_load_n(&m_openState, __ATOMIC_ACQUIRE);
+        if (openState != kOpened) {
+            if (openState == kOpenFailed && !m_openReported) {
+                m_openReported = true;
+                
+                if (m_delegate) {
+                    m_delegate->streamErrorOccurred(CFSTR("fail to open APE file"));
+                }
+            }
+            return;
+        }
+        
+        if (!m_openReported) {
+            m_openReported = true;
+            
+            if (m_delegate) {
+                m_delegate->streamIsReadyRead(true, &m_dstFormat);
+                
+                if (session != m_session) {
+                    /* The delegate closed us */
+                    return;
+                }
+            }
+        }
+        
+        while (m_scheduledInRunLoop) {
+            PCM_Ring::Buffer *buffer = m_ring->readBuffer();
+            if (!buffer) {
+                break;
+            }
+            
+            const bool current = (buffer->epoch == __atomic_load_n(&m_epoch, __ATOMIC_ACQUIRE));
+            const bool endOfStream = buffer->endOfStream;
+            const int result = buffer->result;
+            
+            if (current && buffer->numBytes > 0 && m_delegate) {
+                m_delegate->streamHasBytesAvailable(buffer->data, (UInt32)buffer->numBytes);
+                
+                if (session != m_session) {
+                    /* The delegate closed us; the ring is gone */
+                    return;
+                }
+            }
+            
+            m_ring->commitRead();
+            dispatch_semaphore_signal(m_decodeWakeup);
+            
+            if (current && endOfStream) {
+                if (m_delegate) {
+                    if (result != ERROR_SUCCESS) {
+                        m_delegate->streamErrorOccurred(CFSTR("fail to decompress file"));
+                    } else {
+                        m_delegate->streamEndEncountered();
+                    }
+                }
+                return;
+            }
+        }
+    }
 
     void APEFile_Stream::setUrl(CFURLRef url)
     {
@@ -11,6 +11,7 @@
 
 #import "input_stream.h"
 #import "id3_parser.h"
+#import "pcm_ring.h"
 #import "MACLib.h"
 #import <CoreAudio/CoreAudio.h>
 #import <dispatch/dispatch.h>
@@ -70,27 +71,76 @@ public:
         APEFile_Stream(const APEFile_Stream&);
         APEFile_Stream& operator=(const APEFile_Stream&);
         
-        CFURLRef m_url;
         Input_Stream_Position m_position;
         
-        UInt8 *m_fileReadBuffer;
-        
-        APE_MONKEY::IAPEDecompress *m_pDecompress;
         AudioStreamBasicDescription m_dstFormat;
         
         CFStringRef m_contentType;
         
-        static void readCallBack(CFReadStreamRef stream, CFStreamEventType eventType, void *clientCallBackInfo);
-    
-        pthread_mutex_t mutex;
-        pthread_cond_t cond;
-        dispatch_queue_t m_queue;
-        bool m_scheduledInRunLoop;
+        /*
+         * The decoding thread runs ahead of the output, filling m_ring; the
+         * drain source empties it on the run loop whenever we're scheduled.
+         * A seek only stores m_seekBlock and bumps m_epoch (both with __atomic
+         * builtins, the block first): the decoding thread seeks when it sees
+         * the new epoch, and buffers from older epochs are dropped unplayed.
+         *
+         * The decompressor is created on the decoding thread too, since it reads
+         * the header (over the network for APEHTTP_Stream). The thread fills in
+         * the format, the ring and the m_pDecompress fields and then publishes
+         * m_openState; the drain reports it to the delegate before any data.
+         */
+        enum {
+            kOpening,
+            kOpened,
+            kOpenFailed
+        };
+        
+        PCM_Ring *m_ring;
+        pthread_t m_decodeThread;
+        bool m_decodeThreadRunning;
+        dispatch_semaphore_t m_decodeWakeup;
+        CFRunLoopRef m_runLoop;
+        CFRunLoopSourceRef m_drainSource;
+        
+        unsigned m_openState;
+        bool m_openReported;
+        double m_openSeconds;
+        
+        unsigned m_epoch;
+        size_t m_seekBlock;
+        bool m_quit;                  /* set by stopDecoding() with __atomic release, read with acquire */
+        bool m_scheduledInRunLoop;    /* run loop thread only */
+        
         float m_durationInSeconds;//播放时长
         float m_sampleRate;
         float m_totalBlocks;
         
-        BOOL IsTryLockSucc();
+        /* Bumped by close(), so a drain that closed us (through the delegate) stops touching the ring */
+        unsigned m_session;
+        
+        /* Reports the frames that fail their (deferred) CRC check */
+        class Frame_Error_Trace : public APE_MONKEY::IAPEFrameErrorCallback {
+        public:
+            void FrameError(int nFrame);
+        };
+        Frame_Error_Trace m_frameErrors;
+        
+        bool openDecompress(const Input_Stream_Position& position, double seconds);
+        int prepareDecompress(size_t *pBlockOffset);
+        bool startDecoding();
+        void stopDecoding();
+        void decodeLoop();
+        void drain();
+        
+        static void *decodeThread(void *info);
+        static void drainCallBack(void *info);
+        
+    protected:
+        CFURLRef m_url;
+        APE_MONKEY::IAPEDecompress *m_pDecompress;
+        
+        /* Creates the decompressor for m_url; called on the decoding thread, so it may block */
+        virtual APE_MONKEY::IAPEDecompress *createDecompress(int *pErrorCode);
         
     public:
 
@@ -110,6 +160,8 @@ public:
         int seek(size_t nBlockOffset);
         bool open();
         bool open(const Input_Stream_Position& position);
+        /* Opens at the block closest to a time instead of at a byte offset */
+        bool openAtTime(double seconds);
         void close();
         
         void setScheduledInRunLoop(bool scheduledInRunLoop);
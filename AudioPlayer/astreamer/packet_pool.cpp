@@ -0,0 +1,207 @@
+/*
+ * This file is part of the FreeStreamer project,
+ * (C)Copyright 2011-2015 Matias Muhonen <mmu@iki.fi>
+ * See the file ''LICENSE'' for using the code.
+ *
+ * https://github.com/muhku/FreeStreamer
+ */
+
+#include "packet_pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+namespace astreamer {
+
+/* Sits in front of every chunk; padded to 16 bytes so the payload stays aligned */
+struct Packet_Pool::Chunk {
+    Chunk *next;            /* free list link */
+    uint32_t sizeClass;
+    uint32_t size;          /* whole chunk, header included */
+};
+
+struct Packet_Pool::Slab {
+    Slab *next;
+    void *memory;
+};
+
+static const size_t kHeaderBytes = 16;
+
+static inline void *payload(void *chunk)
+{
+    return (uint8_t *)chunk + kHeaderBytes;
+}
+
+Packet_Pool::Packet_Pool(size_t maxRetainedBytes) :
+    m_slabs(0),
+    m_maxRetainedBytes(maxRetainedBytes),
+    m_retainedLargeBytes(0),
+    m_slabBytes(0),
+    m_slabBytesInUse(0)
+{
+    memset(m_freeLists, 0, sizeof(m_freeLists));
+    memset(&m_statistics, 0, sizeof(m_statistics));
+}
+
+Packet_Pool::~Packet_Pool()
+{
+    trim();
+
+    /* Whatever is still handed out goes with the slabs */
+    while (m_slabs) {
+        Slab *next = m_slabs->next;
+        free(m_slabs->memory);
+        delete m_slabs;
+        m_slabs = next;
+    }
+}
+
+void *Packet_Pool::allocate(size_t size)
+{
+    const size_t chunkBytes = size + kHeaderBytes;
+
+    unsigned shift = kMinClassShift;
+    while (shift <= kMaxClassShift && ((size_t)1 << shift) < chunkBytes) {
+        shift++;
+    }
+
+    if (shift > kMaxClassShift) {
+        Chunk *chunk = (Chunk *)malloc(chunkBytes);
+        if (!chunk) {
+            return 0;
+        }
+        chunk->next = 0;
+        chunk->sizeClass = kOversizeClass;
+        chunk->size = (uint32_t)chunkBytes;
+
+        m_statistics.misses++;
+        m_statistics.bytesInUse += chunkBytes;
+        return payload(chunk);
+    }
+
+    const unsigned sizeClass = shift - kMinClassShift;
+
+    Chunk *chunk = m_freeLists[sizeClass];
+    if (chunk) {
+        m_freeLists[sizeClass] = chunk->next;
+        if (shift > kMaxSlabClassShift) {
+            m_retainedLargeBytes -= chunk->size;
+        }
+        m_statistics.hits++;
+    } else {
+        chunk = newChunk(sizeClass);
+        if (!chunk) {
+            return 0;
+        }
+        m_statistics.misses++;
+    }
+
+    if (shift <= kMaxSlabClassShift) {
+        m_slabBytesInUse += chunk->size;
+    }
+    m_statistics.bytesInUse += chunk->size;
+
+    chunk->next = 0;
+    return payload(chunk);
+}
+
+void Packet_Pool::release(void *ptr)
+{
+    if (!ptr) {
+        return;
+    }
+
+    Chunk *chunk = (Chunk *)((uint8_t *)ptr - kHeaderBytes);
+
+    m_statistics.bytesInUse -= chunk->size;
+
+    if (chunk->sizeClass == kOversizeClass) {
+        free(chunk);
+        return;
+    }
+
+    if (chunk->sizeClass + kMinClassShift <= kMaxSlabClassShift) {
+        m_slabBytesInUse -= chunk->size;
+    } else if (m_retainedLargeBytes + chunk->size > m_maxRetainedBytes) {
+        free(chunk);
+        return;
+    } else {
+        m_retainedLargeBytes += chunk->size;
+    }
+
+    chunk->next = m_freeLists[chunk->sizeClass];
+    m_freeLists[chunk->sizeClass] = chunk;
+}
+
+void Packet_Pool::trim()
+{
+    for (unsigned sizeClass = kMaxSlabClassShift - kMinClassShift + 1; sizeClass < kClassCount; sizeClass++) {
+        while (m_freeLists[sizeClass]) {
+            Chunk *next = m_freeLists[sizeClass]->next;
+            free(m_freeLists[sizeClass]);
+            m_freeLists[sizeClass] = next;
+        }
+    }
+    m_retainedLargeBytes = 0;
+
+    /* A slab can only go once every chunk carved out of it is back */
+    if (m_slabBytesInUse > 0) {
+        return;
+    }
+    for (unsigned sizeClass = 0; sizeClass + kMinClassShift <= kMaxSlabClassShift; sizeClass++) {
+        m_freeLists[sizeClass] = 0;
+    }
+    while (m_slabs) {
+        Slab *next = m_slabs->next;
+        free(m_slabs->memory);
+        delete m_slabs;
+        m_slabs = next;
+    }
+    m_slabBytes = 0;
+}
+
+Packet_Pool::Statistics Packet_Pool::statistics() const
+{
+    Statistics statistics = m_statistics;
+    statistics.bytesRetained = (m_slabBytes - m_slabBytesInUse) + m_retainedLargeBytes;
+    return statistics;
+}
+
+Packet_Pool::Chunk *Packet_Pool::newChunk(unsigned sizeClass)
+{
+    const size_t chunkBytes = (size_t)1 << (sizeClass + kMinClassShift);
+
+    if (sizeClass + kMinClassShift > kMaxSlabClassShift) {
+        Chunk *chunk = (Chunk *)malloc(chunkBytes);
+        if (chunk) {
+            chunk->sizeClass = sizeClass;
+            chunk->size = (uint32_t)chunkBytes;
+        }
+        return chunk;
+    }
+
+    /* Carve a new slab into chunks of this class; the first one is returned, the rest go on the free list */
+    uint8_t *memory = (uint8_t *)malloc(kSlabBytes);
+    if (!memory) {
+        return 0;
+    }
+    Slab *slab = new Slab;
+    slab->memory = memory;
+    slab->next = m_slabs;
+    m_slabs = slab;
+    m_slabBytes += kSlabBytes;
+
+    for (size_t offset = kSlabBytes; offset > 0; offset -= chunkBytes) {
+        Chunk *chunk = (Chunk *)(memory + offset - chunkBytes);
+        chunk->sizeClass = sizeClass;
+        chunk->size = (uint32_t)chunkBytes;
+        chunk->next = m_freeLists[sizeClass];
+        m_freeLists[sizeClass] = chunk;
+    }
+
+    Chunk *chunk = m_freeLists[sizeClass];
+    m_freeLists[sizeClass] = chunk->next;
+    return chunk;
+}
+
+} // namespace astreamer
@@ -0,0 +1,80 @@
+/*
+ * This file is part of the FreeStreamer project,
+ * (C)Copyright 2011-2015 Matias Muhonen <mmu@iki.fi>
+ * See the file ''LICENSE'' for using the code.
+ *
+ * https://github.com/muhku/FreeStreamer
+ */
+
+#ifndef ASTREAMER_PACKET_POOL_H
+#define ASTREAMER_PACKET_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace astreamer {
+
+/*
+ * Recycling allocator for the queued compressed packets.
+ *
+ * Requests are rounded up to a power of two size class (64 bytes .. 64 KB).
+ * Classes up to 4 KB are carved out of 64 KB slabs; the larger classes are
+ * allocated one by one. Released chunks go on a free list per class and are
+ * handed out again, so a steady stream of packets stops hitting malloc once
+ * the pool has warmed up. Anything bigger than the largest class is a plain
+ * malloc.
+ *
+ * Not thread safe: the streams allocate and release on the run loop thread.
+ */
+class Packet_Pool {
+public:
+    struct Statistics {
+        uint64_t hits;            /* served from a free list */
+        uint64_t misses;          /* needed new memory */
+        size_t bytesInUse;        /* handed out and not yet released */
+        size_t bytesRetained;     /* owned by the pool but not handed out */
+    };
+
+    /* maxRetainedBytes caps what the large classes keep on their free lists */
+    Packet_Pool(size_t maxRetainedBytes = 4 * 1024 * 1024);
+    ~Packet_Pool();
+
+    /* 16 byte aligned, or 0 if the memory can't be had */
+    void *allocate(size_t size);
+    void release(void *ptr);
+
+    /* Gives the recycled memory back; the slabs go too if nothing is in use */
+    void trim();
+
+    Statistics statistics() const;
+
+private:
+    Packet_Pool(const Packet_Pool&);
+    Packet_Pool& operator=(const Packet_Pool&);
+
+    struct Chunk;
+    struct Slab;
+
+    enum {
+        kMinClassShift = 6,
+        kMaxSlabClassShift = 12,
+        kMaxClassShift = 16,
+        kClassCount = kMaxClassShift - kMinClassShift + 1,
+        kOversizeClass = kClassCount,
+        kSlabBytes = 64 * 1024
+    };
+
+    Chunk *newChunk(unsigned sizeClass);
+
+    Chunk *m_freeLists[kClassCount];
+    Slab *m_slabs;
+    size_t m_maxRetainedBytes;
+    size_t m_retainedLargeBytes;
+    size_t m_slabBytes;
+    size_t m_slabBytesInUse;
+    Statistics m_statistics;
+};
+
+} // namespace astreamer
+
+#endif // ASTREAMER_PACKET_POOL_H
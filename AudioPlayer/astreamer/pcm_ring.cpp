@@ -0,0 +1,86 @@
+/*
+ * This file is part of the FreeStreamer project,
+ * (C)Copyright 2011-2015 Matias Muhonen <mmu@iki.fi>
+ * See the file ''LICENSE'' for using the code.
+ *
+ * https://github.com/muhku/FreeStreamer
+ */
+
+#include "pcm_ring.h"
+
+namespace astreamer {
+    
+/* Rounded up to a power of two, so the free running indices stay right when they wrap */
+static unsigned ringSize(unsigned bufferCount)
+{
+    unsigned size = 2;
+    while (size < bufferCount) {
+        size <<= 1;
+    }
+    return size;
+}
+    
+PCM_Ring::PCM_Ring(unsigned bufferCount, size_t bufferSize) :
+    m_buffers(new Buffer[ringSize(bufferCount)]),
+    m_storage(new uint8_t[ringSize(bufferCount) * bufferSize]),
+    m_bufferCount(ringSize(bufferCount)),
+    m_writeIndex(0),
+    m_readIndex(0)
+{
+    for (unsigned i=0; i < m_bufferCount; i++) {
+        m_buffers[i].data = m_storage + i * bufferSize;
+        m_buffers[i].capacity = bufferSize;
+        m_buffers[i].numBytes = 0;
+        m_buffers[i].epoch = 0;
+        m_buffers[i].endOfStream = false;
+        m_buffers[i].result = 0;
+    }
+}
+    
+PCM_Ring::~PCM_Ring()
+{
+    delete [] m_buffers, m_buffers = 0;
+    delete [] m_storage, m_storage = 0;
+}
+    
+PCM_Ring::Buffer *PCM_Ring::writeBuffer()
+{
+    const unsigned readIndex = __atomic_load_n(&m_readIndex, __ATOMIC_ACQUIRE);
+    
+    if (m_writeIndex - readIndex >= m_bufferCount) {
+        return 0;
+    }
+    return &m_buffers[m_writeIndex % m_bufferCount];
+}
+    
+void PCM_Ring::commitWrite()
+{
+    __atomic_store_n(&m_writeIndex, m_writeIndex + 1, __ATOMIC_RELEASE);
+}
+    
+PCM_Ring::Buffer *PCM_Ring::readBuffer()
+{
+    const unsigned writeIndex = __atomic_load_n(&m_writeIndex, __ATOMIC_ACQUIRE);
+    
+    if (writeIndex == m_readIndex) {
+        return 0;
+    }
+    return &m_buffers[m_readIndex % m_bufferCount];
+}
+    
+void PCM_Ring::commitRead()
+{
+    __atomic_store_n(&m_readIndex, m_readIndex + 1, __ATOMIC_RELEASE);
+}
+    
+unsigned PCM_Ring::count() const
+{
+    return __atomic_load_n(&m_writeIndex, __ATOMIC_ACQUIRE) - __atomic_load_n(&m_readIndex, __ATOMIC_ACQUIRE);
+}
+    
+unsigned PCM_Ring::bufferCount() const
+{
+    return m_bufferCount;
+}
+
+} // namespace astreamer
@@ -0,0 +1,68 @@
+/*
+ * This file is part of the FreeStreamer project,
+ * (C)Copyright 2011-2015 Matias Muhonen <mmu@iki.fi>
+ * See the file ''LICENSE'' for using the code.
+ *
+ * https://github.com/muhku/FreeStreamer
+ */
+
+#ifndef ASTREAMER_PCM_RING_H
+#define ASTREAMER_PCM_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace astreamer {
+
+/*
+ * Single-producer/single-consumer ring of fixed size PCM buffers.
+ *
+ * The producer (the decoding thread) fills writeBuffer() and publishes it
+ * with commitWrite(); the consumer takes readBuffer() and hands it back
+ * with commitRead(). Neither side locks: each index is written by one side
+ * only, with a release store, and read by the other with an acquire load.
+ * Waiting for space or data is up to the caller.
+ */
+class PCM_Ring {
+public:
+    struct Buffer {
+        uint8_t *data;
+        size_t capacity;
+        size_t numBytes;
+        unsigned epoch;         /* seek generation the data was decoded in */
+        bool endOfStream;       /* the producer has nothing more for this epoch */
+        int result;             /* decoder result that ended the stream */
+    };
+    
+    /* bufferCount is rounded up to a power of two */
+    PCM_Ring(unsigned bufferCount, size_t bufferSize);
+    ~PCM_Ring();
+    
+    /* Producer: the next free buffer, or 0 if the ring is full */
+    Buffer *writeBuffer();
+    void commitWrite();
+    
+    /* Consumer: the oldest filled buffer, or 0 if the ring is empty */
+    Buffer *readBuffer();
+    void commitRead();
+    
+    /* Filled buffers (exact on either side, a snapshot anywhere else) */
+    unsigned count() const;
+    unsigned bufferCount() const;
+    
+private:
+    PCM_Ring(const PCM_Ring&);
+    PCM_Ring& operator=(const PCM_Ring&);
+    
+    Buffer *m_buffers;
+    uint8_t *m_storage;
+    unsigned m_bufferCount;
+    
+    /* Free running; a buffer's slot is index % m_bufferCount */
+    unsigned m_writeIndex;
+    unsigned m_readIndex;
+};
+
+} // namespace astreamer
+
+#endif // ASTREAMER_PCM_RING_H
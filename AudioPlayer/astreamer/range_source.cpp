@@ -0,0 +1,292 @@
+/*
+ * This file is part of the FreeStreamer project,
+ * (C)Copyright 2011-2015 Matias Muhonen <mmu@iki.fi>
+ * See the file ''LICENSE'' for using the code.
+ *
+ * https://github.com/muhku/FreeStreamer
+ */
+
+#include "range_source.h"
+#include "player_debug.h"
+
+#include <string.h>
+#include <algorithm>
+
+namespace astreamer {
+
+Range_Source::Range_Source(Range_Transport *transport) :
+    m_transport(transport),
+    m_readIndex(0),
+    m_bufferStart(0),
+    m_requestGeneration(0),
+    m_streamGeneration(0),
+    m_requestStart(0),
+    m_arrivalOffset(0),
+    m_requestActive(false),
+    m_ended(false),
+    m_error(false),
+    m_paused(false),
+    m_cancelled(false),
+    m_totalBytes(-1)
+{
+    pthread_mutex_init(&m_mutex, NULL);
+    pthread_cond_init(&m_cond, NULL);
+}
+
+Range_Source::~Range_Source()
+{
+    pthread_mutex_destroy(&m_mutex);
+    pthread_cond_destroy(&m_cond);
+}
+
+bool Range_Source::read(uint64_t offset, void *buffer, unsigned bytes, unsigned *bytesRead)
+{
+    bool restarted = false;
+    bool success = true;
+
+    *bytesRead = 0;
+
+    pthread_mutex_lock(&m_mutex);
+
+    for (;;) {
+        if (m_cancelled) {
+            success = false;
+            break;
+        }
+
+        if (m_totalBytes >= 0 && offset >= (uint64_t)m_totalBytes) {
+            break;
+        }
+
+        const uint64_t bufferEnd = m_bufferStart + bufferedLocked();
+
+        if (offset >= m_bufferStart && offset < bufferEnd) {
+            const size_t index = m_readIndex + (size_t)(offset - m_bufferStart);
+            const unsigned count = (unsigned)std::min((uint64_t)bytes, bufferEnd - offset);
+
+            memcpy(buffer, &m_buffer[index], count);
+            *bytesRead = count;
+
+            // The reader doesn't come back for what it has read (CRangedIO caches that)
+            m_readIndex = index + count;
+            m_bufferStart = offset + count;
+
+            if (m_readIndex > m_buffer.size() / 2) {
+                m_buffer.erase(m_buffer.begin(), m_buffer.begin() + m_readIndex);
+                m_readIndex = 0;
+            }
+
+            if (m_paused && bufferedLocked() < kMaxBufferedBytes / 2) {
+                resumeLocked();
+            }
+            break;
+        }
+
+        const bool coming = (m_requestActive && !m_ended && !m_error &&
+                             offset >= bufferEnd && offset < bufferEnd + kSkipAheadBytes);
+
+        if (!coming) {
+            if (restarted) {
+                // A request for exactly this offset ended or failed without delivering it
+                success = !m_error;
+                break;
+            }
+
+            HS_TRACE("Range source: reopening at %llu (buffered %llu-%llu)\n",
+                     (unsigned long long)offset, (unsigned long long)m_bufferStart, (unsigned long long)bufferEnd);
+
+            restartLocked(offset);
+            restarted = true;
+        } else if (offset > bufferEnd) {
+            // Drop what we won't need and let the open request catch up
+            clearLocked(offset);
+
+            if (m_paused) {
+                resumeLocked();
+            }
+        }
+
+        pthread_cond_wait(&m_cond, &m_mutex);
+    }
+
+    pthread_mutex_unlock(&m_mutex);
+
+    return success;
+}
+
+int64_t Range_Source::totalBytes()
+{
+    pthread_mutex_lock(&m_mutex);
+
+    while (m_totalBytes < 0 && !m_error && !m_cancelled) {
+        if (!m_requestActive) {
+            restartLocked(0);
+        }
+        pthread_cond_wait(&m_cond, &m_mutex);
+    }
+
+    const int64_t totalBytes = (m_totalBytes > 0 ? m_totalBytes : 0);
+
+    pthread_mutex_unlock(&m_mutex);
+
+    return totalBytes;
+}
+
+size_t Range_Source::contentLength()
+{
+    pthread_mutex_lock(&m_mutex);
+    const size_t length = (m_totalBytes > 0 ? (size_t)m_totalBytes : 0);
+    pthread_mutex_unlock(&m_mutex);
+
+    return length;
+}
+
+void Range_Source::cancel()
+{
+    pthread_mutex_lock(&m_mutex);
+    m_cancelled = true;
+    pthread_cond_broadcast(&m_cond);
+    pthread_mutex_unlock(&m_mutex);
+}
+
+void Range_Source::resume()
+{
+    pthread_mutex_lock(&m_mutex);
+    m_cancelled = false;
+    pthread_mutex_unlock(&m_mutex);
+}
+
+/* Transport callbacks */
+
+bool Range_Source::requestStarting(unsigned generation)
+{
+    pthread_mutex_lock(&m_mutex);
+    m_streamGeneration = generation;
+    const bool current = (generation == m_requestGeneration);
+    pthread_mutex_unlock(&m_mutex);
+
+    return current;
+}
+
+bool Range_Source::isCurrent(unsigned generation)
+{
+    pthread_mutex_lock(&m_mutex);
+    const bool current = (generation == m_streamGeneration);
+    pthread_mutex_unlock(&m_mutex);
+
+    return current;
+}
+
+void Range_Source::responseStarted(uint64_t contentLength)
+{
+    pthread_mutex_lock(&m_mutex);
+
+    if (m_streamGeneration == m_requestGeneration) {
+        if (m_requestStart == 0) {
+            if (contentLength > 0) {
+                m_totalBytes = (int64_t)contentLength;
+            } else {
+                // Without a length we can't find the tag or seek
+                m_error = true;
+            }
+        } else if (m_totalBytes > 0 && contentLength == (uint64_t)m_totalBytes) {
+            // The server ignored the range and is sending the whole file
+            HS_TRACE("Range source: no range support, skipping to %llu\n", (unsigned long long)m_requestStart);
+
+            m_arrivalOffset = 0;
+        }
+        pthread_cond_broadcast(&m_cond);
+    }
+
+    pthread_mutex_unlock(&m_mutex);
+}
+
+bool Range_Source::dataAvailable(const uint8_t *data, size_t numBytes)
+{
+    bool pause = false;
+
+    pthread_mutex_lock(&m_mutex);
+
+    if (m_streamGeneration == m_requestGeneration) {
+        const uint64_t offset = m_arrivalOffset;
+        const uint64_t bufferEnd = m_bufferStart + bufferedLocked();
+
+        m_arrivalOffset += numBytes;
+
+        // Bytes in front of the wanted offset are skipped
+        if (offset <= bufferEnd && offset + numBytes > bufferEnd) {
+            m_buffer.insert(m_buffer.end(), data + (bufferEnd - offset), data + numBytes);
+        }
+
+        if (!m_paused && bufferedLocked() >= kMaxBufferedBytes) {
+            m_paused = pause = true;
+        }
+        pthread_cond_broadcast(&m_cond);
+    }
+
+    pthread_mutex_unlock(&m_mutex);
+
+    return pause;
+}
+
+void Range_Source::responseEnded()
+{
+    pthread_mutex_lock(&m_mutex);
+
+    if (m_streamGeneration == m_requestGeneration) {
+        m_ended = true;
+        pthread_cond_broadcast(&m_cond);
+    }
+
+    pthread_mutex_unlock(&m_mutex);
+}
+
+void Range_Source::responseFailed()
+{
+    HS_TRACE("Range source: request failed\n");
+
+    pthread_mutex_lock(&m_mutex);
+
+    if (m_streamGeneration == m_requestGeneration) {
+        m_error = true;
+        pthread_cond_broadcast(&m_cond);
+    }
+
+    pthread_mutex_unlock(&m_mutex);
+}
+
+/* private */
+
+size_t Range_Source::bufferedLocked() const
+{
+    return m_buffer.size() - m_readIndex;
+}
+
+void Range_Source::clearLocked(uint64_t offset)
+{
+    m_buffer.clear();
+    m_readIndex = 0;
+    m_bufferStart = offset;
+}
+
+void Range_Source::restartLocked(uint64_t offset)
+{
+    clearLocked(offset);
+    m_requestStart = offset;
+    m_arrivalOffset = offset;
+    m_requestActive = true;
+    m_ended = false;
+    m_error = false;
+    m_paused = false;
+
+    m_transport->openRequest(++m_requestGeneration, offset, m_totalBytes);
+}
+
+void Range_Source::resumeLocked()
+{
+    m_paused = false;
+
+    m_transport->resumeRequest(m_requestGeneration);
+}
+
+} // namespace astreamer
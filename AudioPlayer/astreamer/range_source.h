@@ -0,0 +1,126 @@
+/*
+ * This file is part of the FreeStreamer project,
+ * (C)Copyright 2011-2015 Matias Muhonen <mmu@iki.fi>
+ * See the file ''LICENSE'' for using the code.
+ *
+ * https://github.com/muhku/FreeStreamer
+ */
+
+#ifndef ASTREAMER_RANGE_SOURCE_H
+#define ASTREAMER_RANGE_SOURCE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <vector>
+
+namespace astreamer {
+
+/*
+ * Where a Range_Source gets its bytes: one request at a time, each for the
+ * file from an offset to its end. Both calls are made with the source's lock
+ * held, so they must only queue the work for the transport's own thread and
+ * never call back into the source inline.
+ *
+ * On its thread the transport calls requestStarting() before it opens a
+ * request (and skips it if that says it's superseded), then responseStarted(),
+ * dataAvailable() for each piece and responseEnded() or responseFailed().
+ */
+class Range_Transport {
+public:
+    virtual ~Range_Transport() {}
+
+    /* Drop the open request and start one at offset; totalBytes is -1 until the length is known */
+    virtual void openRequest(unsigned generation, uint64_t offset, int64_t totalBytes) = 0;
+
+    /* Deliver again after dataAvailable() asked for a pause, if the request is still isCurrent() */
+    virtual void resumeRequest(unsigned generation) = 0;
+};
+
+/*
+ * Serves byte ranges of a remote file to a reading thread.
+ *
+ * One request is kept open and read front to back; a read that falls behind
+ * it, or too far ahead of it, reopens it at the wanted offset. read() blocks
+ * until the bytes arrive, so it must not be called on the transport's thread.
+ * If the server ignores the range and sends the whole file, the bytes in
+ * front of the wanted offset are skipped. Once kMaxBufferedBytes are waiting
+ * to be read the transport is paused, and resumed when half of them are gone.
+ *
+ * Every request gets a new generation; callbacks for a request that has been
+ * superseded are dropped, so stale bytes never land in the buffer.
+ */
+class Range_Source {
+public:
+    enum {
+        /* A read this far past the data we have waits for the open request instead of reopening */
+        kSkipAheadBytes = 256 * 1024,
+
+        /* Stop reading from the network once this much is buffered and unread */
+        kMaxBufferedBytes = 1024 * 1024
+    };
+
+    Range_Source(Range_Transport *transport);
+    ~Range_Source();
+
+    /* Up to bytes at offset; false if the request failed or was cancelled. 0 bytes read is the end of the file */
+    bool read(uint64_t offset, void *buffer, unsigned bytes, unsigned *bytesRead);
+
+    /* Length of the file, opening a request to find out if need be; 0 if it can't be had */
+    int64_t totalBytes();
+
+    /* Length of the file if the server has told us, 0 otherwise (doesn't block) */
+    size_t contentLength();
+
+    /* Fails blocked and future reads until resume(), so a reader stuck on the network can be stopped */
+    void cancel();
+    void resume();
+
+    /* For the transport, on its thread */
+    bool requestStarting(unsigned generation);
+    bool isCurrent(unsigned generation);
+    void responseStarted(uint64_t contentLength);
+    bool dataAvailable(const uint8_t *data, size_t numBytes);
+    void responseEnded();
+    void responseFailed();
+
+private:
+    Range_Source(const Range_Source&);
+    Range_Source& operator=(const Range_Source&);
+
+    Range_Transport *m_transport;
+
+    pthread_mutex_t m_mutex;
+    pthread_cond_t m_cond;
+
+    /*
+     * Downloaded bytes not yet read: m_buffer[m_readIndex..] holds the file from
+     * m_bufferStart on. What has been read is only dropped from the front once
+     * it's more than half the buffer, so a read doesn't move the rest down.
+     */
+    std::vector<uint8_t> m_buffer;
+    size_t m_readIndex;
+    uint64_t m_bufferStart;
+
+    /* The request in flight; m_streamGeneration is the one the transport is delivering */
+    unsigned m_requestGeneration;
+    unsigned m_streamGeneration;
+    uint64_t m_requestStart;
+    uint64_t m_arrivalOffset;
+    bool m_requestActive;
+    bool m_ended;
+    bool m_error;
+    bool m_paused;
+    bool m_cancelled;
+
+    int64_t m_totalBytes;
+
+    size_t bufferedLocked() const;
+    void clearLocked(uint64_t offset);
+    void restartLocked(uint64_t offset);
+    void resumeLocked();
+};
+
+} // namespace astreamer
+
+#endif // ASTREAMER_RANGE_SOURCE_H
@@ -18,6 +18,7 @@ struct Stream_Configuration {
     unsigned bufferSize;
     unsigned maxPacketDescs;
     unsigned decodeQueueSize;
+    unsigned decodeAheadBufferCount;
     unsigned httpConnectionBufferSize;
     double outputSampleRate;
     long outputNumChannels;
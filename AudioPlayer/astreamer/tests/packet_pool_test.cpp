@@ -0,0 +1,245 @@
+/*
+ * This file is part of the FreeStreamer project,
+ * (C)Copyright 2011-2015 Matias Muhonen <mmu@iki.fi>
+ * See the file ''LICENSE'' for using the code.
+ *
+ * https://github.com/muhku/FreeStreamer
+ */
+
+/*
+ * Stress test for Packet_Pool.
+ *
+ * Keeps a few thousand chunks of random sizes (mostly packet sized, some
+ * from the large classes, some past the largest class) handed out at once,
+ * releasing them in random order. Every chunk is filled with its own pattern
+ * when it's allocated and checked when it's released, so two live chunks
+ * sharing memory or a chunk header getting overwritten show up. Along the
+ * way the statistics are checked against what the test itself has handed
+ * out, and trim() is called both with chunks live and with none.
+ *
+ * Then checks that released memory is actually reused: once a round of
+ * allocations has warmed the pool up, the same round again must be served
+ * from the free lists without a single miss, and trim() must give back
+ * everything once nothing is in use.
+ */
+
+#include "packet_pool.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+using namespace astreamer;
+
+namespace {
+
+const unsigned kIterations = 500000;
+const size_t kMaxLive = 3000;
+const size_t kMaxRetained = 1024 * 1024;
+
+struct Live {
+    uint8_t *data;
+    size_t size;
+    uint8_t pattern;
+};
+
+size_t randomSize()
+{
+    switch (rand() % 8) {
+        case 0:
+            return (size_t)rand() % 200000; /* the large classes and past them */
+        case 1:
+            return (size_t)rand() % 64;     /* around the smallest class */
+        default:
+            return (size_t)rand() % 3000;   /* a packet */
+    }
+}
+
+bool intact(const Live &live)
+{
+    for (size_t i=0; i < live.size; i++) {
+        if (live.data[i] != (uint8_t)(live.pattern + i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int stress()
+{
+    Packet_Pool pool(kMaxRetained);
+    std::vector<Live> live;
+    size_t bytesRequested = 0;
+    int errors = 0;
+
+    srand(1);
+
+    for (unsigned iteration = 0; iteration < kIterations && !errors; iteration++) {
+        if (live.size() < kMaxLive && (live.empty() || rand() % 2 == 0)) {
+            Live entry;
+            entry.size = randomSize();
+            entry.pattern = (uint8_t)rand();
+            entry.data = (uint8_t *)pool.allocate(entry.size);
+            if (!entry.data) {
+                printf("stress: can't allocate %zu bytes\n", entry.size);
+                errors++;
+                break;
+            }
+            if (((uintptr_t)entry.data & 15) != 0) {
+                printf("stress: %zu bytes at %p, not 16 byte aligned\n", entry.size, entry.data);
+                errors++;
+            }
+            for (size_t i=0; i < entry.size; i++) {
+                entry.data[i] = (uint8_t)(entry.pattern + i);
+            }
+            live.push_back(entry);
+            bytesRequested += entry.size;
+        } else {
+            const size_t index = (size_t)rand() % live.size();
+            const Live entry = live[index];
+            if (!intact(entry)) {
+                printf("stress: %zu bytes at %p were overwritten\n", entry.size, entry.data);
+                errors++;
+            }
+            pool.release(entry.data);
+            live[index] = live.back();
+            live.pop_back();
+            bytesRequested -= entry.size;
+        }
+
+        if (iteration % 25000 == 0) {
+            const Packet_Pool::Statistics statistics = pool.statistics();
+            if (statistics.bytesInUse < bytesRequested) {
+                printf("stress: %zu bytes in use, %zu handed out\n", statistics.bytesInUse, bytesRequested);
+                errors++;
+            }
+        }
+
+        if (iteration % 100000 == 0) {
+            pool.trim();
+        }
+    }
+
+    /* Everything still live has to have survived the trims */
+    for (size_t i=0; i < live.size(); i++) {
+        if (!intact(live[i])) {
+            printf("stress: %zu bytes at %p were overwritten\n", live[i].size, live[i].data);
+            errors++;
+        }
+        pool.release(live[i].data);
+    }
+
+    Packet_Pool::Statistics statistics = pool.statistics();
+    printf("stress: %llu hits, %llu misses, %zu bytes retained\n",
+           (unsigned long long)statistics.hits, (unsigned long long)statistics.misses, statistics.bytesRetained);
+
+    if (statistics.bytesInUse != 0) {
+        printf("stress: %zu bytes still in use after releasing everything\n", statistics.bytesInUse);
+        errors++;
+    }
+    if (statistics.hits < statistics.misses) {
+        printf("stress: the free lists are hardly used\n");
+        errors++;
+    }
+
+    pool.trim();
+    statistics = pool.statistics();
+    if (statistics.bytesRetained != 0) {
+        printf("stress: %zu bytes retained after trim()\n", statistics.bytesRetained);
+        errors++;
+    }
+    return errors;
+}
+
+int reuse()
+{
+    Packet_Pool pool(kMaxRetained);
+    std::vector<size_t> sizes;
+    std::vector<void *> chunks;
+    int errors = 0;
+
+    /* Packet sized and large class requests that all fit in what the pool may keep */
+    srand(2);
+    size_t largeBytes = 0;
+    while (sizes.size() < 2000) {
+        size_t size = (size_t)rand() % 3000;
+        if (rand() % 16 == 0) {
+            size = 4096 + (size_t)rand() % 28000;
+            if (largeBytes + 65536 > kMaxRetained) {
+                continue;
+            }
+            largeBytes += 65536;
+        }
+        sizes.push_back(size);
+    }
+
+    for (unsigned round = 0; round < 3; round++) {
+        const uint64_t misses = pool.statistics().misses;
+
+        for (size_t i=0; i < sizes.size(); i++) {
+            chunks.push_back(pool.allocate(sizes[i]));
+        }
+        /* Released in a different order than they came out */
+        for (size_t i=0; i < chunks.size(); i += 2) {
+            pool.release(chunks[i]);
+        }
+        for (size_t i=1; i < chunks.size(); i += 2) {
+            pool.release(chunks[i]);
+        }
+        chunks.clear();
+
+        const Packet_Pool::Statistics statistics = pool.statistics();
+        if (round > 0 && statistics.misses != misses) {
+            printf("reuse: round %u missed %llu times\n", round, (unsigned long long)(statistics.misses - misses));
+            errors++;
+        }
+        if (statistics.bytesInUse != 0) {
+            printf("reuse: round %u left %zu bytes in use\n", round, statistics.bytesInUse);
+            errors++;
+        }
+    }
+
+    /* While a single slab chunk is out, trim() keeps the slabs but drops the large classes */
+    void *chunk = pool.allocate(100);
+    pool.trim();
+    Packet_Pool::Statistics statistics = pool.statistics();
+    if (statistics.bytesRetained == 0) {
+        printf("reuse: the slabs went with a chunk still in use\n");
+        errors++;
+    }
+    const uint64_t misses = statistics.misses;
+    pool.release(pool.allocate(100));
+    if (pool.statistics().misses != misses) {
+        printf("reuse: the slab chunks weren't kept by trim()\n");
+        errors++;
+    }
+
+    pool.release(chunk);
+    pool.trim();
+    statistics = pool.statistics();
+    if (statistics.bytesRetained != 0 || statistics.bytesInUse != 0) {
+        printf("reuse: %zu bytes retained, %zu in use after trim()\n", statistics.bytesRetained, statistics.bytesInUse);
+        errors++;
+    }
+
+    /* And the pool still works after giving everything back */
+    chunk = pool.allocate(1000);
+    memset(chunk, 0xA5, 1000);
+    pool.release(chunk);
+
+    printf("reuse: %llu hits, %llu misses\n", (unsigned long long)pool.statistics().hits, (unsigned long long)pool.statistics().misses);
+    return errors;
+}
+
+} // namespace
+
+int main()
+{
+    int errors = 0;
+    errors += stress();
+    errors += reuse();
+    printf("%s\n", (errors ? "FAILED" : "passed"));
+    return (errors ? 1 : 0);
+}
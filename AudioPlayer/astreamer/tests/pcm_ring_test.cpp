@@ -0,0 +1,187 @@
+/*
+ * This file is part of the FreeStreamer project,
+ * (C)Copyright 2011-2015 Matias Muhonen <mmu@iki.fi>
+ * See the file ''LICENSE'' for using the code.
+ *
+ * https://github.com/muhku/FreeStreamer
+ */
+
+/*
+ * Two thread stress test for PCM_Ring, run the way APEFile_Stream runs it.
+ *
+ * The producer stands in for the decoding thread: it fills buffers with a
+ * stream of numbered bytes and follows seeks the way decodeLoop() does (the
+ * seek block is stored, then the epoch is bumped; the producer picks up the
+ * new epoch and seeks). The consumer stands in for drain(): it checks that
+ * every buffer of the current epoch carries on exactly where the last one
+ * stopped, drops the stale ones, and seeks at random.
+ *
+ * Build it with -fsanitize=thread (ASTREAMER_TESTS_TSAN) to have the ring's
+ * and the seek protocol's memory ordering checked as well.
+ */
+
+#include "pcm_ring.h"
+
+#include <algorithm>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace astreamer;
+
+namespace {
+
+const size_t kStreamBytes = 4 * 1024 * 1024;
+const size_t kBufferSize = 256;
+const unsigned kSeeks = 20000;
+
+struct Shared {
+    PCM_Ring *ring;
+    unsigned epoch;
+    size_t seekBlock;
+    bool quit;
+};
+
+/* What the stream holds at a position, and how much of it goes in the buffer starting there */
+uint8_t streamByte(size_t position)
+{
+    return (uint8_t)(position * 7 + (position >> 8));
+}
+
+size_t bufferBytes(size_t position)
+{
+    return std::min<size_t>(1 + position % kBufferSize, kStreamBytes - position);
+}
+
+void *producer(void *info)
+{
+    Shared *shared = static_cast<Shared*>(info);
+    unsigned epoch = 0;
+    size_t position = 0;
+    bool finished = false;
+
+    while (!__atomic_load_n(&shared->quit, __ATOMIC_ACQUIRE)) {
+        const unsigned requestedEpoch = __atomic_load_n(&shared->epoch, __ATOMIC_ACQUIRE);
+        if (requestedEpoch != epoch) {
+            epoch = requestedEpoch;
+            position = __atomic_load_n(&shared->seekBlock, __ATOMIC_RELAXED);
+            finished = false;
+        }
+
+        PCM_Ring::Buffer *buffer = (finished ? NULL : shared->ring->writeBuffer());
+        if (!buffer) {
+            sched_yield();
+            continue;
+        }
+
+        /* (the test keeps the buffer's stream position in result) */
+        buffer->numBytes = bufferBytes(position);
+        for (size_t i=0; i < buffer->numBytes; i++) {
+            buffer->data[i] = streamByte(position + i);
+        }
+        buffer->epoch = epoch;
+        buffer->result = (int)position;
+        position += buffer->numBytes;
+        buffer->endOfStream = finished = (position >= kStreamBytes);
+        shared->ring->commitWrite();
+    }
+    return NULL;
+}
+
+/* Like APEFile_Stream::seek(): the block, then the epoch */
+size_t seek(Shared *shared, unsigned *epoch)
+{
+    const size_t position = (size_t)rand() % kStreamBytes;
+    __atomic_store_n(&shared->seekBlock, position, __ATOMIC_RELAXED);
+    *epoch = __atomic_add_fetch(&shared->epoch, 1, __ATOMIC_RELEASE);
+    return position;
+}
+
+int run(unsigned bufferCount)
+{
+    Shared shared;
+    shared.ring = new PCM_Ring(bufferCount, kBufferSize);
+    shared.epoch = 0;
+    shared.seekBlock = 0;
+    shared.quit = false;
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, producer, &shared) != 0) {
+        printf("%u buffers: can't start the producer\n", bufferCount);
+        return 1;
+    }
+
+    unsigned epoch = 0;
+    size_t expected = 0;
+    unsigned seeks = 0;
+    unsigned long long buffers = 0, stale = 0;
+    int errors = 0;
+
+    srand(bufferCount);
+
+    for (;;) {
+        if (shared.ring->count() > shared.ring->bufferCount()) {
+            printf("%u buffers: %u filled\n", bufferCount, shared.ring->count());
+            errors++;
+            break;
+        }
+
+        /* Now and then seek again before the last seek has produced anything (the user dragging the slider) */
+        PCM_Ring::Buffer *buffer = shared.ring->readBuffer();
+        if (!buffer || buffer->epoch != epoch) {
+            if (buffer) {
+                stale++;
+                shared.ring->commitRead();
+            } else {
+                sched_yield();
+            }
+            if (seeks < kSeeks && rand() % 32 == 0) {
+                expected = seek(&shared, &epoch);
+                seeks++;
+            }
+            continue;
+        }
+
+        bool good = ((size_t)buffer->result == expected && buffer->numBytes == bufferBytes(expected));
+        for (size_t i=0; good && i < buffer->numBytes; i++) {
+            good = (buffer->data[i] == streamByte(expected + i));
+        }
+        if (!good) {
+            printf("%u buffers: the buffer at %zu (epoch %u) should be at %zu\n", bufferCount, (size_t)buffer->result, epoch, expected);
+            errors++;
+            break;
+        }
+
+        expected += buffer->numBytes;
+        buffers++;
+        const bool endOfStream = buffer->endOfStream;
+        shared.ring->commitRead();
+
+        if (seeks < kSeeks && (endOfStream || rand() % 16 == 0)) {
+            expected = seek(&shared, &epoch);
+            seeks++;
+        } else if (endOfStream) {
+            break;
+        }
+    }
+
+    __atomic_store_n(&shared.quit, true, __ATOMIC_RELEASE);
+    pthread_join(thread, NULL);
+    delete shared.ring;
+
+    printf("%u buffers: %llu read, %llu stale, %u seeks%s\n", bufferCount, buffers, stale, seeks, (errors ? ", FAILED" : ""));
+    return errors;
+}
+
+} // namespace
+
+int main()
+{
+    int errors = 0;
+    errors += run(2);
+    errors += run(5);
+    errors += run(16);
+    return (errors ? 1 : 0);
+}
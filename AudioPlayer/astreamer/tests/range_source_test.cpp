@@ -0,0 +1,1006 @@
+/*
+ * This file is part of the FreeStreamer project,
+ * (C)Copyright 2011-2015 Matias Muhonen <mmu@iki.fi>
+ * See the file ''LICENSE'' for using the code.
+ *
+ * https://github.com/muhku/FreeStreamer
+ */
+
+/*
+ * Tests for Range_Source, the part of the remote APE player that decides
+ * which byte ranges to request.
+ *
+ * Most of them run it the way HTTP_Range_Source does, over a transport with
+ * its own thread, against a small HTTP server on the loopback interface: a
+ * file is read through in order (one request), reads a little ahead wait for
+ * the open request while reads far ahead or behind reopen it, a server that
+ * ignores Range has the bytes in front of the wanted offset skipped, and the
+ * transport is paused once a megabyte is waiting and resumed as it's read.
+ *
+ * The last one drives the source by hand to check the generations: bytes
+ * from a request that has been replaced don't land in the buffer, a request
+ * superseded before it started isn't opened, and cancel() fails a read.
+ */
+
+#include "range_source.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using namespace astreamer;
+
+namespace {
+
+const uint64_t kFileBytes = 3 * 1024 * 1024 + 12345;
+const unsigned kReadBytes = 65536;
+
+/* What the served file holds at an offset */
+uint8_t fileByte(uint64_t offset)
+{
+    return (uint8_t)(((uint32_t)offset * 2654435761u) >> 24);
+}
+
+bool fileMatches(uint64_t offset, const uint8_t *data, unsigned bytes)
+{
+    for (unsigned i=0; i < bytes; i++) {
+        if (data[i] != fileByte(offset + i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void sleepMilliseconds(unsigned milliseconds)
+{
+    usleep(milliseconds * 1000);
+}
+
+/*
+ * HTTP stand-in: serves kFileBytes of fileByte() to GET requests, one thread
+ * per connection, honouring "Range: bytes=N-" unless told not to, and logs
+ * the offset each request asked for.
+ */
+class Loopback_Server {
+public:
+    Loopback_Server(bool honourRange) :
+        m_honourRange(honourRange),
+        m_listenSocket(-1),
+        m_port(0),
+        m_quit(false)
+    {
+        pthread_mutex_init(&m_mutex, NULL);
+    }
+
+    ~Loopback_Server()
+    {
+        stop();
+        pthread_mutex_destroy(&m_mutex);
+    }
+
+    bool start()
+    {
+        m_listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+        if (m_listenSocket < 0) {
+            return false;
+        }
+
+        sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = 0;
+
+        socklen_t length = sizeof(address);
+        if (bind(m_listenSocket, (sockaddr *)&address, sizeof(address)) != 0 ||
+            listen(m_listenSocket, 16) != 0 ||
+            getsockname(m_listenSocket, (sockaddr *)&address, &length) != 0) {
+            return false;
+        }
+        m_port = ntohs(address.sin_port);
+
+        return (pthread_create(&m_acceptThread, NULL, acceptThread, this) == 0);
+    }
+
+    void stop()
+    {
+        if (m_listenSocket < 0) {
+            return;
+        }
+
+        pthread_mutex_lock(&m_mutex);
+        m_quit = true;
+        pthread_mutex_unlock(&m_mutex);
+
+        pthread_join(m_acceptThread, NULL);
+        for (size_t i=0; i < m_connectionThreads.size(); i++) {
+            pthread_join(m_connectionThreads[i], NULL);
+        }
+        m_connectionThreads.clear();
+
+        close(m_listenSocket), m_listenSocket = -1;
+    }
+
+    unsigned short port() const
+    {
+        return m_port;
+    }
+
+    /* The offsets the requests so far asked for */
+    std::vector<uint64_t> requests()
+    {
+        pthread_mutex_lock(&m_mutex);
+        const std::vector<uint64_t> requests = m_requests;
+        pthread_mutex_unlock(&m_mutex);
+
+        return requests;
+    }
+
+private:
+    struct Connection {
+        Loopback_Server *server;
+        int socket;
+    };
+
+    bool m_honourRange;
+    int m_listenSocket;
+    unsigned short m_port;
+    bool m_quit;
+    pthread_mutex_t m_mutex;
+    pthread_t m_acceptThread;
+    std::vector<pthread_t> m_connectionThreads;
+    std::vector<uint64_t> m_requests;
+
+    bool quitting()
+    {
+        pthread_mutex_lock(&m_mutex);
+        const bool quit = m_quit;
+        pthread_mutex_unlock(&m_mutex);
+
+        return quit;
+    }
+
+    static void *acceptThread(void *info)
+    {
+        Loopback_Server *THIS = static_cast<Loopback_Server*>(info);
+
+        while (!THIS->quitting()) {
+            pollfd ready = { THIS->m_listenSocket, POLLIN, 0 };
+            if (poll(&ready, 1, 20) <= 0) {
+                continue;
+            }
+
+            Connection *connection = new Connection;
+            connection->server = THIS;
+            connection->socket = accept(THIS->m_listenSocket, NULL, NULL);
+
+            pthread_t thread;
+            if (connection->socket < 0 || pthread_create(&thread, NULL, connectionThread, connection) != 0) {
+                if (connection->socket >= 0) {
+                    close(connection->socket);
+                }
+                delete connection;
+                continue;
+            }
+            THIS->m_connectionThreads.push_back(thread);
+        }
+        return NULL;
+    }
+
+    static void *connectionThread(void *info)
+    {
+        Connection *connection = static_cast<Connection*>(info);
+        connection->server->serve(connection->socket);
+
+        close(connection->socket);
+        delete connection;
+        return NULL;
+    }
+
+    void serve(int fd)
+    {
+        std::string request;
+        char chunk[1024];
+
+        while (request.find("\r\n\r\n") == std::string::npos) {
+            const ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+            if (received <= 0) {
+                return;
+            }
+            request.append(chunk, (size_t)received);
+        }
+
+        uint64_t offset = 0;
+        const size_t range = request.find("Range: bytes=");
+        if (range != std::string::npos) {
+            offset = strtoull(request.c_str() + range + 13, NULL, 10);
+        }
+
+        pthread_mutex_lock(&m_mutex);
+        m_requests.push_back(offset);
+        pthread_mutex_unlock(&m_mutex);
+
+        char header[256];
+        if (offset > 0 && m_honourRange) {
+            snprintf(header, sizeof(header),
+                     "HTTP/1.1 206 Partial Content\r\nContent-Length: %llu\r\nContent-Range: bytes %llu-%llu/%llu\r\nConnection: close\r\n\r\n",
+                     (unsigned long long)(kFileBytes - offset), (unsigned long long)offset,
+                     (unsigned long long)(kFileBytes - 1), (unsigned long long)kFileBytes);
+        } else {
+            offset = 0;
+            snprintf(header, sizeof(header),
+                     "HTTP/1.1 200 OK\r\nContent-Length: %llu\r\nConnection: close\r\n\r\n",
+                     (unsigned long long)kFileBytes);
+        }
+        if (!sendAll(fd, (const uint8_t *)header, strlen(header))) {
+            return;
+        }
+
+        /* Until the client hangs up (a reopen) or the file is out */
+        uint8_t body[16384];
+        while (offset < kFileBytes && !quitting()) {
+            const size_t count = (size_t)std::min<uint64_t>(sizeof(body), kFileBytes - offset);
+            for (size_t i=0; i < count; i++) {
+                body[i] = fileByte(offset + i);
+            }
+            if (!sendAll(fd, body, count)) {
+                return;
+            }
+            offset += count;
+        }
+    }
+
+    bool sendAll(int fd, const uint8_t *data, size_t bytes)
+    {
+        while (bytes > 0) {
+            /* Waits for a paused client with a timeout, so stop() isn't held up by one */
+            pollfd ready = { fd, POLLOUT, 0 };
+            if (poll(&ready, 1, 20) <= 0) {
+                if (quitting()) {
+                    return false;
+                }
+                continue;
+            }
+
+            const ssize_t sent = send(fd, data, bytes, 0);
+            if (sent <= 0) {
+                return false;
+            }
+            data += sent;
+            bytes -= (size_t)sent;
+        }
+        return true;
+    }
+};
+
+/*
+ * Range_Transport over plain sockets, standing in for HTTP_Range_Source: the
+ * requests and resumes are queued for the transport's thread, which plays
+ * the part of the run loop and calls back into the source.
+ */
+class Socket_Transport : public Range_Transport {
+public:
+    struct Statistics {
+        uint64_t bytesDelivered;
+        unsigned pauses;
+        unsigned resumes;
+    };
+
+    Socket_Transport(unsigned short port) :
+        m_port(port),
+        m_source(0),
+        m_socket(-1),
+        m_paused(false)
+    {
+        memset(&m_statistics, 0, sizeof(m_statistics));
+        pthread_mutex_init(&m_mutex, NULL);
+        pthread_cond_init(&m_cond, NULL);
+    }
+
+    ~Socket_Transport()
+    {
+        pthread_mutex_destroy(&m_mutex);
+        pthread_cond_destroy(&m_cond);
+    }
+
+    bool start(Range_Source *source)
+    {
+        m_source = source;
+        return (pthread_create(&m_thread, NULL, transportThread, this) == 0);
+    }
+
+    void stop()
+    {
+        Command command = { kQuit, 0, 0, 0 };
+        queue(command);
+        pthread_join(m_thread, NULL);
+    }
+
+    Statistics statistics()
+    {
+        pthread_mutex_lock(&m_mutex);
+        const Statistics statistics = m_statistics;
+        pthread_mutex_unlock(&m_mutex);
+
+        return statistics;
+    }
+
+    /* Range_Transport */
+    void openRequest(unsigned generation, uint64_t offset, int64_t totalBytes)
+    {
+        Command command = { kOpen, generation, offset, totalBytes };
+        queue(command);
+    }
+
+    void resumeRequest(unsigned generation)
+    {
+        Command command = { kResume, generation, 0, 0 };
+        queue(command);
+    }
+
+private:
+    enum Type {
+        kOpen,
+        kResume,
+        kQuit
+    };
+
+    struct Command {
+        Type type;
+        unsigned generation;
+        uint64_t offset;
+        int64_t totalBytes;
+    };
+
+    unsigned short m_port;
+    Range_Source *m_source;
+    pthread_t m_thread;
+    pthread_mutex_t m_mutex;
+    pthread_cond_t m_cond;
+    std::vector<Command> m_commands;
+    Statistics m_statistics;
+
+    /* Only touched on the transport's thread */
+    int m_socket;
+    bool m_paused;
+
+    void queue(const Command& command)
+    {
+        pthread_mutex_lock(&m_mutex);
+        m_commands.push_back(command);
+        pthread_cond_signal(&m_cond);
+        pthread_mutex_unlock(&m_mutex);
+    }
+
+    static void *transportThread(void *info)
+    {
+        static_cast<Socket_Transport*>(info)->run();
+        return NULL;
+    }
+
+    void run()
+    {
+        for (;;) {
+            pthread_mutex_lock(&m_mutex);
+            while (m_commands.empty() && (m_socket < 0 || m_paused)) {
+                pthread_cond_wait(&m_cond, &m_mutex);
+            }
+            std::vector<Command> commands;
+            commands.swap(m_commands);
+            pthread_mutex_unlock(&m_mutex);
+
+            for (size_t i=0; i < commands.size(); i++) {
+                const Command& command = commands[i];
+
+                switch (command.type) {
+                    case kOpen:
+                        closeSocket();
+                        if (m_source->requestStarting(command.generation) && !open(command.offset, command.totalBytes)) {
+                            closeSocket();
+                            m_source->responseFailed();
+                        }
+                        break;
+                    case kResume:
+                        if (m_source->isCurrent(command.generation) && m_paused) {
+                            m_paused = false;
+
+                            pthread_mutex_lock(&m_mutex);
+                            m_statistics.resumes++;
+                            pthread_mutex_unlock(&m_mutex);
+                        }
+                        break;
+                    case kQuit:
+                        closeSocket();
+                        return;
+                }
+            }
+
+            if (m_socket >= 0 && !m_paused) {
+                receive();
+            }
+        }
+    }
+
+    bool open(uint64_t offset, int64_t totalBytes)
+    {
+        m_socket = socket(AF_INET, SOCK_STREAM, 0);
+        if (m_socket < 0) {
+            return false;
+        }
+
+        sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(m_port);
+        if (connect(m_socket, (sockaddr *)&address, sizeof(address)) != 0) {
+            return false;
+        }
+
+        /* Like HTTP_Stream: a range only past the start, up to the end if we know where that is */
+        char request[256];
+        if (offset > 0 && totalBytes > 0) {
+            snprintf(request, sizeof(request), "GET /file.ape HTTP/1.1\r\nHost: 127.0.0.1\r\nRange: bytes=%llu-%llu\r\n\r\n",
+                     (unsigned long long)offset, (unsigned long long)(totalBytes - 1));
+        } else if (offset > 0) {
+            snprintf(request, sizeof(request), "GET /file.ape HTTP/1.1\r\nHost: 127.0.0.1\r\nRange: bytes=%llu-\r\n\r\n",
+                     (unsigned long long)offset);
+        } else {
+            snprintf(request, sizeof(request), "GET /file.ape HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n");
+        }
+        if (send(m_socket, request, strlen(request), 0) != (ssize_t)strlen(request)) {
+            return false;
+        }
+
+        std::string response;
+        char chunk[1024];
+        size_t headerEnd;
+        while ((headerEnd = response.find("\r\n\r\n")) == std::string::npos) {
+            pollfd ready = { m_socket, POLLIN, 0 };
+            if (poll(&ready, 1, 5000) <= 0) {
+                return false;
+            }
+            const ssize_t received = recv(m_socket, chunk, sizeof(chunk), 0);
+            if (received <= 0) {
+                return false;
+            }
+            response.append(chunk, (size_t)received);
+        }
+
+        const size_t length = response.find("Content-Length: ");
+        if (response.compare(0, 9, "HTTP/1.1 ") != 0 || length == std::string::npos || length > headerEnd) {
+            return false;
+        }
+        m_source->responseStarted(strtoull(response.c_str() + length + 16, NULL, 10));
+
+        /* Whatever of the body came with the header */
+        if (response.size() > headerEnd + 4) {
+            deliver((const uint8_t *)response.data() + headerEnd + 4, response.size() - headerEnd - 4);
+        }
+        return true;
+    }
+
+    void receive()
+    {
+        pollfd ready = { m_socket, POLLIN, 0 };
+        if (poll(&ready, 1, 20) <= 0) {
+            return;
+        }
+
+        uint8_t data[16384];
+        const ssize_t received = recv(m_socket, data, sizeof(data), 0);
+        if (received > 0) {
+            deliver(data, (size_t)received);
+        } else {
+            closeSocket();
+            if (received == 0) {
+                m_source->responseEnded();
+            } else {
+                m_source->responseFailed();
+            }
+        }
+    }
+
+    void deliver(const uint8_t *data, size_t bytes)
+    {
+        const bool pause = m_source->dataAvailable(data, bytes);
+
+        pthread_mutex_lock(&m_mutex);
+        m_statistics.bytesDelivered += bytes;
+        if (pause) {
+            m_statistics.pauses++;
+        }
+        pthread_mutex_unlock(&m_mutex);
+
+        if (pause) {
+            /* Like HTTP_Stream unscheduled from the run loop: the rest stays in the socket */
+            m_paused = true;
+        }
+    }
+
+    void closeSocket()
+    {
+        if (m_socket >= 0) {
+            close(m_socket), m_socket = -1;
+        }
+        m_paused = false;
+    }
+};
+
+/* A source over a transport to a server, torn down in the right order */
+struct Loopback {
+    Loopback_Server server;
+    Socket_Transport *transport;
+    Range_Source *source;
+
+    Loopback(bool honourRange) :
+        server(honourRange),
+        transport(0),
+        source(0)
+    {
+    }
+
+    bool start()
+    {
+        if (!server.start()) {
+            return false;
+        }
+        transport = new Socket_Transport(server.port());
+        source = new Range_Source(transport);
+        return transport->start(source);
+    }
+
+    ~Loopback()
+    {
+        if (transport) {
+            transport->stop();
+        }
+        delete source;
+        delete transport;
+        server.stop();
+    }
+};
+
+/* Reads bytes at offset and checks they're the file's; counts an error if not */
+int readAndCheck(const char *test, Range_Source *source, uint64_t offset, unsigned bytes)
+{
+    std::vector<uint8_t> buffer(bytes);
+    unsigned total = 0;
+
+    while (total < bytes) {
+        unsigned bytesRead = 0;
+        if (!source->read(offset + total, &buffer[total], bytes - total, &bytesRead)) {
+            printf("%s: reading %u bytes at %llu failed\n", test, bytes - total, (unsigned long long)(offset + total));
+            return 1;
+        }
+        if (bytesRead == 0) {
+            break;
+        }
+        total += bytesRead;
+    }
+
+    const unsigned expected = (unsigned)std::min<uint64_t>(bytes, offset < kFileBytes ? kFileBytes - offset : 0);
+    if (total != expected) {
+        printf("%s: %u bytes at %llu, expected %u\n", test, total, (unsigned long long)offset, expected);
+        return 1;
+    }
+    if (!fileMatches(offset, &buffer[0], total)) {
+        printf("%s: the %u bytes at %llu aren't the file's\n", test, total, (unsigned long long)offset);
+        return 1;
+    }
+    return 0;
+}
+
+int checkRequests(const char *test, Loopback_Server& server, const std::vector<uint64_t>& expected)
+{
+    const std::vector<uint64_t> requests = server.requests();
+    if (requests != expected) {
+        printf("%s: %zu requests (", test, requests.size());
+        for (size_t i=0; i < requests.size(); i++) {
+            printf("%s%llu", (i ? ", " : ""), (unsigned long long)requests[i]);
+        }
+        printf("), expected %zu\n", expected.size());
+        return 1;
+    }
+    return 0;
+}
+
+/* The whole file in order, the way the decoder reads frames: all of it from the one request */
+int sequential()
+{
+    Loopback loopback(true);
+    if (!loopback.start()) {
+        printf("sequential: can't start the server\n");
+        return 1;
+    }
+    int errors = 0;
+
+    if (loopback.source->totalBytes() != (int64_t)kFileBytes) {
+        printf("sequential: wrong length\n");
+        errors++;
+    }
+    for (uint64_t offset = 0; offset < kFileBytes && !errors; offset += kReadBytes) {
+        errors += readAndCheck("sequential", loopback.source, offset, kReadBytes);
+    }
+
+    /* At and past the end there's nothing, without asking the server */
+    unsigned bytesRead = 1;
+    uint8_t byte;
+    if (!loopback.source->read(kFileBytes, &byte, 1, &bytesRead) || bytesRead != 0) {
+        printf("sequential: read past the end\n");
+        errors++;
+    }
+
+    std::vector<uint64_t> expected(1, 0);
+    errors += checkRequests("sequential", loopback.server, expected);
+    return errors;
+}
+
+/* Reads a little ahead wait for the open request; far ahead or behind reopen at the offset */
+int skipAheadAndReopen()
+{
+    Loopback loopback(true);
+    if (!loopback.start()) {
+        printf("skip ahead: can't start the server\n");
+        return 1;
+    }
+    int errors = 0;
+    std::vector<uint64_t> expected(1, 0);
+
+    errors += readAndCheck("skip ahead", loopback.source, 0, kReadBytes);
+
+    /* Within kSkipAheadBytes of what has come in so far, whatever that is */
+    const uint64_t nearOffset = kReadBytes + Range_Source::kSkipAheadBytes - 4096;
+    errors += readAndCheck("skip ahead", loopback.source, nearOffset, kReadBytes);
+    errors += checkRequests("skip ahead", loopback.server, expected);
+
+    /* Further than kMaxBufferedBytes + kSkipAheadBytes past that can't be coming */
+    const uint64_t farOffset = nearOffset + kReadBytes + Range_Source::kMaxBufferedBytes + Range_Source::kSkipAheadBytes + 65536;
+    errors += readAndCheck("skip ahead", loopback.source, farOffset, kReadBytes);
+    expected.push_back(farOffset);
+    errors += checkRequests("skip ahead", loopback.server, expected);
+
+    /* Behind what has been read */
+    errors += readAndCheck("skip ahead", loopback.source, 1000, kReadBytes);
+    expected.push_back(1000);
+    errors += checkRequests("skip ahead", loopback.server, expected);
+
+    /* And on from there, up to the end, without another request */
+    for (uint64_t offset = 1000 + kReadBytes; offset < kFileBytes && !errors; offset += kReadBytes) {
+        errors += readAndCheck("skip ahead", loopback.source, offset, kReadBytes);
+    }
+    errors += checkRequests("skip ahead", loopback.server, expected);
+    return errors;
+}
+
+/* A server that ignores Range sends the whole file; the source skips to the offset */
+int ignoredRange()
+{
+    Loopback loopback(false);
+    if (!loopback.start()) {
+        printf("ignored range: can't start the server\n");
+        return 1;
+    }
+    int errors = 0;
+    std::vector<uint64_t> expected(1, 0);
+
+    if (loopback.source->totalBytes() != (int64_t)kFileBytes) {
+        printf("ignored range: wrong length\n");
+        errors++;
+    }
+    errors += readAndCheck("ignored range", loopback.source, 0, 1000);
+
+    /* The tail, where the APE tag is looked for: all but 32 bytes of the response are skipped */
+    errors += readAndCheck("ignored range", loopback.source, kFileBytes - 32, 32);
+    expected.push_back(kFileBytes - 32);
+
+    /* Then back into the middle, and the start */
+    const uint64_t middleOffset = 2 * 1024 * 1024 + 17;
+    errors += readAndCheck("ignored range", loopback.source, middleOffset, kReadBytes);
+    expected.push_back(middleOffset);
+    errors += readAndCheck("ignored range", loopback.source, 100, kReadBytes);
+    expected.push_back(100);
+
+    errors += checkRequests("ignored range", loopback.server, expected);
+    return errors;
+}
+
+/* Waits until the transport's statistics pass a test, or a few seconds */
+template <typename Test>
+Socket_Transport::Statistics waitFor(Socket_Transport *transport, Test test)
+{
+    Socket_Transport::Statistics statistics = transport->statistics();
+    for (unsigned i=0; i < 500 && !test(statistics); i++) {
+        sleepMilliseconds(10);
+        statistics = transport->statistics();
+    }
+    return statistics;
+}
+
+bool paused(const Socket_Transport::Statistics& statistics)
+{
+    return statistics.pauses > 0;
+}
+
+bool resumed(const Socket_Transport::Statistics& statistics)
+{
+    return statistics.resumes > 0;
+}
+
+/* Once a megabyte waits to be read the transport is paused, and resumed when half of it is gone */
+int pauseAndResume()
+{
+    Loopback loopback(true);
+    if (!loopback.start()) {
+        printf("pause: can't start the server\n");
+        return 1;
+    }
+    int errors = 0;
+
+    errors += readAndCheck("pause", loopback.source, 0, 1);
+
+    Socket_Transport::Statistics statistics = waitFor(loopback.transport, paused);
+    if (statistics.pauses != 1) {
+        printf("pause: %u pauses with nothing read\n", statistics.pauses);
+        errors++;
+    }
+
+    /* Nothing more comes in while paused (what a single receive brings over the limit at most) */
+    sleepMilliseconds(200);
+    statistics = loopback.transport->statistics();
+    if (statistics.bytesDelivered > 1 + Range_Source::kMaxBufferedBytes + 16384) {
+        printf("pause: %llu bytes delivered while paused\n", (unsigned long long)statistics.bytesDelivered);
+        errors++;
+    }
+
+    /* Down to just over half: still paused */
+    const uint64_t halfOffset = statistics.bytesDelivered - Range_Source::kMaxBufferedBytes / 2;
+    errors += readAndCheck("pause", loopback.source, 1, (unsigned)(halfOffset - 1));
+    sleepMilliseconds(100);
+    if (loopback.transport->statistics().resumes != 0) {
+        printf("pause: resumed with more than half the buffer unread\n");
+        errors++;
+    }
+
+    /* And below half: resumed, and it fills up to the limit again */
+    errors += readAndCheck("pause", loopback.source, halfOffset, 2);
+    statistics = waitFor(loopback.transport, resumed);
+    if (statistics.resumes != 1) {
+        printf("pause: not resumed with less than half the buffer unread\n");
+        errors++;
+    }
+
+    for (uint64_t offset = halfOffset + 2; offset < kFileBytes && !errors; offset += kReadBytes) {
+        errors += readAndCheck("pause", loopback.source, offset, kReadBytes);
+    }
+
+    /* All of it came over the one request, no byte twice */
+    statistics = loopback.transport->statistics();
+    if (statistics.bytesDelivered != kFileBytes) {
+        printf("pause: %llu bytes delivered for a %llu byte file\n",
+               (unsigned long long)statistics.bytesDelivered, (unsigned long long)kFileBytes);
+        errors++;
+    }
+    std::vector<uint64_t> expected(1, 0);
+    errors += checkRequests("pause", loopback.server, expected);
+
+    printf("pause: %u pauses, %u resumes\n", statistics.pauses, statistics.resumes);
+    return errors;
+}
+
+/*
+ * Transport that only records what it's asked for; the test delivers the
+ * responses (and stale ones) itself.
+ */
+class Scripted_Transport : public Range_Transport {
+public:
+    struct Request {
+        unsigned generation;
+        uint64_t offset;
+    };
+
+    Scripted_Transport()
+    {
+        pthread_mutex_init(&m_mutex, NULL);
+        pthread_cond_init(&m_cond, NULL);
+    }
+
+    ~Scripted_Transport()
+    {
+        pthread_mutex_destroy(&m_mutex);
+        pthread_cond_destroy(&m_cond);
+    }
+
+    void openRequest(unsigned generation, uint64_t offset, int64_t)
+    {
+        pthread_mutex_lock(&m_mutex);
+        Request request = { generation, offset };
+        m_requests.push_back(request);
+        pthread_cond_broadcast(&m_cond);
+        pthread_mutex_unlock(&m_mutex);
+    }
+
+    void resumeRequest(unsigned)
+    {
+    }
+
+    /* Waits for the count'th request */
+    Request waitForRequest(size_t count)
+    {
+        pthread_mutex_lock(&m_mutex);
+        while (m_requests.size() < count) {
+            pthread_cond_wait(&m_cond, &m_mutex);
+        }
+        const Request request = m_requests[count - 1];
+        pthread_mutex_unlock(&m_mutex);
+
+        return request;
+    }
+
+private:
+    pthread_mutex_t m_mutex;
+    pthread_cond_t m_cond;
+    std::vector<Request> m_requests;
+};
+
+/* A read on its own thread, as the decoder makes them */
+struct Reader {
+    Range_Source *source;
+    uint64_t offset;
+    unsigned bytes;
+    uint8_t data[256];
+    unsigned bytesRead;
+    bool success;
+    pthread_t thread;
+
+    static void *readThread(void *info)
+    {
+        Reader *reader = static_cast<Reader*>(info);
+        reader->success = reader->source->read(reader->offset, reader->data, reader->bytes, &reader->bytesRead);
+        return NULL;
+    }
+
+    void start(Range_Source *readSource, uint64_t readOffset, unsigned readBytes)
+    {
+        source = readSource;
+        offset = readOffset;
+        bytes = readBytes;
+        bytesRead = 0;
+        success = false;
+        pthread_create(&thread, NULL, readThread, this);
+    }
+
+    void finish()
+    {
+        pthread_join(thread, NULL);
+    }
+};
+
+/* The file's bytes from offset, as a response would bring them */
+std::vector<uint8_t> fileBytes(uint64_t offset, size_t bytes)
+{
+    std::vector<uint8_t> data(bytes);
+    for (size_t i=0; i < bytes; i++) {
+        data[i] = fileByte(offset + i);
+    }
+    return data;
+}
+
+int generations()
+{
+    Scripted_Transport transport;
+    Range_Source source(&transport);
+    Reader reader;
+    int errors = 0;
+
+    /* The first request, answered */
+    reader.start(&source, 0, 100);
+    Scripted_Transport::Request request = transport.waitForRequest(1);
+    source.requestStarting(request.generation);
+    source.responseStarted(kFileBytes);
+    std::vector<uint8_t> data = fileBytes(0, 4096);
+    source.dataAvailable(&data[0], data.size());
+    reader.finish();
+    if (!reader.success || reader.bytesRead != 100 || !fileMatches(0, reader.data, 100)) {
+        printf("generations: the first read went wrong\n");
+        errors++;
+    }
+
+    /* A far read replaces it; what the old request still delivers must not be taken as the new one's */
+    reader.start(&source, 2000000, 200);
+    const Scripted_Transport::Request farRequest = transport.waitForRequest(2);
+    if (farRequest.generation == request.generation || farRequest.offset != 2000000) {
+        printf("generations: the far read didn't reopen\n");
+        errors++;
+    }
+    data = fileBytes(4096, 8192);
+    source.dataAvailable(&data[0], data.size());
+    source.responseEnded();
+
+    source.requestStarting(farRequest.generation);
+    if (source.isCurrent(request.generation) || !source.isCurrent(farRequest.generation)) {
+        printf("generations: isCurrent() is wrong\n");
+        errors++;
+    }
+    source.responseStarted(kFileBytes - 2000000);
+    data = fileBytes(2000000, 1000);
+    source.dataAvailable(&data[0], data.size());
+    reader.finish();
+    if (!reader.success || reader.bytesRead != 200 || !fileMatches(2000000, reader.data, 200)) {
+        printf("generations: the far read got the old request's bytes\n");
+        errors++;
+    }
+
+    /* A read stuck on the network is failed by cancel() */
+    reader.start(&source, 10, 50);
+    const Scripted_Transport::Request cancelledRequest = transport.waitForRequest(3);
+    source.cancel();
+    reader.finish();
+    if (reader.success) {
+        printf("generations: cancel() didn't fail the read\n");
+        errors++;
+    }
+    source.resume();
+
+    /* The next read (too far ahead to wait for it) supersedes that request before it started */
+    reader.start(&source, 600000, 100);
+    const Scripted_Transport::Request nextRequest = transport.waitForRequest(4);
+    if (source.requestStarting(cancelledRequest.generation)) {
+        printf("generations: a superseded request was started\n");
+        errors++;
+    }
+    data = fileBytes(10, 1000);
+    source.dataAvailable(&data[0], data.size());
+    if (!source.requestStarting(nextRequest.generation)) {
+        printf("generations: the current request wasn't started\n");
+        errors++;
+    }
+    source.responseStarted(kFileBytes - 600000);
+    data = fileBytes(600000, 1000);
+    source.dataAvailable(&data[0], data.size());
+    reader.finish();
+    if (!reader.success || reader.bytesRead != 100 || !fileMatches(600000, reader.data, 100)) {
+        printf("generations: the read after a cancel went wrong\n");
+        errors++;
+    }
+
+    /* A request that fails fails the read it was made for */
+    reader.start(&source, 1500000, 100);
+    const Scripted_Transport::Request failedRequest = transport.waitForRequest(5);
+    source.requestStarting(failedRequest.generation);
+    source.responseFailed();
+    reader.finish();
+    if (reader.success) {
+        printf("generations: a failed request didn't fail the read\n");
+        errors++;
+    }
+    return errors;
+}
+
+} // namespace
+
+int main()
+{
+    /* A reopen hangs up on the server mid response */
+    signal(SIGPIPE, SIG_IGN);
+
+    int errors = 0;
+    errors += sequential();
+    errors += skipAheadAndReopen();
+    errors += ignoredRange();
+    errors += pauseAndResume();
+    errors += generations();
+    printf("%s\n", (errors ? "FAILED" : "passed"));
+    return (errors ? 1 : 0);
+}